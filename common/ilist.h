@@ -0,0 +1,149 @@
+#ifndef _TIGERA_ILIST__H__
+#define _TIGERA_ILIST__H__
+
+#include "includes.h"
+
+/* Intrusive doubly linked list.
+ *
+ * Link lives inside the owning struct, so that pushing and removing
+ * never allocate: owner is recovered from its link with downcast.
+ *
+ *     struct item { ...; ilink_t link; };
+ *     item_t *item = downcast(ilist_head(list), item_t, link);
+ */
+
+typedef struct ilink ilink_t;
+
+struct ilink {
+    ilink_t *next;
+    ilink_t **previous;
+};
+
+typedef struct ilist ilist_t;
+
+struct ilist {
+    ilink_t *head;
+    ilink_t **tail;
+};
+
+#define ilist_foreach(list, link) \
+    for ((link) = (list)->head; \
+         (NULL != (link)); \
+         (link) = (link)->next)
+
+#define ilist_foreach_safe(list, link, next) \
+    for ((link) = (list)->head; \
+         (NULL != (link)) && ((next) = (link)->next, 1); \
+         (link) = (next))
+
+static inline void
+ilist_init(ilist_t *list)
+{
+    list->head = NULL;
+    list->tail = &list->head;
+}
+
+static inline bool
+ilist_empty(ilist_t *list)
+{
+    return NULL == list->head;
+}
+
+/* whether link is currently in a list (links must be zeroed initially) */
+static inline bool
+ilink_linked(ilink_t *link)
+{
+    return NULL != link->previous;
+}
+
+static inline void
+ilist_remove(ilist_t *list, ilink_t *link)
+{
+    *link->previous = link->next;
+    if (NULL != link->next) {
+        link->next->previous = link->previous;
+    }
+    if (list->tail == &link->next) {
+        list->tail = link->previous;
+    }
+    link->next = NULL;
+    link->previous = NULL;
+}
+
+static inline void
+ilist_push_front(ilist_t *list, ilink_t *link)
+{
+    link->next = list->head;
+    link->previous = &list->head;
+    if (NULL != list->head) {
+        list->head->previous = &link->next;
+    }
+    else {
+        list->tail = &link->next;
+    }
+    list->head = link;
+}
+
+static inline void
+ilist_push_back(ilist_t *list, ilink_t *link)
+{
+    link->next = NULL;
+    *list->tail = link;
+    link->previous = list->tail;
+    list->tail = &link->next;
+}
+
+static inline void
+ilist_push_before(ilist_t *list, ilink_t *next, ilink_t *link)
+{
+    if (NULL == next) {
+        ilist_push_back(list, link);
+        return;
+    }
+    link->next = next;
+    link->previous = next->previous;
+    *next->previous = link;
+    next->previous = &link->next;
+}
+
+static inline ilink_t *
+ilist_pop_front(ilist_t *list)
+{
+    ilink_t *link = list->head;
+    if (NULL != link) {
+        ilist_remove(list, link);
+    }
+    return link;
+}
+
+static inline ilink_t *
+ilist_head(ilist_t *list)
+{
+    return list->head;
+}
+
+static inline ilink_t *
+ilist_tail(ilist_t *list)
+{
+    if (list->tail == &list->head) {
+        return NULL;
+    }
+    return downcast(list->tail, ilink_t, next);
+}
+
+static inline ilink_t *
+ilist_next(ilist_t *list, ilink_t *link)
+{
+    return link->next;
+}
+
+static inline ilink_t *
+ilist_previous(ilist_t *list, ilink_t *link)
+{
+    if (link->previous == &list->head) {
+        return NULL;
+    }
+    return downcast(link->previous, ilink_t, next);
+}
+
+#endif /* _TIGERA_ILIST__H__ */
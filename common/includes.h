@@ -11,6 +11,7 @@
 #include <pthread.h>
 #include <signal.h>
 #include <sys/stat.h>
+#include <sys/time.h>
 
 #include <sys/types.h>
 #include <sys/socket.h>
@@ -24,5 +25,7 @@
 
 #include "list.h"
 #include "slist.h"
+#include "ilist.h"
+#include "islist.h"
 
 #endif /* _TIGERA_INCLUDES__H__ */
@@ -0,0 +1,88 @@
+#ifndef _TIGERA_ISLIST__H__
+#define _TIGERA_ISLIST__H__
+
+#include "includes.h"
+
+/* Intrusive singly linked list: link lives inside the owning
+ * struct and owner is recovered from it with downcast.
+ */
+
+typedef struct islink islink_t;
+
+struct islink {
+    islink_t *next;
+};
+
+typedef struct islist islist_t;
+
+struct islist {
+    islink_t *head;
+};
+
+#define islist_foreach(list, link) \
+    for ((link) = (list)->head; \
+         (NULL != (link)); \
+         (link) = (link)->next)
+
+static inline void
+islist_init(islist_t *list)
+{
+    list->head = NULL;
+}
+
+static inline bool
+islist_empty(islist_t *list)
+{
+    return NULL == list->head;
+}
+
+static inline void
+islist_push_front(islist_t *list, islink_t *link)
+{
+    link->next = list->head;
+    list->head = link;
+}
+
+static inline islink_t *
+islist_pop_front(islist_t *list)
+{
+    islink_t *link = list->head;
+    if (NULL != link) {
+        list->head = link->next;
+        link->next = NULL;
+    }
+    return link;
+}
+
+/**
+ * Unlinks link, walking list to find it.
+ *
+ * @return whether link was found.
+ */
+static inline bool
+islist_remove(islist_t *list, islink_t *link)
+{
+    islink_t **prev = &list->head;
+    for (; NULL != *prev; prev = &(*prev)->next) {
+        if (*prev == link) {
+            *prev = link->next;
+            link->next = NULL;
+            return true;
+        }
+    }
+    return false;
+}
+
+static inline islink_t *
+islist_head(islist_t *list)
+{
+    return list->head;
+}
+
+static inline islink_t *
+islist_next(islist_t *list, islink_t *link)
+{
+    return link->next;
+}
+
+#endif /* _TIGERA_ISLIST__H__ */
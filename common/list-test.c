@@ -1,9 +1,15 @@
 #include "list.h"
+#include <time.h>
+#include <assert.h>
+
+#define BENCH_ITEMS     1024
+#define BENCH_ROUNDS    4096
 
 typedef struct item item_t;
 
 struct item {
     int value;
+    ilink_t link; /**< for intrusive list */
 };
 
 item_t *
@@ -19,6 +25,86 @@ item_free(item_t *item)
     free(item);
 }
 
+static void
+ilist_test(void)
+{
+    ilink_t *link, *next;
+    item_t items[10];
+    ilist_t list;
+    int i;
+
+    ilist_init(&list);
+    for (i = 0; i < 10; ++i) {
+        items[i].value = i;
+        ilist_push_back(&list, &items[i].link);
+    }
+
+    ilist_foreach_safe(&list, link, next) {
+        item_t *item = downcast(link, item_t, link);
+        ilist_remove(&list, link);
+        item->value += 1;
+        ilist_push_before(&list, next, link);
+    }
+
+    assert(&items[9].link == ilist_tail(&list));
+    assert(&items[8].link == ilist_previous(&list, ilist_tail(&list)));
+
+    for (i = 0; NULL != (link = ilist_pop_front(&list)); ++i) {
+        item_t *item = downcast(link, item_t, link);
+        assert(item == &items[i] && item->value == i + 1);
+        assert(!ilink_linked(link));
+    }
+    assert(10 == i && ilist_empty(&list));
+}
+
+/* queue-like usage (as session lists): push back, remove from front */
+static void
+bench(void)
+{
+    static item_t items[BENCH_ITEMS];
+    list_t *list = list_new();
+    ilist_t ilist;
+    clock_t start;
+    double elapsed[2];
+    long sum = 0;
+
+    assert(NULL != list);
+    ilist_init(&ilist);
+    for (int i = 0; i < BENCH_ITEMS; ++i) {
+        items[i].value = i;
+    }
+
+    start = clock();
+    for (int r = 0; r < BENCH_ROUNDS; ++r) {
+        for (int i = 0; i < BENCH_ITEMS; ++i) {
+            list_push_back(list, &items[i]);
+        }
+        item_t *item = NULL;
+        while (NULL != (item = list_pop_front(list))) {
+            sum += item->value;
+        }
+    }
+    elapsed[0] = (double)(clock() - start) / CLOCKS_PER_SEC;
+
+    start = clock();
+    for (int r = 0; r < BENCH_ROUNDS; ++r) {
+        for (int i = 0; i < BENCH_ITEMS; ++i) {
+            ilist_push_back(&ilist, &items[i].link);
+        }
+        ilink_t *link = NULL;
+        while (NULL != (link = ilist_pop_front(&ilist))) {
+            sum += downcast(link, item_t, link)->value;
+        }
+    }
+    elapsed[1] = (double)(clock() - start) / CLOCKS_PER_SEC;
+
+    fprintf(stderr, "list: %.1f ns/item, ilist: %.1f ns/item (push back + pop front, %ld)\n",
+            elapsed[0] * 1e9 / (BENCH_ROUNDS * BENCH_ITEMS),
+            elapsed[1] * 1e9 / (BENCH_ROUNDS * BENCH_ITEMS), sum);
+
+    list_free(list);
+}
+
 int main(int argc, char **argv)
 {
     node_t *node, *next;
@@ -59,5 +145,8 @@ int main(int argc, char **argv)
 
     list_free(list);
 
+    ilist_test();
+    bench();
+
     return 0;
 }
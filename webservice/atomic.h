@@ -19,4 +19,47 @@ atomic_dec(atomic_t *atomic)
     return __sync_sub_and_fetch(atomic, 1);
 }
 
+/* reference counting orderings: taking a reference needs no
+ * ordering, dropping one releases accesses made through it
+ */
+static
+inline
+atomic_t
+atomic_inc_relaxed(atomic_t *atomic)
+{
+    return __atomic_add_fetch(atomic, 1, __ATOMIC_RELAXED);
+}
+
+static
+inline
+atomic_t
+atomic_dec_release(atomic_t *atomic)
+{
+    return __atomic_sub_fetch(atomic, 1, __ATOMIC_RELEASE);
+}
+
+static
+inline
+void
+atomic_fence_acquire(void)
+{
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+}
+
+/**
+ * Stores desired if atomic still holds expected.
+ * On failure, expected is updated with current value.
+ */
+static
+inline
+bool
+atomic_cas(atomic_t *atomic, atomic_t *expected, atomic_t desired)
+{
+    return __atomic_compare_exchange_n(atomic, expected, desired, false, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED);
+}
+
+/* ordered accesses, usable with any scalar or pointer type */
+#define atomic_load_acquire(p)      __atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define atomic_store_release(p, v)  __atomic_store_n((p), (v), __ATOMIC_RELEASE)
+
 #endif /* __TIGERA_ATOMIC__H__ */
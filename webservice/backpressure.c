@@ -0,0 +1,66 @@
+#include "includes.h"
+#include "backpressure.h"
+
+void
+backpressure_init(backpressure_t *backpressure, size_t budget)
+{
+    memset(backpressure, 0, sizeof(*backpressure));
+    backpressure->budget = budget;
+    ilist_init(&backpressure->waiting);
+}
+
+void
+backpressure_attach(backpressure_t *backpressure)
+{
+    backpressure->connections++;
+}
+
+void
+backpressure_detach(backpressure_t *backpressure, size_t buffered)
+{
+    backpressure->connections--;
+    backpressure->buffered -= buffered;
+}
+
+void
+backpressure_account(backpressure_t *backpressure, size_t added, size_t removed, size_t conn_buffered)
+{
+    backpressure->buffered += added;
+    backpressure->buffered -= removed;
+    if (backpressure->buffered > backpressure->peak) {
+        backpressure->peak = backpressure->buffered;
+    }
+    if (conn_buffered > backpressure->conn_peak) {
+        backpressure->conn_peak = conn_buffered;
+    }
+}
+
+size_t
+backpressure_wm(const backpressure_t *backpressure)
+{
+    size_t wm = BACKPRESSURE_MAX_WM;
+
+    if (0 != backpressure->budget && 0 != backpressure->connections) {
+        wm = backpressure->budget / backpressure->connections;
+        if (wm > BACKPRESSURE_MAX_WM) {
+            wm = BACKPRESSURE_MAX_WM;
+        }
+        if (wm < BACKPRESSURE_MIN_WM) {
+            wm = BACKPRESSURE_MIN_WM;
+        }
+    }
+    return wm;
+}
+
+bool
+backpressure_exceeded(const backpressure_t *backpressure)
+{
+    return 0 != backpressure->budget && backpressure->buffered >= backpressure->budget;
+}
+
+bool
+backpressure_relieved(const backpressure_t *backpressure)
+{
+    return 0 == backpressure->budget ||
+           backpressure->buffered <= backpressure->budget / 100 * BACKPRESSURE_RESUME_PCT;
+}
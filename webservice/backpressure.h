@@ -0,0 +1,83 @@
+#ifndef _TIGERA_BACKPRESSURE__H__
+#define _TIGERA_BACKPRESSURE__H__
+
+#include "includes.h"
+
+/* Budget of bytes connections of a worker may hold in their input
+ * and output buffers.
+ *
+ * Each connection gets a share of budget as watermark: its input
+ * buffer is not filled past it, and it stops reading while its
+ * output backlog (e.g. replies to a slow client, or pipelined
+ * requests) is over it, until output drains to half of it. Shares
+ * shrink as connections come in, within [BACKPRESSURE_MIN_WM,
+ * BACKPRESSURE_MAX_WM].
+ *
+ * Once all connections of worker buffer as much as budget, every
+ * connection being read stops reading, until worker buffers drop
+ * under BACKPRESSURE_RESUME_PCT of budget.
+ *
+ * Not synchronized: meant for budgets owned by a single worker.
+ */
+
+#define BACKPRESSURE_MIN_WM     (16*1024)     /**< smallest share, fits request headers */
+#define BACKPRESSURE_MAX_WM     (1024*1024)   /**< largest share, and share without budget */
+#define BACKPRESSURE_BUDGET     (64*1024*1024) /**< default budget per worker */
+#define BACKPRESSURE_RESUME_PCT 75
+
+typedef struct backpressure backpressure_t;
+
+struct backpressure {
+    size_t budget;      /**< bytes, 0 means unlimited */
+    size_t buffered;    /**< bytes held by connections */
+    size_t peak;        /**< highest buffered */
+    size_t conn_peak;   /**< most bytes held by a single connection */
+    size_t connections; /**< # connections accounted */
+    size_t paused;      /**< # connections not reading */
+    size_t pauses;      /**< # times a connection stopped reading */
+    ilist_t waiting;    /**< connections not reading until worker buffers drop */
+    bool resuming;      /**< whether waiting connections are about to resume */
+};
+
+void
+backpressure_init(backpressure_t *backpressure, size_t budget);
+
+/**
+ * Accounts a new connection, holding nothing yet.
+ */
+void
+backpressure_attach(backpressure_t *backpressure);
+
+/**
+ * Accounts a connection going away, along with bytes it held.
+ */
+void
+backpressure_detach(backpressure_t *backpressure, size_t buffered);
+
+/**
+ * Accounts bytes added to and removed from buffers of a
+ * connection, now holding conn_buffered bytes.
+ */
+void
+backpressure_account(backpressure_t *backpressure, size_t added, size_t removed, size_t conn_buffered);
+
+/**
+ * @return watermark of each connection, in bytes
+ */
+size_t
+backpressure_wm(const backpressure_t *backpressure);
+
+/**
+ * Whether connections should stop reading.
+ */
+bool
+backpressure_exceeded(const backpressure_t *backpressure);
+
+/**
+ * Whether connections waiting for worker buffers to drop may
+ * read again.
+ */
+bool
+backpressure_relieved(const backpressure_t *backpressure);
+
+#endif /* _TIGERA_BACKPRESSURE__H__ */
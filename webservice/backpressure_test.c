@@ -0,0 +1,72 @@
+#include "includes.h"
+#include "backpressure.h"
+#include <assert.h>
+
+/* shares shrink as connections come in, within bounds */
+static void
+test_wm(void)
+{
+    backpressure_t backpressure;
+    backpressure_init(&backpressure, 4 * 1024 * 1024);
+
+    assert(BACKPRESSURE_MAX_WM == backpressure_wm(&backpressure));
+    for (int i = 0; i < 8; ++i) {
+        backpressure_attach(&backpressure);
+    }
+    assert(512 * 1024 == backpressure_wm(&backpressure));
+    for (int i = 0; i < 1000; ++i) {
+        backpressure_attach(&backpressure);
+    }
+    assert(BACKPRESSURE_MIN_WM == backpressure_wm(&backpressure));
+    for (int i = 0; i < 1006; ++i) {
+        backpressure_detach(&backpressure, 0);
+    }
+    assert(2 == backpressure.connections);
+    assert(BACKPRESSURE_MAX_WM == backpressure_wm(&backpressure));
+
+    /* unlimited */
+    backpressure_init(&backpressure, 0);
+    backpressure_attach(&backpressure);
+    backpressure_account(&backpressure, 1 << 30, 0, 1 << 30);
+    assert(BACKPRESSURE_MAX_WM == backpressure_wm(&backpressure));
+    assert(!backpressure_exceeded(&backpressure));
+    assert(backpressure_relieved(&backpressure));
+}
+
+/* reading stops at budget, and resumes under resume percentage of it */
+static void
+test_budget(void)
+{
+    backpressure_t backpressure;
+    backpressure_init(&backpressure, 1000 * 1000);
+
+    backpressure_attach(&backpressure);
+    backpressure_attach(&backpressure);
+    backpressure_account(&backpressure, 600 * 1000, 0, 600 * 1000);
+    assert(!backpressure_exceeded(&backpressure));
+    backpressure_account(&backpressure, 400 * 1000, 0, 400 * 1000);
+    assert(backpressure_exceeded(&backpressure));
+    assert(!backpressure_relieved(&backpressure));
+    assert(1000 * 1000 == backpressure.peak);
+    assert(600 * 1000 == backpressure.conn_peak);
+
+    backpressure_account(&backpressure, 0, 200 * 1000, 400 * 1000);
+    assert(!backpressure_exceeded(&backpressure));
+    assert(!backpressure_relieved(&backpressure));
+    backpressure_account(&backpressure, 0, 50 * 1000, 350 * 1000);
+    assert(backpressure_relieved(&backpressure));
+
+    /* bytes of a connection going away */
+    backpressure_detach(&backpressure, 350 * 1000);
+    assert(400 * 1000 == backpressure.buffered);
+    assert(1 == backpressure.connections);
+    assert(1000 * 1000 == backpressure.peak);
+}
+
+int
+main(int argc, char **argv)
+{
+    test_wm();
+    test_budget();
+    return 0;
+}
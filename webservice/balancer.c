@@ -0,0 +1,185 @@
+#include "includes.h"
+#include "balancer.h"
+#include <time.h>
+
+static uint64_t
+balancer_now_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static uint32_t
+balancer_random(balancer_t *balancer)
+{
+    /* xorshift */
+    uint32_t x = balancer->seed;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    return balancer->seed = x;
+}
+
+static bool
+balancer_addr_equal(const struct sockaddr_storage *a, const struct sockaddr_storage *b)
+{
+    if (a->ss_family != b->ss_family) {
+        return false;
+    }
+    if (AF_INET == a->ss_family) {
+        const struct sockaddr_in *a4 = (const struct sockaddr_in *)a;
+        const struct sockaddr_in *b4 = (const struct sockaddr_in *)b;
+        return a4->sin_port == b4->sin_port && a4->sin_addr.s_addr == b4->sin_addr.s_addr;
+    }
+    const struct sockaddr_in6 *a6 = (const struct sockaddr_in6 *)a;
+    const struct sockaddr_in6 *b6 = (const struct sockaddr_in6 *)b;
+    return a6->sin6_port == b6->sin6_port &&
+           0 == memcmp(&a6->sin6_addr, &b6->sin6_addr, sizeof(a6->sin6_addr));
+}
+
+static balancer_addr_t *
+balancer_find(balancer_t *balancer, const struct sockaddr_storage *addr)
+{
+    for (size_t i = 0; i < balancer->naddrs; ++i) {
+        if (balancer_addr_equal(&balancer->addrs[i].addr, addr)) {
+            return &balancer->addrs[i];
+        }
+    }
+    return NULL;
+}
+
+void
+balancer_init(balancer_t *balancer, unsigned eject_ms)
+{
+    memset(balancer, 0, sizeof(*balancer));
+    balancer->eject_ms = eject_ms;
+    balancer->seed = 2463534242u ^ (uint32_t)(uintptr_t)balancer;
+    if (0 == balancer->seed) {
+        balancer->seed = 1;
+    }
+}
+
+void
+balancer_update(balancer_t *balancer, const struct sockaddr_storage *addrs, size_t naddrs)
+{
+    balancer_addr_t updated[BALANCER_MAX_ADDRS];
+    size_t n = 0;
+
+    for (size_t i = 0; i < naddrs && n < BALANCER_MAX_ADDRS; ++i) {
+        balancer_addr_t *known = balancer_find(balancer, &addrs[i]);
+        if (NULL != known) {
+            updated[n] = *known;
+        }
+        else {
+            memset(&updated[n], 0, sizeof(updated[n]));
+            updated[n].addr = addrs[i];
+        }
+        n++;
+    }
+    memcpy(balancer->addrs, updated, n * sizeof(balancer_addr_t));
+    balancer->naddrs = n;
+}
+
+int
+balancer_pick(balancer_t *balancer, struct sockaddr_storage *addr, const struct sockaddr_storage *avoid)
+{
+    balancer_addr_t *candidates[BALANCER_MAX_ADDRS];
+    balancer_addr_t *same_family[BALANCER_MAX_ADDRS];
+    balancer_addr_t *picked = NULL;
+    balancer_addr_t *avoided = NULL;
+    size_t n = 0;
+    size_t nsame = 0;
+    uint64_t now = 0;
+
+    if (0 == balancer->naddrs) {
+        return -1;
+    }
+
+    for (size_t i = 0; i < balancer->naddrs; ++i) {
+        balancer_addr_t *candidate = &balancer->addrs[i];
+        if (0 != candidate->ejected_until) {
+            if (0 == now) {
+                now = balancer_now_ms();
+            }
+            if (now < candidate->ejected_until) {
+                continue;
+            }
+            /* back in rotation, one more failure ejects it again */
+            candidate->ejected_until = 0;
+            candidate->failures = BALANCER_EJECT_FAILURES - 1;
+        }
+        if (NULL != avoid && balancer_addr_equal(&candidate->addr, avoid)) {
+            avoided = candidate;
+            continue;
+        }
+        if (NULL != avoid && candidate->addr.ss_family == avoid->ss_family) {
+            same_family[nsame++] = candidate;
+            continue;
+        }
+        candidates[n++] = candidate;
+    }
+
+    if (0 == n) {
+        memcpy(candidates, same_family, nsame * sizeof(balancer_addr_t *));
+        n = nsame;
+    }
+    if (0 == n && NULL != avoided) {
+        candidates[n++] = avoided;
+    }
+
+    if (0 == n) {
+        /* all ejected: the one coming back soonest */
+        picked = &balancer->addrs[0];
+        for (size_t i = 1; i < balancer->naddrs; ++i) {
+            if (balancer->addrs[i].ejected_until < picked->ejected_until) {
+                picked = &balancer->addrs[i];
+            }
+        }
+    }
+    else if (1 == n) {
+        picked = candidates[0];
+    }
+    else {
+        uint32_t r = balancer_random(balancer);
+        size_t i = r % n;
+        size_t j = (i + 1 + (r >> 16) % (n - 1)) % n;
+        picked = (candidates[j]->outstanding < candidates[i]->outstanding) ? candidates[j] : candidates[i];
+    }
+
+    picked->outstanding++;
+    picked->requests++;
+    *addr = picked->addr;
+    return 0;
+}
+
+void
+balancer_connected(balancer_t *balancer, const struct sockaddr_storage *addr, bool connected)
+{
+    balancer_addr_t *known = balancer_find(balancer, addr);
+
+    if (NULL == known) {
+        /* not resolved anymore */
+        return;
+    }
+
+    if (connected) {
+        known->failures = 0;
+        return;
+    }
+
+    if (++known->failures >= BALANCER_EJECT_FAILURES && 0 == known->ejected_until) {
+        known->ejected_until = balancer_now_ms() + balancer->eject_ms;
+        balancer->ejections++;
+    }
+}
+
+void
+balancer_release(balancer_t *balancer, const struct sockaddr_storage *addr)
+{
+    balancer_addr_t *known = balancer_find(balancer, addr);
+
+    if (NULL != known && 0 != known->outstanding) {
+        known->outstanding--;
+    }
+}
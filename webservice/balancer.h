@@ -0,0 +1,75 @@
+#ifndef _TIGERA_BALANCER__H__
+#define _TIGERA_BALANCER__H__
+
+#include "includes.h"
+
+/* Spreads requests to an upstream server over all addresses
+ * its domain resolved to.
+ *
+ * Addresses are picked by power of two choices: out of two
+ * random addresses, the one with fewer outstanding requests.
+ * Addresses failing BALANCER_EJECT_FAILURES connections in a
+ * row are ejected (not picked) for a while, unless all of them
+ * are.
+ *
+ * Address set is replaced on every resolution: addresses still
+ * resolved keep their outstanding requests and ejection.
+ *
+ * Not synchronized: meant for balancers owned by a single worker.
+ */
+
+#define BALANCER_MAX_ADDRS      8  /**< # addresses kept per upstream server */
+#define BALANCER_EJECT_FAILURES 2  /**< # connections in a row failing before ejection */
+#define BALANCER_EJECT_MS   30000  /**< default ejection period */
+
+typedef struct balancer_addr balancer_addr_t;
+
+struct balancer_addr {
+    struct sockaddr_storage addr;
+    unsigned outstanding;   /**< # requests picked it and not released yet */
+    unsigned failures;      /**< # connections in a row failed */
+    uint64_t ejected_until; /**< ms, 0 if not ejected */
+    size_t requests;        /**< # requests picked it */
+};
+
+typedef struct balancer balancer_t;
+
+struct balancer {
+    balancer_addr_t addrs[BALANCER_MAX_ADDRS];
+    size_t naddrs;
+    unsigned eject_ms;
+    uint32_t seed;
+    size_t ejections; /**< # times an address was ejected */
+};
+
+void
+balancer_init(balancer_t *balancer, unsigned eject_ms);
+
+/**
+ * Replaces address set (first BALANCER_MAX_ADDRS addresses).
+ */
+void
+balancer_update(balancer_t *balancer, const struct sockaddr_storage *addrs, size_t naddrs);
+
+/**
+ * Picks address for a new request: it is outstanding until
+ * released with balancer_release.
+ *
+ * @param avoid address other request is already sent to, or
+ *        NULL: addresses of other family are picked first, then
+ *        other addresses, avoided one only if it is the only one
+ * @return 0, if successfull. -1, if there is no address.
+ */
+int
+balancer_pick(balancer_t *balancer, struct sockaddr_storage *addr, const struct sockaddr_storage *avoid);
+
+/**
+ * Reports whether connection to address succeeded.
+ */
+void
+balancer_connected(balancer_t *balancer, const struct sockaddr_storage *addr, bool connected);
+
+void
+balancer_release(balancer_t *balancer, const struct sockaddr_storage *addr);
+
+#endif /* _TIGERA_BALANCER__H__ */
@@ -0,0 +1,142 @@
+#include "includes.h"
+#include "balancer.h"
+#include <assert.h>
+
+#define NR_ADDRS 4
+#define EJECT_MS 50
+
+static struct sockaddr_storage addrs[NR_ADDRS];
+
+static int
+addr_idx(const struct sockaddr_storage *addr)
+{
+    const struct sockaddr_in *sin = (const struct sockaddr_in *)addr;
+    return (ntohl(sin->sin_addr.s_addr) & 0xff) - 1;
+}
+
+/* outstanding requests are spread evenly */
+static void
+test_spread(void)
+{
+    balancer_t balancer;
+    struct sockaddr_storage addr;
+    int outstanding[NR_ADDRS] = { 0 };
+
+    balancer_init(&balancer, EJECT_MS);
+    assert(balancer_pick(&balancer, &addr, NULL) < 0);
+
+    balancer_update(&balancer, addrs, NR_ADDRS);
+    for (int i = 0; i < 100 * NR_ADDRS; ++i) {
+        assert(0 == balancer_pick(&balancer, &addr, NULL));
+        outstanding[addr_idx(&addr)]++;
+    }
+    for (int i = 0; i < NR_ADDRS; ++i) {
+        /* power of two choices keeps them close */
+        assert(outstanding[i] >= 90 && outstanding[i] <= 110);
+        assert(balancer.addrs[i].outstanding == outstanding[i]);
+    }
+
+    /* busy address is avoided */
+    for (int i = 0; i < outstanding[0]; ++i) {
+        balancer_release(&balancer, &addrs[1]);
+        balancer_release(&balancer, &addrs[2]);
+        balancer_release(&balancer, &addrs[3]);
+    }
+    for (int i = 0; i < 50; ++i) {
+        assert(0 == balancer_pick(&balancer, &addr, NULL));
+        assert(0 != addr_idx(&addr));
+    }
+
+    /* other address than avoided one, unless it is the only one */
+    for (int i = 0; i < 50; ++i) {
+        assert(0 == balancer_pick(&balancer, &addr, &addrs[1]));
+        assert(1 != addr_idx(&addr));
+    }
+    balancer_update(&balancer, addrs, 1);
+    assert(0 == balancer_pick(&balancer, &addr, &addrs[0]));
+    assert(0 == addr_idx(&addr));
+}
+
+/* other family is picked first */
+static void
+test_family(void)
+{
+    balancer_t balancer;
+    struct sockaddr_storage addr;
+    struct sockaddr_storage dual[NR_ADDRS + 1];
+    struct sockaddr_in6 *sin6 = (struct sockaddr_in6 *)&dual[NR_ADDRS];
+
+    memcpy(dual, addrs, sizeof(addrs));
+    memset(sin6, 0, sizeof(dual[NR_ADDRS]));
+    sin6->sin6_family = AF_INET6;
+    sin6->sin6_port = htons(80);
+    inet_pton(AF_INET6, "2001:db8::1", &sin6->sin6_addr);
+
+    balancer_init(&balancer, EJECT_MS);
+    balancer_update(&balancer, dual, NR_ADDRS + 1);
+    for (int i = 0; i < 50; ++i) {
+        assert(0 == balancer_pick(&balancer, &addr, &addrs[i % NR_ADDRS]));
+        assert(AF_INET6 == addr.ss_family);
+        assert(0 == balancer_pick(&balancer, &addr, &dual[NR_ADDRS]));
+        assert(AF_INET == addr.ss_family);
+    }
+}
+
+/* failing address is ejected for a while */
+static void
+test_eject(void)
+{
+    balancer_t balancer;
+    struct sockaddr_storage addr;
+
+    balancer_init(&balancer, EJECT_MS);
+    balancer_update(&balancer, addrs, NR_ADDRS);
+
+    for (int i = 0; i < BALANCER_EJECT_FAILURES; ++i) {
+        balancer_connected(&balancer, &addrs[2], false);
+    }
+    assert(1 == balancer.ejections);
+    for (int i = 0; i < 100; ++i) {
+        assert(0 == balancer_pick(&balancer, &addr, NULL));
+        assert(2 != addr_idx(&addr));
+    }
+
+    /* survives re-resolution */
+    balancer_update(&balancer, addrs, NR_ADDRS);
+    for (int i = 0; i < 100; ++i) {
+        assert(0 == balancer_pick(&balancer, &addr, NULL));
+        assert(2 != addr_idx(&addr));
+    }
+
+    usleep((EJECT_MS + 10) * 1000);
+    bool picked = false;
+    for (int i = 0; i < 100 && !picked; ++i) {
+        assert(0 == balancer_pick(&balancer, &addr, NULL));
+        picked = (2 == addr_idx(&addr));
+    }
+    assert(picked);
+
+    /* all ejected: still picked */
+    balancer_update(&balancer, addrs, 1);
+    for (int i = 0; i < BALANCER_EJECT_FAILURES; ++i) {
+        balancer_connected(&balancer, &addrs[0], false);
+    }
+    assert(0 == balancer_pick(&balancer, &addr, NULL));
+    assert(0 == addr_idx(&addr));
+}
+
+int
+main(int argc, char **argv)
+{
+    for (int i = 0; i < NR_ADDRS; ++i) {
+        struct sockaddr_in *sin = (struct sockaddr_in *)&addrs[i];
+        sin->sin_family = AF_INET;
+        sin->sin_port = htons(80);
+        sin->sin_addr.s_addr = htonl(0x0a000001 + i);
+    }
+
+    test_spread();
+    test_eject();
+    test_family();
+    return 0;
+}
@@ -0,0 +1,130 @@
+#include "includes.h"
+#include "breaker.h"
+#include <time.h>
+
+#define BREAKER_WINDOW_MASK ((1u << BREAKER_WINDOW) - 1)
+
+static uint64_t
+breaker_now_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static void
+breaker_reset(breaker_t *breaker)
+{
+    breaker->outcomes = 0;
+    breaker->calls = 0;
+    breaker->probe_at = 0;
+}
+
+static void
+breaker_open(breaker_t *breaker)
+{
+    breaker->generation++;
+    breaker->state = BREAKER_OPEN;
+    breaker->opened_at = breaker_now_ms();
+    breaker->trips++;
+    breaker_reset(breaker);
+}
+
+void
+breaker_init(breaker_t *breaker, unsigned open_ms, unsigned slow_ms)
+{
+    memset(breaker, 0, sizeof(*breaker));
+    breaker->state = BREAKER_CLOSED;
+    breaker->open_ms = open_ms;
+    breaker->slow_ms = slow_ms;
+}
+
+bool
+breaker_allow(breaker_t *breaker, unsigned *generation)
+{
+    uint64_t now = 0;
+
+    switch (breaker->state) {
+    case BREAKER_CLOSED:
+        *generation = breaker->generation;
+        return true;
+
+    case BREAKER_OPEN:
+        now = breaker_now_ms();
+        if (now - breaker->opened_at < breaker->open_ms) {
+            break;
+        }
+        breaker->state = BREAKER_HALF_OPEN;
+        breaker->probe_at = now;
+        *generation = ++breaker->generation;
+        return true;
+
+    case BREAKER_HALF_OPEN:
+        now = breaker_now_ms();
+        /* probe outcome never came: lost with its session */
+        if (0 == breaker->probe_at || now - breaker->probe_at >= breaker->open_ms) {
+            breaker->probe_at = now;
+            *generation = ++breaker->generation;
+            return true;
+        }
+        break;
+    }
+    breaker->refused++;
+    return false;
+}
+
+static void
+breaker_outcome(breaker_t *breaker, unsigned generation, bool failed)
+{
+    if (generation != breaker->generation) {
+        /* let through under a former state, or a former probe */
+        return;
+    }
+
+    switch (breaker->state) {
+    case BREAKER_CLOSED:
+        breaker->outcomes = ((breaker->outcomes << 1) | failed) & BREAKER_WINDOW_MASK;
+        if (breaker->calls < BREAKER_WINDOW) {
+            breaker->calls++;
+        }
+        if (breaker->calls >= BREAKER_MIN_CALLS &&
+            (unsigned)__builtin_popcount(breaker->outcomes) * 100 >= breaker->calls * BREAKER_FAILURE_PCT) {
+            breaker_open(breaker);
+        }
+        break;
+
+    case BREAKER_OPEN:
+        /* requests let through before opening */
+        break;
+
+    case BREAKER_HALF_OPEN:
+        if (failed) {
+            breaker_open(breaker);
+        }
+        else {
+            breaker->generation++;
+            breaker->state = BREAKER_CLOSED;
+            breaker_reset(breaker);
+        }
+        break;
+    }
+}
+
+void
+breaker_success(breaker_t *breaker, unsigned generation, unsigned latency_ms)
+{
+    breaker_outcome(breaker, generation, latency_ms >= breaker->slow_ms);
+}
+
+void
+breaker_failure(breaker_t *breaker, unsigned generation)
+{
+    breaker_outcome(breaker, generation, true);
+}
+
+const char *
+breaker_state_name(breaker_state_t state)
+{
+    static const char *names[] = { "closed", "open", "half-open" };
+    return names[state];
+}
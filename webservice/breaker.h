@@ -0,0 +1,86 @@
+#ifndef _TIGERA_BREAKER__H__
+#define _TIGERA_BREAKER__H__
+
+#include "includes.h"
+
+/* Circuit breaker guarding requests to an upstream server.
+ *
+ * Closed: requests go through, their outcomes are kept over a
+ * sliding window of last BREAKER_WINDOW requests. Requests slower
+ * than slow threshold count as failed. Once failure rate reaches
+ * BREAKER_FAILURE_PCT (over at least BREAKER_MIN_CALLS requests),
+ * breaker opens.
+ *
+ * Open: requests are refused, callers fall back to other data,
+ * until open period elapses.
+ *
+ * Half-open: a single probe request goes through (another one if
+ * its outcome is not known within open period). Its success closes
+ * breaker, its failure opens it again.
+ *
+ * Requests are tagged with breaker generation when let through:
+ * outcomes of requests let through before breaker last changed
+ * state (or before latest probe) are ignored, so that only probe
+ * outcome decides whether a half-open breaker closes.
+ *
+ * Not synchronized: meant for breakers owned by a single worker.
+ */
+
+#define BREAKER_WINDOW      20 /**< # last requests failure rate is computed over */
+#define BREAKER_MIN_CALLS   10 /**< # requests in window before breaker may open */
+#define BREAKER_FAILURE_PCT 50
+
+#define BREAKER_OPEN_MS 5000 /**< default open period */
+#define BREAKER_SLOW_MS 3000 /**< default slow request threshold */
+
+typedef enum breaker_state breaker_state_t;
+
+enum breaker_state {
+     BREAKER_CLOSED
+    ,BREAKER_OPEN
+    ,BREAKER_HALF_OPEN
+};
+
+typedef struct breaker breaker_t;
+
+struct breaker {
+    breaker_state_t state;
+    uint32_t outcomes;   /**< last requests, most recent in bit 0: 1 if failed */
+    unsigned calls;      /**< # requests in window */
+    uint64_t opened_at;  /**< ms */
+    uint64_t probe_at;   /**< ms probe went through, 0 if none */
+    unsigned generation; /**< bumped on every state change and probe */
+    unsigned open_ms;
+    unsigned slow_ms;
+    size_t trips;        /**< # times breaker opened */
+    size_t refused;      /**< # requests refused */
+};
+
+void
+breaker_init(breaker_t *breaker, unsigned open_ms, unsigned slow_ms);
+
+/**
+ * Whether request may go to upstream server. Every request let
+ * through should report its outcome (breaker_success or
+ * breaker_failure), unless it is abandoned.
+ *
+ * @param generation set to breaker generation request is let
+ *        through under, to be reported along with its outcome
+ */
+bool
+breaker_allow(breaker_t *breaker, unsigned *generation);
+
+/**
+ * @param generation as set by breaker_allow
+ * @param latency_ms how long request took
+ */
+void
+breaker_success(breaker_t *breaker, unsigned generation, unsigned latency_ms);
+
+void
+breaker_failure(breaker_t *breaker, unsigned generation);
+
+const char *
+breaker_state_name(breaker_state_t state);
+
+#endif /* _TIGERA_BREAKER__H__ */
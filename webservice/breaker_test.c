@@ -0,0 +1,136 @@
+#include "includes.h"
+#include "breaker.h"
+#include <assert.h>
+
+#define OPEN_MS 50
+#define SLOW_MS 100
+
+/* error rate opens breaker, a single probe closes it */
+static void
+test_failures(void)
+{
+    breaker_t breaker;
+    unsigned gen = 0;
+    breaker_init(&breaker, OPEN_MS, SLOW_MS);
+
+    /* too few requests to judge */
+    for (int i = 0; i < BREAKER_MIN_CALLS - 1; ++i) {
+        assert(breaker_allow(&breaker, &gen));
+        breaker_failure(&breaker, gen);
+    }
+    assert(BREAKER_CLOSED == breaker.state);
+
+    assert(breaker_allow(&breaker, &gen));
+    breaker_failure(&breaker, gen);
+    assert(BREAKER_OPEN == breaker.state);
+    assert(1 == breaker.trips);
+    assert(!breaker_allow(&breaker, &gen));
+    assert(1 == breaker.refused);
+
+    usleep((OPEN_MS + 10) * 1000);
+    /* one probe at a time */
+    assert(breaker_allow(&breaker, &gen));
+    assert(BREAKER_HALF_OPEN == breaker.state);
+    assert(!breaker_allow(&breaker, &gen));
+
+    /* probe failed */
+    breaker_failure(&breaker, gen);
+    assert(BREAKER_OPEN == breaker.state);
+    assert(2 == breaker.trips);
+    assert(!breaker_allow(&breaker, &gen));
+
+    usleep((OPEN_MS + 10) * 1000);
+    assert(breaker_allow(&breaker, &gen));
+    breaker_success(&breaker, gen, 1);
+    assert(BREAKER_CLOSED == breaker.state);
+    assert(breaker_allow(&breaker, &gen));
+}
+
+/* failure rate under threshold keeps breaker closed,
+ * slow requests count as failed
+ */
+static void
+test_rate(void)
+{
+    breaker_t breaker;
+    unsigned gen = 0;
+    breaker_init(&breaker, OPEN_MS, SLOW_MS);
+
+    for (int i = 0; i < 10 * BREAKER_WINDOW; ++i) {
+        assert(breaker_allow(&breaker, &gen));
+        if (i % 3) {
+            breaker_success(&breaker, gen, 1);
+        }
+        else {
+            breaker_failure(&breaker, gen);
+        }
+    }
+    assert(BREAKER_CLOSED == breaker.state);
+
+    for (int i = 0; i < BREAKER_WINDOW && BREAKER_CLOSED == breaker.state; ++i) {
+        assert(breaker_allow(&breaker, &gen));
+        breaker_success(&breaker, gen, SLOW_MS);
+    }
+    assert(BREAKER_OPEN == breaker.state);
+}
+
+/* probe lost with its session: another one goes after open period */
+static void
+test_lost_probe(void)
+{
+    breaker_t breaker;
+    unsigned gen = 0;
+    breaker_init(&breaker, OPEN_MS, SLOW_MS);
+
+    for (int i = 0; i < BREAKER_MIN_CALLS; ++i) {
+        breaker_failure(&breaker, gen);
+    }
+    assert(BREAKER_OPEN == breaker.state);
+
+    usleep((OPEN_MS + 10) * 1000);
+    assert(breaker_allow(&breaker, &gen));
+    assert(!breaker_allow(&breaker, &gen));
+    usleep((OPEN_MS + 10) * 1000);
+    assert(breaker_allow(&breaker, &gen));
+    assert(BREAKER_HALF_OPEN == breaker.state);
+}
+
+/* only probe outcome decides, not those of requests let through before */
+static void
+test_stale_outcome(void)
+{
+    breaker_t breaker;
+    unsigned gen = 0, early = 0, probe = 0;
+    breaker_init(&breaker, OPEN_MS, SLOW_MS);
+
+    /* let through while closed, outcome comes late */
+    assert(breaker_allow(&breaker, &early));
+    for (int i = 0; i < BREAKER_MIN_CALLS; ++i) {
+        assert(breaker_allow(&breaker, &gen));
+        breaker_failure(&breaker, gen);
+    }
+    assert(BREAKER_OPEN == breaker.state);
+
+    usleep((OPEN_MS + 10) * 1000);
+    assert(breaker_allow(&breaker, &probe));
+    breaker_success(&breaker, early, 1);
+    assert(BREAKER_HALF_OPEN == breaker.state);
+
+    /* probe lost: outcome of former probe no longer counts either */
+    usleep((OPEN_MS + 10) * 1000);
+    assert(breaker_allow(&breaker, &gen));
+    breaker_success(&breaker, probe, 1);
+    assert(BREAKER_HALF_OPEN == breaker.state);
+    breaker_failure(&breaker, gen);
+    assert(BREAKER_OPEN == breaker.state);
+}
+
+int
+main(int argc, char **argv)
+{
+    test_failures();
+    test_rate();
+    test_lost_probe();
+    test_stale_outcome();
+    return 0;
+}
@@ -0,0 +1,242 @@
+#include "includes.h"
+#include "swisstable.h"
+#include "cache.h"
+#include <time.h>
+
+typedef struct cache_key cache_key_t;
+
+/* nul padded, so that keys hash and compare bytewise */
+struct cache_key {
+    char key[CACHE_KEY_MAX];
+};
+
+/* key to entry index */
+SWISSTABLE_DEFINE(cache_index, cache_key_t, uint32_t)
+
+typedef struct cache_entry cache_entry_t;
+
+struct cache_entry {
+    cache_key_t key;
+    void *value;
+    uint64_t fresh_until;  /**< ms */
+    uint64_t stale_until;  /**< ms */
+    bool used;
+    bool referenced;       /**< looked up since CLOCK hand last passed */
+    bool revalidating;
+};
+
+struct cache {
+    cache_index_t *index;
+    cache_entry_t *entries;
+    size_t capacity;
+    size_t hand;           /**< CLOCK hand */
+    unsigned ttl_ms;
+    unsigned stale_ms;
+    cache_free_t value_free;
+    cache_stats_t stats;
+};
+
+static uint64_t
+cache_now_ms(void)
+{
+    struct timespec ts;
+    /* ms granularity is all it takes: coarse clock is cheaper */
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static int
+cache_key_set(cache_key_t *cache_key, const char *key)
+{
+    size_t len = strlen(key);
+    if (len >= CACHE_KEY_MAX) {
+        return -1;
+    }
+    memset(cache_key, 0, sizeof(*cache_key));
+    memcpy(cache_key->key, key, len);
+    return 0;
+}
+
+static cache_entry_t *
+cache_find(cache_t *cache, const char *key)
+{
+    cache_key_t cache_key;
+    uint32_t *idx = NULL;
+
+    if (cache_key_set(&cache_key, key) < 0) {
+        return NULL;
+    }
+    idx = cache_index_find(cache->index, &cache_key);
+    return (NULL != idx) ? &cache->entries[*idx] : NULL;
+}
+
+static void
+cache_entry_clear(cache_t *cache, cache_entry_t *entry)
+{
+    cache_index_remove(cache->index, &entry->key, NULL);
+    if (NULL != cache->value_free) {
+        cache->value_free(entry->value);
+    }
+    entry->value = NULL;
+    entry->used = false;
+    cache->stats.size--;
+}
+
+/**
+ * Picks entry for a new value: a free one if any, otherwise
+ * first one CLOCK hand finds not referenced.
+ */
+static cache_entry_t *
+cache_evict(cache_t *cache)
+{
+    for (;;) {
+        cache_entry_t *entry = &cache->entries[cache->hand];
+        cache->hand = (cache->hand + 1) % cache->capacity;
+        if (!entry->used) {
+            return entry;
+        }
+        if (entry->referenced) {
+            entry->referenced = false;
+            continue;
+        }
+        cache_entry_clear(cache, entry);
+        cache->stats.evictions++;
+        return entry;
+    }
+}
+
+cache_t *
+cache_new(size_t capacity, unsigned ttl_ms, unsigned stale_ms, cache_free_t value_free)
+{
+    cache_t *cache = calloc(1, sizeof(cache_t));
+    if (NULL == cache) {
+        return NULL;
+    }
+    cache->entries = calloc(capacity, sizeof(cache_entry_t));
+    if (NULL == cache->entries) {
+        goto error;
+    }
+    cache->index = cache_index_new(capacity);
+    if (NULL == cache->index) {
+        goto error;
+    }
+    cache->capacity = capacity;
+    cache->ttl_ms = ttl_ms;
+    cache->stale_ms = stale_ms;
+    cache->value_free = value_free;
+    return cache;
+
+error:
+    cache_free(cache);
+    return NULL;
+}
+
+void
+cache_free(cache_t *cache)
+{
+    if (NULL != cache) {
+        if (NULL != cache->entries && NULL != cache->index) {
+            for (size_t i = 0; i < cache->capacity; ++i) {
+                if (cache->entries[i].used) {
+                    cache_entry_clear(cache, &cache->entries[i]);
+                }
+            }
+        }
+        cache_index_free(cache->index);
+        cache->index = NULL;
+        free(cache->entries);
+        cache->entries = NULL;
+        free(cache);
+    }
+}
+
+cache_result_t
+cache_get(cache_t *cache, const char *key, void **value)
+{
+    cache_entry_t *entry = cache_find(cache, key);
+    uint64_t now = 0;
+
+    if (NULL == entry) {
+        cache->stats.misses++;
+        return CACHE_MISS;
+    }
+
+    now = cache_now_ms();
+    if (now >= entry->stale_until) {
+        /* no use keeping it */
+        cache_entry_clear(cache, entry);
+        cache->stats.misses++;
+        return CACHE_MISS;
+    }
+
+    entry->referenced = true;
+    *value = entry->value;
+
+    if (now < entry->fresh_until) {
+        cache->stats.hits++;
+        return CACHE_HIT;
+    }
+
+    cache->stats.stale_hits++;
+    if (entry->revalidating) {
+        return CACHE_STALE;
+    }
+    entry->revalidating = true;
+    cache->stats.revalidations++;
+    return CACHE_REVALIDATE;
+}
+
+int
+cache_put(cache_t *cache, const char *key, void *value)
+{
+    cache_entry_t *entry = cache_find(cache, key);
+    uint64_t now = cache_now_ms();
+
+    if (NULL != entry) {
+        if (NULL != cache->value_free) {
+            cache->value_free(entry->value);
+        }
+    }
+    else {
+        cache_key_t cache_key;
+        if (0 == cache->capacity || cache_key_set(&cache_key, key) < 0) {
+            goto error;
+        }
+        entry = cache_evict(cache);
+        if (HASHTABLE_E_SUCCESS != cache_index_add(cache->index, &cache_key, entry - cache->entries)) {
+            goto error;
+        }
+        entry->key = cache_key;
+        entry->used = true;
+        /* new values get a full round before being evicted */
+        entry->referenced = false;
+        cache->stats.size++;
+    }
+
+    entry->value = value;
+    entry->fresh_until = now + cache->ttl_ms;
+    entry->stale_until = entry->fresh_until + cache->stale_ms;
+    entry->revalidating = false;
+    return 0;
+
+error:
+    if (NULL != cache->value_free) {
+        cache->value_free(value);
+    }
+    return -1;
+}
+
+void
+cache_revalidate_failed(cache_t *cache, const char *key)
+{
+    cache_entry_t *entry = cache_find(cache, key);
+    if (NULL != entry) {
+        entry->revalidating = false;
+    }
+}
+
+void
+cache_get_stats(cache_t *cache, cache_stats_t *stats)
+{
+    *stats = cache->stats;
+}
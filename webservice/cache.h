@@ -0,0 +1,88 @@
+#ifndef _TIGERA_CACHE__H__
+#define _TIGERA_CACHE__H__
+
+#include "includes.h"
+
+/* Stale-while-revalidate cache of parsed upstream results.
+ *
+ * Values are fresh for ttl after being stored, then stale for a
+ * further window: stale values are still served, and the first
+ * lookup of a stale value asks its caller to revalidate it (once,
+ * until a new value is stored or revalidation fails). Past stale
+ * window values are gone.
+ *
+ * Size is bounded: once full, storing a value evicts one picked by
+ * CLOCK (values looked up since hand last passed get a second chance).
+ *
+ * Not synchronized: meant for caches owned by a single worker.
+ */
+
+#define CACHE_KEY_MAX 64 /**< including terminating nul */
+
+typedef struct cache cache_t;
+
+typedef void (*cache_free_t)(void *value);
+
+typedef enum cache_result cache_result_t;
+
+enum cache_result {
+     CACHE_MISS       /**< no value, or past stale window */
+    ,CACHE_HIT        /**< fresh value */
+    ,CACHE_STALE      /**< stale value, already being revalidated */
+    ,CACHE_REVALIDATE /**< stale value, caller should revalidate it */
+};
+
+typedef struct cache_stats cache_stats_t;
+
+struct cache_stats {
+    size_t size;
+    size_t hits;
+    size_t stale_hits;    /**< CACHE_STALE and CACHE_REVALIDATE */
+    size_t misses;
+    size_t revalidations; /**< CACHE_REVALIDATE */
+    size_t evictions;
+};
+
+/**
+ * @param capacity max # values
+ * @param ttl_ms how long values are fresh
+ * @param stale_ms how long values are served stale after ttl
+ * @param value_free called on values replaced, evicted or
+ *        still stored when cache is freed
+ */
+cache_t *
+cache_new(size_t capacity, unsigned ttl_ms, unsigned stale_ms, cache_free_t value_free);
+
+void
+cache_free(cache_t *cache);
+
+/**
+ * Looks value up. Value remains valid until next
+ * cache_put or cache_free.
+ *
+ * @param key at most CACHE_KEY_MAX - 1 characters
+ * @param value set to value found, unless CACHE_MISS
+ */
+cache_result_t
+cache_get(cache_t *cache, const char *key, void **value);
+
+/**
+ * Stores value (ownership goes to cache), fresh from now on,
+ * replacing value stored under key, if any.
+ *
+ * @return 0, if successfull. -1, otherwise (value is freed).
+ */
+int
+cache_put(cache_t *cache, const char *key, void *value);
+
+/**
+ * Revalidation requested by CACHE_REVALIDATE failed:
+ * next lookup of stale value asks for it again.
+ */
+void
+cache_revalidate_failed(cache_t *cache, const char *key);
+
+void
+cache_get_stats(cache_t *cache, cache_stats_t *stats);
+
+#endif /* _TIGERA_CACHE__H__ */
@@ -0,0 +1,116 @@
+#include "includes.h"
+#include "cache.h"
+#include <assert.h>
+
+#define TTL_MS   50
+#define STALE_MS 100
+
+static int freed = 0;
+
+static void
+value_free(void *value)
+{
+    freed++;
+    free(value);
+}
+
+static int *
+value_new(int i)
+{
+    int *value = malloc(sizeof(int));
+    assert(NULL != value);
+    *value = i;
+    return value;
+}
+
+/* fresh, then stale with a single revalidation, then gone */
+static void
+test_stale_while_revalidate(void)
+{
+    cache_stats_t stats;
+    void *value = NULL;
+    cache_t *cache = cache_new(4, TTL_MS, STALE_MS, value_free);
+    assert(NULL != cache);
+
+    assert(CACHE_MISS == cache_get(cache, "name", &value));
+    assert(0 == cache_put(cache, "name", value_new(1)));
+    assert(CACHE_HIT == cache_get(cache, "name", &value));
+    assert(1 == *(int *)value);
+
+    usleep((TTL_MS + 10) * 1000);
+    assert(CACHE_REVALIDATE == cache_get(cache, "name", &value));
+    assert(1 == *(int *)value);
+    /* revalidation in progress */
+    assert(CACHE_STALE == cache_get(cache, "name", &value));
+    assert(1 == *(int *)value);
+
+    /* failed: next lookup asks again */
+    cache_revalidate_failed(cache, "name");
+    assert(CACHE_REVALIDATE == cache_get(cache, "name", &value));
+
+    /* revalidated: fresh again */
+    assert(0 == cache_put(cache, "name", value_new(2)));
+    assert(1 == freed);
+    assert(CACHE_HIT == cache_get(cache, "name", &value));
+    assert(2 == *(int *)value);
+
+    usleep((TTL_MS + STALE_MS + 10) * 1000);
+    assert(CACHE_MISS == cache_get(cache, "name", &value));
+    assert(2 == freed);
+
+    cache_get_stats(cache, &stats);
+    assert(0 == stats.size);
+    assert(2 == stats.hits && 3 == stats.stale_hits && 2 == stats.misses);
+    assert(2 == stats.revalidations && 0 == stats.evictions);
+
+    cache_free(cache);
+}
+
+/* values looked up survive eviction */
+static void
+test_clock(void)
+{
+    char key[16];
+    void *value = NULL;
+    cache_stats_t stats;
+    cache_t *cache = cache_new(4, 60 * 1000, 0, value_free);
+    assert(NULL != cache);
+
+    freed = 0;
+    for (int i = 0; i < 4; ++i) {
+        snprintf(key, sizeof(key), "key%d", i);
+        assert(0 == cache_put(cache, key, value_new(i)));
+    }
+    assert(CACHE_HIT == cache_get(cache, "key0", &value));
+    assert(CACHE_HIT == cache_get(cache, "key2", &value));
+
+    /* key1 is first one not referenced */
+    assert(0 == cache_put(cache, "key4", value_new(4)));
+    assert(1 == freed);
+    assert(CACHE_MISS == cache_get(cache, "key1", &value));
+    assert(CACHE_HIT == cache_get(cache, "key0", &value) && 0 == *(int *)value);
+    assert(CACHE_HIT == cache_get(cache, "key2", &value) && 2 == *(int *)value);
+    assert(CACHE_HIT == cache_get(cache, "key3", &value) && 3 == *(int *)value);
+    assert(CACHE_HIT == cache_get(cache, "key4", &value) && 4 == *(int *)value);
+
+    /* too long keys are never stored */
+    char long_key[CACHE_KEY_MAX + 1];
+    memset(long_key, 'k', CACHE_KEY_MAX);
+    long_key[CACHE_KEY_MAX] = '\0';
+    assert(-1 == cache_put(cache, long_key, value_new(5)));
+    assert(CACHE_MISS == cache_get(cache, long_key, &value));
+
+    cache_get_stats(cache, &stats);
+    assert(4 == stats.size && 1 == stats.evictions);
+
+    cache_free(cache);
+    assert(2 + 4 == freed);
+}
+
+int
+main(int argc, char **argv)
+{
+    test_stale_while_revalidate();
+    test_clock();
+    return 0;
+}
@@ -0,0 +1,372 @@
+#include "includes.h"
+#include "libs.h"
+#include "atomic.h"
+#include "thread.h"
+#include "mpsc.h"
+#include "worker.h"
+#include "compute.h"
+#include <sys/eventfd.h>
+#include <sched.h>
+
+#define COMPUTE_DEQUE_SIZE  1024 /**< power of 2 */
+#define COMPUTE_INBOX_SIZE  1024
+
+typedef struct compute_deque compute_deque_t;
+
+/**
+ * Fixed size Chase-Lev deque (as formalized for C11 by Le et al.):
+ * only owner pushes and takes at bottom, thieves CAS top.
+ */
+struct compute_deque {
+    atomic_t top __attribute__((aligned(64)));
+    atomic_t bottom __attribute__((aligned(64)));
+    compute_task_t *tasks[COMPUTE_DEQUE_SIZE];
+};
+
+typedef struct compute_thread compute_thread_t;
+
+struct compute_thread {
+    compute_deque_t deque;
+    compute_pool_t *pool;
+    thread_t *thread;
+    int idx;
+    mpsc_queue_t *inbox; /**< tasks submitted by workers */
+    int wakeup_fd;       /**< eventfd sleeping thread blocks on */
+    atomic_t sleeping;
+} __attribute__((aligned(64)));
+
+struct compute_pool {
+    compute_thread_t *threads;
+    int nthreads;
+    atomic_t next;       /**< round-robin submission */
+    atomic_t stopping;
+    atomic_t submitting; /**< # workers pushing tasks right now */
+    bool stopped;        /**< only touched by thread stopping pool */
+};
+
+/* @return -1 if deque is full */
+static int
+compute_deque_push(compute_deque_t *deque, compute_task_t *task)
+{
+    atomic_t b = __atomic_load_n(&deque->bottom, __ATOMIC_RELAXED);
+    atomic_t t = atomic_load_acquire(&deque->top);
+
+    if (b - t >= COMPUTE_DEQUE_SIZE) {
+        return -1;
+    }
+    __atomic_store_n(&deque->tasks[b & (COMPUTE_DEQUE_SIZE - 1)], task, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    __atomic_store_n(&deque->bottom, b + 1, __ATOMIC_RELAXED);
+    return 0;
+}
+
+/* owner side */
+static compute_task_t *
+compute_deque_take(compute_deque_t *deque)
+{
+    compute_task_t *task = NULL;
+    atomic_t b = __atomic_load_n(&deque->bottom, __ATOMIC_RELAXED) - 1;
+    atomic_t t;
+
+    __atomic_store_n(&deque->bottom, b, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    t = __atomic_load_n(&deque->top, __ATOMIC_RELAXED);
+
+    if (t <= b) {
+        task = __atomic_load_n(&deque->tasks[b & (COMPUTE_DEQUE_SIZE - 1)], __ATOMIC_RELAXED);
+        if (t == b) {
+            /* last task: race against thieves */
+            if (!__atomic_compare_exchange_n(&deque->top, &t, t + 1, false,
+                                             __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)) {
+                task = NULL;
+            }
+            __atomic_store_n(&deque->bottom, b + 1, __ATOMIC_RELAXED);
+        }
+    }
+    else {
+        __atomic_store_n(&deque->bottom, b + 1, __ATOMIC_RELAXED);
+    }
+    return task;
+}
+
+/* thief side: NULL if empty or lost race */
+static compute_task_t *
+compute_deque_steal(compute_deque_t *deque)
+{
+    atomic_t t = atomic_load_acquire(&deque->top);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    atomic_t b = atomic_load_acquire(&deque->bottom);
+
+    if (t < b) {
+        compute_task_t *task = __atomic_load_n(&deque->tasks[t & (COMPUTE_DEQUE_SIZE - 1)], __ATOMIC_RELAXED);
+        if (__atomic_compare_exchange_n(&deque->top, &t, t + 1, false,
+                                        __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)) {
+            return task;
+        }
+    }
+    return NULL;
+}
+
+static void
+compute_wakeup(compute_thread_t *thread)
+{
+    uint64_t one = 1;
+
+    if (1 == __atomic_exchange_n(&thread->sleeping, 0, __ATOMIC_SEQ_CST)) {
+        if (write(thread->wakeup_fd, &one, sizeof(one)) < 0) {
+            fprintf(stderr, "%s: error waking compute thread up\n", __func__);
+        }
+    }
+}
+
+static void
+compute_task_done(void *arg)
+{
+    compute_task_t *task = arg;
+    task->done(task);
+}
+
+static void
+compute_task_run(void *arg)
+{
+    compute_task_t *task = arg;
+    task->work(task);
+    if (worker_call(task->owner, compute_task_done, task) < 0) {
+        fprintf(stderr, "%s: error posting task back to worker\n", __func__);
+    }
+}
+
+/* back on submitting worker: task was never run by pool */
+static void
+compute_task_inline(void *arg)
+{
+    compute_task_t *task = arg;
+    task->work(task);
+    task->done(task);
+}
+
+static void
+compute_task_return(compute_task_t *task)
+{
+    if (worker_call(task->owner, compute_task_inline, task) < 0) {
+        fprintf(stderr, "%s: error handing task back to worker\n", __func__);
+    }
+}
+
+/**
+ * Moves tasks submitted to this thread into its deque,
+ * where idle threads can steal them from.
+ */
+static void
+compute_inbox_drain(compute_thread_t *self)
+{
+    mpsc_fn_t fn = NULL;
+    void *arg = NULL;
+    int n = 0;
+
+    while (0 == mpsc_queue_pop(self->inbox, &fn, &arg)) {
+        if (compute_deque_push(&self->deque, arg) < 0) {
+            /* deque full: run it right away */
+            compute_task_run(arg);
+            continue;
+        }
+        n++;
+    }
+
+    /* more than this thread can take at once: wake a peer up */
+    if (n > 1 && self->pool->nthreads > 1) {
+        compute_wakeup(&self->pool->threads[(self->idx + 1) % self->pool->nthreads]);
+    }
+}
+
+static compute_task_t *
+compute_next(compute_thread_t *self)
+{
+    compute_pool_t *pool = self->pool;
+    compute_task_t *task = compute_deque_take(&self->deque);
+
+    if (NULL == task) {
+        compute_inbox_drain(self);
+        task = compute_deque_take(&self->deque);
+    }
+
+    for (int i = 1; NULL == task && i < pool->nthreads; ++i) {
+        task = compute_deque_steal(&pool->threads[(self->idx + i) % pool->nthreads].deque);
+    }
+    return task;
+}
+
+static void
+compute_loop(void *arg)
+{
+    compute_thread_t *self = arg;
+    compute_pool_t *pool = self->pool;
+    compute_task_t *task = NULL;
+    uint64_t value;
+
+    while (!atomic_load_acquire(&pool->stopping)) {
+        task = compute_next(self);
+        if (NULL == task) {
+            /* announce sleep, then look again: submitters either
+             * see thread sleeping or their task is found here
+             */
+            __atomic_store_n(&self->sleeping, 1, __ATOMIC_SEQ_CST);
+            __atomic_thread_fence(__ATOMIC_SEQ_CST);
+            task = compute_next(self);
+            if (NULL == task && !atomic_load_acquire(&pool->stopping)) {
+                if (read(self->wakeup_fd, &value, sizeof(value)) < 0) {
+                    /* interrupted */
+                }
+            }
+            __atomic_store_n(&self->sleeping, 0, __ATOMIC_SEQ_CST);
+        }
+        if (NULL != task) {
+            compute_task_run(task);
+        }
+    }
+}
+
+compute_pool_t *
+compute_pool_new(int nthreads)
+{
+    compute_pool_t *pool = calloc(1, sizeof(compute_pool_t));
+    if (NULL == pool) {
+        return NULL;
+    }
+
+    if (0 != posix_memalign((void **)&pool->threads, 64, nthreads * sizeof(compute_thread_t))) {
+        pool->threads = NULL;
+        goto error;
+    }
+    memset(pool->threads, 0, nthreads * sizeof(compute_thread_t));
+    for (int i = 0; i < nthreads; ++i) {
+        pool->threads[i].wakeup_fd = -1;
+    }
+    pool->nthreads = nthreads;
+
+    for (int i = 0; i < nthreads; ++i) {
+        compute_thread_t *thread = &pool->threads[i];
+        thread->pool = pool;
+        thread->idx = i;
+        thread->inbox = mpsc_queue_new(COMPUTE_INBOX_SIZE);
+        if (NULL == thread->inbox) {
+            goto error;
+        }
+        thread->wakeup_fd = eventfd(0, EFD_CLOEXEC);
+        if (thread->wakeup_fd < 0) {
+            goto error;
+        }
+        thread->thread = thread_new(compute_loop);
+        if (NULL == thread->thread) {
+            goto error;
+        }
+    }
+
+    for (int i = 0; i < nthreads; ++i) {
+        if (thread_start(pool->threads[i].thread, &pool->threads[i]) < 0) {
+            fprintf(stderr, "%s: error starting compute thread\n", __func__);
+            /* threads not started are not joined */
+            for (int j = i; j < nthreads; ++j) {
+                thread_free(pool->threads[j].thread);
+                pool->threads[j].thread = NULL;
+            }
+            goto error;
+        }
+    }
+    return pool;
+
+error:
+    compute_pool_free(pool);
+    return NULL;
+}
+
+void
+compute_pool_stop(compute_pool_t *pool)
+{
+    uint64_t one = 1;
+
+    if (NULL != pool && !pool->stopped) {
+        pool->stopped = true;
+
+        /* submitters either see pool stopping or are waited for */
+        __atomic_store_n(&pool->stopping, 1, __ATOMIC_SEQ_CST);
+        while (0 != __atomic_load_n(&pool->submitting, __ATOMIC_SEQ_CST)) {
+            sched_yield();
+        }
+
+        for (int i = 0; i < pool->nthreads; ++i) {
+            compute_thread_t *thread = &pool->threads[i];
+            if (-1 != thread->wakeup_fd && write(thread->wakeup_fd, &one, sizeof(one)) < 0) {
+                fprintf(stderr, "%s: error waking compute thread up\n", __func__);
+            }
+        }
+        for (int i = 0; i < pool->nthreads; ++i) {
+            compute_thread_t *thread = &pool->threads[i];
+            if (NULL != thread->thread) {
+                thread_join(thread->thread);
+                thread_free(thread->thread);
+                thread->thread = NULL;
+            }
+        }
+
+        /* tasks not run yet go back to their workers */
+        for (int i = 0; i < pool->nthreads; ++i) {
+            compute_thread_t *thread = &pool->threads[i];
+            compute_task_t *task = NULL;
+            mpsc_fn_t fn = NULL;
+            void *arg = NULL;
+
+            while (NULL != (task = compute_deque_take(&thread->deque))) {
+                compute_task_return(task);
+            }
+            while (NULL != thread->inbox && 0 == mpsc_queue_pop(thread->inbox, &fn, &arg)) {
+                compute_task_return(arg);
+            }
+        }
+    }
+}
+
+void
+compute_pool_free(compute_pool_t *pool)
+{
+    if (NULL != pool) {
+        compute_pool_stop(pool);
+        for (int i = 0; i < pool->nthreads; ++i) {
+            compute_thread_t *thread = &pool->threads[i];
+            if (-1 != thread->wakeup_fd) {
+                close(thread->wakeup_fd);
+                thread->wakeup_fd = -1;
+            }
+            mpsc_queue_free(thread->inbox);
+            thread->inbox = NULL;
+        }
+        free(pool->threads);
+        pool->threads = NULL;
+        free(pool);
+    }
+}
+
+void
+compute_submit(compute_pool_t *pool, compute_task_t *task)
+{
+    task->owner = this_worker();
+
+    if (NULL != pool && NULL != task->owner) {
+        compute_thread_t *thread = &pool->threads[atomic_inc(&pool->next) % pool->nthreads];
+        bool pushed = false;
+
+        __atomic_fetch_add(&pool->submitting, 1, __ATOMIC_SEQ_CST);
+        if (!__atomic_load_n(&pool->stopping, __ATOMIC_SEQ_CST) &&
+            0 == mpsc_queue_push(thread->inbox, compute_task_run, task)) {
+            compute_wakeup(thread);
+            pushed = true;
+        }
+        __atomic_fetch_sub(&pool->submitting, 1, __ATOMIC_RELEASE);
+        if (pushed) {
+            return;
+        }
+    }
+
+    task->work(task);
+    task->done(task);
+}
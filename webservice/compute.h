@@ -0,0 +1,73 @@
+#ifndef _TIGERA_COMPUTE__H__
+#define _TIGERA_COMPUTE__H__
+
+/* Pool of compute threads CPU-bound steps are offloaded to, so
+ * that worker event loops keep serving other connections.
+ *
+ * Each compute thread owns a Chase-Lev work-stealing deque: it
+ * takes tasks from its bottom while idle threads steal from their
+ * top. Workers submit through a per-thread lock-free inbox; once
+ * done, tasks are posted back to the worker which submitted them.
+ */
+
+typedef struct compute_pool compute_pool_t;
+
+typedef struct compute_task compute_task_t;
+
+typedef void (*compute_fn_t)(compute_task_t *task);
+
+struct worker;
+
+/**
+ * Embedded in caller's object (recovered with downcast),
+ * so that submitting never allocates.
+ */
+struct compute_task {
+    compute_fn_t work;    /**< runs on a compute thread */
+    compute_fn_t done;    /**< runs back on submitting worker */
+    struct worker *owner;
+};
+
+static inline void
+compute_task_init(compute_task_t *task, compute_fn_t work, compute_fn_t done)
+{
+    task->work = work;
+    task->done = done;
+    task->owner = NULL;
+}
+
+/**
+ * @param nthreads # compute threads
+ */
+compute_pool_t *
+compute_pool_new(int nthreads);
+
+/**
+ * Stops and joins compute threads. Done callbacks of tasks
+ * being run are posted to their workers, and tasks not run
+ * yet are handed back to their workers, which run them
+ * inline: workers should still be running (or not stopped
+ * before running calls queued to them), so that every task
+ * completes. Tasks submitted from now on run inline.
+ */
+void
+compute_pool_stop(compute_pool_t *pool);
+
+/**
+ * Stops pool, if not stopped yet, and frees it: workers
+ * should no longer submit tasks.
+ */
+void
+compute_pool_free(compute_pool_t *pool);
+
+/**
+ * Runs task->work on a compute thread, then task->done on
+ * calling worker thread. Without a pool (or a worker to post
+ * back to, or room in thread inbox) both run inline.
+ *
+ * Task must remain valid until done runs.
+ */
+void
+compute_submit(compute_pool_t *pool, compute_task_t *task);
+
+#endif /* _TIGERA_COMPUTE__H__ */
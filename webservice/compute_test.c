@@ -0,0 +1,181 @@
+#include "includes.h"
+#include "libs.h"
+#include "thread.h"
+#include "worker.h"
+#include "compute.h"
+#include "atomic.h"
+#include <time.h>
+#include <assert.h>
+
+#define NR_COMPUTE  4
+#define NR_TASKS    (16*1024) /**< overflows compute inboxes */
+
+typedef struct compute_test compute_test_t;
+
+struct compute_test {
+    worker_t *worker;
+    compute_pool_t *pool;
+    atomic_t done;      /**< only written by worker thread */
+    bool offloaded;     /**< whether any work ran off worker thread */
+};
+
+typedef struct job job_t;
+
+struct job {
+    compute_task_t task;
+    compute_test_t *test;
+    uint32_t n;
+    uint32_t result;
+    bool on_worker;
+};
+
+static uint32_t
+collatz(uint32_t n)
+{
+    uint32_t steps = 0;
+    uint64_t x = n;
+    while (x > 1) {
+        x = (x & 1) ? 3 * x + 1 : x / 2;
+        steps++;
+    }
+    return steps;
+}
+
+static void
+job_work(compute_task_t *task)
+{
+    job_t *job = downcast(task, job_t, task);
+    job->on_worker = (NULL != this_worker());
+    /* uneven costs, so that idle threads steal */
+    for (uint32_t i = 0; i < job->n % 64; ++i) {
+        job->result += collatz(job->n + i);
+    }
+}
+
+static void
+job_done(compute_task_t *task)
+{
+    job_t *job = downcast(task, job_t, task);
+    compute_test_t *test = job->test;
+    uint32_t expected = 0;
+
+    assert(this_worker() == test->worker);
+    for (uint32_t i = 0; i < job->n % 64; ++i) {
+        expected += collatz(job->n + i);
+    }
+    assert(expected == job->result);
+    if (!job->on_worker) {
+        test->offloaded = true;
+    }
+    atomic_store_release(&test->done, test->done + 1);
+}
+
+static job_t jobs[NR_TASKS];
+
+/* on worker thread */
+static void
+submit_all(void *arg)
+{
+    compute_test_t *test = arg;
+
+    for (uint32_t i = 0; i < NR_TASKS; ++i) {
+        jobs[i].test = test;
+        jobs[i].n = i * 2654435761u % 100000 + 1;
+        jobs[i].result = 0;
+        compute_task_init(&jobs[i].task, job_work, job_done);
+        compute_submit(test->pool, &jobs[i].task);
+    }
+}
+
+static double
+now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* tasks run on pool and complete back on submitting worker */
+static void
+test(int nthreads)
+{
+    compute_test_t test;
+
+    memset(&test, 0, sizeof(test));
+    if (nthreads > 0) {
+        test.pool = compute_pool_new(nthreads);
+        assert(NULL != test.pool);
+    }
+    test.worker = worker_new(&test, "8.8.8.8:53", WORKER_CPU_ANY);
+    assert(NULL != test.worker);
+    assert(0 == worker_start(test.worker));
+
+    double start = now();
+    assert(0 == worker_call(test.worker, submit_all, &test));
+    while (atomic_load_acquire(&test.done) < NR_TASKS) {
+        usleep(1000);
+    }
+    double elapsed = now() - start;
+
+    worker_stop(test.worker);
+    compute_pool_free(test.pool);
+    worker_free(test.worker);
+
+    assert(NR_TASKS == test.done);
+    assert(test.offloaded == (nthreads > 0));
+    printf("%d compute thread(s): %d tasks in %.1f ms\n", nthreads, NR_TASKS, elapsed * 1e3);
+}
+
+/* tasks still queued when pool stops complete on their worker */
+static void
+test_stop(void)
+{
+    compute_test_t test;
+
+    memset(&test, 0, sizeof(test));
+    test.pool = compute_pool_new(1);
+    assert(NULL != test.pool);
+    test.worker = worker_new(&test, "8.8.8.8:53", WORKER_CPU_ANY);
+    assert(NULL != test.worker);
+    assert(0 == worker_start(test.worker));
+
+    assert(0 == worker_call(test.worker, submit_all, &test));
+    while (0 == atomic_load_acquire(&test.done)) {
+        usleep(100);
+    }
+    compute_pool_stop(test.pool);
+    while (atomic_load_acquire(&test.done) < NR_TASKS) {
+        usleep(1000);
+    }
+
+    /* stopped pool runs tasks inline */
+    test.offloaded = false;
+    atomic_store_release(&test.done, 0);
+    assert(0 == worker_call(test.worker, submit_all, &test));
+    while (atomic_load_acquire(&test.done) < NR_TASKS) {
+        usleep(1000);
+    }
+    assert(!test.offloaded);
+
+    worker_stop(test.worker);
+    compute_pool_free(test.pool);
+    worker_free(test.worker);
+    printf("stopped pool: queued tasks completed on worker\n");
+}
+
+int
+main(int argc, char **argv)
+{
+    worker_init();
+
+    test(0);
+    test(1);
+    test(NR_COMPUTE);
+    test_stop();
+
+    /* idle pool is stopped right away */
+    compute_pool_free(compute_pool_new(NR_COMPUTE));
+
+    worker_fini();
+    return 0;
+}
@@ -0,0 +1,190 @@
+#include "includes.h"
+#include "handover.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+
+extern char **environ;
+
+/* socket to acknowledge previous process image on */
+static int handover_sock = -1;
+
+static int
+handover_send(int sock, const int *fds, int nfds)
+{
+    char byte = 0;
+    struct iovec iov = { .iov_base = &byte, .iov_len = 1 };
+    struct msghdr msg;
+    struct cmsghdr *cmsg = NULL;
+    size_t len = nfds * sizeof(int);
+    char *control = NULL;
+    int ret = -1;
+
+    control = calloc(1, CMSG_SPACE(len));
+    if (NULL == control) {
+        return -1;
+    }
+
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = CMSG_SPACE(len);
+
+    cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(len);
+    memcpy(CMSG_DATA(cmsg), fds, len);
+
+    if (sendmsg(sock, &msg, MSG_NOSIGNAL) == 1) {
+        ret = 0;
+    }
+    free(control);
+    return ret;
+}
+
+int
+handover_exec(const char *path, char **argv, const int *fds, int nfds, pid_t *pid)
+{
+    int sv[2] = { -1, -1 };
+    char env[64];
+    char **envp = NULL;
+    size_t nenv = 0;
+
+    if (nfds <= 0 || nfds > HANDOVER_MAX_FDS) {
+        return -1;
+    }
+
+    /* child end must survive exec, parent end must not */
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) < 0) {
+        return -1;
+    }
+    if (fcntl(sv[0], F_SETFD, FD_CLOEXEC) < 0) {
+        goto error;
+    }
+
+    /* environment is built before fork: only exec happens in child */
+    snprintf(env, sizeof(env), "%s=%d", HANDOVER_ENV, sv[1]);
+    while (NULL != environ[nenv]) {
+        nenv++;
+    }
+    envp = calloc(nenv + 2, sizeof(char *));
+    if (NULL == envp) {
+        goto error;
+    }
+    memcpy(envp, environ, nenv * sizeof(char *));
+    envp[nenv] = env;
+
+    *pid = fork();
+    if (*pid < 0) {
+        goto error;
+    }
+
+    if (0 == *pid) {
+        execve(path, argv, envp);
+        _exit(127);
+    }
+
+    free(envp);
+    close(sv[1]);
+    sv[1] = -1;
+
+    /* sockets are queued in UNIX socket: new image gets them whenever it is ready */
+    if (handover_send(sv[0], fds, nfds) < 0) {
+        close(sv[0]);
+        handover_abort(*pid);
+        return -1;
+    }
+
+    return sv[0];
+
+error:
+    free(envp);
+    if (-1 != sv[0]) {
+        close(sv[0]);
+    }
+    if (-1 != sv[1]) {
+        close(sv[1]);
+    }
+    return -1;
+}
+
+void
+handover_abort(pid_t pid)
+{
+    /* never acknowledged: it holds no connection worth draining */
+    kill(pid, SIGKILL);
+    while (waitpid(pid, NULL, 0) < 0 && EINTR == errno) {
+    }
+}
+
+int
+handover_inherit(int *fds, int max)
+{
+    char byte;
+    struct iovec iov = { .iov_base = &byte, .iov_len = 1 };
+    struct msghdr msg;
+    struct cmsghdr *cmsg = NULL;
+    char control[CMSG_SPACE(HANDOVER_MAX_FDS * sizeof(int))];
+    const char *env = getenv(HANDOVER_ENV);
+    int nfds = 0;
+    int sock;
+
+    if (NULL == env) {
+        return 0;
+    }
+    if (1 != sscanf(env, "%d", &sock) || sock < 0) {
+        return -1;
+    }
+    /* do not leak it to processes we might start */
+    unsetenv(HANDOVER_ENV);
+    fcntl(sock, F_SETFD, FD_CLOEXEC);
+
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+
+    if (recvmsg(sock, &msg, MSG_CMSG_CLOEXEC) != 1) {
+        close(sock);
+        return -1;
+    }
+
+    for (cmsg = CMSG_FIRSTHDR(&msg); NULL != cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+        if (SOL_SOCKET == cmsg->cmsg_level && SCM_RIGHTS == cmsg->cmsg_type) {
+            int n = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+            int *received = (int *)CMSG_DATA(cmsg);
+            for (int i = 0; i < n; ++i) {
+                if (nfds < max) {
+                    fds[nfds++] = received[i];
+                }
+                else {
+                    close(received[i]);
+                }
+            }
+        }
+    }
+
+    handover_sock = sock;
+    return nfds;
+}
+
+int
+handover_ack(void)
+{
+    char byte = 1;
+    int ret = 0;
+
+    if (-1 == handover_sock) {
+        return -1;
+    }
+    if (write(handover_sock, &byte, 1) != 1) {
+        ret = -1;
+    }
+    close(handover_sock);
+    handover_sock = -1;
+    return ret;
+}
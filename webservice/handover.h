@@ -0,0 +1,61 @@
+#ifndef _TIGERA_HANDOVER__H__
+#define _TIGERA_HANDOVER__H__
+
+/**
+ * Hands sockets over to a new process image (e.g. upgraded binary)
+ * so that listening sockets are never closed while service restarts.
+ *
+ * Old process forks and execs new image, then sends it sockets
+ * over a UNIX socket with SCM_RIGHTS. New image starts using them
+ * and acknowledges, so that old process can begin draining.
+ */
+
+#define HANDOVER_ENV    "TIGERA_HANDOVER_FD" /**< UNIX socket inherited by new image */
+#define HANDOVER_MAX_FDS    253 /**< SCM_MAX_FD */
+#define HANDOVER_ACK_TIMEOUT 10 /**< seconds new image has to acknowledge, before being aborted */
+
+/**
+ * Starts new process image and sends fds to it.
+ *
+ * @param path executable of new image
+ * @param argv arguments of new image
+ * @param fds sockets to hand over
+ * @param nfds # sockets
+ * @param pid set to process id of new image, for caller to reap it
+ *        (@see handover_abort) should it never acknowledge
+ * @return UNIX socket new image acknowledges on (@see handover_ack),
+ *         or -1 on error (new image, if started, is reaped already).
+ */
+int
+handover_exec(const char *path, char **argv, const int *fds, int nfds, pid_t *pid);
+
+/**
+ * Kills and reaps new image which failed to acknowledge (or
+ * did not within HANDOVER_ACK_TIMEOUT), so that
+ * it neither keeps serving along with us nor stays a zombie.
+ */
+void
+handover_abort(pid_t pid);
+
+/**
+ * Receives sockets handed over by previous process image.
+ *
+ * Received sockets are close-on-exec.
+ *
+ * @param fds filled with received sockets
+ * @param max fds capacity
+ * @return # received sockets, 0 if process was not started
+ *         by handover_exec, or -1 on error.
+ */
+int
+handover_inherit(int *fds, int max);
+
+/**
+ * Tells previous process image inherited sockets are in use.
+ *
+ * @return 0, if successfull. -1, otherwise.
+ */
+int
+handover_ack(void);
+
+#endif /* _TIGERA_HANDOVER__H__ */
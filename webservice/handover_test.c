@@ -0,0 +1,116 @@
+#include "includes.h"
+#include "handover.h"
+#include <sys/wait.h>
+#include <poll.h>
+#include <errno.h>
+#include <assert.h>
+
+/* new process image: serves one connection on inherited listener */
+static int
+upgraded(void)
+{
+    int fds[HANDOVER_MAX_FDS];
+    int nfds = handover_inherit(fds, countof(fds));
+    assert(1 == nfds);
+    assert(NULL == getenv(HANDOVER_ENV));
+    assert(0 == handover_ack());
+
+    int fd = accept(fds[0], NULL, NULL);
+    assert(fd >= 0);
+    assert(2 == write(fd, "ok", 2));
+    close(fd);
+    close(fds[0]);
+    return 0;
+}
+
+/* new process image which hangs before acknowledging */
+static int
+hung(void)
+{
+    int fds[HANDOVER_MAX_FDS];
+    assert(1 == handover_inherit(fds, countof(fds)));
+    for (;;) {
+        pause();
+    }
+    return 0;
+}
+
+int
+main(int argc, char **argv)
+{
+    struct sockaddr_in addr;
+    socklen_t addrlen = sizeof(addr);
+    char *upgraded_argv[] = { argv[0], "upgraded", NULL };
+    char buffer[2];
+    char ack = 0;
+    int status = 0;
+
+    if (argc > 1 && 0 == strcmp(argv[1], "upgraded")) {
+        return upgraded();
+    }
+    if (argc > 1 && 0 == strcmp(argv[1], "hung")) {
+        return hung();
+    }
+
+    /* not started by handover */
+    assert(0 == handover_inherit(NULL, 0));
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    inet_pton(AF_INET, "127.0.0.1", &addr.sin_addr);
+
+    int listener = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    assert(listener >= 0);
+    assert(0 == bind(listener, (struct sockaddr *)&addr, sizeof(addr)));
+    assert(0 == listen(listener, 1));
+    assert(0 == getsockname(listener, (struct sockaddr *)&addr, &addrlen));
+
+    pid_t pid = 0;
+    int sock = handover_exec("/proc/self/exe", upgraded_argv, &listener, 1, &pid);
+    assert(sock >= 0);
+    assert(1 == read(sock, &ack, 1));
+    assert(1 == ack);
+    close(sock);
+
+    /* socket outlives our copy of it */
+    close(listener);
+
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    assert(0 == connect(fd, (struct sockaddr *)&addr, sizeof(addr)));
+    assert(2 == read(fd, buffer, 2));
+    assert(0 == memcmp(buffer, "ok", 2));
+    close(fd);
+
+    assert(pid == waitpid(pid, &status, 0));
+    assert(WIFEXITED(status) && 0 == WEXITSTATUS(status));
+
+    /* new image failing to start is reaped */
+    char *missing_argv[] = { "/nonexistent", NULL };
+    listener = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    sock = handover_exec("/nonexistent", missing_argv, &listener, 1, &pid);
+    close(listener);
+    if (sock >= 0) {
+        /* exited before acknowledging */
+        assert(read(sock, &ack, 1) <= 0);
+        close(sock);
+        handover_abort(pid);
+    }
+    assert(waitpid(pid, &status, WNOHANG) < 0 && ECHILD == errno);
+
+    /* new image not acknowledging in time is killed and reaped,
+     * as http service does on HANDOVER_ACK_TIMEOUT (shortened here)
+     */
+    char *hung_argv[] = { argv[0], "hung", NULL };
+    listener = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    sock = handover_exec("/proc/self/exe", hung_argv, &listener, 1, &pid);
+    close(listener);
+    assert(sock >= 0);
+    struct pollfd pfd = { .fd = sock, .events = POLLIN };
+    assert(0 == poll(&pfd, 1, 100));
+    handover_abort(pid);
+    close(sock);
+    assert(waitpid(pid, &status, WNOHANG) < 0 && ECHILD == errno);
+
+    printf("listener handed over\n");
+    return 0;
+}
@@ -1,44 +1,141 @@
 #include "hashtable.h"
 #include "rwlock.h"
+#include "atomic.h"
+#include "qsbr.h"
 
 /**
- * Lock-free strategies or lock per bucked (as opposed to
- * global hashtable lock) might be used to make this data
- * structure more scalable.
+ * Writers always serialize on stripe lock. Readers either take
+ * stripe read lock or, once a qsbr domain is set, take no lock at
+ * all: writers then publish every link with release stores and
+ * retire (instead of freeing) whatever they unlink.
+ *
+ * Values are linked through a hashtable_link_t they embed, so that
+ * adding and removing never allocate.
  */
 
-struct hashtable {
-    slist_t *buckets;
-    size_t size;
+#define HASHTABLE_MAX_LOAD      1 /**< stripe grows when # values exceeds # buckets times this */
+#define HASHTABLE_REHASH_STEP   4 /**< # buckets moved to grown table on every write */
+
+typedef struct hashtable_table hashtable_table_t;
+
+struct hashtable_table {
     size_t nr_buckets;
-    size_t collisions;
+    islink_t *buckets[];
+};
+
+typedef struct hashtable_stripe hashtable_stripe_t;
+
+/**
+ * While a stripe grows, values live in two tables: buckets
+ * [0, rehash_idx) of old one (0) were already moved to new
+ * one (1). Once all are moved, new table replaces old one.
+ */
+struct hashtable_stripe {
     rwlock_t *rwlock; /**< assuming much more reads than writes */
+    unsigned seq;     /**< odd while values are being moved between tables */
+    hashtable_table_t *tables[2];
+    size_t rehash_idx;
+    size_t size;
+    size_t collisions;
+};
+
+struct hashtable {
+    hashtable_stripe_t *stripes;
+    size_t nr_stripes;
+    unsigned stripe_bits; /**< log2(nr_stripes) */
+    size_t link_offset;   /**< of hashtable_link_t within values */
     hashtable_cmp_t cmp;
     hashtable_hash_t hash;
     hashtable_free_t value_free;
+    qsbr_t *qsbr;         /**< lock-free reads, if set */
 };
 
+static inline hashtable_link_t *
+_hashtable_link(hashtable_t *hashtable, void *value)
+{
+    return (hashtable_link_t *)((char *)value + hashtable->link_offset);
+}
+
+static inline void *
+_hashtable_value(hashtable_t *hashtable, islink_t *link)
+{
+    return (char *)downcast(link, hashtable_link_t, link) - hashtable->link_offset;
+}
+
+static inline hash_t
+_hashtable_hash(islink_t *link)
+{
+    return downcast(link, hashtable_link_t, link)->hash;
+}
+
+static hashtable_table_t *
+hashtable_table_new(size_t nr_buckets)
+{
+    hashtable_table_t *table = calloc(1, sizeof(hashtable_table_t) + nr_buckets * sizeof(islink_t *));
+    if (NULL != table) {
+        table->nr_buckets = nr_buckets;
+    }
+    return table;
+}
+
+static void
+hashtable_table_free(hashtable_t *hashtable, hashtable_table_t *table)
+{
+    if (NULL != table) {
+        for (size_t i = 0; i < table->nr_buckets; ++i) {
+            islink_t *link = NULL;
+            while (NULL != (link = table->buckets[i])) {
+                /* link is freed along with its value */
+                table->buckets[i] = link->next;
+                if (NULL != hashtable->value_free) {
+                    hashtable->value_free(_hashtable_value(hashtable, link));
+                }
+            }
+        }
+        free(table);
+    }
+}
+
 hashtable_t *
-hashtable_new(hashtable_cmp_t cmp, hashtable_hash_t hash, hashtable_free_t value_free, size_t nr_buckets)
+hashtable_new(hashtable_cmp_t cmp, hashtable_hash_t hash, hashtable_free_t value_free, size_t link_offset, size_t nr_buckets, size_t nr_stripes)
 {
     hashtable_t *hashtable = calloc(1, sizeof(hashtable_t));
 
     if (NULL != hashtable) {
-        slist_t *buckets = calloc(nr_buckets, sizeof(slist_t));
-        if (NULL == buckets) {
-            goto error;
+        size_t stripes = 1;
+        while (stripes < nr_stripes && hashtable->stripe_bits < 16) {
+            stripes <<= 1;
+            hashtable->stripe_bits++;
         }
-        hashtable->buckets = buckets;
+
         hashtable->cmp = cmp;
         hashtable->hash = hash;
         hashtable->value_free = value_free;
-        hashtable->nr_buckets = nr_buckets;
-        
-        hashtable->rwlock = rwlock_new();
-        if (NULL == hashtable->rwlock) {
+        hashtable->link_offset = link_offset;
+
+        hashtable->stripes = calloc(stripes, sizeof(hashtable_stripe_t));
+        if (NULL == hashtable->stripes) {
             goto error;
-        }        
-        
+        }
+        hashtable->nr_stripes = stripes;
+
+        size_t stripe_buckets = nr_buckets / stripes;
+        if (0 == stripe_buckets) {
+            stripe_buckets = 1;
+        }
+
+        for (size_t i = 0; i < stripes; ++i) {
+            hashtable_stripe_t *stripe = &hashtable->stripes[i];
+            stripe->tables[0] = hashtable_table_new(stripe_buckets);
+            if (NULL == stripe->tables[0]) {
+                goto error;
+            }
+
+            stripe->rwlock = rwlock_new();
+            if (NULL == stripe->rwlock) {
+                goto error;
+            }
+        }
     }
 
     return hashtable;
@@ -52,72 +149,211 @@ void
 hashtable_free(hashtable_t *hashtable)
 {
     if (NULL != hashtable) {
-        slist_t *bucket;
-        if (NULL != hashtable->buckets) {
-            for (int i = 0; i < hashtable->nr_buckets; ++i) {
-                void *value = NULL;
-                bucket = &hashtable->buckets[i];
-                while (NULL != (value = slist_pop_front(bucket))) {
-                    if (NULL != hashtable->value_free) {
-                        hashtable->value_free(value);
-                    }
+        if (NULL != hashtable->stripes) {
+            for (size_t i = 0; i < hashtable->nr_stripes; ++i) {
+                hashtable_stripe_t *stripe = &hashtable->stripes[i];
+                for (int t = 0; t < countof(stripe->tables); ++t) {
+                    hashtable_table_free(hashtable, stripe->tables[t]);
+                    stripe->tables[t] = NULL;
                 }
+                rwlock_free(stripe->rwlock);
+                stripe->rwlock = NULL;
             }
-            free(hashtable->buckets);
-            hashtable->buckets = NULL;
+            free(hashtable->stripes);
+            hashtable->stripes = NULL;
         }
-        rwlock_free(hashtable->rwlock);
-        hashtable->rwlock = NULL;
         free(hashtable);
     }
 }
 
-static slist_t *
-_hashtable_get_bucket(hashtable_t *hashtable, const void *key)
+void
+hashtable_set_qsbr(hashtable_t *hashtable, struct qsbr *qsbr)
 {
-    slist_t *bucket = NULL;
+    hashtable->qsbr = qsbr;
+}
 
-    hash_t hash = hashtable->hash(key);
-    hash = hash % hashtable->nr_buckets;
-    bucket = &hashtable->buckets[hash];
+/* low bits select stripe, remaining ones select bucket within stripe */
+static hashtable_stripe_t *
+_hashtable_get_stripe(hashtable_t *hashtable, hash_t hash)
+{
+    return &hashtable->stripes[hash & (hashtable->nr_stripes - 1)];
+}
 
-    return bucket;
+static islink_t **
+_hashtable_get_bucket(hashtable_t *hashtable, hashtable_table_t *table, hash_t hash)
+{
+    hash >>= hashtable->stripe_bits;
+    return &table->buckets[hash % table->nr_buckets];
 }
 
-static snode_t *
-_hashtable_find(hashtable_t *hashtable, slist_t *bucket, const void *key)
+/**
+ * Returns link pointing to value holding key (so that
+ * value can be unlinked), or NULL if not found. Value
+ * itself is returned in found: lock-free readers can't
+ * read it back from link, which might have changed.
+ *
+ * Links are loaded with acquire semantics: chains may be
+ * walked while writers change them.
+ */
+static islink_t **
+_hashtable_find(hashtable_t *hashtable, islink_t **prev, hash_t hash, const void *key, void **found)
 {
-    snode_t *node = NULL;
+    islink_t *link = NULL;
 
-    slist_foreach(bucket, node) {
-        if (0 == hashtable->cmp(node->data, key)) {
+    for (; NULL != (link = atomic_load_acquire(prev)); prev = &link->next) {
+        if (_hashtable_hash(link) == hash) {
+            void *value = _hashtable_value(hashtable, link);
+            if (0 == hashtable->cmp(value, key)) {
+                *found = value;
+                return prev;
+            }
+        }
+    }
+    return NULL;
+}
+
+/**
+ * Looks key up in both tables of stripe.
+ *
+ * Lock-free readers may miss a value being moved to grown
+ * table (its link then leads them to another chain): if
+ * stripe sequence tells values were moved meanwhile, lookup
+ * restarts. Values found are always right ones.
+ */
+static islink_t **
+_hashtable_stripe_find(hashtable_t *hashtable, hashtable_stripe_t *stripe, hash_t hash, const void *key, void **found)
+{
+    islink_t **prev = NULL;
+    hashtable_table_t *table = NULL;
+    unsigned seq = 0;
+
+    do {
+        seq = atomic_load_acquire(&stripe->seq);
+        table = atomic_load_acquire(&stripe->tables[0]);
+        prev = _hashtable_find(hashtable, _hashtable_get_bucket(hashtable, table, hash), hash, key, found);
+        if (NULL == prev && NULL != (table = atomic_load_acquire(&stripe->tables[1]))) {
+            prev = _hashtable_find(hashtable, _hashtable_get_bucket(hashtable, table, hash), hash, key, found);
+        }
+        if (NULL != prev) {
             break;
         }
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    } while ((seq & 1) || seq != __atomic_load_n(&stripe->seq, __ATOMIC_RELAXED));
+
+    return prev;
+}
+
+/* value unlinked might still be in use by lock-free readers */
+static void
+_hashtable_retire(hashtable_t *hashtable, void *ptr)
+{
+    if (NULL != hashtable->qsbr) {
+        qsbr_retire(hashtable->qsbr, ptr, free);
+    }
+    else {
+        free(ptr);
+    }
+}
+
+/**
+ * Moves a few buckets of old table to grown one.
+ * Values are relinked: no allocation takes place.
+ *
+ * Stripe write lock must be held.
+ */
+static void
+_hashtable_rehash_step(hashtable_t *hashtable, hashtable_stripe_t *stripe)
+{
+    hashtable_table_t *old = stripe->tables[0];
+
+    /* seqlock write side: tells lock-free readers to retry misses */
+    __atomic_store_n(&stripe->seq, stripe->seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    for (int step = 0; step < HASHTABLE_REHASH_STEP && NULL != stripe->tables[1]; ++step) {
+        islink_t **bucket = &old->buckets[stripe->rehash_idx];
+        islink_t *link = NULL;
+
+        while (NULL != (link = *bucket)) {
+            islink_t **dst = _hashtable_get_bucket(hashtable, stripe->tables[1], _hashtable_hash(link));
+            atomic_store_release(bucket, link->next);
+            atomic_store_release(&link->next, *dst);
+            atomic_store_release(dst, link);
+        }
+
+        if (++stripe->rehash_idx == old->nr_buckets) {
+            atomic_store_release(&stripe->tables[0], stripe->tables[1]);
+            atomic_store_release(&stripe->tables[1], NULL);
+            stripe->rehash_idx = 0;
+            _hashtable_retire(hashtable, old);
+        }
     }
-    return node;
+
+    atomic_store_release(&stripe->seq, stripe->seq + 1);
+}
+
+/**
+ * Starts growing stripe if it got too loaded.
+ * On allocation failure stripe just keeps its size.
+ *
+ * Stripe write lock must be held.
+ */
+static void
+_hashtable_grow(hashtable_stripe_t *stripe)
+{
+    if (NULL != stripe->tables[1] ||
+        stripe->size <= stripe->tables[0]->nr_buckets * HASHTABLE_MAX_LOAD) {
+        return;
+    }
+    hashtable_table_t *table = hashtable_table_new(stripe->tables[0]->nr_buckets * 2);
+    if (NULL != table) {
+        stripe->rehash_idx = 0;
+        atomic_store_release(&stripe->tables[1], table);
+    }
+}
+
+/**
+ * Links value at head of its bucket in newest table.
+ *
+ * Stripe write lock must be held.
+ */
+static void
+_hashtable_link_value(hashtable_t *hashtable, hashtable_stripe_t *stripe, hashtable_link_t *link)
+{
+    hashtable_table_t *table = stripe->tables[1];
+    islink_t **bucket = _hashtable_get_bucket(hashtable, NULL != table ? table : stripe->tables[0], link->hash);
+
+    if (NULL != *bucket) {
+        stripe->collisions++;
+    }
+    link->link.next = *bucket;
+    atomic_store_release(bucket, &link->link);
+    stripe->size++;
+    _hashtable_grow(stripe);
 }
 
 hashtable_error_t
 hashtable_add(hashtable_t *hashtable, void *value, const void *key)
 {
     hashtable_error_t error = HASHTABLE_E_SUCCESS;
-    slist_t *bucket = _hashtable_get_bucket(hashtable, key);
-    snode_t *node = NULL;
+    hash_t hash = hashtable->hash(key);
+    hashtable_stripe_t *stripe = _hashtable_get_stripe(hashtable, hash);
+    void *found = NULL;
 
-    rwlock_wrlock(hashtable->rwlock);
-    if (NULL != slist_head(bucket)) {
-        hashtable->collisions++;
+    rwlock_wrlock(stripe->rwlock);
+    if (NULL != stripe->tables[1]) {
+        _hashtable_rehash_step(hashtable, stripe);
     }
-    node = _hashtable_find(hashtable, bucket, key);
-    if (NULL == node) {
-        if (NULL == slist_push_front(bucket, value)) {
-            error = HASHTABLE_E_ERROR;
-        }
+    if (NULL == _hashtable_stripe_find(hashtable, stripe, hash, key, &found)) {
+        hashtable_link_t *link = _hashtable_link(hashtable, value);
+        link->hash = hash;
+        _hashtable_link_value(hashtable, stripe, link);
     }
     else {
         error = HASHTABLE_E_FOUND;
     }
-    rwlock_unlock(hashtable->rwlock);
+    rwlock_unlock(stripe->rwlock);
+
     return error;
 }
 
@@ -125,24 +361,118 @@ void *
 hashtable_find(hashtable_t *hashtable, const void *key)
 {
     void *value = NULL;
-    slist_t *bucket = _hashtable_get_bucket(hashtable, key);
-    snode_t *node = NULL;
-
-    rwlock_rdlock(hashtable->rwlock);
-    node = _hashtable_find(hashtable, bucket, key);
-    if (NULL != node) {
-        /* As no node removal takes place for this hashtable
-         * and readers themselves don't change recovered item 
-         * we can return pointer to item just found.
+    hash_t hash = hashtable->hash(key);
+    hashtable_stripe_t *stripe = _hashtable_get_stripe(hashtable, hash);
+
+    if (NULL != hashtable->qsbr) {
+        _hashtable_stripe_find(hashtable, stripe, hash, key, &value);
+        return value;
+    }
+
+    rwlock_rdlock(stripe->rwlock);
+    /* readers themselves don't change recovered item:
+     * it is up to callers not to remove it while in use.
+     */
+    _hashtable_stripe_find(hashtable, stripe, hash, key, &value);
+    rwlock_unlock(stripe->rwlock);
+    return value;
+}
+
+void *
+hashtable_replace(hashtable_t *hashtable, void *value, const void *key)
+{
+    void *old = NULL;
+    hash_t hash = hashtable->hash(key);
+    hashtable_stripe_t *stripe = _hashtable_get_stripe(hashtable, hash);
+    hashtable_link_t *link = _hashtable_link(hashtable, value);
+    islink_t **prev = NULL;
+
+    link->hash = hash;
+
+    rwlock_wrlock(stripe->rwlock);
+    if (NULL != stripe->tables[1]) {
+        _hashtable_rehash_step(hashtable, stripe);
+    }
+    prev = _hashtable_stripe_find(hashtable, stripe, hash, key, &old);
+    if (NULL != prev) {
+        /* readers see either old value or new one: old value
+         * keeps pointing to rest of chain for those still on it
          */
-        value = node->data;
+        link->link.next = _hashtable_link(hashtable, old)->link.next;
+        atomic_store_release(prev, &link->link);
     }
-    rwlock_unlock(hashtable->rwlock);
+    else {
+        _hashtable_link_value(hashtable, stripe, link);
+    }
+    rwlock_unlock(stripe->rwlock);
+
+    return old;
+}
+
+void *
+hashtable_remove(hashtable_t *hashtable, const void *key)
+{
+    void *value = NULL;
+    hash_t hash = hashtable->hash(key);
+    hashtable_stripe_t *stripe = _hashtable_get_stripe(hashtable, hash);
+    islink_t **prev = NULL;
+
+    rwlock_wrlock(stripe->rwlock);
+    if (NULL != stripe->tables[1]) {
+        _hashtable_rehash_step(hashtable, stripe);
+    }
+    prev = _hashtable_stripe_find(hashtable, stripe, hash, key, &value);
+    if (NULL != prev) {
+        /* removed value keeps its next link for lock-free readers on it */
+        atomic_store_release(prev, _hashtable_link(hashtable, value)->link.next);
+        stripe->size--;
+    }
+    rwlock_unlock(stripe->rwlock);
+
     return value;
 }
 
 size_t
 hashtable_get_collisions(hashtable_t *hashtable)
 {
-    return hashtable->collisions;
+    hashtable_stats_t stats;
+    hashtable_get_stats(hashtable, &stats);
+    return stats.collisions;
+}
+
+void
+hashtable_get_stats(hashtable_t *hashtable, hashtable_stats_t *stats)
+{
+    memset(stats, 0, sizeof(*stats));
+    stats->nr_stripes = hashtable->nr_stripes;
+
+    for (size_t i = 0; i < hashtable->nr_stripes; ++i) {
+        hashtable_stripe_t *stripe = &hashtable->stripes[i];
+        rwlock_rdlock(stripe->rwlock);
+        stats->size += stripe->size;
+        stats->collisions += stripe->collisions;
+        stats->rehashing += NULL != stripe->tables[1] ? 1 : 0;
+        for (int t = 0; t < countof(stripe->tables); ++t) {
+            hashtable_table_t *table = stripe->tables[t];
+            if (NULL == table) {
+                continue;
+            }
+            stats->nr_buckets += table->nr_buckets;
+            for (size_t b = 0; b < table->nr_buckets; ++b) {
+                size_t chain = 0;
+                islink_t *link = NULL;
+                for (link = table->buckets[b]; NULL != link; link = link->next) {
+                    chain++;
+                }
+                if (chain > stats->max_chain) {
+                    stats->max_chain = chain;
+                }
+            }
+        }
+        rwlock_unlock(stripe->rwlock);
+    }
+
+    if (0 != stats->nr_buckets) {
+        stats->load_factor = (double)stats->size / stats->nr_buckets;
+    }
 }
@@ -4,9 +4,27 @@
 #include "includes.h"
 
 /* Synchronized chained Hash Table implementation.
- * Collision resolution by separate chaining with linked lists
- * and synchronizing access with rwlock (assuming much more reads
- * than writes would take place).
+ * Collision resolution by separate chaining with linked lists.
+ *
+ * Table is split into lock stripes: each stripe is an independent
+ * sub-table with its own rwlock (assuming much more reads than
+ * writes would take place), so that operations on different
+ * stripes never contend. Stripes grow independently, by
+ * incrementally rehashing a few buckets on every write.
+ *
+ * Hash Table is intrusive: values embed a hashtable_link_t,
+ * so that storing them never allocates.
+ *
+ * With a qsbr domain set, reads take no lock at all: values
+ * replaced or removed must then be retired, not freed right away.
+ * Nor may they be stored again (in this or any other table)
+ * before being reclaimed: readers still on them follow their
+ * link, which would then lead into another chain. A key removed
+ * and added again, with another value, within a grace period is
+ * fine: readers find either no value, the removed one (valid
+ * until their next quiescent state) or the new one.
+ *
+ * Resolver keeps pinned names in such a table (@see resolver_pin).
  */
 
 typedef uint32_t hash_t;
@@ -17,6 +35,20 @@ typedef void (*hashtable_free_t)(void *value);
 
 typedef struct hashtable hashtable_t;
 
+typedef struct hashtable_link hashtable_link_t;
+
+/**
+ * Chain link embedded in values. Hash is kept so that
+ * values can be moved to a grown table (and mismatches
+ * skipped) without ever hashing them again.
+ */
+struct hashtable_link {
+    islink_t link;
+    hash_t hash;
+};
+
+struct qsbr;
+
 typedef enum hashtable_error hashtable_error_t;
 
 enum hashtable_error {
@@ -25,16 +57,50 @@ enum hashtable_error {
     ,HASHTABLE_E_ERROR   /**< operation was unsuccessfull */
 };
 
+typedef struct hashtable_stats hashtable_stats_t;
+
+struct hashtable_stats {
+    size_t size;        /**< # values stored */
+    size_t nr_buckets;  /**< # buckets over all stripes */
+    size_t nr_stripes;
+    size_t collisions;  /**< # values added to non-empty buckets */
+    size_t max_chain;   /**< longest bucket chain */
+    size_t rehashing;   /**< # stripes being rehashed */
+    double load_factor; /**< size / nr_buckets */
+};
+
+/**
+ * @param cmp
+ * @param hash
+ * @param value_free called on values still stored when table is freed
+ * @param link_offset offset of hashtable_link_t within values
+ *        (e.g. offsetof(item_t, link))
+ * @param nr_buckets initial # buckets, table grows as needed
+ * @param nr_stripes # locks (rounded up to power of 2), 1 makes
+ *        every operation serialize on a single table lock
+ */
 hashtable_t *
-hashtable_new(hashtable_cmp_t cmp, hashtable_hash_t hash, hashtable_free_t value_free, size_t nr_buckets);
+hashtable_new(hashtable_cmp_t cmp, hashtable_hash_t hash, hashtable_free_t value_free, size_t link_offset, size_t nr_buckets, size_t nr_stripes);
 
 void
 hashtable_free(hashtable_t *table);
 
+/**
+ * Makes hashtable_find lock-free: readers must be registered
+ * to qsbr, and values they find remain valid until their next
+ * quiescent state. Tables replaced by growth are retired.
+ *
+ * Should be called before hashtable is shared.
+ */
+void
+hashtable_set_qsbr(hashtable_t *hashtable, struct qsbr *qsbr);
+
 /**
  * Tries to add value to the hashtable.
  *
- * Element is not added if it already exists.
+ * Element is not added if it already exists. Value link
+ * is used for chaining: value should not be in any other
+ * hashtable at the same time.
  *
  * @param hashtable
  * @param value 
@@ -52,14 +118,39 @@ hashtable_add(hashtable_t *hashtable, void *value, const void *key);
  *
  * If value is not found, NULL is returned.
  *
- * Pointer to value internally is stored is returned under
- * the assumption that this hash table does not allow
- * removals.
+ * Pointer to value internally stored is returned: it remains
+ * valid as long as nobody removes it from the hashtable (with a
+ * qsbr domain set, until calling thread next quiescent state).
  */
 void *
 hashtable_find(hashtable_t *hashtable, const void *key);
 
+/**
+ * Removes value corresponding to informed key.
+ *
+ * Removed value is not freed: ownership goes back to caller
+ * (with a qsbr domain set, it should be retired with qsbr_retire
+ * and not be stored again until reclaimed).
+ *
+ * @return value removed, NULL if not found.
+ */
+void *
+hashtable_remove(hashtable_t *hashtable, const void *key);
+
+/**
+ * Stores value, replacing the one corresponding to informed
+ * key, if any. Lock-free readers see either of them.
+ *
+ * @return replaced value (ownership goes back to caller, as
+ *         with hashtable_remove), NULL if value was just added
+ */
+void *
+hashtable_replace(hashtable_t *hashtable, void *value, const void *key);
+
 size_t
 hashtable_get_collisions(hashtable_t *hashtable);
 
+void
+hashtable_get_stats(hashtable_t *hashtable, hashtable_stats_t *stats);
+
 #endif /* _TIGERA_HASHTABLE__H__ */
@@ -0,0 +1,349 @@
+#include "includes.h"
+#include "thread.h"
+#include "hashtable.h"
+#include "qsbr.h"
+#include "atomic.h"
+#include <time.h>
+#include <assert.h>
+
+#define NR_KEYS     (64*1024)
+#define NR_THREADS  8
+#define NR_OPS      (256*1024) /**< per thread */
+#define WRITE_PCT   10 /**< half adds, half removes */
+
+typedef struct item item_t;
+
+struct item {
+    uint32_t key;
+    hashtable_link_t link;
+};
+
+static item_t items[NR_KEYS];
+
+static int
+item_cmp(const void *value, const void *key)
+{
+    const item_t *item = value;
+    return item->key != *(const uint32_t *)key;
+}
+
+static hash_t
+item_hash(const void *key)
+{
+    /* murmur3 finalizer */
+    uint32_t h = *(const uint32_t *)key;
+    h ^= h >> 16;
+    h *= 0x85ebca6b;
+    h ^= h >> 13;
+    h *= 0xc2b2ae35;
+    h ^= h >> 16;
+    return h;
+}
+
+static item_t *
+item_new(uint32_t key)
+{
+    item_t *item = calloc(1, sizeof(item_t));
+    assert(NULL != item);
+    item->key = key;
+    return item;
+}
+
+static void
+item_free(void *value)
+{
+    item_t *item = value;
+    /* readers still using it would notice */
+    item->key = ~0u;
+    free(item);
+}
+
+typedef struct bench_arg bench_arg_t;
+
+struct bench_arg {
+    hashtable_t *hashtable;
+    qsbr_t *qsbr;
+    uint32_t seed;
+    islist_t removed;
+};
+
+static uint32_t
+xorshift(uint32_t *state)
+{
+    uint32_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    return *state = x;
+}
+
+static void
+bench_run(void *arg)
+{
+    bench_arg_t *bench_arg = arg;
+    hashtable_t *hashtable = bench_arg->hashtable;
+    uint32_t state = bench_arg->seed;
+
+    if (NULL != bench_arg->qsbr) {
+        assert(0 == qsbr_register(bench_arg->qsbr));
+    }
+
+    for (int i = 0; i < NR_OPS; ++i) {
+        uint32_t r = xorshift(&state);
+        uint32_t key = r % NR_KEYS;
+        uint32_t op = (r >> 16) % 100;
+        if (op < WRITE_PCT / 2) {
+            item_t *item = item_new(key);
+            if (HASHTABLE_E_SUCCESS != hashtable_add(hashtable, item, &key)) {
+                item_free(item);
+            }
+        }
+        else if (op < WRITE_PCT) {
+            item_t *item = hashtable_remove(hashtable, &key);
+            if (NULL != item && NULL != bench_arg->qsbr) {
+                qsbr_retire(bench_arg->qsbr, item, item_free);
+            }
+            else if (NULL != item) {
+                /* other readers might still use it: freed once all are done */
+                islist_push_front(&bench_arg->removed, &item->link.link);
+            }
+        }
+        else {
+            item_t *item = hashtable_find(hashtable, &key);
+            assert(NULL == item || item->key == key);
+        }
+        if (NULL != bench_arg->qsbr && 0 == i % 64) {
+            qsbr_quiescent(bench_arg->qsbr);
+        }
+    }
+
+    if (NULL != bench_arg->qsbr) {
+        qsbr_unregister(bench_arg->qsbr);
+    }
+}
+
+static void
+bench_removed_free(bench_arg_t *bench_arg)
+{
+    islink_t *link = NULL;
+    while (NULL != (link = islist_pop_front(&bench_arg->removed))) {
+        item_free(downcast(link, item_t, link.link));
+    }
+}
+
+static double
+now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* compares single table lock (former design) against lock
+ * stripes, and locked reads against lock-free ones
+ */
+static void
+bench(size_t nr_stripes, bool lockfree)
+{
+    thread_t *threads[NR_THREADS];
+    bench_arg_t args[NR_THREADS];
+    hashtable_stats_t stats;
+    qsbr_t *qsbr = NULL;
+    hashtable_t *hashtable = hashtable_new(item_cmp, item_hash, item_free, offsetof(item_t, link), 64, nr_stripes);
+    assert(NULL != hashtable);
+
+    if (lockfree) {
+        qsbr = qsbr_new();
+        assert(NULL != qsbr);
+        hashtable_set_qsbr(hashtable, qsbr);
+    }
+
+    /* half full to begin with */
+    for (uint32_t key = 0; key < NR_KEYS; key += 2) {
+        assert(HASHTABLE_E_SUCCESS == hashtable_add(hashtable, item_new(key), &key));
+    }
+
+    double start = now();
+    for (int i = 0; i < NR_THREADS; ++i) {
+        args[i].hashtable = hashtable;
+        args[i].qsbr = qsbr;
+        args[i].seed = 2463534242u + i;
+        islist_init(&args[i].removed);
+        threads[i] = thread_new(bench_run);
+        thread_start(threads[i], &args[i]);
+    }
+    for (int i = 0; i < NR_THREADS; ++i) {
+        thread_join(threads[i]);
+        thread_free(threads[i]);
+    }
+    double elapsed = now() - start;
+
+    for (int i = 0; i < NR_THREADS; ++i) {
+        bench_removed_free(&args[i]);
+    }
+
+    hashtable_get_stats(hashtable, &stats);
+    printf("%3zu stripe(s)%s: %6.2f Mops/s, %zu values, %zu buckets, load %.2f, max chain %zu, %zu collisions\n",
+           stats.nr_stripes, lockfree ? ", lock-free reads" : "", NR_THREADS * NR_OPS / elapsed / 1e6, stats.size, stats.nr_buckets,
+           stats.load_factor, stats.max_chain, stats.collisions);
+
+    hashtable_free(hashtable);
+    qsbr_free(qsbr);
+}
+
+#define NR_READERS  4
+#define NR_WRITES   (64*1024)
+#define LF_KEYS     256
+
+typedef struct lockfree_arg lockfree_arg_t;
+
+struct lockfree_arg {
+    hashtable_t *hashtable;
+    qsbr_t *qsbr;
+    bool *done;
+    size_t lookups;
+};
+
+static void
+lockfree_read(void *arg)
+{
+    lockfree_arg_t *lockfree_arg = arg;
+    uint32_t state = 88172645u;
+
+    assert(0 == qsbr_register(lockfree_arg->qsbr));
+    while (!atomic_load_acquire(lockfree_arg->done)) {
+        for (int i = 0; i < 64; ++i) {
+            uint32_t key = xorshift(&state) % LF_KEYS;
+            item_t *item = hashtable_find(lockfree_arg->hashtable, &key);
+            assert(NULL == item || item->key == key);
+            lockfree_arg->lookups++;
+        }
+        /* as workers do in between event loop iterations */
+        qsbr_quiescent(lockfree_arg->qsbr);
+    }
+    qsbr_unregister(lockfree_arg->qsbr);
+}
+
+static void
+lockfree_write(void *arg)
+{
+    lockfree_arg_t *lockfree_arg = arg;
+    uint32_t state = 2463534242u;
+
+    assert(0 == qsbr_register(lockfree_arg->qsbr));
+    for (int i = 0; i < NR_WRITES; ++i) {
+        uint32_t key = xorshift(&state) % LF_KEYS;
+        item_t *old = NULL;
+        if (i % 4) {
+            item_t *item = malloc(sizeof(item_t));
+            assert(NULL != item);
+            item->key = key;
+            old = hashtable_replace(lockfree_arg->hashtable, item, &key);
+        }
+        else {
+            old = hashtable_remove(lockfree_arg->hashtable, &key);
+        }
+        if (NULL != old) {
+            qsbr_retire(lockfree_arg->qsbr, old, item_free);
+        }
+        if (0 == i % 64) {
+            qsbr_quiescent(lockfree_arg->qsbr);
+        }
+    }
+    qsbr_unregister(lockfree_arg->qsbr);
+}
+
+/* readers never see a value freed by concurrent writer */
+static void
+test_lockfree(void)
+{
+    thread_t *readers[NR_READERS];
+    thread_t *writer = NULL;
+    lockfree_arg_t args[NR_READERS + 1];
+    bool done = false;
+    size_t lookups = 0;
+    qsbr_t *qsbr = qsbr_new();
+    hashtable_t *hashtable = hashtable_new(item_cmp, item_hash, item_free, offsetof(item_t, link), 1, 4);
+    assert(NULL != qsbr && NULL != hashtable);
+    hashtable_set_qsbr(hashtable, qsbr);
+
+    for (int i = 0; i <= NR_READERS; ++i) {
+        args[i].hashtable = hashtable;
+        args[i].qsbr = qsbr;
+        args[i].done = &done;
+        args[i].lookups = 0;
+    }
+    for (int i = 0; i < NR_READERS; ++i) {
+        readers[i] = thread_new(lockfree_read);
+        assert(0 == thread_start(readers[i], &args[i]));
+    }
+    writer = thread_new(lockfree_write);
+    assert(0 == thread_start(writer, &args[NR_READERS]));
+
+    thread_join(writer);
+    thread_free(writer);
+    atomic_store_release(&done, true);
+    for (int i = 0; i < NR_READERS; ++i) {
+        thread_join(readers[i]);
+        thread_free(readers[i]);
+        lookups += args[i].lookups;
+    }
+    printf("lock-free: %d writes, %zu concurrent lookups\n", NR_WRITES, lookups);
+
+    hashtable_free(hashtable);
+    qsbr_free(qsbr);
+}
+
+static void
+test(void)
+{
+    hashtable_stats_t stats;
+    hashtable_t *hashtable = hashtable_new(item_cmp, item_hash, NULL, offsetof(item_t, link), 1, 4);
+    assert(NULL != hashtable);
+
+    for (uint32_t key = 0; key < NR_KEYS; ++key) {
+        assert(HASHTABLE_E_SUCCESS == hashtable_add(hashtable, &items[key], &key));
+        assert(HASHTABLE_E_FOUND == hashtable_add(hashtable, &items[key], &key));
+    }
+
+    /* grew while being filled */
+    hashtable_get_stats(hashtable, &stats);
+    assert(NR_KEYS == stats.size);
+    assert(stats.load_factor <= 2.0);
+
+    for (uint32_t key = 0; key < NR_KEYS; ++key) {
+        assert(&items[key] == hashtable_find(hashtable, &key));
+    }
+
+    for (uint32_t key = 0; key < NR_KEYS; key += 2) {
+        assert(&items[key] == hashtable_remove(hashtable, &key));
+        assert(NULL == hashtable_remove(hashtable, &key));
+    }
+
+    for (uint32_t key = 0; key < NR_KEYS; ++key) {
+        item_t *item = hashtable_find(hashtable, &key);
+        assert((key % 2) ? (item == &items[key]) : (item == NULL));
+    }
+
+    hashtable_get_stats(hashtable, &stats);
+    assert(NR_KEYS / 2 == stats.size);
+
+    hashtable_free(hashtable);
+}
+
+int
+main(int argc, char **argv)
+{
+    for (uint32_t key = 0; key < NR_KEYS; ++key) {
+        items[key].key = key;
+    }
+
+    test();
+    test_lockfree();
+
+    bench(1, false);
+    bench(64, false);
+    bench(64, true);
+
+    return 0;
+}
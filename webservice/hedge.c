@@ -0,0 +1,69 @@
+#include "includes.h"
+#include "hedge.h"
+
+static int
+hedge_latency_cmp(const void *a, const void *b)
+{
+    uint32_t x = *(const uint32_t *)a;
+    uint32_t y = *(const uint32_t *)b;
+    return (x > y) - (x < y);
+}
+
+/* percentile over window: recomputed every quarter window only */
+static void
+hedge_adapt(hedge_t *hedge)
+{
+    uint32_t sorted[HEDGE_WINDOW];
+    size_t n = (hedge->nlatencies < HEDGE_WINDOW) ? hedge->nlatencies : HEDGE_WINDOW;
+
+    memcpy(sorted, hedge->latencies, n * sizeof(uint32_t));
+    qsort(sorted, n, sizeof(uint32_t), hedge_latency_cmp);
+
+    /* rounded up: never hedges sooner than percentile */
+    hedge->adaptive_ms = (sorted[(n * HEDGE_PERCENTILE - 1) / 100] + 999) / 1000;
+    if (0 == hedge->adaptive_ms) {
+        hedge->adaptive_ms = 1;
+    }
+}
+
+void
+hedge_init(hedge_t *hedge, unsigned delay_ms, unsigned budget_pct)
+{
+    memset(hedge, 0, sizeof(*hedge));
+    hedge->delay_ms = delay_ms;
+    hedge->budget_pct = budget_pct;
+}
+
+unsigned
+hedge_request(hedge_t *hedge)
+{
+    hedge->requests++;
+    hedge->credits += hedge->budget_pct;
+    if (hedge->credits > HEDGE_BURST * 100) {
+        hedge->credits = HEDGE_BURST * 100;
+    }
+    return (0 != hedge->delay_ms) ? hedge->delay_ms : hedge->adaptive_ms;
+}
+
+bool
+hedge_allow(hedge_t *hedge)
+{
+    if (hedge->credits < 100) {
+        return false;
+    }
+    hedge->credits -= 100;
+    hedge->hedged++;
+    return true;
+}
+
+void
+hedge_latency(hedge_t *hedge, unsigned latency_us)
+{
+    hedge->latencies[hedge->nlatencies % HEDGE_WINDOW] = latency_us;
+    hedge->nlatencies++;
+
+    if (hedge->nlatencies >= HEDGE_MIN_SAMPLES &&
+        0 == hedge->nlatencies % (HEDGE_WINDOW / 4)) {
+        hedge_adapt(hedge);
+    }
+}
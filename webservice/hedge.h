@@ -0,0 +1,66 @@
+#ifndef _TIGERA_HEDGE__H__
+#define _TIGERA_HEDGE__H__
+
+#include "includes.h"
+
+/* Hedging of requests to an upstream server: once a reply is
+ * late, the same request is sent again (elsewhere) and first
+ * reply wins.
+ *
+ * Late means later than a fixed delay or, adaptively, than the
+ * HEDGE_PERCENTILE of latencies of last HEDGE_WINDOW requests.
+ * Hedged requests are capped to a budget percentage of requests
+ * (with a burst of HEDGE_BURST), so that a struggling upstream
+ * server never gets twice as much load.
+ *
+ * Not synchronized: meant for hedges owned by a single worker.
+ */
+
+#define HEDGE_WINDOW      64 /**< # last latencies adaptive delay is computed over */
+#define HEDGE_MIN_SAMPLES 16 /**< # latencies before adaptive delay applies */
+#define HEDGE_PERCENTILE  95
+#define HEDGE_BURST       10 /**< # hedged requests budget may save up */
+
+typedef struct hedge hedge_t;
+
+struct hedge {
+    unsigned delay_ms;   /**< fixed delay, 0 for adaptive one */
+    unsigned budget_pct; /**< hedged requests per 100 requests */
+    unsigned credits;    /**< hundredths of hedged requests that may be sent */
+    uint32_t latencies[HEDGE_WINDOW]; /**< microseconds, ring */
+    size_t nlatencies;   /**< # latencies ever recorded */
+    unsigned adaptive_ms; /**< percentile of latencies, 0 until known */
+    size_t requests;     /**< # requests */
+    size_t hedged;       /**< # hedged requests sent */
+    size_t won;          /**< # hedged requests replied first */
+};
+
+/**
+ * @param delay_ms how late replies get hedged, 0 for adaptive delay
+ * @param budget_pct hedged requests per 100 requests
+ */
+void
+hedge_init(hedge_t *hedge, unsigned delay_ms, unsigned budget_pct);
+
+/**
+ * Accounts for request being sent, earning budget.
+ *
+ * @return milliseconds to wait for its reply before hedging
+ *         it, 0 not to hedge it (adaptive delay unknown yet)
+ */
+unsigned
+hedge_request(hedge_t *hedge);
+
+/**
+ * Whether late request may be hedged, spending budget.
+ */
+bool
+hedge_allow(hedge_t *hedge);
+
+/**
+ * Records how long request took.
+ */
+void
+hedge_latency(hedge_t *hedge, unsigned latency_us);
+
+#endif /* _TIGERA_HEDGE__H__ */
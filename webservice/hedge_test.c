@@ -0,0 +1,70 @@
+#include "includes.h"
+#include "hedge.h"
+#include <assert.h>
+
+/* fixed delay, budget caps hedged requests */
+static void
+test_budget(void)
+{
+    hedge_t hedge;
+    size_t hedged = 0;
+    hedge_init(&hedge, 20, 5);
+
+    for (int i = 0; i < 1000; ++i) {
+        assert(20 == hedge_request(&hedge));
+        /* every request is late */
+        if (hedge_allow(&hedge)) {
+            hedged++;
+        }
+    }
+    assert(50 == hedged);
+    assert(hedged == hedge.hedged);
+
+    /* budget saved up while nothing is late is capped */
+    for (int i = 0; i < 1000; ++i) {
+        hedge_request(&hedge);
+    }
+    hedged = 0;
+    while (hedge_allow(&hedge)) {
+        hedged++;
+    }
+    assert(HEDGE_BURST == hedged);
+}
+
+/* adaptive delay follows latency percentile */
+static void
+test_adaptive(void)
+{
+    hedge_t hedge;
+    hedge_init(&hedge, 0, 10);
+
+    /* unknown yet: not hedged */
+    for (int i = 0; i < HEDGE_MIN_SAMPLES - 1; ++i) {
+        assert(0 == hedge_request(&hedge));
+        hedge_latency(&hedge, 1000);
+    }
+    assert(0 == hedge_request(&hedge));
+    hedge_latency(&hedge, 1000);
+    assert(1 == hedge_request(&hedge));
+
+    /* 1 in 20 requests takes 50ms, others 1ms to 10ms */
+    for (int i = 0; i < 10 * HEDGE_WINDOW; ++i) {
+        hedge_latency(&hedge, (0 == i % 20) ? 50000 : 1000 * (1 + i % 10));
+    }
+    unsigned delay = hedge_request(&hedge);
+    assert(delay >= 10 && delay <= 50);
+
+    /* upstream slows down */
+    for (int i = 0; i < HEDGE_WINDOW; ++i) {
+        hedge_latency(&hedge, 200000);
+    }
+    assert(200 == hedge_request(&hedge));
+}
+
+int
+main(int argc, char **argv)
+{
+    test_budget();
+    test_adaptive();
+    return 0;
+}
@@ -4,8 +4,65 @@
 #include "io_service.h"
 #include "tcp_socket.h"
 #include "session.h"
+#include "http_session.h"
 #include "http_service.h"
-#include "mutex.h"
+#include "thread.h"
+#include "atomic.h"
+#include "handover.h"
+#include "compute.h"
+#include "trace.h"
+#include "cache.h"
+#include "breaker.h"
+#include "hedge.h"
+#include "balancer.h"
+#include "resolver.h"
+#include "backpressure.h"
+#include "memacct.h"
+#include "pool.h"
+#include <limits.h>
+
+/* connections are refused while worker is over its limits and
+ * admitted again only after load drops below this percentage
+ * of them, so that admission does not flap around the limit.
+ */
+#define HTTP_SERVICE_ADMISSION_RESUME_PCT  90
+
+#define HTTP_SERVICE_DRAIN_TIMEOUT  30 /**< default drain deadline in seconds */
+#define HTTP_SERVICE_TRACE_THRESHOLD 1000 /**< default slow session threshold in milliseconds */
+#define HTTP_SERVICE_TRACE_RING      64   /**< # slow session traces kept per worker */
+#define HTTP_SERVICE_CACHE_SIZE      256  /**< # upstream replies cached per worker */
+#define HTTP_SERVICE_UPSTREAMS       4    /**< # upstream servers breakers, hedges and balancers are kept for */
+#define HTTP_SERVICE_PIN_REFRESH     60000 /**< default pinned addresses refresh period in milliseconds */
+#define HTTP_SERVICE_DNS_NEGATIVE_TTL 2000  /**< default dns failures ttl in milliseconds */
+
+typedef struct http_worker http_worker_t;
+
+/**
+ * Per worker service context. Only ever
+ * touched by its own worker thread.
+ */
+struct http_worker {
+    io_channel_t *listener;
+    int inherited_fd; /**< listening socket handed over by previous process, or -1 */
+    ilist_t sessions; /**< sessions being processed by this worker */
+    ilist_t parked; /**< connections client sent nothing on yet, without any session */
+    trace_ring_t *traces; /**< slow sessions, read by main thread on SIGUSR1 */
+    cache_t *cache; /**< parsed upstream replies, NULL if disabled */
+    resolver_cache_t *dns_cache; /**< upstream domain name answers, NULL if disabled */
+    breaker_t breakers[HTTP_SERVICE_UPSTREAMS]; /**< one per upstream server */
+    hedge_t hedges[HTTP_SERVICE_UPSTREAMS]; /**< one per upstream server */
+    balancer_t balancers[HTTP_SERVICE_UPSTREAMS]; /**< one per upstream server */
+    backpressure_t backpressure; /**< budget of bytes buffered by connections */
+    pool_t session_pool; /**< sessions freed, for reuse */
+    pool_t http_session_pool; /**< http sessions freed, for reuse */
+    size_t nsessions; /**< # sessions in flight */
+    size_t nparked; /**< # parked connections */
+    size_t upstream_requests; /**< # outstanding requests to upstream servers */
+    size_t rejected; /**< # connections refused with 503 */
+    bool shedding; /**< whether new connections are being refused */
+    bool draining; /**< whether listener is closed and worker waits for sessions */
+    bool drained; /**< whether all sessions were processed after draining started */
+};
 
 typedef struct http_service http_service_t;
 
@@ -15,58 +72,355 @@ struct http_service {
     struct event_base *ebase;
     struct event *ev_sigterm;
     struct event *ev_sigint;
+    struct event *ev_drain_deadline;
+    struct event *ev_sigusr2;
+    struct event *ev_sigusr1;
+    struct event *ev_handover; /**< waits for upgraded process acknowledgment */
+    pid_t upgrade_pid; /**< upgraded process, while waiting for its acknowledgment */
     const char *resolver;
     worker_t **workers;
-    io_channel_t **listeners;
-    list_t *sessions;
-    mutex_t *session_mutex;
+    http_worker_t *http_workers;
+    atomic_t drained_workers; /**< # workers done draining */
+    atomic_t listening_workers; /**< # workers accepting connections */
+    bool inherited; /**< whether listeners were handed over by previous process */
+    char **argv; /**< to re-execute on upgrade, NULL disables upgrade */
+    char path[PATH_MAX]; /**< of binary re-executed, empty if it could not be resolved */
+    bool draining;
+    bool stopped;
+    unsigned drain_timeout; /**< seconds, 0 means stop without draining */
+    bool cpu_affinity; /**< pin workers to available cpus */
+    size_t max_sessions; /**< per worker, 0 means unlimited */
+    size_t max_upstream_requests; /**< per worker, 0 means unlimited */
+    unsigned trace_threshold; /**< milliseconds */
+    unsigned cache_ttl; /**< milliseconds, 0 disables cache */
+    unsigned cache_stale; /**< milliseconds */
+    unsigned breaker_open; /**< milliseconds, 0 disables breakers */
+    unsigned breaker_slow; /**< milliseconds */
+    unsigned hedge_delay; /**< milliseconds, 0 for adaptive delay */
+    unsigned hedge_budget; /**< percentage of upstream requests, 0 disables hedging */
+    int compute_threads; /**< 0 means no compute pool */
+    compute_pool_t *compute;
+    bool shared_resolver; /**< workers resolve on a single thread */
+    unsigned dns_ttl; /**< milliseconds, 0 does not keep dns answers */
+    unsigned dns_negative_ttl; /**< milliseconds, 0 does not keep dns failures */
+    const char *pin_hosts; /**< hosts-style file of pinned upstream addresses, or NULL */
+    char *const *pins; /**< "name=address" pinned upstream addresses */
+    int npins;
+    unsigned pin_refresh; /**< milliseconds, 0 never re-resolves pinned names */
+    uint16_t upstream_port; /**< 0 keeps upstream servers' own */
+    resolver_t *dns;
+    size_t buffer_budget; /**< bytes per worker, 0 means unlimited */
+    size_t memory_budget; /**< bytes per worker, 0 means unlimited */
+};
+
+static http_service_t http_service = {
+    .cpu_affinity = true,
+    .drain_timeout = HTTP_SERVICE_DRAIN_TIMEOUT,
+    .trace_threshold = HTTP_SERVICE_TRACE_THRESHOLD,
+    .breaker_open = BREAKER_OPEN_MS,
+    .breaker_slow = BREAKER_SLOW_MS,
+    .pin_refresh = HTTP_SERVICE_PIN_REFRESH,
+    .dns_negative_ttl = HTTP_SERVICE_DNS_NEGATIVE_TTL,
+    .buffer_budget = BACKPRESSURE_BUDGET
 };
 
-static http_service_t http_service;
+static void
+http_service_stop(void);
 
 static void
 http_service_stop_request(evutil_socket_t fd, short events, void *arg);
 
 static void
+http_service_drain_request(evutil_socket_t fd, short events, void *arg);
+
+static void
+http_service_drain_check(http_worker_t *http_worker);
+
+static void
+http_service_upgrade_request(evutil_socket_t fd, short events, void *arg);
+
+static void
+http_service_profile_request(evutil_socket_t fd, short events, void *arg);
+
+static const char HTTP_SERVICE_UNAVAILABLE[] =
+    "HTTP/1.0 503 Service Unavailable\r\n"
+    "Content-Type: text/plain\r\n"
+    "Content-Length: 0\r\n"
+    "Retry-After: 1\r\n"
+    "Connection: close\r\n"
+    "Server: Tigera/WebServer/1.0.0\r\n"
+    "\r\n";
+
+static bool
+http_service_over_limit(size_t count, size_t limit, bool shedding)
+{
+    if (0 == limit) {
+        return false;
+    }
+    if (shedding) {
+        return count > limit * HTTP_SERVICE_ADMISSION_RESUME_PCT / 100;
+    }
+    return count >= limit;
+}
+
+/**
+ * Decides whether worker can take one more connection,
+ * with hysteresis between shedding and admitting states.
+ * Parked connections count as sessions: each one becomes
+ * a session as soon as its client sends something.
+ */
+static bool
+http_service_admit(http_worker_t *http_worker)
+{
+    memacct_t *memacct = this_memacct();
+    bool shedding = http_worker->shedding;
+    bool over =
+        http_service_over_limit(http_worker->nsessions + http_worker->nparked,
+                                http_service.max_sessions,
+                                shedding) ||
+        http_service_over_limit(http_worker->upstream_requests,
+                                http_service.max_upstream_requests,
+                                shedding) ||
+        http_service_over_limit(memacct->total,
+                                memacct->budget,
+                                shedding);
+
+    if (over != shedding) {
+        fprintf(stderr, "%s: %s shedding load: %zu sessions, %zu parked, %zu upstream requests, %zu bytes held, %zu rejected\n",
+                __func__, over ? "start" : "stop",
+                http_worker->nsessions, http_worker->nparked, http_worker->upstream_requests, memacct->total, http_worker->rejected);
+        http_worker->shedding = over;
+    }
+    return !over;
+}
+
+/**
+ * Sessions are only ever touched by worker thread
+ * that accepted them, so worker lists need no locking.
+ */
+void
 http_service_session_add(session_t *session)
 {
-	mutex_lock(http_service.session_mutex);
-	list_push_back(http_service.sessions, session);
-	mutex_unlock(http_service.session_mutex);
+    http_worker_t *http_worker = this_worker_ctx();
+
+    if (NULL != http_worker) {
+        http_worker->nsessions++;
+        ilist_push_back(&http_worker->sessions, session_link(session));
+    }
 }
 
 void
 http_service_session_remove(session_t *session)
 {
-    bool found = false;
-    node_t *node = NULL;
-	mutex_lock(http_service.session_mutex);
-    list_foreach(http_service.sessions, node) {
-        if ((node)->data == session) {
-            list_remove(http_service.sessions, node);
-            session_free(session);
-            found = true;
-            break;
-        }
-    } 
-	mutex_unlock(http_service.session_mutex);
-    if (!found) {
-        session_free(session);
+    http_worker_t *http_worker = this_worker_ctx();
+
+    if (NULL != http_worker && ilink_linked(session_link(session))) {
+        ilist_remove(&http_worker->sessions, session_link(session));
+        http_worker->nsessions--;
+    }
+    session_free(session);
+
+    if (NULL != http_worker) {
+        http_service_drain_check(http_worker);
+    }
+}
+
+void
+http_service_upstream_request_add(void)
+{
+    http_worker_t *http_worker = this_worker_ctx();
+    if (NULL != http_worker) {
+        http_worker->upstream_requests++;
+    }
+}
+
+void
+http_service_upstream_request_remove(void)
+{
+    http_worker_t *http_worker = this_worker_ctx();
+    if (NULL != http_worker) {
+        http_worker->upstream_requests--;
+    }
+}
+
+void
+http_service_session_traced(const trace_t *trace)
+{
+    http_worker_t *http_worker = this_worker_ctx();
+
+    if (NULL != http_worker && NULL != http_worker->traces &&
+        trace->duration_us >= http_service.trace_threshold * 1000ULL) {
+        trace_t slow = *trace;
+        /* only slow sessions pay for a clock read */
+        struct timeval now, duration = { slow.duration_us / 1000000, slow.duration_us % 1000000 };
+        gettimeofday(&now, NULL);
+        timersub(&now, &duration, &slow.when);
+        trace_ring_put(http_worker->traces, &slow);
     }
 }
 
+cache_t *
+http_service_cache(void)
+{
+    http_worker_t *http_worker = this_worker_ctx();
+    return (NULL != http_worker) ? http_worker->cache : NULL;
+}
+
+breaker_t *
+http_service_breaker(int upstream)
+{
+    http_worker_t *http_worker = this_worker_ctx();
+
+    if (NULL == http_worker || 0 == http_service.breaker_open ||
+        upstream < 0 || upstream >= HTTP_SERVICE_UPSTREAMS) {
+        return NULL;
+    }
+    return &http_worker->breakers[upstream];
+}
+
+hedge_t *
+http_service_hedge(int upstream)
+{
+    http_worker_t *http_worker = this_worker_ctx();
+
+    if (NULL == http_worker || 0 == http_service.hedge_budget ||
+        upstream < 0 || upstream >= HTTP_SERVICE_UPSTREAMS) {
+        return NULL;
+    }
+    return &http_worker->hedges[upstream];
+}
+
+backpressure_t *
+http_service_backpressure(void)
+{
+    http_worker_t *http_worker = this_worker_ctx();
+    return (NULL != http_worker) ? &http_worker->backpressure : NULL;
+}
+
+pool_t *
+http_service_session_pool(void)
+{
+    http_worker_t *http_worker = this_worker_ctx();
+    return (NULL != http_worker) ? &http_worker->session_pool : NULL;
+}
+
+pool_t *
+http_service_http_session_pool(void)
+{
+    http_worker_t *http_worker = this_worker_ctx();
+    return (NULL != http_worker) ? &http_worker->http_session_pool : NULL;
+}
+
+balancer_t *
+http_service_balancer(int upstream)
+{
+    http_worker_t *http_worker = this_worker_ctx();
+
+    if (NULL == http_worker || upstream < 0 || upstream >= HTTP_SERVICE_UPSTREAMS) {
+        return NULL;
+    }
+    return &http_worker->balancers[upstream];
+}
+
+int
+http_service_resolve(const char *name, resolver_cb_t cb, void *arg)
+{
+    http_worker_t *http_worker = this_worker_ctx();
+
+    if (NULL == http_worker || NULL == http_service.dns) {
+        return -1;
+    }
+    return resolver_resolve(http_service.dns, http_worker->dns_cache, name, cb, arg);
+}
+
+void
+http_service_offload(compute_task_t *task)
+{
+    compute_submit(http_service.compute, task);
+}
+
+static void
+http_service_session_start(io_channel_t *channel)
+{
+    session_t *session = session_new(channel);
+    if (NULL == session) {
+        channel_free(channel);
+        return;
+    }
+    http_service_session_add(session);
+}
+
+static void
+http_service_unpark(io_channel_t *channel)
+{
+    http_worker_t *http_worker = channel->ctx;
+
+    ilist_remove(&http_worker->parked, &channel->link);
+    http_worker->nparked--;
+    channel->service = NULL;
+    channel->ctx = NULL;
+}
+
+/* client sent something on parked connection */
+static void
+http_service_parked_read_cb(io_channel_t *channel)
+{
+    http_service_unpark(channel);
+    http_service_session_start(channel);
+}
+
+static void
+http_service_parked_event_cb(io_channel_t *channel, io_channel_event_t events)
+{
+    http_service_unpark(channel);
+    channel_free(channel);
+}
+
+static io_service_t
+http_parked_io_service = {
+    .read_cb = http_service_parked_read_cb,
+    .event_cb = http_service_parked_event_cb
+};
+
+/* frees connections client sent nothing on yet */
+static void
+http_service_parked_close(http_worker_t *http_worker)
+{
+    ilink_t *link = NULL;
+
+    while (NULL != (link = ilist_pop_front(&http_worker->parked))) {
+        channel_free(downcast(link, io_channel_t, link));
+    }
+    http_worker->nparked = 0;
+}
+
 static void
 http_service_accept_cb(io_channel_t *listener, io_channel_accept_param_t *param)
 {
+    http_worker_t *http_worker = listener->ctx;
+
+    if (!http_service_admit(http_worker)) {
+        /* fast path: no session nor buffers for refused connections */
+        http_worker->rejected++;
+        channel_reject(listener, param,
+                       (const unsigned char *)HTTP_SERVICE_UNAVAILABLE,
+                       sizeof(HTTP_SERVICE_UNAVAILABLE) - 1);
+        return;
+    }
+
     io_channel_t *channel = channel_accept(listener, param);
-    if (NULL != channel) {
-        session_t *session = session_new(channel);
-        if (NULL == session) {
-            channel_free(channel);
-			return;
-        }
-		http_service_session_add(session);
+    if (NULL == channel) {
+        return;
+    }
+    if (channel_is_parked(channel)) {
+        /* idle connection: session is only set up once client sends something */
+        channel->service = &http_parked_io_service;
+        channel->ctx = http_worker;
+        ilist_push_back(&http_worker->parked, &channel->link);
+        http_worker->nparked++;
+        return;
     }
+    http_service_session_start(channel);
 }
 
 io_service_t
@@ -78,42 +432,165 @@ http_io_service = {
  * Start listeners on their own thread event loop,
  * waiting for incoming connection requests.
  */
+static void
+http_service_listening_cb(evutil_socket_t fd, short events, void *arg)
+{
+    /* previous process may start draining now */
+    if (handover_ack() < 0) {
+        fprintf(stderr, "%s: error acknowledging handover\n", __func__);
+        return;
+    }
+    fprintf(stderr, "%s: accepting on inherited listeners\n", __func__);
+}
+
 static int 
 http_service_listener_start(void *ctx)
 {
-    io_channel_t *listener = ctx;
-    if (channel_listen(listener, &http_service.sockaddr) != IO_CHANNEL_E_SUCCESS) {
+    http_worker_t *http_worker = ctx;
+    io_channel_t *listener = http_worker->listener;
+    io_channel_error_t error;
+
+    if (-1 != http_worker->inherited_fd) {
+        error = channel_listen_fd(listener, http_worker->inherited_fd);
+        http_worker->inherited_fd = -1;
+    }
+    else {
+        error = channel_listen(listener, &http_service.sockaddr);
+    }
+    if (error != IO_CHANNEL_E_SUCCESS) {
         return -1;
     }
+
+    if (atomic_inc(&http_service.listening_workers) == http_service.nworkers &&
+        http_service.inherited) {
+        event_base_once(http_service.ebase, -1, EV_TIMEOUT, http_service_listening_cb, NULL, NULL);
+    }
     return 0;
 }
 
+/**
+ * Runs on worker thread: stops accepting connections, closes
+ * idle ones (and ones client was fully responded on) and lets
+ * sessions in progress complete.
+ */
+static void
+http_service_worker_drain(void *arg)
+{
+    http_worker_t *http_worker = arg;
+    ilink_t *link = NULL, *next = NULL;
+
+    http_worker->draining = true;
+
+    if (NULL != http_worker->listener) {
+        channel_free(http_worker->listener);
+        http_worker->listener = NULL;
+    }
+
+    http_service_parked_close(http_worker);
+    ilist_foreach_safe(&http_worker->sessions, link, next) {
+        session_t *session = session_from_link(link);
+        if (session_is_idle(session) || session_is_done(session)) {
+            http_service_session_remove(session);
+        }
+    }
+
+    http_service_drain_check(http_worker);
+}
+
+static void
+http_service_drained_cb(evutil_socket_t fd, short events, void *arg)
+{
+    fprintf(stderr, "%s: all sessions completed\n", __func__);
+    http_service_stop();
+}
+
+/**
+ * Notifies main thread once last draining worker
+ * has no more sessions in flight.
+ */
+static void
+http_service_drain_check(http_worker_t *http_worker)
+{
+    if (!http_worker->draining || http_worker->drained ||
+        0 != http_worker->nsessions) {
+        return;
+    }
+    http_worker->drained = true;
+    if (atomic_inc(&http_service.drained_workers) == http_service.nworkers) {
+        event_base_once(http_service.ebase, -1, EV_TIMEOUT, http_service_drained_cb, NULL, NULL);
+    }
+}
+
+static void
+http_service_drain_deadline_cb(evutil_socket_t fd, short events, void *arg)
+{
+    fprintf(stderr, "%s: drain deadline expired, stopping\n", __func__);
+    http_service_stop();
+}
+
+/* "name=address" */
+static int
+http_service_pin(const char *pin)
+{
+    char name[RESOLVER_NAME_MAX];
+    const char *addr = strchr(pin, '=');
+
+    if (NULL == addr || addr == pin || (size_t)(addr - pin) >= sizeof(name)) {
+        fprintf(stderr, "%s: invalid pinned address %s\n", __func__, pin);
+        return -1;
+    }
+    memcpy(name, pin, addr - pin);
+    name[addr - pin] = '\0';
+    return resolver_pin(http_service.dns, name, addr + 1);
+}
+
+static int
+http_service_pins_load(void)
+{
+    if (NULL != http_service.pin_hosts && resolver_pin_hosts(http_service.dns, http_service.pin_hosts) < 0) {
+        return -1;
+    }
+    for (int i = 0; i < http_service.npins; ++i) {
+        if (http_service_pin(http_service.pins[i]) < 0) {
+            return -1;
+        }
+    }
+    resolver_set_refresh(http_service.dns, http_service.pin_refresh);
+    return 0;
+}
+
+/* decoded upstream replies, charged to worker decoding them (compute threads are not accounted) */
+static void *
+http_service_json_malloc(size_t size)
+{
+    return memacct_malloc(this_memacct(), MEMACCT_JSON, size);
+}
+
 int
 http_service_init(int nworkers, struct sockaddr_storage *sockaddr, const char *resolver)
 {
     worker_init();
+    json_set_alloc_funcs(http_service_json_malloc, memacct_free);
 
     http_service.resolver = resolver;
 
-	http_service.sessions = list_new();
-	
-	if (NULL == http_service.sessions) {
-		goto error;
-	}
-
-    http_service.session_mutex = mutex_new();
+    http_service.ebase = event_base_new();
 
-    if (NULL == http_service.session_mutex) {
+    if (NULL == http_service.ebase) {
         goto error;
     }
 
-    http_service.ebase = event_base_new();
+    /* draining workers notify main thread */
+    if (evthread_make_base_notifiable(http_service.ebase) != 0) {
+        goto error;
+    }
 
-    if (NULL == http_service.ebase) {
+    http_service.ev_drain_deadline = evtimer_new(http_service.ebase, http_service_drain_deadline_cb, NULL);
+    if (NULL == http_service.ev_drain_deadline) {
         goto error;
     }
 
-    http_service.ev_sigterm = evsignal_new(http_service.ebase, SIGTERM, http_service_stop_request, NULL);
+    http_service.ev_sigterm = evsignal_new(http_service.ebase, SIGTERM, http_service_drain_request, NULL);
     if (NULL == http_service.ev_sigterm) {
         goto error;
     }
@@ -131,35 +608,134 @@ http_service_init(int nworkers, struct sockaddr_storage *sockaddr, const char *r
         goto error;
     }
 
-    io_channel_t **listeners = calloc(nworkers, sizeof(io_channel_t *));
-    if (NULL == listeners) {
+    http_service.ev_sigusr1 = evsignal_new(http_service.ebase, SIGUSR1, http_service_profile_request, NULL);
+    if (NULL == http_service.ev_sigusr1) {
+        goto error;
+    }
+
+    if (event_add(http_service.ev_sigusr1, NULL) < 0) {
+        goto error;
+    }
+
+    if (NULL != http_service.argv) {
+        http_service.ev_sigusr2 = evsignal_new(http_service.ebase, SIGUSR2, http_service_upgrade_request, NULL);
+        if (NULL == http_service.ev_sigusr2) {
+            goto error;
+        }
+
+        if (event_add(http_service.ev_sigusr2, NULL) < 0) {
+            goto error;
+        }
+    }
+
+    http_worker_t *http_workers = calloc(nworkers, sizeof(http_worker_t));
+    if (NULL == http_workers) {
         goto error;
     }
-    http_service.listeners = listeners;
+    http_service.nworkers = nworkers;
+    http_service.http_workers = http_workers;
 
     for (int i = 0; i < nworkers; ++i) {
-        listeners[i] = tcp_socket_new();
-        if (NULL == listeners[i]) {
+        http_workers[i].inherited_fd = -1;
+        ilist_init(&http_workers[i].sessions);
+        ilist_init(&http_workers[i].parked);
+        session_pool_init(&http_workers[i].session_pool, POOL_MAX);
+        http_session_pool_init(&http_workers[i].http_session_pool, POOL_MAX);
+        backpressure_init(&http_workers[i].backpressure, http_service.buffer_budget);
+        for (int j = 0; j < HTTP_SERVICE_UPSTREAMS; ++j) {
+            breaker_init(&http_workers[i].breakers[j], http_service.breaker_open, http_service.breaker_slow);
+            hedge_init(&http_workers[i].hedges[j], http_service.hedge_delay, http_service.hedge_budget);
+            balancer_init(&http_workers[i].balancers[j], BALANCER_EJECT_MS);
+        }
+    }
+
+    for (int i = 0; i < nworkers; ++i) {
+        http_workers[i].traces = trace_ring_new(HTTP_SERVICE_TRACE_RING);
+        if (NULL == http_workers[i].traces) {
             goto error;
         }
-        listeners[i]->service = &http_io_service;
+        if (0 != http_service.cache_ttl) {
+            http_workers[i].cache = cache_new(HTTP_SERVICE_CACHE_SIZE, http_service.cache_ttl, http_service.cache_stale, memacct_free);
+            if (NULL == http_workers[i].cache) {
+                goto error;
+            }
+        }
+        if (0 != http_service.dns_ttl || 0 != http_service.dns_negative_ttl) {
+            http_workers[i].dns_cache = resolver_cache_new(http_service.dns_ttl, http_service.dns_negative_ttl);
+            if (NULL == http_workers[i].dns_cache) {
+                goto error;
+            }
+        }
+    }
+
+    /* listeners handed over by process we are upgrading, if any */
+    int fds[HANDOVER_MAX_FDS];
+    int nfds = handover_inherit(fds, countof(fds));
+    if (nfds < 0) {
+        fprintf(stderr, "%s: error inheriting listeners\n", __func__);
+        goto error;
+    }
+    for (int i = 0; i < nfds; ++i) {
+        if (i < nworkers) {
+            http_workers[i].inherited_fd = fds[i];
+        }
+        else {
+            /* more listeners than workers: connections queued on them are lost */
+            evutil_closesocket(fds[i]);
+        }
+    }
+    http_service.inherited = (nfds > 0);
+
+    for (int i = 0; i < nworkers; ++i) {
+        io_channel_t *listener = tcp_socket_new();
+        if (NULL == listener) {
+            goto error;
+        }
+        listener->service = &http_io_service;
+        listener->ctx = &http_workers[i];
+        channel_set_backpressure(listener, &http_workers[i].backpressure);
+        http_workers[i].listener = listener;
     }
 
     worker_t **workers = calloc(nworkers, sizeof(worker_t *));
     if (NULL == workers) {
-        return -1;
+        goto error;
     }
-    http_service.nworkers = nworkers;
     http_service.workers = workers;
 
+    /* spread workers round-robin over cpus we are allowed to run on */
+    int cpus[THREAD_MAX_CPUS];
+    int ncpus = 0;
+    if (http_service.cpu_affinity) {
+        ncpus = thread_cpus_available(cpus, countof(cpus));
+    }
+
+    /* with a shared resolver, workers have no dns resolver of their own */
+    http_service.dns = resolver_new(resolver, http_service.shared_resolver, nworkers);
+    if (NULL == http_service.dns) {
+        goto error;
+    }
+    if (http_service_pins_load() < 0) {
+        goto error;
+    }
+
     for (int i = 0; i < nworkers; ++i) {
-        workers[i] = worker_new(listeners[i], resolver);
+        int cpu = (ncpus > 0) ? cpus[i % ncpus] : WORKER_CPU_ANY;
+        workers[i] = worker_new(&http_workers[i], http_service.shared_resolver ? NULL : resolver, cpu);
         if (NULL == workers[i]) {
             goto error;
         }
         worker_set_prologue(workers[i], http_service_listener_start);
+        worker_memacct(workers[i])->budget = http_service.memory_budget;
+        resolver_add_worker(http_service.dns, workers[i], http_workers[i].dns_cache);
     }
 
+    if (http_service.compute_threads > 0) {
+        http_service.compute = compute_pool_new(http_service.compute_threads);
+        if (NULL == http_service.compute) {
+            goto error;
+        }
+    }
 
     http_service.sockaddr = *sockaddr;
 
@@ -171,9 +747,121 @@ error:
     return -1;
 }
 
+void
+http_service_set_cpu_affinity(bool enabled)
+{
+    http_service.cpu_affinity = enabled;
+}
+
+void
+http_service_set_cache(unsigned ttl_ms, unsigned stale_ms)
+{
+    http_service.cache_ttl = ttl_ms;
+    http_service.cache_stale = stale_ms;
+}
+
+void
+http_service_set_breaker(unsigned open_ms, unsigned slow_ms)
+{
+    http_service.breaker_open = open_ms;
+    http_service.breaker_slow = slow_ms;
+}
+
+void
+http_service_set_hedge(unsigned delay_ms, unsigned budget_pct)
+{
+    http_service.hedge_delay = delay_ms;
+    http_service.hedge_budget = budget_pct;
+}
+
+void
+http_service_set_memory_budget(size_t bytes)
+{
+    http_service.memory_budget = bytes;
+}
+
+void
+http_service_set_buffer_budget(size_t bytes)
+{
+    http_service.buffer_budget = bytes;
+}
+
+void
+http_service_set_resolver(bool shared, unsigned ttl_ms, unsigned negative_ttl_ms)
+{
+    http_service.shared_resolver = shared;
+    http_service.dns_ttl = ttl_ms;
+    http_service.dns_negative_ttl = negative_ttl_ms;
+}
+
+void
+http_service_set_pins(const char *hosts_path, char *const *pins, int npins, unsigned refresh_ms)
+{
+    http_service.pin_hosts = hosts_path;
+    http_service.pins = pins;
+    http_service.npins = npins;
+    http_service.pin_refresh = refresh_ms;
+}
+
+void
+http_service_set_upstream_port(uint16_t port)
+{
+    http_service.upstream_port = port;
+}
+
+uint16_t
+http_service_upstream_port(void)
+{
+    return http_service.upstream_port;
+}
+
+void
+http_service_set_trace_threshold(unsigned ms)
+{
+    http_service.trace_threshold = ms;
+}
+
+void
+http_service_set_compute_threads(int nthreads)
+{
+    http_service.compute_threads = nthreads;
+}
+
+void
+http_service_set_argv(char **argv)
+{
+    http_service.argv = argv;
+    /* relative path might lead to another binary once resolved elsewhere */
+    if (NULL == realpath(argv[0], http_service.path)) {
+        fprintf(stderr, "%s: error resolving %s, upgrade disabled: %s\n", __func__, argv[0], strerror(errno));
+        http_service.path[0] = '\0';
+    }
+}
+
+void
+http_service_set_drain_timeout(unsigned seconds)
+{
+    http_service.drain_timeout = seconds;
+}
+
+void
+http_service_set_session_limit(size_t max_sessions)
+{
+    http_service.max_sessions = max_sessions;
+}
+
+void
+http_service_set_upstream_limit(size_t max_upstream_requests)
+{
+    http_service.max_upstream_requests = max_upstream_requests;
+}
+
 int
 http_service_start(void)
 {
+    if (resolver_start(http_service.dns) < 0) {
+        return -1;
+    }
     for (int i = 0; i < http_service.nworkers; ++i) {
         if (worker_start(http_service.workers[i]) < 0) {
             return -1;
@@ -186,12 +874,34 @@ http_service_start(void)
 static void
 http_service_stop(void)
 {
+    if (http_service.stopped) {
+        return;
+    }
+    http_service.stopped = true;
+
+    /* tasks in flight complete on workers, which are still running */
+    compute_pool_stop(http_service.compute);
+
     for (int i = 0; i < http_service.nworkers; ++i) {
         worker_stop(http_service.workers[i]);
     }
 
+    compute_pool_free(http_service.compute);
+    http_service.compute = NULL;
+
+    /* answers still in flight are no longer delivered */
+    resolver_stop(http_service.dns);
+
     event_del(http_service.ev_sigterm);
     event_del(http_service.ev_sigint);
+    event_del(http_service.ev_drain_deadline);
+    event_del(http_service.ev_sigusr1);
+    if (NULL != http_service.ev_sigusr2) {
+        event_del(http_service.ev_sigusr2);
+    }
+    if (NULL != http_service.ev_handover) {
+        event_del(http_service.ev_handover);
+    }
 }
 
 static void
@@ -200,27 +910,249 @@ http_service_stop_request(evutil_socket_t fd, short events, void *arg)
     http_service_stop();
 }
 
+static void
+http_service_drain_request(evutil_socket_t fd, short events, void *arg)
+{
+    if (http_service.draining || 0 == http_service.drain_timeout) {
+        /* repeated request (or draining disabled) stops right away */
+        http_service_stop();
+        return;
+    }
+    http_service.draining = true;
+
+    fprintf(stderr, "%s: draining sessions for up to %u seconds\n", __func__, http_service.drain_timeout);
+
+    struct timeval deadline = { http_service.drain_timeout, 0 };
+    if (evtimer_add(http_service.ev_drain_deadline, &deadline) < 0) {
+        http_service_stop();
+        return;
+    }
+
+    for (int i = 0; i < http_service.nworkers; ++i) {
+        if (worker_call(http_service.workers[i], http_service_worker_drain, &http_service.http_workers[i]) < 0) {
+            http_service_stop();
+            return;
+        }
+    }
+}
+
+/* runs on worker thread: cache, breakers, hedges, balancers and buffer budget are confined to it */
+static void
+http_service_worker_dump(void *arg)
+{
+    http_worker_t *http_worker = arg;
+    backpressure_t *backpressure = &http_worker->backpressure;
+    memacct_t *memacct = this_memacct();
+    cache_stats_t stats;
+
+    fprintf(stderr, "%s: %zu bytes held (peak %zu), %zu bytes budget\n",
+            __func__, memacct->total, memacct->total_peak, memacct->budget);
+    for (int i = 0; i < MEMACCT_COUNT; ++i) {
+        fprintf(stderr, "%s:     %-12s %zu bytes (peak %zu)\n",
+                __func__, memacct_tag_name(i), memacct->live[i], memacct->peak[i]);
+    }
+
+    fprintf(stderr, "%s: %zu connections parked (%zu bytes each), %zu sessions\n",
+            __func__, http_worker->nparked, tcp_socket_parked_size(), http_worker->nsessions);
+    fprintf(stderr, "%s: pooled %zu sessions (%zu reused, %zu allocated), %zu http sessions (%zu reused, %zu allocated)\n",
+            __func__, http_worker->session_pool.count, http_worker->session_pool.hits, http_worker->session_pool.misses,
+            http_worker->http_session_pool.count, http_worker->http_session_pool.hits, http_worker->http_session_pool.misses);
+
+    fprintf(stderr, "%s: %zu connections buffering %zu bytes (%zu per connection, peak %zu, largest connection %zu), "
+            "%zu bytes budget, %zu connections paused, %zu pauses\n",
+            __func__, backpressure->connections, backpressure->buffered,
+            (0 != backpressure->connections) ? backpressure->buffered / backpressure->connections : 0,
+            backpressure->peak, backpressure->conn_peak, backpressure->budget,
+            backpressure->paused, backpressure->pauses);
+
+    if (NULL != http_worker->cache) {
+        cache_get_stats(http_worker->cache, &stats);
+        fprintf(stderr, "%s: %zu replies cached, %zu hits, %zu stale hits, %zu misses, %zu revalidations, %zu evictions\n",
+                __func__, stats.size, stats.hits, stats.stale_hits, stats.misses, stats.revalidations, stats.evictions);
+    }
+    if (NULL != http_worker->dns_cache) {
+        resolver_cache_stats_t dns_stats;
+        resolver_cache_get_stats(http_worker->dns_cache, &dns_stats);
+        fprintf(stderr, "%s: %zu dns answers cached, %zu hits (%zu failures), %zu misses, %zu failures cached\n",
+                __func__, dns_stats.size, dns_stats.hits, dns_stats.negative_hits, dns_stats.misses, dns_stats.negative_stores);
+    }
+    for (int i = 0; i < HTTP_SERVICE_UPSTREAMS && 0 != http_service.breaker_open; ++i) {
+        breaker_t *breaker = &http_worker->breakers[i];
+        if (BREAKER_CLOSED != breaker->state || 0 != breaker->trips) {
+            fprintf(stderr, "%s: upstream %d breaker %s, opened %zu times, %zu requests refused\n",
+                    __func__, i, breaker_state_name(breaker->state), breaker->trips, breaker->refused);
+        }
+    }
+    for (int i = 0; i < HTTP_SERVICE_UPSTREAMS && 0 != http_service.hedge_budget; ++i) {
+        hedge_t *hedge = &http_worker->hedges[i];
+        if (0 != hedge->requests) {
+            fprintf(stderr, "%s: upstream %d %zu requests, %zu hedged (%zu won), hedge delay %ums\n",
+                    __func__, i, hedge->requests, hedge->hedged, hedge->won,
+                    (0 != hedge->delay_ms) ? hedge->delay_ms : hedge->adaptive_ms);
+        }
+    }
+    for (int i = 0; i < HTTP_SERVICE_UPSTREAMS; ++i) {
+        balancer_t *balancer = &http_worker->balancers[i];
+        for (size_t j = 0; j < balancer->naddrs; ++j) {
+            balancer_addr_t *addr = &balancer->addrs[j];
+            char dst[INET6_ADDRSTRLEN];
+            const void *in_addr = (AF_INET == addr->addr.ss_family) ?
+                (const void *)&((struct sockaddr_in *)&addr->addr)->sin_addr :
+                (const void *)&((struct sockaddr_in6 *)&addr->addr)->sin6_addr;
+            fprintf(stderr, "%s: upstream %d %s: %zu requests, %u outstanding%s\n", __func__, i,
+                    evutil_inet_ntop(addr->addr.ss_family, in_addr, dst, sizeof(dst)),
+                    addr->requests, addr->outstanding, (0 != addr->ejected_until) ? ", ejected" : "");
+        }
+    }
+}
+
+/**
+ * SIGUSR1: each worker prints its loop lag and callback
+ * durations, while slow session traces are read from here
+ * without disturbing workers.
+ */
+static void
+http_service_profile_request(evutil_socket_t fd, short events, void *arg)
+{
+    trace_t *traces = calloc(HTTP_SERVICE_TRACE_RING, sizeof(trace_t));
+    resolver_stats_t dns_stats;
+
+    resolver_get_stats(http_service.dns, &dns_stats);
+    fprintf(stderr, "%s: %zu dns queries (%zu failed), %zu coalesced requests, %zu answers published, %zu pinned names refreshed (%zu failed)\n",
+            __func__, dns_stats.queries, dns_stats.failures, dns_stats.coalesced, dns_stats.published,
+            dns_stats.refreshes, dns_stats.refresh_failures);
+
+    for (int i = 0; i < http_service.nworkers; ++i) {
+        if (worker_profile_dump(http_service.workers[i]) < 0) {
+            fprintf(stderr, "%s: error requesting worker profile\n", __func__);
+        }
+        if (worker_call(http_service.workers[i], http_service_worker_dump, &http_service.http_workers[i]) < 0) {
+            fprintf(stderr, "%s: error requesting worker upstream stats\n", __func__);
+        }
+        if (NULL != traces) {
+            size_t n = trace_ring_snapshot(http_service.http_workers[i].traces, traces, HTTP_SERVICE_TRACE_RING);
+            fprintf(stderr, "%s: worker %d: %zu sessions over %ums\n", __func__, i, n, http_service.trace_threshold);
+            for (size_t j = 0; j < n; ++j) {
+                trace_print(&traces[j]);
+            }
+        }
+    }
+    free(traces);
+}
+
+static void
+http_service_handover_cb(evutil_socket_t fd, short events, void *arg)
+{
+    char byte = 0;
+    ssize_t n = (events & EV_READ) ? read(fd, &byte, 1) : 0;
+
+    event_free(http_service.ev_handover);
+    http_service.ev_handover = NULL;
+    evutil_closesocket(fd);
+
+    /* timed out, or exited without acknowledging */
+    if (1 != n) {
+        fprintf(stderr, "%s: upgraded process %s, still serving\n", __func__,
+                (events & EV_TIMEOUT) ? "did not take over in time" : "failed to start");
+        handover_abort(http_service.upgrade_pid);
+        http_service.upgrade_pid = 0;
+        return;
+    }
+    http_service.upgrade_pid = 0;
+
+    /* new process already accepts on the very same sockets */
+    fprintf(stderr, "%s: upgraded process took over listeners\n", __func__);
+    http_service_drain_request(-1, 0, NULL);
+}
+
+/**
+ * Re-executes binary, handing listening sockets over to it.
+ * Connections keep being accepted by this process until the
+ * new one acknowledges, and by the new one afterwards.
+ */
+static void
+http_service_upgrade_request(evutil_socket_t fd, short events, void *arg)
+{
+    struct timeval timeout = { HANDOVER_ACK_TIMEOUT, 0 };
+    int fds[HANDOVER_MAX_FDS];
+    int nfds = 0;
+    int sock;
+
+    if (http_service.draining || NULL != http_service.ev_handover) {
+        return;
+    }
+    if ('\0' == http_service.path[0]) {
+        fprintf(stderr, "%s: binary path unknown, upgrade refused\n", __func__);
+        return;
+    }
+
+    for (int i = 0; i < http_service.nworkers && nfds < countof(fds); ++i) {
+        io_channel_t *listener = http_service.http_workers[i].listener;
+        int listener_fd = (NULL != listener) ? channel_get_fd(listener) : -1;
+        if (-1 != listener_fd) {
+            fds[nfds++] = listener_fd;
+        }
+    }
+
+    fprintf(stderr, "%s: upgrading to %s, handing over %d listeners\n", __func__, http_service.path, nfds);
+
+    sock = handover_exec(http_service.path, http_service.argv, fds, nfds, &http_service.upgrade_pid);
+    if (sock < 0) {
+        fprintf(stderr, "%s: error starting upgraded process\n", __func__);
+        return;
+    }
+
+    http_service.ev_handover = event_new(http_service.ebase, sock, EV_READ, http_service_handover_cb, NULL);
+    if (NULL == http_service.ev_handover || event_add(http_service.ev_handover, &timeout) < 0) {
+        if (NULL != http_service.ev_handover) {
+            event_free(http_service.ev_handover);
+            http_service.ev_handover = NULL;
+        }
+        evutil_closesocket(sock);
+        /* its acknowledgment would go unnoticed */
+        handover_abort(http_service.upgrade_pid);
+        http_service.upgrade_pid = 0;
+    }
+}
+
 void
 http_service_fini(void)
 {
-    node_t *node = NULL, *next = NULL;;
-    list_foreach_safe(http_service.sessions, node, next) {
-        session_t *session = node->data;
-        session_free(session);
+    /* before sessions in flight are freed, if not stopped */
+    compute_pool_free(http_service.compute);
+    http_service.compute = NULL;
+    if (NULL != http_service.dns) {
+        resolver_stop(http_service.dns);
     }
-    list_free(http_service.sessions);
-    http_service.sessions = NULL;
 
-    if (NULL != http_service.listeners) {
+    if (NULL != http_service.http_workers) {
         for (int i = 0; i < http_service.nworkers; ++i) {
-            io_channel_t *listener = http_service.listeners[i];
-            if (NULL != listener) {
-                channel_free(listener);
-                http_service.listeners[i] = NULL;
+            http_worker_t *http_worker = &http_service.http_workers[i];
+            ilink_t *link = NULL;
+            /* sessions cut off by drain deadline */
+            while (NULL != (link = ilist_pop_front(&http_worker->sessions))) {
+                session_free(session_from_link(link));
+            }
+            http_service_parked_close(http_worker);
+            if (NULL != http_worker->listener) {
+                channel_free(http_worker->listener);
+                http_worker->listener = NULL;
+            }
+            if (-1 != http_worker->inherited_fd) {
+                evutil_closesocket(http_worker->inherited_fd);
+                http_worker->inherited_fd = -1;
             }
+            trace_ring_free(http_worker->traces);
+            http_worker->traces = NULL;
+            cache_free(http_worker->cache);
+            http_worker->cache = NULL;
+            resolver_cache_free(http_worker->dns_cache);
+            http_worker->dns_cache = NULL;
+            pool_fini(&http_worker->session_pool);
+            pool_fini(&http_worker->http_session_pool);
         }
-        free(http_service.listeners);
-        http_service.listeners = NULL;
+        free(http_service.http_workers);
+        http_service.http_workers = NULL;
     }
 
     if (NULL != http_service.workers) {
@@ -235,6 +1167,12 @@ http_service_fini(void)
         http_service.workers = NULL;
     }
 
+    /* once worker dns resolvers are gone: requests in flight
+     * see their sessions are gone too
+     */
+    resolver_free(http_service.dns);
+    http_service.dns = NULL;
+
     if (NULL != http_service.ev_sigterm) {
         event_free(http_service.ev_sigterm);
         http_service.ev_sigterm = NULL;
@@ -245,6 +1183,30 @@ http_service_fini(void)
         http_service.ev_sigint = NULL;
     }
 
+    if (NULL != http_service.ev_drain_deadline) {
+        event_free(http_service.ev_drain_deadline);
+        http_service.ev_drain_deadline = NULL;
+    }
+
+    if (NULL != http_service.ev_sigusr1) {
+        event_free(http_service.ev_sigusr1);
+        http_service.ev_sigusr1 = NULL;
+    }
+
+    if (NULL != http_service.ev_sigusr2) {
+        event_free(http_service.ev_sigusr2);
+        http_service.ev_sigusr2 = NULL;
+    }
+
+    if (NULL != http_service.ev_handover) {
+        evutil_closesocket(event_get_fd(http_service.ev_handover));
+        event_free(http_service.ev_handover);
+        http_service.ev_handover = NULL;
+        /* stopped while upgraded process was yet to acknowledge */
+        handover_abort(http_service.upgrade_pid);
+        http_service.upgrade_pid = 0;
+    }
+
     if (NULL != http_service.ebase) {
         event_base_free(http_service.ebase);
         http_service.ebase = NULL;
@@ -16,13 +16,231 @@
 int
 http_service_init(int nworkers, struct sockaddr_storage *sockaddr, const char *resolver);
 
+/**
+ * Enables/disables pinning of worker threads to cpus.
+ *
+ * When enabled (default), workers are assigned round-robin
+ * to cpus process is allowed to run on and allocate their
+ * memory from those cpus numa nodes.
+ *
+ * Should be called before http_service_init.
+ */
+void
+http_service_set_cpu_affinity(bool enabled);
+
+/**
+ * Limits # sessions in flight per worker, parked connections
+ * (client sent nothing on yet) included.
+ *
+ * Once limit is reached, new connections are answered
+ * with 503 (Service Unavailable) straight from accept path
+ * until load drops back below 90% of limit.
+ *
+ * Should be called before http_service_start.
+ *
+ * @param max_sessions limit, 0 means unlimited (default)
+ */
+void
+http_service_set_session_limit(size_t max_sessions);
+
+/**
+ * Limits # outstanding requests to upstream servers per
+ * worker, shedding new connections the same way as
+ * http_service_set_session_limit.
+ *
+ * Should be called before http_service_start.
+ *
+ * @param max_upstream_requests limit, 0 means unlimited (default)
+ */
+void
+http_service_set_upstream_limit(size_t max_upstream_requests);
+
+/**
+ * Sets # compute threads CPU-bound session steps (decoding
+ * upstream replies, rendering responses) are offloaded to,
+ * so that worker event loops stay responsive however big
+ * payloads get.
+ *
+ * Should be called before http_service_init.
+ *
+ * @param nthreads # compute threads, 0 runs those steps
+ *        inline on workers (default)
+ */
+void
+http_service_set_compute_threads(int nthreads);
+
+/**
+ * Sets latency above which session traces are kept, in a ring
+ * per worker SIGUSR1 dumps.
+ *
+ * Should be called before http_service_start.
+ *
+ * @param ms threshold (default 1000 milliseconds)
+ */
+void
+http_service_set_trace_threshold(unsigned ms);
+
+/**
+ * Enables per worker cache of parsed upstream replies: they
+ * are served fresh for ttl, then stale for a further window
+ * while a single request revalidates them in background.
+ *
+ * Should be called before http_service_init.
+ *
+ * @param ttl_ms freshness, 0 disables cache (default)
+ * @param stale_ms stale serving window
+ */
+void
+http_service_set_cache(unsigned ttl_ms, unsigned stale_ms);
+
+/**
+ * Configures per worker circuit breakers guarding upstream
+ * servers: once too many requests to an upstream server fail
+ * (or are slower than slow_ms), no request is sent to it for
+ * open_ms and its replies are served from cache, or defaults.
+ * A single probe request then decides whether it recovered.
+ *
+ * Should be called before http_service_init.
+ *
+ * @param open_ms how long breakers stay open, 0 disables
+ *        breakers (default 5000 milliseconds)
+ * @param slow_ms requests slower than that count as failed
+ *        (default 3000 milliseconds)
+ */
+void
+http_service_set_breaker(unsigned open_ms, unsigned slow_ms);
+
+/**
+ * Enables hedging of requests to upstream servers: a reply
+ * later than delay_ms (or, adaptively, than 95th percentile
+ * of recent latencies of its upstream server) gets the same
+ * request sent again, to another address if any. First reply
+ * wins, the other request is cancelled.
+ *
+ * Should be called before http_service_init.
+ *
+ * @param delay_ms how late replies get hedged, 0 for adaptive
+ *        delay (default)
+ * @param budget_pct caps hedged requests to this percentage of
+ *        upstream requests, 0 disables hedging (default)
+ */
+void
+http_service_set_hedge(unsigned delay_ms, unsigned budget_pct);
+
+/**
+ * Sets how much memory each worker may hold in sessions, http
+ * sessions, sockets and their buffers, dns answers, decoded
+ * json and cached replies (@see memacct.h). Past budget, worker
+ * refuses new connections (as past its sessions limit) and no
+ * longer caches replies, until it holds less than 90% of it.
+ *
+ * Should be called before http_service_init.
+ *
+ * @param bytes per worker budget, 0 means unlimited (default)
+ */
+void
+http_service_set_memory_budget(size_t bytes);
+
+/**
+ * Sets how many bytes connections of a worker may hold in their
+ * buffers: connections read no more than their share of it, and
+ * stop reading while replies pile up in their output, or while
+ * worker buffers are over budget (@see backpressure.h).
+ *
+ * Should be called before http_service_init.
+ *
+ * @param bytes per worker budget, 0 means unlimited (default
+ *        64 MB), connections then read up to 1 MB ahead
+ */
+void
+http_service_set_buffer_budget(size_t bytes);
+
+/**
+ * Configures resolution of upstream domain names: by default
+ * each worker resolves them on its own dns resolver. A shared
+ * resolver runs on a thread of its own, sending a single query
+ * for identical requests of all workers in flight, and hands
+ * answers over to every worker.
+ *
+ * Should be called before http_service_init.
+ *
+ * @param shared whether workers share a single resolver thread
+ *        (default false)
+ * @param ttl_ms how long workers keep answers, 0 disables
+ *        keeping them (default)
+ * @param negative_ttl_ms how long workers keep dns failures (no
+ *        such name, no addresses, server failure or timeout),
+ *        failing requests for them right away, 0 disables keeping
+ *        them (default 2000)
+ */
+void
+http_service_set_resolver(bool shared, unsigned ttl_ms, unsigned negative_ttl_ms);
+
+/**
+ * Pins upstream domain names to addresses known upfront, so
+ * that no dns query is ever sent on behalf of a request for
+ * them. They are re-resolved in background every refresh_ms,
+ * their addresses being replaced as a whole once resolved (and
+ * kept while resolution fails).
+ *
+ * Should be called before http_service_init.
+ *
+ * @param hosts_path hosts-style file (lines of an address followed
+ *        by names), or NULL
+ * @param pins "name=address" strings, which should outlive service
+ * @param refresh_ms 0 never re-resolves pinned names (default
+ *        60000 milliseconds)
+ */
+void
+http_service_set_pins(const char *hosts_path, char *const *pins, int npins, unsigned refresh_ms);
+
+/**
+ * Sends upstream requests to port instead of upstream servers'
+ * own (80), e.g. to upstreams pinned to a local test server.
+ *
+ * Should be called before http_service_init.
+ *
+ * @param port 0 keeps upstream servers' own (default)
+ */
+void
+http_service_set_upstream_port(uint16_t port);
+
+/**
+ * Enables zero-downtime binary upgrade on SIGUSR2.
+ *
+ * SIGUSR2 re-executes argv[0] with argv and hands listening
+ * sockets over to it. Once new process accepts connections
+ * on them, this process drains as if it received SIGTERM.
+ *
+ * Should be called before http_service_init and before
+ * changing working directory (argv[0] is resolved here).
+ */
+void
+http_service_set_argv(char **argv);
+
+/**
+ * Sets how long SIGTERM waits for sessions in progress.
+ *
+ * On SIGTERM, workers stop accepting connections and close
+ * idle ones, while sessions in progress are allowed to
+ * complete. Service stops as soon as all sessions complete
+ * or deadline expires, whatever happens first.
+ *
+ * Should be called before http_service_start.
+ *
+ * @param seconds drain deadline, 0 stops without draining
+ *        (default is 30 seconds)
+ */
+void
+http_service_set_drain_timeout(unsigned seconds);
+
 /**
  * Start http worker threads defined by
  * http_service_init and blocks until process
  * receives and processes SIGTERM or SIGINT.
  *
- * SIGTERM or SIGINT triggers http service
- * finalization.
+ * SIGTERM drains http service before finalization,
+ * SIGINT (or a second SIGTERM) finalizes it right away.
  * 
  * @return 0, if successfull. 0, otherwise.
  */
@@ -38,10 +256,115 @@ void
 http_service_fini(void);
 
 /**
- * Remove session from http_service's queue.
+ * Add session to calling worker queue: sessions not started
+ * by a client connection (e.g. background revalidations).
  */
 struct session;
 void
+http_service_session_add(struct session *session);
+
+/**
+ * Remove session from http_service's queue.
+ */
+void
 http_service_session_remove(struct session *session);
 
+/**
+ * Account for requests to upstream servers issued
+ * by sessions of calling worker.
+ */
+void
+http_service_upstream_request_add(void);
+
+void
+http_service_upstream_request_remove(void);
+
+/**
+ * Keeps trace of session being released by calling
+ * worker, if session was slow.
+ */
+struct trace;
+void
+http_service_session_traced(const struct trace *trace);
+
+/**
+ * Return port upstream requests are sent to instead of
+ * upstream servers' own, 0 if not overridden.
+ */
+uint16_t
+http_service_upstream_port(void);
+
+/**
+ * Return calling worker cache of upstream replies,
+ * NULL if disabled.
+ */
+struct cache;
+struct cache *
+http_service_cache(void);
+
+/**
+ * Return calling worker circuit breaker guarding upstream
+ * server (small index chosen by caller), NULL if disabled.
+ */
+struct breaker;
+struct breaker *
+http_service_breaker(int upstream);
+
+/**
+ * Return calling worker hedging state of upstream server
+ * (@see http_service_breaker), NULL if disabled.
+ */
+struct hedge;
+struct hedge *
+http_service_hedge(int upstream);
+
+/**
+ * Return calling worker balancer of requests over addresses
+ * of upstream server (@see http_service_breaker).
+ */
+struct balancer;
+struct balancer *
+http_service_balancer(int upstream);
+
+/**
+ * Return calling worker budget of connection buffers,
+ * NULL off worker threads.
+ */
+struct backpressure;
+struct backpressure *
+http_service_backpressure(void);
+
+/**
+ * Return calling worker pool of sessions freed,
+ * NULL off worker threads.
+ */
+struct pool;
+struct pool *
+http_service_session_pool(void);
+
+/**
+ * Return calling worker pool of http sessions freed,
+ * NULL off worker threads.
+ */
+struct pool *
+http_service_http_session_pool(void);
+
+/**
+ * Resolves domain name for calling worker: cb(answer, arg)
+ * runs later on it (@see resolver_resolve).
+ *
+ * @return 0, if cb is going to run. -1, otherwise.
+ */
+struct resolver_answer;
+int
+http_service_resolve(const char *name, void (*cb)(struct resolver_answer *answer, void *arg), void *arg);
+
+/**
+ * Runs task on compute threads, if any, and its
+ * completion back on calling worker.
+ */
+struct compute_task;
+void
+http_service_offload(struct compute_task *task);
+
 #endif /* _TIGERA_HTTP_SERVICE__H__ */
@@ -0,0 +1,218 @@
+#include "includes.h"
+#include "http_service.h"
+#include <pthread.h>
+#include <signal.h>
+#include <errno.h>
+#include <assert.h>
+
+/* Whole service on a single worker, upstream domains pinned to
+ * an upstream server of this test, with cache enabled: replies
+ * cached are replaced on revalidation, and freed on teardown.
+ */
+
+#define TEST_DRAIN_TIMEOUT 30 /* seconds, never reached */
+#define TEST_ATTEMPTS      100
+#define TEST_CACHE_TTL     50    /* milliseconds */
+#define TEST_CACHE_STALE   10000 /* milliseconds */
+
+static struct sockaddr_in addr;
+static struct sockaddr_in upstream_addr;
+static pthread_mutex_t upstream_lock = PTHREAD_MUTEX_INITIALIZER;
+static int upstream_replies; /* under upstream_lock */
+
+/* replies to upstream requests one at a time, closing connections */
+static void *
+upstream(void *arg)
+{
+    static const char name[] = "{\"name\": \"Ada\", \"surname\": \"Lovelace\"}";
+    static const char joke[] = "{\"type\": \"success\", \"value\": {\"joke\": \"Eduardo Panisset writes C.\"}}";
+    int fd = *(int *)arg;
+
+    for (;;) {
+        char request[4096];
+        char reply[4096];
+        size_t len = 0;
+        ssize_t n = 0;
+        const char *body = NULL;
+        int conn = accept(fd, NULL, NULL);
+
+        if (conn < 0) {
+            continue;
+        }
+        while (len < sizeof(request) - 1 && (n = read(conn, request + len, sizeof(request) - 1 - len)) > 0) {
+            len += n;
+            request[len] = '\0';
+            if (NULL != strstr(request, "\r\n\r\n")) {
+                break;
+            }
+        }
+        if (n > 0) {
+            body = (0 == strncmp(request, "GET /api/", 9)) ? name : joke;
+            n = snprintf(reply, sizeof(reply),
+                         "HTTP/1.1 200 OK\r\nContent-Type: application/json\r\nContent-Length: %zu\r\nConnection: close\r\n\r\n%s",
+                         strlen(body), body);
+            assert(n == write(conn, reply, n));
+            pthread_mutex_lock(&upstream_lock);
+            ++upstream_replies;
+            pthread_mutex_unlock(&upstream_lock);
+        }
+        close(conn);
+    }
+    return NULL;
+}
+
+/* waits until upstream server replied to count requests */
+static void
+upstream_wait(int count)
+{
+    for (int i = 0; i < TEST_ATTEMPTS; ++i) {
+        pthread_mutex_lock(&upstream_lock);
+        bool done = upstream_replies >= count;
+        pthread_mutex_unlock(&upstream_lock);
+        if (done) {
+            /* replies reach cache after upstream sent them */
+            usleep(100000);
+            return;
+        }
+        usleep(10000);
+    }
+    assert(!"upstream requests sent");
+}
+
+static int
+client_connect(void)
+{
+    struct timeval tv = { 5, 0 };
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+
+    assert(fd >= 0);
+    assert(0 == setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv)));
+    /* worker might not listen yet */
+    for (int i = 0; 0 != connect(fd, (struct sockaddr *)&addr, sizeof(addr)); ++i) {
+        assert(ECONNREFUSED == errno && i < TEST_ATTEMPTS);
+        usleep(10000);
+    }
+    return fd;
+}
+
+/**
+ * Sends a request and reads its whole response, if any,
+ * leaving connection open.
+ *
+ * @return whether client was responded to with 200
+ */
+static bool
+client_request(int fd)
+{
+    static const char request[] = "GET / HTTP/1.1\r\nHost: localhost\r\n\r\n";
+    char reply[4096];
+    size_t len = 0;
+    size_t content_length = 0;
+    char *body = NULL;
+    ssize_t n = 0;
+
+    assert(sizeof(request) - 1 == write(fd, request, sizeof(request) - 1));
+    while (len < sizeof(reply) - 1 && (n = read(fd, reply + len, sizeof(reply) - 1 - len)) > 0) {
+        len += n;
+        reply[len] = '\0';
+        body = strstr(reply, "\r\n\r\n");
+        if (NULL != body && NULL != strstr(reply, "Content-Length: ")) {
+            content_length = strtoul(strstr(reply, "Content-Length: ") + 16, NULL, 10);
+            if (len - (body + 4 - reply) >= content_length) {
+                break;
+            }
+        }
+    }
+    return len > 0 && 0 == strncmp(reply, "HTTP/1.0 200 OK\r\n", 17);
+}
+
+/* once responded to, client keeps its connection open: server closes it */
+static void *
+client(void *arg)
+{
+    char byte;
+    int fd = -1;
+
+    /* cache miss: replies are stored */
+    fd = client_connect();
+    assert(client_request(fd));
+    upstream_wait(2);
+
+    /* stale replies are served and replaced by revalidation */
+    usleep(2 * TEST_CACHE_TTL * 1000);
+    int stale = client_connect();
+    assert(client_request(stale));
+    close(stale);
+    upstream_wait(4);
+
+    /* idle connection: client sends nothing, accepted by
+     * the time next connection is responded to */
+    int idle = client_connect();
+    int other = client_connect();
+    usleep(2 * TEST_CACHE_TTL * 1000);
+    assert(client_request(other));
+    upstream_wait(6);
+
+    assert(0 == kill(getpid(), SIGTERM));
+
+    assert(0 == read(fd, &byte, 1));
+    assert(0 == read(other, &byte, 1));
+    assert(0 == read(idle, &byte, 1));
+    close(fd);
+    close(other);
+    close(idle);
+    return NULL;
+}
+
+int
+main(int argc, char **argv)
+{
+    struct sockaddr_storage ss;
+    socklen_t addrlen = sizeof(addr);
+    char *pins[] = { "uinames.com=127.0.0.1", "api.icndb.com=127.0.0.1" };
+    struct timeval start, end;
+    pthread_t thread;
+    pthread_t upstream_thread;
+    int upstream_fd = socket(AF_INET, SOCK_STREAM, 0);
+
+    /* upstream server, on a free port */
+    memset(&upstream_addr, 0, sizeof(upstream_addr));
+    upstream_addr.sin_family = AF_INET;
+    inet_pton(AF_INET, "127.0.0.1", &upstream_addr.sin_addr);
+    assert(0 == bind(upstream_fd, (struct sockaddr *)&upstream_addr, sizeof(upstream_addr)));
+    assert(0 == getsockname(upstream_fd, (struct sockaddr *)&upstream_addr, &addrlen));
+    assert(0 == listen(upstream_fd, 16));
+    assert(0 == pthread_create(&upstream_thread, NULL, upstream, &upstream_fd));
+    addrlen = sizeof(addr);
+
+    /* free port to listen on */
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    inet_pton(AF_INET, "127.0.0.1", &addr.sin_addr);
+    assert(0 == bind(fd, (struct sockaddr *)&addr, sizeof(addr)));
+    assert(0 == getsockname(fd, (struct sockaddr *)&addr, &addrlen));
+    close(fd);
+    memset(&ss, 0, sizeof(ss));
+    memcpy(&ss, &addr, sizeof(addr));
+
+    http_service_set_cpu_affinity(false);
+    http_service_set_drain_timeout(TEST_DRAIN_TIMEOUT);
+    http_service_set_pins(NULL, pins, countof(pins), 0);
+    http_service_set_upstream_port(ntohs(upstream_addr.sin_port));
+    http_service_set_cache(TEST_CACHE_TTL, TEST_CACHE_STALE);
+    assert(0 == http_service_init(1, &ss, "127.0.0.1:53"));
+
+    assert(0 == pthread_create(&thread, NULL, client, NULL));
+    gettimeofday(&start, NULL);
+    assert(0 == http_service_start());
+    gettimeofday(&end, NULL);
+    assert(0 == pthread_join(thread, NULL));
+    http_service_fini();
+
+    /* drain did not wait for connections client kept open */
+    assert(end.tv_sec - start.tv_sec < TEST_DRAIN_TIMEOUT / 2);
+
+    printf("service drained\n");
+    return 0;
+}
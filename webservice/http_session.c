@@ -4,6 +4,9 @@
 #include "session.h"
 #include "http_session.h"
 #include "http_parser.h"
+#include "worker.h"
+#include "memacct.h"
+#include "pool.h"
 
 typedef enum http_state http_state_t;
 
@@ -23,6 +26,8 @@ struct http_session {
     struct evbuffer *body;
     io_channel_t *channel;
     http_callbacks_t cbs;
+    memacct_t *memacct; /**< of worker session was created on, or NULL */
+    size_t charged;     /**< body bytes charged to memacct */
 };
 
 /* http parser callbacks */
@@ -32,11 +37,19 @@ message_begin(http_parser *parser)
 {
     //int type = parser->type;
     http_session_t *session = parser->data;
-    session->body = evbuffer_new();
     if (NULL == session->body) {
-        return -1;
+        session->body = evbuffer_new();
+        if (NULL == session->body) {
+            return -1;
+        }
+    }
+    else {
+        evbuffer_drain(session->body, evbuffer_get_length(session->body));
     }
     session->state = HTTP_MESSAGE_PARSE_BEGIN;
+    if (NULL != session->cbs.message_begin) {
+        session->cbs.message_begin(session);
+    }
     http_parser_pause(parser, 1); /**< breaking parser loop */
     return 0;
 }
@@ -68,6 +81,8 @@ message_body(http_parser *parser, const char *at, size_t len)
     if (evbuffer_add(session->body, at, len) < 0) {
         return -1;
     }
+    memacct_charge(session->memacct, MEMACCT_HTTP_SESSION, len);
+    session->charged += len;
     fprintf(stderr, "%s: %d %*.s\n", __func__, (int)len, (int)len, at);
     return 0;
 } 
@@ -287,8 +302,7 @@ http_session_channel_should_close(io_channel_t *channel)
     http_session_t *session = channel->ctx;
 
     if ((channel->eof && (HTTP_MESSAGE_BEGIN == session->state)) ||
-        ((HTTP_MESSAGE_COMPLETE == session->state) &&
-         (0 == channel_get_output_length(channel)))) {
+        http_session_is_flushed(session)) {
         if (NULL != session->cbs.ready_to_close) {
             session->cbs.ready_to_close(session);
         }
@@ -297,6 +311,17 @@ http_session_channel_should_close(io_channel_t *channel)
     return false;    
 }
 
+static void
+http_session_failed(http_session_t *session)
+{
+    if (NULL != session->cbs.error) {
+        /* master might get along without this http session */
+        session->cbs.error(session);
+        return;
+    }
+    http_service_session_remove(session->master);
+}
+
 static void
 http_session_event_cb(io_channel_t *channel, io_channel_event_t event)
 {
@@ -304,7 +329,7 @@ http_session_event_cb(io_channel_t *channel, io_channel_event_t event)
 
     if (event & IO_CHANNEL_EVENT_ERROR) {
         /* unrecoverable error */
-        http_service_session_remove(session->master);
+        http_session_failed(session);
 
     }
     else if (event & IO_CHANNEL_EVENT_CONNECTED) {
@@ -322,7 +347,7 @@ http_session_event_cb(io_channel_t *channel, io_channel_event_t event)
     else if ((event & IO_CHANNEL_EVENT_TIMEOUT) &&
              (event & IO_CHANNEL_EVENT_READ)) {
         /* long time no see from the client */
-        http_service_session_remove(session->master);
+        http_session_failed(session);
     }
 }
 
@@ -394,7 +419,7 @@ http_session_read_cb(io_channel_t *channel)
     }
 
     if (HTTP_PARSER_E_ERROR == error) {
-        http_service_session_remove(session->master);
+        http_session_failed(session);
         return;
     }
 }
@@ -432,35 +457,77 @@ http_session_io_service = {
 http_session_t *
 http_session_new(session_t *master, io_channel_t *channel, int http_parser_type)
 {
-    http_session_t *session = calloc(1, sizeof(http_session_t));
+    pool_t *pool = http_service_http_session_pool();
+    http_session_t *session = (NULL != pool) ? pool_get(pool) : calloc(1, sizeof(http_session_t));
     if (NULL != session) {
+        /* body buffer of a pooled session is reused */
+        struct evbuffer *body = session->body;
+        memset(session, 0, sizeof(*session));
+        session->body = body;
         http_parser_init(&session->http_parser, http_parser_type);
         session->http_parser.data = session;
         session->state = HTTP_MESSAGE_BEGIN;
         session->channel = channel;
         session->master = master;
+        session->memacct = this_memacct();
+        memacct_charge(session->memacct, MEMACCT_HTTP_SESSION, sizeof(http_session_t));
         channel->service = &http_session_io_service;
         channel->ctx = session;
     }
     return session;
 }
 
+static void
+http_session_destroy(void *arg)
+{
+    http_session_t *session = arg;
+    if (NULL != session->body) {
+        evbuffer_free(session->body);
+        session->body = NULL;
+    }
+}
+
 void
 http_session_free(http_session_t *session)
 {
     if (NULL != session) {
-        if (NULL != session->body) {
-            evbuffer_free(session->body);
-            session->body = NULL;
-        }
+        pool_t *pool = http_service_http_session_pool();
         channel_free(session->channel);
         session->channel = NULL;
-        free(session);
+        memacct_release(session->memacct, MEMACCT_HTTP_SESSION, sizeof(http_session_t) + session->charged);
+        if (NULL != session->body) {
+            /* chains go back to allocator, buffer itself is kept */
+            evbuffer_drain(session->body, evbuffer_get_length(session->body));
+        }
+        if (NULL == pool || !pool_put(pool, session)) {
+            http_session_destroy(session);
+            free(session);
+        }
     }
 }
 
+void
+http_session_pool_init(pool_t *pool, size_t max)
+{
+    pool_init(pool, sizeof(http_session_t), max, http_session_destroy);
+}
+
 void
 http_session_callbacks_set(http_session_t *session, http_callbacks_t *cbs)
 {
     session->cbs = *cbs;
 }
+
+bool
+http_session_is_idle(http_session_t *session)
+{
+    return (HTTP_MESSAGE_BEGIN == session->state) &&
+           (0 == channel_get_input_length(session->channel));
+}
+
+bool
+http_session_is_flushed(http_session_t *session)
+{
+    return (HTTP_MESSAGE_COMPLETE == session->state) &&
+           (0 == channel_get_output_length(session->channel));
+}
@@ -10,9 +10,11 @@ typedef void (*http_session_cb_t)(http_session_t *);
 typedef struct http_callbacks http_callbacks_t;
 
 struct http_callbacks {
+    http_session_cb_t message_begin; /**< first byte of message parsed */
     http_session_cb_t message_complete;
     http_session_cb_t connected;
     http_session_cb_t ready_to_close;
+    http_session_cb_t error; /**< connection failed, timed out or sent malformed message: master is removed, unless set (it is then up to callback) */
 };
 
 struct session;
@@ -23,6 +25,15 @@ http_session_new(struct session *master, io_channel_t *channel, int http_parser_
 void
 http_session_free(http_session_t *session);
 
+/**
+ * Sets up pool http sessions freed by a worker are kept in for
+ * reuse, along with their emptied message body buffer
+ * (@see http_service_http_session_pool).
+ */
+struct pool;
+void
+http_session_pool_init(struct pool *pool, size_t max);
+
 struct session *
 http_session_master(http_session_t *session);
 
@@ -33,6 +44,19 @@ http_session_body(http_session_t *session);
 void
 http_session_callbacks_set(http_session_t *session, http_callbacks_t *callbacks);
 
+/**
+ * Whether no byte of a new message was received yet.
+ */
+bool
+http_session_is_idle(http_session_t *session);
+
+/**
+ * Whether a whole message was received and
+ * nothing is left to write back.
+ */
+bool
+http_session_is_flushed(http_session_t *session);
+
 int
 http_request_write(http_session_t *session, http_request_t *request);
 
@@ -50,8 +50,13 @@ struct io_channel_accept_param {
 
 typedef struct io_channel io_channel_t;
 
+struct backpressure;
+
 typedef io_channel_t* (*io_channel_accept_t)(io_channel_accept_param_t *param);
+typedef io_channel_error_t (*io_channel_reject_t)(io_channel_accept_param_t *param, const unsigned char *buffer, size_t len);
 typedef io_channel_error_t (*io_channel_listen_t)(io_channel_t *, struct sockaddr_storage *sockaddr);
+typedef io_channel_error_t (*io_channel_listen_fd_t)(io_channel_t *, int fd);
+typedef int (*io_channel_get_fd_t)(io_channel_t *);
 typedef io_channel_error_t (*io_channel_connect_t)(io_channel_t *, struct sockaddr_storage *sockaddr);
 typedef io_channel_error_t (*io_channel_read_t)(io_channel_t *, unsigned char *buffer, size_t len);
 typedef io_channel_error_t (*io_channel_write_t)(io_channel_t *, const unsigned char *buffer, size_t len);
@@ -63,13 +68,18 @@ typedef size_t (*io_channel_get_input_length_t)(io_channel_t *);
 typedef size_t (*io_channel_get_output_length_t)(io_channel_t *);
 typedef size_t (*io_channel_get_write_low_wm_t)(io_channel_t *);
 typedef int (*io_channel_drain_input_t)(io_channel_t *, size_t len);
+typedef void (*io_channel_set_backpressure_t)(io_channel_t *, struct backpressure *);
+typedef bool (*io_channel_is_parked_t)(io_channel_t *);
 
 typedef struct io_channel_ops io_channel_ops_t;
 
 struct io_channel_ops {
     const char *name;
     io_channel_accept_t accept;
+    io_channel_reject_t reject;
     io_channel_listen_t listen;
+    io_channel_listen_fd_t listen_fd;
+    io_channel_get_fd_t get_fd;
     io_channel_connect_t connect;
     io_channel_read_t read;
     io_channel_write_t write;
@@ -81,6 +91,8 @@ struct io_channel_ops {
     io_channel_get_output_length_t get_output_length;
     io_channel_get_write_low_wm_t get_write_low_wm;
     io_channel_drain_input_t drain_input;
+    io_channel_set_backpressure_t set_backpressure;
+    io_channel_is_parked_t is_parked;
 };
 
 struct io_service;
@@ -90,6 +102,7 @@ struct io_channel {
     struct io_service *service;
     unsigned eof:1;
     void *ctx;
+    ilink_t link; /**< in list of its owner, if linked */
 };
 
 /* Helper Functions */
@@ -99,12 +112,38 @@ channel_accept(io_channel_t *channel, io_channel_accept_param_t *param)
     return channel->ops->accept(param);
 }
 
+/**
+ * Writes buffer to a connection being accepted and closes it
+ * right away, without allocating any channel for it.
+ */
+static inline io_channel_error_t
+channel_reject(io_channel_t *channel, io_channel_accept_param_t *param, const unsigned char *buffer, size_t len)
+{
+    return channel->ops->reject(param, buffer, len);
+}
+
 static inline io_channel_error_t
 channel_listen(io_channel_t *channel, struct sockaddr_storage *sockaddr)
 {
     return channel->ops->listen(channel, sockaddr);
 }
 
+/**
+ * Listens on an already bound socket (e.g. handed over
+ * by another process). Channel owns fd from now on.
+ */
+static inline io_channel_error_t
+channel_listen_fd(io_channel_t *channel, int fd)
+{
+    return channel->ops->listen_fd(channel, fd);
+}
+
+static inline int
+channel_get_fd(io_channel_t *channel)
+{
+    return channel->ops->get_fd(channel);
+}
+
 static inline io_channel_error_t
 channel_connect(io_channel_t *channel, struct sockaddr_storage *sockaddr)
 {
@@ -171,4 +210,31 @@ channel_drain_input(io_channel_t *channel, size_t len)
     return channel->ops->drain_input(channel, len);
 }
 
+/**
+ * Has channel account its buffers against budget of worker
+ * it runs on (@see backpressure.h), and connections accepted
+ * by a listening channel as well.
+ *
+ * Should be called before channel_connect or channel_listen.
+ */
+static inline void
+channel_set_backpressure(io_channel_t *channel, struct backpressure *backpressure)
+{
+    channel->ops->set_backpressure(channel, backpressure);
+}
+
+/**
+ * Whether accepted channel is parked: peer sent nothing yet, so
+ * channel holds no buffers. Once peer sends something (or closes),
+ * parked channel sets its buffers up and calls service read_cb,
+ * bytes being read into them right after, or event_cb with
+ * IO_CHANNEL_EVENT_ERROR if they could not be set up. Buffers
+ * of a parked channel should not be accessed before that.
+ */
+static inline bool
+channel_is_parked(io_channel_t *channel)
+{
+    return channel->ops->is_parked(channel);
+}
+
 #endif /* _TIGERA_IO_CHANNEL__H__ */
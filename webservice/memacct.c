@@ -0,0 +1,58 @@
+#include "includes.h"
+#include "memacct.h"
+
+typedef struct memacct_header memacct_header_t;
+
+/**
+ * Prepended to memacct_malloc allocations: keeps
+ * memory that follows it aligned as malloc does.
+ */
+struct memacct_header {
+    memacct_t *memacct; /**< charged, or NULL */
+    uint32_t tag;
+    uint32_t size;
+} __attribute__((aligned(16)));
+
+static const char *memacct_tag_names[MEMACCT_COUNT] = {
+    [MEMACCT_SESSION] = "session",
+    [MEMACCT_HTTP_SESSION] = "http_session",
+    [MEMACCT_TCP_SOCKET] = "tcp_socket",
+    [MEMACCT_DNS] = "dns",
+    [MEMACCT_JSON] = "json",
+    [MEMACCT_CACHE] = "cache"
+};
+
+const char *
+memacct_tag_name(memacct_tag_t tag)
+{
+    return (tag < MEMACCT_COUNT) ? memacct_tag_names[tag] : "unknown";
+}
+
+void *
+memacct_malloc(memacct_t *memacct, memacct_tag_t tag, size_t size)
+{
+    memacct_header_t *header = NULL;
+
+    if (size > UINT32_MAX - sizeof(memacct_header_t)) {
+        return NULL;
+    }
+    header = malloc(sizeof(memacct_header_t) + size);
+    if (NULL == header) {
+        return NULL;
+    }
+    header->memacct = memacct;
+    header->tag = tag;
+    header->size = sizeof(memacct_header_t) + size;
+    memacct_charge(memacct, tag, header->size);
+    return header + 1;
+}
+
+void
+memacct_free(void *ptr)
+{
+    if (NULL != ptr) {
+        memacct_header_t *header = (memacct_header_t *)ptr - 1;
+        memacct_release(header->memacct, header->tag, header->size);
+        free(header);
+    }
+}
@@ -0,0 +1,101 @@
+#ifndef _TIGERA_MEMACCT__H__
+#define _TIGERA_MEMACCT__H__
+
+#include "includes.h"
+
+/* Accounting of memory held by a worker, by subsystem: live and
+ * peak bytes of each of them, and of all of them against a budget
+ * worker sheds load past (@see http_service_set_memory_budget).
+ *
+ * Subsystems charge bytes they hold on to (objects, buffers) to
+ * account of worker running them (@see this_memacct), and release
+ * them from the same account. Charges to a NULL account (threads
+ * other than workers) do nothing.
+ *
+ * Not synchronized: meant for accounts owned by a single worker.
+ */
+
+#define MEMACCT_RESUME_PCT 90 /**< % of budget a worker past it must get under again */
+
+typedef enum memacct_tag memacct_tag_t;
+
+enum memacct_tag {
+     MEMACCT_SESSION      /**< client sessions */
+    ,MEMACCT_HTTP_SESSION /**< http sessions and message bodies */
+    ,MEMACCT_TCP_SOCKET   /**< sockets and their buffers */
+    ,MEMACCT_DNS          /**< dns answers cached */
+    ,MEMACCT_JSON         /**< upstream replies being decoded, and decoded */
+    ,MEMACCT_CACHE        /**< upstream replies cached */
+    ,MEMACCT_COUNT
+};
+
+typedef struct memacct memacct_t;
+
+struct memacct {
+    size_t live[MEMACCT_COUNT]; /**< bytes, per subsystem */
+    size_t peak[MEMACCT_COUNT]; /**< highest live bytes, per subsystem */
+    size_t total;               /**< live bytes of all subsystems */
+    size_t total_peak;
+    size_t budget;              /**< bytes, 0 means unlimited */
+    bool exceeded;              /**< whether budget was reached, and total not under MEMACCT_RESUME_PCT of it since */
+};
+
+static inline void
+memacct_charge(memacct_t *memacct, memacct_tag_t tag, size_t bytes)
+{
+    if (NULL != memacct) {
+        memacct->live[tag] += bytes;
+        if (memacct->live[tag] > memacct->peak[tag]) {
+            memacct->peak[tag] = memacct->live[tag];
+        }
+        memacct->total += bytes;
+        if (memacct->total > memacct->total_peak) {
+            memacct->total_peak = memacct->total;
+        }
+    }
+}
+
+static inline void
+memacct_release(memacct_t *memacct, memacct_tag_t tag, size_t bytes)
+{
+    if (NULL != memacct) {
+        memacct->live[tag] -= bytes;
+        memacct->total -= bytes;
+    }
+}
+
+/**
+ * Whether worker holds as much as its budget or, once it did,
+ * until it holds less than MEMACCT_RESUME_PCT of it (so that
+ * callers do not flap right at budget).
+ */
+static inline bool
+memacct_exceeded(memacct_t *memacct)
+{
+    if (NULL == memacct || 0 == memacct->budget) {
+        return false;
+    }
+    if (memacct->exceeded) {
+        memacct->exceeded = memacct->total >= memacct->budget * MEMACCT_RESUME_PCT / 100;
+    }
+    else {
+        memacct->exceeded = memacct->total >= memacct->budget;
+    }
+    return memacct->exceeded;
+}
+
+const char *
+memacct_tag_name(memacct_tag_t tag);
+
+/**
+ * Allocates size bytes charged to tag of memacct, for callers
+ * which do not know size when freeing (e.g. json allocator).
+ * Memory is freed with memacct_free, on the same thread.
+ */
+void *
+memacct_malloc(memacct_t *memacct, memacct_tag_t tag, size_t size);
+
+void
+memacct_free(void *ptr);
+
+#endif /* _TIGERA_MEMACCT__H__ */
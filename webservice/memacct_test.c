@@ -0,0 +1,75 @@
+#include "includes.h"
+#include "memacct.h"
+#include <assert.h>
+
+/* live and peak bytes, per subsystem and overall, against budget */
+static void
+test_charge(void)
+{
+    memacct_t memacct;
+    memset(&memacct, 0, sizeof(memacct));
+    memacct.budget = 1000;
+
+    memacct_charge(&memacct, MEMACCT_SESSION, 600);
+    memacct_charge(&memacct, MEMACCT_TCP_SOCKET, 300);
+    assert(!memacct_exceeded(&memacct));
+    memacct_charge(&memacct, MEMACCT_TCP_SOCKET, 100);
+    assert(memacct_exceeded(&memacct));
+
+    /* until under 90% of budget again */
+    memacct_release(&memacct, MEMACCT_TCP_SOCKET, 50);
+    assert(memacct_exceeded(&memacct));
+    memacct_charge(&memacct, MEMACCT_TCP_SOCKET, 50);
+    memacct_release(&memacct, MEMACCT_SESSION, 600);
+    assert(!memacct_exceeded(&memacct));
+    memacct_charge(&memacct, MEMACCT_SESSION, 550);
+    assert(!memacct_exceeded(&memacct));
+    memacct_release(&memacct, MEMACCT_SESSION, 550);
+    assert(0 == memacct.live[MEMACCT_SESSION] && 600 == memacct.peak[MEMACCT_SESSION]);
+    assert(400 == memacct.live[MEMACCT_TCP_SOCKET] && 400 == memacct.peak[MEMACCT_TCP_SOCKET]);
+    assert(400 == memacct.total && 1000 == memacct.total_peak);
+
+    /* unlimited */
+    memacct.budget = 0;
+    memacct_charge(&memacct, MEMACCT_CACHE, 1 << 30);
+    assert(!memacct_exceeded(&memacct));
+
+    /* off worker threads */
+    memacct_charge(NULL, MEMACCT_CACHE, 1);
+    memacct_release(NULL, MEMACCT_CACHE, 1);
+    assert(!memacct_exceeded(NULL));
+}
+
+/* allocations carry their account along, for frees not knowing size */
+static void
+test_malloc(void)
+{
+    memacct_t memacct;
+    char *p = NULL;
+    memset(&memacct, 0, sizeof(memacct));
+
+    p = memacct_malloc(&memacct, MEMACCT_JSON, 100);
+    assert(NULL != p);
+    assert(0 == (uintptr_t)p % 16);
+    memset(p, 0xff, 100);
+    assert(memacct.live[MEMACCT_JSON] >= 100);
+    assert(memacct.live[MEMACCT_JSON] == memacct.total);
+    memacct_free(p);
+    assert(0 == memacct.live[MEMACCT_JSON] && 0 == memacct.total);
+    assert(0 != memacct.peak[MEMACCT_JSON]);
+
+    p = memacct_malloc(NULL, MEMACCT_JSON, 10);
+    assert(NULL != p);
+    memacct_free(p);
+    memacct_free(NULL);
+
+    assert(0 == strcmp("json", memacct_tag_name(MEMACCT_JSON)));
+}
+
+int
+main(int argc, char **argv)
+{
+    test_charge();
+    test_malloc();
+    return 0;
+}
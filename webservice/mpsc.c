@@ -0,0 +1,108 @@
+#include "includes.h"
+#include "atomic.h"
+#include "mpsc.h"
+
+/**
+ * Dmitry Vyukov's bounded queue: slot sequence tells whether slot
+ * is free for position pos (seq == pos), holds message written at
+ * pos (seq == pos + 1), or still holds a message from previous lap.
+ */
+
+typedef struct mpsc_slot mpsc_slot_t;
+
+struct mpsc_slot {
+    size_t seq;
+    mpsc_fn_t fn;
+    void *arg;
+};
+
+struct mpsc_queue {
+    size_t tail __attribute__((aligned(64))); /**< next position producers claim */
+    size_t head __attribute__((aligned(64))); /**< next position consumer takes */
+    size_t mask;
+    mpsc_slot_t *slots;
+};
+
+mpsc_queue_t *
+mpsc_queue_new(size_t capacity)
+{
+    mpsc_queue_t *queue = NULL;
+    size_t size = 2;
+
+    while (size < capacity) {
+        size <<= 1;
+    }
+
+    if (0 != posix_memalign((void **)&queue, 64, sizeof(mpsc_queue_t))) {
+        return NULL;
+    }
+    memset(queue, 0, sizeof(mpsc_queue_t));
+
+    queue->slots = calloc(size, sizeof(mpsc_slot_t));
+    if (NULL == queue->slots) {
+        mpsc_queue_free(queue);
+        return NULL;
+    }
+    for (size_t i = 0; i < size; ++i) {
+        queue->slots[i].seq = i;
+    }
+    queue->mask = size - 1;
+    return queue;
+}
+
+void
+mpsc_queue_free(mpsc_queue_t *queue)
+{
+    if (NULL != queue) {
+        free(queue->slots);
+        queue->slots = NULL;
+        free(queue);
+    }
+}
+
+int
+mpsc_queue_push(mpsc_queue_t *queue, mpsc_fn_t fn, void *arg)
+{
+    mpsc_slot_t *slot = NULL;
+    size_t pos = __atomic_load_n(&queue->tail, __ATOMIC_RELAXED);
+
+    for (;;) {
+        slot = &queue->slots[pos & queue->mask];
+        intptr_t diff = (intptr_t)atomic_load_acquire(&slot->seq) - (intptr_t)pos;
+        if (0 == diff) {
+            if (__atomic_compare_exchange_n(&queue->tail, &pos, pos + 1, true,
+                                            __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+                break;
+            }
+        }
+        else if (diff < 0) {
+            /* slot still holds message from previous lap */
+            return -1;
+        }
+        else {
+            pos = __atomic_load_n(&queue->tail, __ATOMIC_RELAXED);
+        }
+    }
+
+    slot->fn = fn;
+    slot->arg = arg;
+    atomic_store_release(&slot->seq, pos + 1);
+    return 0;
+}
+
+int
+mpsc_queue_pop(mpsc_queue_t *queue, mpsc_fn_t *fn, void **arg)
+{
+    size_t pos = queue->head;
+    mpsc_slot_t *slot = &queue->slots[pos & queue->mask];
+
+    if (atomic_load_acquire(&slot->seq) != pos + 1) {
+        return -1;
+    }
+    *fn = slot->fn;
+    *arg = slot->arg;
+    /* frees slot for producers one lap ahead */
+    atomic_store_release(&slot->seq, pos + queue->mask + 1);
+    queue->head = pos + 1;
+    return 0;
+}
@@ -0,0 +1,42 @@
+#ifndef _TIGERA_MPSC__H__
+#define _TIGERA_MPSC__H__
+
+/* Bounded lock-free multi-producer single-consumer queue.
+ *
+ * Each slot carries a call (function and argument), so that
+ * messages never need any allocation. Producers claim slots
+ * with a CAS on tail; consumer owns head and takes no atomic
+ * read-modify-write at all.
+ */
+
+typedef struct mpsc_queue mpsc_queue_t;
+
+typedef void (*mpsc_fn_t)(void *);
+
+/**
+ * @param capacity # slots (rounded up to power of 2)
+ */
+mpsc_queue_t *
+mpsc_queue_new(size_t capacity);
+
+void
+mpsc_queue_free(mpsc_queue_t *queue);
+
+/**
+ * May be called from any thread.
+ *
+ * @return 0, if successfull. -1, if queue is full.
+ */
+int
+mpsc_queue_push(mpsc_queue_t *queue, mpsc_fn_t fn, void *arg);
+
+/**
+ * Should only be called by consumer thread.
+ *
+ * @return 0, if a message was taken. -1, if queue is empty
+ *         (or next message is still being written).
+ */
+int
+mpsc_queue_pop(mpsc_queue_t *queue, mpsc_fn_t *fn, void **arg);
+
+#endif /* _TIGERA_MPSC__H__ */
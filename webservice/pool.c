@@ -0,0 +1,52 @@
+#include "includes.h"
+#include "pool.h"
+
+void
+pool_init(pool_t *pool, size_t size, size_t max, pool_destroy_t destroy)
+{
+    memset(pool, 0, sizeof(*pool));
+    islist_init(&pool->objects);
+    pool->size = (size < sizeof(islink_t)) ? sizeof(islink_t) : size;
+    pool->max = max;
+    pool->destroy = destroy;
+}
+
+void
+pool_fini(pool_t *pool)
+{
+    islink_t *link = NULL;
+
+    while (NULL != (link = islist_pop_front(&pool->objects))) {
+        if (NULL != pool->destroy) {
+            pool->destroy(link);
+        }
+        free(link);
+    }
+    pool->count = 0;
+    pool->max = 0;
+}
+
+void *
+pool_get(pool_t *pool)
+{
+    islink_t *link = islist_pop_front(&pool->objects);
+
+    if (NULL != link) {
+        pool->count--;
+        pool->hits++;
+        return link;
+    }
+    pool->misses++;
+    return calloc(1, pool->size);
+}
+
+bool
+pool_put(pool_t *pool, void *object)
+{
+    if (pool->count >= pool->max) {
+        return false;
+    }
+    islist_push_front(&pool->objects, object);
+    pool->count++;
+    return true;
+}
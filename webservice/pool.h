@@ -0,0 +1,60 @@
+#ifndef _TIGERA_POOL__H__
+#define _TIGERA_POOL__H__
+
+#include "includes.h"
+
+/* Bounded free list of objects of a single size, kept for reuse
+ * instead of going back to allocator: objects of connections coming
+ * and going are recycled rather than allocated anew each time.
+ *
+ * Objects put back are linked through their first bytes: everything
+ * else in them (e.g. buffers they own) is left as it was, for callers
+ * to reuse. Objects allocated anew are zeroed.
+ *
+ * Not synchronized: meant for pools owned by a single worker.
+ */
+
+#define POOL_MAX 1024 /**< default # objects kept per pool */
+
+typedef void (*pool_destroy_t)(void *object);
+
+typedef struct pool pool_t;
+
+struct pool {
+    islist_t objects;       /**< objects put back */
+    size_t size;            /**< bytes per object */
+    size_t max;             /**< most objects kept, 0 keeps none */
+    size_t count;           /**< # objects kept */
+    size_t hits;            /**< # objects reused */
+    size_t misses;          /**< # objects allocated */
+    pool_destroy_t destroy; /**< frees what objects own, may be NULL */
+};
+
+/**
+ * @param size bytes per object, at least a pointer
+ * @param destroy called on objects freed by pool, before their memory
+ */
+void
+pool_init(pool_t *pool, size_t size, size_t max, pool_destroy_t destroy);
+
+/**
+ * Frees objects kept: pool keeps none from now on.
+ */
+void
+pool_fini(pool_t *pool);
+
+/**
+ * @return object put back, or a zeroed one, NULL on error
+ */
+void *
+pool_get(pool_t *pool);
+
+/**
+ * Keeps object for reuse.
+ *
+ * @return whether object was kept, otherwise caller frees it
+ */
+bool
+pool_put(pool_t *pool, void *object);
+
+#endif /* _TIGERA_POOL__H__ */
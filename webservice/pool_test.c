@@ -0,0 +1,87 @@
+#include "includes.h"
+#include "pool.h"
+#include <assert.h>
+
+typedef struct object object_t;
+
+struct object {
+    void *link;
+    char *buffer; /**< owned, survives reuse */
+};
+
+static int destroyed = 0;
+
+static void
+object_destroy(void *arg)
+{
+    object_t *object = arg;
+    free(object->buffer);
+    destroyed++;
+}
+
+/* objects put back are handed out again, along with what they own */
+static void
+test_reuse(void)
+{
+    pool_t pool;
+    object_t *object = NULL;
+    object_t *other = NULL;
+
+    pool_init(&pool, sizeof(object_t), 2, object_destroy);
+
+    object = pool_get(&pool);
+    assert(NULL != object && NULL == object->buffer);
+    assert(1 == pool.misses && 0 == pool.hits);
+    object->buffer = malloc(16);
+    assert(pool_put(&pool, object));
+    assert(1 == pool.count);
+
+    other = pool_get(&pool);
+    assert(other == object && NULL != other->buffer);
+    assert(1 == pool.hits && 0 == pool.count);
+    assert(pool_put(&pool, other));
+
+    pool_fini(&pool);
+    assert(1 == destroyed && 0 == pool.count);
+
+    /* keeps none once finalized */
+    object = pool_get(&pool);
+    assert(NULL != object);
+    assert(!pool_put(&pool, object));
+    free(object);
+}
+
+/* pool keeps at most max objects */
+static void
+test_max(void)
+{
+    pool_t pool;
+    void *objects[3];
+
+    pool_init(&pool, 1, 2, NULL);
+    assert(sizeof(void *) <= pool.size);
+    for (int i = 0; i < 3; ++i) {
+        objects[i] = pool_get(&pool);
+        assert(NULL != objects[i]);
+    }
+    assert(pool_put(&pool, objects[0]));
+    assert(pool_put(&pool, objects[1]));
+    assert(!pool_put(&pool, objects[2]));
+    free(objects[2]);
+    assert(2 == pool.count);
+    pool_fini(&pool);
+
+    /* keeps none */
+    pool_init(&pool, 8, 0, NULL);
+    objects[0] = pool_get(&pool);
+    assert(!pool_put(&pool, objects[0]));
+    free(objects[0]);
+}
+
+int
+main(int argc, char **argv)
+{
+    test_reuse();
+    test_max();
+    return 0;
+}
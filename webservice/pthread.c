@@ -1,5 +1,10 @@
+#define _GNU_SOURCE /**< cpu affinity extensions */
 #include "thread.h"
 #include "includes.h"
+#include <sched.h>
+#include <dirent.h>
+#include <sys/syscall.h>
+#include <linux/mempolicy.h>
 
 typedef struct thread_id thread_id_t;
 
@@ -10,6 +15,8 @@ struct thread_id {
 struct thread {
     pthread_t id;
     thread_fn_t fn;
+    int cpu;  /**< cpu thread is pinned to */
+    int node; /**< numa node thread allocates memory from */
 };
 
 struct thread_key {
@@ -46,6 +53,8 @@ thread_new(thread_fn_t fn)
     thread_t *thread = calloc(1, sizeof(thread_t));
     if (NULL != thread) {
         thread->fn = fn;
+        thread->cpu = THREAD_CPU_ANY;
+        thread->node = THREAD_NODE_ANY;
     }
     return thread;
 }
@@ -66,27 +75,72 @@ thread_routine(void *arg)
     thread_t *thread = thread_arg->thread;
     void *user_arg = thread_arg->user_arg;
     thread_arg_free(thread_arg);
+    if (THREAD_NODE_ANY != thread->node) {
+        /* best effort: on failure memory just comes from default policy */
+        thread_numa_node_prefer(thread->node);
+    }
     thread->fn(user_arg);
     pthread_exit(NULL);
 }
 
+int
+thread_set_affinity(thread_t *thread, int cpu)
+{
+    if (THREAD_CPU_ANY != cpu && (cpu < 0 || cpu >= CPU_SETSIZE)) {
+        return -1;
+    }
+    thread->cpu = cpu;
+    return 0;
+}
+
+int
+thread_set_numa_node(thread_t *thread, int node)
+{
+    if (THREAD_NODE_ANY != node && (node < 0 || node >= sizeof(unsigned long) * 8)) {
+        return -1;
+    }
+    thread->node = node;
+    return 0;
+}
+
 int
 thread_start(thread_t *thread, void *arg)
 {
     int ret = 0;
-    thread_arg_t *thread_arg = thread_arg_new();
+    pthread_attr_t attr;
+    thread_arg_t *thread_arg = NULL;
+
+    if (0 != pthread_attr_init(&attr)) {
+        return -1;
+    }
+
+    /* pinning from creation makes thread first touch its stack
+     * and allocator arena already on the target cpu
+     */
+    if (THREAD_CPU_ANY != thread->cpu) {
+        cpu_set_t cpuset;
+        CPU_ZERO(&cpuset);
+        CPU_SET(thread->cpu, &cpuset);
+        if (0 != pthread_attr_setaffinity_np(&attr, sizeof(cpuset), &cpuset)) {
+            goto error;
+        }
+    }
+
+    thread_arg = thread_arg_new();
     if (NULL == thread_arg) {
         goto error;
     }
     thread_arg->thread = thread;
     thread_arg->user_arg = arg;
-    ret = pthread_create(&thread->id, NULL, thread_routine, thread_arg);
+    ret = pthread_create(&thread->id, &attr, thread_routine, thread_arg);
     if (0 != ret) {
         goto error;
     }
+    pthread_attr_destroy(&attr);
     return 0;
 
 error:
+    pthread_attr_destroy(&attr);
     thread_arg_free(thread_arg);
     return -1; 
 }
@@ -116,6 +170,96 @@ thread_id_free(thread_id_t *thread_id)
     free(thread_id);
 }
 
+int
+thread_cpus_available(int *cpus, int max)
+{
+    int n = 0;
+    cpu_set_t cpuset;
+
+    /* affinity mask of this process is already restricted
+     * by its cgroup cpuset (and by taskset, if any)
+     */
+    CPU_ZERO(&cpuset);
+    if (0 != sched_getaffinity(0, sizeof(cpuset), &cpuset)) {
+        return -1;
+    }
+
+    for (int cpu = 0; cpu < CPU_SETSIZE && n < max; ++cpu) {
+        if (CPU_ISSET(cpu, &cpuset)) {
+            cpus[n++] = cpu;
+        }
+    }
+    return n;
+}
+
+int
+thread_cpu_numa_node(int cpu)
+{
+    int node = THREAD_NODE_ANY;
+    char path[64];
+    struct dirent *entry = NULL;
+    DIR *dir = NULL;
+
+    /* sysfs exposes a "node<N>" link inside each cpu directory */
+    snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d", cpu);
+    dir = opendir(path);
+    if (NULL == dir) {
+        return THREAD_NODE_ANY;
+    }
+    while (NULL != (entry = readdir(dir))) {
+        if (1 == sscanf(entry->d_name, "node%d", &node)) {
+            break;
+        }
+        node = THREAD_NODE_ANY;
+    }
+    closedir(dir);
+    return node;
+}
+
+int
+thread_numa_node_prefer(int node)
+{
+    unsigned long nodemask = 0;
+    long ret;
+
+    if (THREAD_NODE_ANY == node) {
+        ret = syscall(SYS_set_mempolicy, MPOL_DEFAULT, NULL, 0);
+    }
+    else {
+        if (node < 0 || node >= sizeof(nodemask) * 8) {
+            return -1;
+        }
+        nodemask = 1UL << node;
+        ret = syscall(SYS_set_mempolicy, MPOL_PREFERRED, &nodemask, sizeof(nodemask) * 8);
+    }
+    if (0 != ret) {
+        return -1;
+    }
+    return 0;
+}
+
+int
+thread_numa_policy_save(thread_numa_policy_t *policy)
+{
+    memset(policy, 0, sizeof(thread_numa_policy_t));
+    if (0 != syscall(SYS_get_mempolicy, &policy->mode, policy->nodemask, THREAD_MAX_NODES, NULL, 0)) {
+        return -1;
+    }
+    return 0;
+}
+
+int
+thread_numa_policy_restore(const thread_numa_policy_t *policy)
+{
+    /* default policy takes no nodes */
+    const unsigned long *nodemask = (MPOL_DEFAULT == policy->mode) ? NULL : policy->nodemask;
+
+    if (0 != syscall(SYS_set_mempolicy, policy->mode, nodemask, THREAD_MAX_NODES)) {
+        return -1;
+    }
+    return 0;
+}
+
 thread_key_t *
 thread_key_new(void)
 {
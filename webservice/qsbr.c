@@ -0,0 +1,261 @@
+#include "includes.h"
+#include "atomic.h"
+#include "mutex.h"
+#include "thread.h"
+#include "qsbr.h"
+
+/**
+ * Global epoch is bumped on every retire: retired data is tagged
+ * with epoch it was retired at, and can be freed once every online
+ * reader announced a quiescent state after that (its own epoch is
+ * then greater than data's one).
+ */
+
+#define QSBR_EPOCH_OFFLINE  0 /**< reader epoch while not holding references */
+#define QSBR_EPOCH_FIRST    1
+#define QSBR_EPOCH_MAX      ((atomic_t)(~0UL >> 1))
+
+#define QSBR_SYNCHRONIZE_WAIT_US 1000
+
+typedef struct qsbr_retired qsbr_retired_t;
+
+struct qsbr_retired {
+    qsbr_retired_t *next;
+    void *ptr;
+    qsbr_free_t free_fn;
+    atomic_t epoch;
+};
+
+typedef struct qsbr_reader qsbr_reader_t;
+
+/* one cache line per reader: quiescent states never contend */
+struct qsbr_reader {
+    atomic_t epoch;          /**< last global epoch seen quiescent */
+    bool used;
+    qsbr_retired_t *retired; /**< in retire (epoch) order */
+    qsbr_retired_t **tail;
+} __attribute__((aligned(64)));
+
+struct qsbr {
+    atomic_t epoch;
+    mutex_t *mutex;        /**< serializes (un)registration only */
+    thread_key_t *key;     /**< calling thread reader */
+    int nr_readers;        /**< high watermark of used slots */
+    qsbr_reader_t readers[QSBR_MAX_THREADS];
+};
+
+qsbr_t *
+qsbr_new(void)
+{
+    qsbr_t *qsbr = NULL;
+
+    if (0 != posix_memalign((void **)&qsbr, 64, sizeof(qsbr_t))) {
+        return NULL;
+    }
+    memset(qsbr, 0, sizeof(qsbr_t));
+    qsbr->epoch = QSBR_EPOCH_FIRST;
+
+    qsbr->mutex = mutex_new();
+    if (NULL == qsbr->mutex) {
+        goto error;
+    }
+    qsbr->key = thread_key_new();
+    if (NULL == qsbr->key) {
+        goto error;
+    }
+    return qsbr;
+
+error:
+    qsbr_free(qsbr);
+    return NULL;
+}
+
+static void
+_qsbr_reclaim(qsbr_reader_t *reader, atomic_t epoch)
+{
+    qsbr_retired_t *retired = NULL;
+
+    while (NULL != (retired = reader->retired) && retired->epoch < epoch) {
+        reader->retired = retired->next;
+        retired->free_fn(retired->ptr);
+        free(retired);
+    }
+    if (NULL == reader->retired) {
+        reader->tail = &reader->retired;
+    }
+}
+
+void
+qsbr_free(qsbr_t *qsbr)
+{
+    if (NULL != qsbr) {
+        for (int i = 0; i < qsbr->nr_readers; ++i) {
+            if (NULL != qsbr->readers[i].tail) {
+                _qsbr_reclaim(&qsbr->readers[i], QSBR_EPOCH_MAX);
+            }
+        }
+        thread_key_free(qsbr->key);
+        mutex_free(qsbr->mutex);
+        free(qsbr);
+    }
+}
+
+/* oldest epoch seen by online readers, or current one if none online */
+static atomic_t
+_qsbr_min_epoch(qsbr_t *qsbr)
+{
+    atomic_t min = 0;
+    int nr_readers = 0;
+
+    /* pairs with qsbr_online fence */
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    min = atomic_load_acquire(&qsbr->epoch);
+    nr_readers = atomic_load_acquire(&qsbr->nr_readers);
+
+    for (int i = 0; i < nr_readers; ++i) {
+        atomic_t epoch = atomic_load_acquire(&qsbr->readers[i].epoch);
+        if (QSBR_EPOCH_OFFLINE != epoch && epoch < min) {
+            min = epoch;
+        }
+    }
+    return min;
+}
+
+int
+qsbr_register(qsbr_t *qsbr)
+{
+    qsbr_reader_t *reader = NULL;
+
+    mutex_lock(qsbr->mutex);
+    for (int i = 0; i < QSBR_MAX_THREADS; ++i) {
+        if (!qsbr->readers[i].used) {
+            reader = &qsbr->readers[i];
+            reader->used = true;
+            reader->retired = NULL;
+            reader->tail = &reader->retired;
+            if (i >= qsbr->nr_readers) {
+                atomic_store_release(&qsbr->nr_readers, i + 1);
+            }
+            break;
+        }
+    }
+    mutex_unlock(qsbr->mutex);
+
+    if (NULL == reader) {
+        fprintf(stderr, "%s: too many readers\n", __func__);
+        return -1;
+    }
+    if (0 != thread_key_set(qsbr->key, reader)) {
+        mutex_lock(qsbr->mutex);
+        atomic_store_release(&reader->epoch, QSBR_EPOCH_OFFLINE);
+        reader->used = false;
+        mutex_unlock(qsbr->mutex);
+        return -1;
+    }
+    qsbr_online(qsbr);
+    return 0;
+}
+
+void
+qsbr_unregister(qsbr_t *qsbr)
+{
+    qsbr_reader_t *reader = thread_key_get(qsbr->key);
+
+    if (NULL != reader) {
+        atomic_store_release(&reader->epoch, QSBR_EPOCH_OFFLINE);
+        if (NULL != reader->retired) {
+            qsbr_synchronize(qsbr);
+            _qsbr_reclaim(reader, QSBR_EPOCH_MAX);
+        }
+        thread_key_set(qsbr->key, NULL);
+
+        mutex_lock(qsbr->mutex);
+        reader->used = false;
+        mutex_unlock(qsbr->mutex);
+    }
+}
+
+void
+qsbr_quiescent(qsbr_t *qsbr)
+{
+    qsbr_reader_t *reader = thread_key_get(qsbr->key);
+
+    if (NULL != reader) {
+        /* release: accesses done so far complete before writers
+         * can see this reader moved on
+         */
+        atomic_store_release(&reader->epoch, atomic_load_acquire(&qsbr->epoch));
+        if (NULL != reader->retired) {
+            _qsbr_reclaim(reader, _qsbr_min_epoch(qsbr));
+        }
+    }
+}
+
+void
+qsbr_offline(qsbr_t *qsbr)
+{
+    qsbr_reader_t *reader = thread_key_get(qsbr->key);
+
+    if (NULL != reader) {
+        atomic_store_release(&reader->epoch, QSBR_EPOCH_OFFLINE);
+    }
+}
+
+void
+qsbr_online(qsbr_t *qsbr)
+{
+    qsbr_reader_t *reader = thread_key_get(qsbr->key);
+
+    if (NULL != reader) {
+        /* must be visible to writers before any shared data is read */
+        atomic_store_release(&reader->epoch, atomic_load_acquire(&qsbr->epoch));
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    }
+}
+
+void
+qsbr_retire(qsbr_t *qsbr, void *ptr, qsbr_free_t free_fn)
+{
+    qsbr_reader_t *reader = thread_key_get(qsbr->key);
+    qsbr_retired_t *retired = NULL;
+
+    if (NULL != reader) {
+        retired = malloc(sizeof(qsbr_retired_t));
+    }
+    if (NULL == retired) {
+        /* not a reader (or out of memory): wait grace period here */
+        qsbr_synchronize(qsbr);
+        free_fn(ptr);
+        return;
+    }
+
+    retired->next = NULL;
+    retired->ptr = ptr;
+    retired->free_fn = free_fn;
+    /* ptr was unlinked before: readers seeing a newer epoch can't reach it */
+    retired->epoch = __atomic_fetch_add(&qsbr->epoch, 1, __ATOMIC_SEQ_CST);
+    *reader->tail = retired;
+    reader->tail = &retired->next;
+}
+
+void
+qsbr_synchronize(qsbr_t *qsbr)
+{
+    qsbr_reader_t *self = thread_key_get(qsbr->key);
+    atomic_t epoch = __atomic_fetch_add(&qsbr->epoch, 1, __ATOMIC_SEQ_CST);
+    int nr_readers = 0;
+
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    nr_readers = atomic_load_acquire(&qsbr->nr_readers);
+    for (int i = 0; i < nr_readers; ++i) {
+        qsbr_reader_t *reader = &qsbr->readers[i];
+        atomic_t seen;
+        if (reader == self) {
+            continue;
+        }
+        while (QSBR_EPOCH_OFFLINE != (seen = atomic_load_acquire(&reader->epoch)) &&
+               seen <= epoch) {
+            usleep(QSBR_SYNCHRONIZE_WAIT_US);
+        }
+    }
+}
@@ -0,0 +1,78 @@
+#ifndef _TIGERA_QSBR__H__
+#define _TIGERA_QSBR__H__
+
+/* Quiescent-State-Based memory Reclamation.
+ *
+ * Readers access shared data without any lock and periodically
+ * announce a quiescent state: a point where they hold no reference
+ * to shared data (for workers, in between event loop iterations).
+ *
+ * Writers unlink data and retire it instead of freeing it: retired
+ * data is only freed once every online reader went through a
+ * quiescent state, so that no reader can still be using it.
+ */
+
+typedef struct qsbr qsbr_t;
+
+typedef void (*qsbr_free_t)(void *);
+
+#define QSBR_MAX_THREADS    256
+
+qsbr_t *
+qsbr_new(void);
+
+/**
+ * Should only be called once no thread is registered.
+ * Data still retired is freed.
+ */
+void
+qsbr_free(qsbr_t *qsbr);
+
+/**
+ * Registers calling thread as an online reader.
+ *
+ * @return 0, if successfull. -1, otherwise.
+ */
+int
+qsbr_register(qsbr_t *qsbr);
+
+/**
+ * Unregisters calling thread, freeing data it retired
+ * (waits for a grace period if needed).
+ */
+void
+qsbr_unregister(qsbr_t *qsbr);
+
+/**
+ * Announces calling thread holds no reference to shared data
+ * and frees data it retired whose grace period is over.
+ */
+void
+qsbr_quiescent(qsbr_t *qsbr);
+
+/**
+ * Calling thread holds no reference until qsbr_online: it is
+ * not waited for (e.g. while blocking for a long time).
+ */
+void
+qsbr_offline(qsbr_t *qsbr);
+
+void
+qsbr_online(qsbr_t *qsbr);
+
+/**
+ * Frees ptr with free_fn once every online reader went through
+ * a quiescent state. Calling thread should be registered,
+ * otherwise it waits for grace period itself.
+ */
+void
+qsbr_retire(qsbr_t *qsbr, void *ptr, qsbr_free_t free_fn);
+
+/**
+ * Waits until every other online reader went through a
+ * quiescent state. Calling thread should not hold references.
+ */
+void
+qsbr_synchronize(qsbr_t *qsbr);
+
+#endif /* _TIGERA_QSBR__H__ */
@@ -2,89 +2,151 @@
 #define _TIGERA_REFERENCE__H__
 
 #include "includes.h"
+#include "atomic.h"
 
-typedef void (*free_fn_t)(void *);
+/* Reference counting embedded in the object it tracks:
+ *
+ *     struct object { ...; reference_t ref; };
+ *     object_t *object = downcast(ref, object_t, ref);
+ *
+ * Strong references keep object usable: once last one is dropped,
+ * release is called (object should free its resources). Weak
+ * references only keep object memory around, so that holders can
+ * tell object is gone: once last weak reference is dropped too,
+ * free_fn is called. Strong references altogether hold one weak one.
+ *
+ * reference_* functions are atomic, so that objects can be shared
+ * between workers: dropping a reference releases accesses made
+ * through it to whoever drops last one. reference_local_* ones
+ * are cheaper, for objects confined to a single thread. An object
+ * should be handled with one family only.
+ */
 
 typedef struct reference reference_t;
 
+typedef void (*reference_fn_t)(reference_t *ref);
+
 struct reference {
-    void *ptr;
-    int refcnt;
-    int weak_refcnt;
-    free_fn_t free_fn;
+    atomic_t refcnt;
+    atomic_t weak_refcnt;
+    reference_fn_t release; /**< last strong reference dropped */
+    reference_fn_t free_fn; /**< last weak reference dropped */
 };
 
-static inline reference_t *
-reference_new(void *ptr, free_fn_t free_fn)
+/**
+ * Initializes reference with one strong reference held by caller.
+ *
+ * @param release may be NULL
+ * @param free_fn may be NULL (object memory is not owned)
+ */
+static inline void
+reference_init(reference_t *ref, reference_fn_t release, reference_fn_t free_fn)
+{
+    ref->refcnt = 1;
+    ref->weak_refcnt = 1;
+    ref->release = release;
+    ref->free_fn = free_fn;
+}
+
+/* atomic variant */
+
+static inline void
+reference_inc(reference_t *ref)
+{
+    atomic_inc_relaxed(&ref->refcnt);
+}
+
+static inline void
+reference_weak_inc(reference_t *ref)
+{
+    atomic_inc_relaxed(&ref->weak_refcnt);
+}
+
+static inline void
+reference_weak_dec(reference_t *ref)
 {
-    reference_t *ref = calloc(1, sizeof(*ref));
-    if (NULL != ref) {
-        ref->ptr = ptr;
-        ref->refcnt = 1;
-        ref->free_fn = free_fn;
+    if (0 == atomic_dec_release(&ref->weak_refcnt)) {
+        atomic_fence_acquire();
+        if (NULL != ref->free_fn) {
+            ref->free_fn(ref);
+        }
     }
-    return ref;
 }
 
-static inline int 
+/**
+ * Drops a strong reference: ref must not be used afterwards.
+ */
+static inline void
 reference_dec(reference_t *ref)
 {
-    if (ref != NULL) {
-        if (--ref->refcnt == 0) {
-            if (ref->free_fn) {
-                ref->free_fn(ref->ptr);
-            }
-            ref->ptr = NULL;
-            if (ref->weak_refcnt == 0) {
-                free(ref);
-            }
-            return 0;
+    if (0 == atomic_dec_release(&ref->refcnt)) {
+        /* every access made through other references happened before */
+        atomic_fence_acquire();
+        if (NULL != ref->release) {
+            ref->release(ref);
         }
-        return ref->refcnt;
+        reference_weak_dec(ref);
     }
-    return 0;
 }
 
-static inline int 
-reference_weak_dec(reference_t *ref)
+/**
+ * Turns a weak reference into a strong one (weak one is kept).
+ *
+ * @return false if object is gone.
+ */
+static inline bool
+reference_upgrade(reference_t *ref)
 {
-    if (ref != NULL) {
-        if (--ref->weak_refcnt == 0) {
-            if (ref->ptr == NULL) {
-                free(ref);
-            }
-            return 0;
+    atomic_t refcnt = atomic_load_acquire(&ref->refcnt);
+    while (0 != refcnt) {
+        if (atomic_cas(&ref->refcnt, &refcnt, refcnt + 1)) {
+            return true;
         }
-        return ref->weak_refcnt;
     }
-    return 0;
+    return false;
 }
 
-static inline int
-reference_inc(reference_t *ref)
+/* non-atomic variant, for thread-confined objects */
+
+static inline void
+reference_local_inc(reference_t *ref)
 {
-    if (ref != NULL) {
-        return ++ref->refcnt;
-    }
-    return 0;
+    ref->refcnt++;
 }
 
-static inline int
-reference_weak_inc(reference_t *ref)
+static inline void
+reference_local_weak_inc(reference_t *ref)
 {
-    if (ref != NULL) {
-        return ++ref->weak_refcnt;
+    ref->weak_refcnt++;
+}
+
+static inline void
+reference_local_weak_dec(reference_t *ref)
+{
+    if (0 == --ref->weak_refcnt && NULL != ref->free_fn) {
+        ref->free_fn(ref);
     }
-    return 0;
 }
 
-static inline void *
-reference_get(reference_t *ref)
+static inline void
+reference_local_dec(reference_t *ref)
 {
-    if (ref != NULL) {
-        return ref->ptr;
+    if (0 == --ref->refcnt) {
+        if (NULL != ref->release) {
+            ref->release(ref);
+        }
+        reference_local_weak_dec(ref);
     }
-    return NULL;
+}
+
+/**
+ * Whether object is still usable: weak reference holders
+ * of thread-confined objects check this before using it.
+ */
+static inline bool
+reference_local_alive(reference_t *ref)
+{
+    return 0 != ref->refcnt;
 }
 
 #endif /* _TIGERA_REFERENCE__H_ */
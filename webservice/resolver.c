@@ -0,0 +1,887 @@
+#include "includes.h"
+#include "libs.h"
+#include "atomic.h"
+#include "reference.h"
+#include "worker.h"
+#include "qsbr.h"
+#include "hashtable.h"
+#include "swisstable.h"
+#include "resolver.h"
+#include "memacct.h"
+#include <time.h>
+#include <ctype.h>
+
+typedef struct resolver_waiter resolver_waiter_t;
+
+/**
+ * Request of a worker, handed over to shared resolver thread and
+ * back to worker along with its answer. Also carries answers being
+ * published to worker caches (without callback).
+ */
+struct resolver_waiter {
+    islink_t link;           /**< in query waiters */
+    resolver_t *resolver;
+    worker_t *worker;        /**< answer is delivered to */
+    resolver_cache_t *cache; /**< answer is stored in, or NULL */
+    resolver_cb_t cb;        /**< NULL when only publishing */
+    void *arg;
+    resolver_answer_t *answer;
+    bool resolving;          /**< whether evdns_getaddrinfo is still being called */
+    bool answered;           /**< whether answer was got */
+    char name[RESOLVER_NAME_MAX];
+};
+
+typedef struct resolver_query resolver_query_t;
+
+/**
+ * Query in flight on shared resolver thread, with
+ * requests of every worker waiting for it.
+ */
+struct resolver_query {
+    ilink_t link; /**< in resolver pending queries */
+    resolver_t *resolver;
+    islist_t waiters;
+    char name[RESOLVER_NAME_MAX];
+};
+
+typedef struct resolver_pin resolver_pin_t;
+
+/**
+ * Name resolved to addresses given upfront: its answer is read by
+ * workers without any lock while being replaced by refreshes, and
+ * replaced answers are retired (@see worker_qsbr).
+ */
+struct resolver_pin {
+    hashtable_link_t link; /**< in resolver pins */
+    islink_t next;         /**< in resolver pin list */
+    resolver_t *resolver;
+    resolver_answer_t *answer;
+    bool refreshing; /**< only touched by resolver thread */
+    char name[RESOLVER_NAME_MAX];
+};
+
+struct resolver {
+    worker_t *worker;          /**< resolver thread, if any */
+    char *nameserver;
+    bool shared;               /**< whether workers resolve on resolver thread */
+    ilist_t pending;           /**< queries in flight, only touched by shared resolver thread */
+    worker_t **workers;        /**< answers are published to */
+    resolver_cache_t **caches; /**< of workers, in same order */
+    int nworkers;
+    int maxworkers;
+    bool started;
+    bool stopped;              /**< answers are no longer delivered to workers */
+    hashtable_t *pins;         /**< by name, set before start: found by workers without any lock */
+    islist_t pin_list;         /**< same pins, walked by refreshes */
+    int npins;
+    unsigned refresh_ms;
+    struct event *ev_refresh;  /**< on resolver thread */
+    atomic_t queries;
+    atomic_t coalesced;
+    atomic_t published;
+    atomic_t failures;
+    atomic_t refreshes;
+    atomic_t refresh_failures;
+};
+
+/* names are case insensitive: FNV-1a over lowercase characters */
+static hash_t
+resolver_name_hash(const void *key)
+{
+    hash_t hash = 2166136261u;
+    for (const char *c = key; '\0' != *c; ++c) {
+        hash ^= (unsigned char)tolower((unsigned char)*c);
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+static inline uint64_t
+resolver_cache_hash(const char *const *name)
+{
+    return swisstable_mix(resolver_name_hash(*name));
+}
+
+static inline bool
+resolver_cache_eq(const char *const *a, const char *const *b)
+{
+    return 0 == strcasecmp(*a, *b);
+}
+
+/* name (of answer cached) to entry index */
+SWISSTABLE_DEFINE_HASH_EQ(resolver_cache_index, const char *, uint32_t, resolver_cache_hash, resolver_cache_eq)
+
+typedef struct resolver_entry resolver_entry_t;
+
+struct resolver_entry {
+    resolver_answer_t *answer; /**< NULL if slot is free */
+    uint64_t expires;          /**< ms */
+};
+
+struct resolver_cache {
+    resolver_cache_index_t *index;
+    resolver_entry_t entries[RESOLVER_CACHE_SIZE];
+    unsigned ttl_ms;
+    unsigned negative_ttl_ms;
+    size_t hits;
+    size_t misses;
+    size_t negative_hits;
+    size_t negative_stores;
+};
+
+static uint64_t
+resolver_now_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static void
+resolver_answer_dealloc(reference_t *ref)
+{
+    free(downcast(ref, resolver_answer_t, ref));
+}
+
+/* keeps A and AAAA addresses only, in order resolved */
+static resolver_answer_t *
+resolver_answer_new(const char *name, int error, struct evutil_addrinfo *addrinfo)
+{
+    resolver_answer_t *answer = calloc(1, sizeof(resolver_answer_t));
+    if (NULL != answer) {
+        struct evutil_addrinfo *ai = NULL;
+
+        reference_init(&answer->ref, NULL, resolver_answer_dealloc);
+        snprintf(answer->name, sizeof(answer->name), "%s", name);
+        answer->error = error;
+        for (ai = addrinfo; 0 == error && NULL != ai && answer->naddrs < RESOLVER_MAX_ADDRS; ai = ai->ai_next) {
+            if (AF_INET == ai->ai_family || AF_INET6 == ai->ai_family) {
+                memcpy(&answer->addrs[answer->naddrs++], ai->ai_addr, ai->ai_addrlen);
+            }
+        }
+        if (0 == error && 0 == answer->naddrs) {
+            answer->error = EVUTIL_EAI_NODATA;
+        }
+    }
+    return answer;
+}
+
+/* errors told by dns, as opposed to local ones */
+static bool
+resolver_answer_negative(resolver_answer_t *answer)
+{
+    switch (answer->error) {
+    case EVUTIL_EAI_NONAME: /* NXDOMAIN */
+    case EVUTIL_EAI_NODATA: /* no A nor AAAA */
+    case EVUTIL_EAI_FAIL:   /* SERVFAIL, REFUSED, ... */
+    case EVUTIL_EAI_AGAIN:  /* timed out */
+        return true;
+    default:
+        return false;
+    }
+}
+
+resolver_answer_t *
+resolver_answer_ref(resolver_answer_t *answer)
+{
+    if (NULL != answer) {
+        reference_inc(&answer->ref);
+    }
+    return answer;
+}
+
+void
+resolver_answer_free(resolver_answer_t *answer)
+{
+    if (NULL != answer) {
+        reference_dec(&answer->ref);
+    }
+}
+
+static resolver_waiter_t *
+resolver_waiter_new(resolver_t *resolver, worker_t *worker, resolver_cache_t *cache, resolver_cb_t cb, void *arg)
+{
+    resolver_waiter_t *waiter = calloc(1, sizeof(resolver_waiter_t));
+    if (NULL != waiter) {
+        waiter->resolver = resolver;
+        waiter->worker = worker;
+        waiter->cache = cache;
+        waiter->cb = cb;
+        waiter->arg = arg;
+    }
+    return waiter;
+}
+
+/* runs on waiter worker thread */
+static void
+resolver_deliver(void *arg)
+{
+    resolver_waiter_t *waiter = arg;
+
+    if (NULL != waiter->cache && NULL != waiter->answer) {
+        resolver_cache_store(waiter->cache, waiter->answer);
+    }
+    if (NULL != waiter->cb) {
+        waiter->cb(waiter->answer, waiter->arg);
+    }
+    resolver_answer_free(waiter->answer);
+    free(waiter);
+}
+
+/**
+ * Hands answer over to waiter worker. Once stopped, workers
+ * no longer run calls: callback runs from calling thread, where
+ * callers can still tell they are gone.
+ */
+static void
+resolver_reply(resolver_waiter_t *waiter, resolver_answer_t *answer)
+{
+    waiter->answer = resolver_answer_ref(answer);
+    if (waiter->resolver->stopped) {
+        waiter->cache = NULL;
+        resolver_deliver(waiter);
+        return;
+    }
+    if (worker_call(waiter->worker, resolver_deliver, waiter) < 0) {
+        fprintf(stderr, "%s: error delivering answer for %s\n", __func__, waiter->name);
+        resolver_answer_free(waiter->answer);
+        free(waiter);
+    }
+}
+
+/* first ones to be handed over: stored before waiters get answer */
+static void
+resolver_publish(resolver_t *resolver, resolver_answer_t *answer)
+{
+    if ((0 != answer->error && !resolver_answer_negative(answer)) ||
+        0 == resolver->nworkers || resolver->stopped) {
+        return;
+    }
+    for (int i = 0; i < resolver->nworkers; ++i) {
+        resolver_waiter_t *waiter = resolver_waiter_new(resolver, resolver->workers[i], resolver->caches[i], NULL, NULL);
+        if (NULL == waiter) {
+            return;
+        }
+        snprintf(waiter->name, sizeof(waiter->name), "%s", answer->name);
+        resolver_reply(waiter, answer);
+    }
+    atomic_inc_relaxed(&resolver->published);
+}
+
+/* @return NULL if cb ran right away (e.g. numeric names, errors) */
+static struct evdns_getaddrinfo_request *
+resolver_getaddrinfo(struct evdns_base *dnsbase, const char *name, evdns_getaddrinfo_cb cb, void *arg)
+{
+    struct evutil_addrinfo hints;
+
+    memset(&hints, 0, sizeof(hints));
+    /* A and AAAA queried in parallel, for families host has addresses of */
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_flags = EVUTIL_AI_ADDRCONFIG;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_protocol = IPPROTO_TCP;
+
+    return evdns_getaddrinfo(dnsbase, name, NULL, &hints, cb, arg);
+}
+
+/* shared resolver thread: every waiter of query gets answer */
+static void
+resolver_query_done(int errcode, struct evutil_addrinfo *addr, void *arg)
+{
+    resolver_query_t *query = arg;
+    resolver_t *resolver = query->resolver;
+    resolver_answer_t *answer = resolver_answer_new(query->name, errcode, addr);
+    islink_t *link = NULL;
+
+    if (NULL != addr) {
+        evutil_freeaddrinfo(addr);
+    }
+    ilist_remove(&resolver->pending, &query->link);
+    if (0 != errcode) {
+        atomic_inc_relaxed(&resolver->failures);
+    }
+
+    if (NULL != answer) {
+        resolver_publish(resolver, answer);
+    }
+    while (NULL != (link = islist_pop_front(&query->waiters))) {
+        resolver_reply(downcast(link, resolver_waiter_t, link), answer);
+    }
+    resolver_answer_free(answer);
+    free(query);
+}
+
+static resolver_query_t *
+resolver_query_find(resolver_t *resolver, const char *name)
+{
+    ilink_t *link = NULL;
+
+    ilist_foreach(&resolver->pending, link) {
+        resolver_query_t *query = downcast(link, resolver_query_t, link);
+        if (0 == strcasecmp(query->name, name)) {
+            return query;
+        }
+    }
+    return NULL;
+}
+
+/* shared resolver thread: joins query in flight, if any */
+static void
+resolver_query(void *arg)
+{
+    resolver_waiter_t *waiter = arg;
+    resolver_t *resolver = waiter->resolver;
+    resolver_query_t *query = resolver_query_find(resolver, waiter->name);
+
+    if (NULL != query) {
+        atomic_inc_relaxed(&resolver->coalesced);
+        islist_push_front(&query->waiters, &waiter->link);
+        return;
+    }
+
+    query = calloc(1, sizeof(resolver_query_t));
+    if (NULL == query) {
+        resolver_reply(waiter, NULL);
+        return;
+    }
+    query->resolver = resolver;
+    islist_init(&query->waiters);
+    islist_push_front(&query->waiters, &waiter->link);
+    snprintf(query->name, sizeof(query->name), "%s", waiter->name);
+    ilist_push_back(&resolver->pending, &query->link);
+    atomic_inc_relaxed(&resolver->queries);
+
+    /* query might be done already */
+    resolver_getaddrinfo(this_dnsbase(), query->name, resolver_query_done, query);
+}
+
+/* worker thread, resolving on its own dns resolver */
+static void
+resolver_local_done(int errcode, struct evutil_addrinfo *addr, void *arg)
+{
+    resolver_waiter_t *waiter = arg;
+
+    waiter->answer = resolver_answer_new(waiter->name, errcode, addr);
+    waiter->answered = true;
+    if (0 != errcode) {
+        atomic_inc_relaxed(&waiter->resolver->failures);
+    }
+    if (waiter->resolver->stopped) {
+        /* worker dns resolver being freed: caches may be gone */
+        waiter->cache = NULL;
+    }
+    if (NULL != addr) {
+        evutil_freeaddrinfo(addr);
+    }
+    /* otherwise, resolver_resolve defers it */
+    if (!waiter->resolving) {
+        resolver_deliver(waiter);
+    }
+}
+
+static int
+resolver_pin_cmp(const void *value, const void *key)
+{
+    return strcasecmp(((const resolver_pin_t *)value)->name, key);
+}
+
+/* worker thread: answer remains valid until its next quiescent state */
+static resolver_answer_t *
+resolver_pin_lookup(resolver_t *resolver, const char *name)
+{
+    resolver_pin_t *pin = NULL;
+
+    if (0 == resolver->npins) {
+        return NULL;
+    }
+    pin = hashtable_find(resolver->pins, name);
+    return NULL != pin ? atomic_load_acquire(&pin->answer) : NULL;
+}
+
+static void
+resolver_answer_retired(void *answer)
+{
+    resolver_answer_free(answer);
+}
+
+/* resolver thread: pinned addresses are kept unless name resolves */
+static void
+resolver_pin_refreshed(int errcode, struct evutil_addrinfo *addr, void *arg)
+{
+    resolver_pin_t *pin = arg;
+    resolver_t *resolver = pin->resolver;
+    resolver_answer_t *answer = resolver_answer_new(pin->name, errcode, addr);
+    resolver_answer_t *old = NULL;
+
+    if (NULL != addr) {
+        evutil_freeaddrinfo(addr);
+    }
+    pin->refreshing = false;
+    if (resolver->stopped) {
+        /* dns resolver being freed */
+        resolver_answer_free(answer);
+        return;
+    }
+    if (NULL == answer || 0 != answer->error) {
+        fprintf(stderr, "%s: error refreshing %s, pinned addresses kept\n", __func__, pin->name);
+        atomic_inc_relaxed(&resolver->refresh_failures);
+        resolver_answer_free(answer);
+        return;
+    }
+    old = __atomic_exchange_n(&pin->answer, answer, __ATOMIC_ACQ_REL);
+    qsbr_retire(worker_qsbr(), old, resolver_answer_retired);
+    atomic_inc_relaxed(&resolver->refreshes);
+}
+
+static void
+resolver_refresh_cb(evutil_socket_t fd, short events, void *arg)
+{
+    resolver_t *resolver = arg;
+    islink_t *link = NULL;
+
+    islist_foreach(&resolver->pin_list, link) {
+        resolver_pin_t *pin = downcast(link, resolver_pin_t, next);
+        if (!pin->refreshing) {
+            pin->refreshing = true;
+            atomic_inc_relaxed(&resolver->queries);
+            resolver_getaddrinfo(this_dnsbase(), pin->name, resolver_pin_refreshed, pin);
+        }
+    }
+}
+
+/* resolver thread */
+static void
+resolver_refresh_start(void *arg)
+{
+    resolver_t *resolver = arg;
+    struct timeval period = { resolver->refresh_ms / 1000, (resolver->refresh_ms % 1000) * 1000 };
+
+    resolver->ev_refresh = event_new(this_event_base(), -1, EV_PERSIST, resolver_refresh_cb, resolver);
+    if (NULL == resolver->ev_refresh || event_add(resolver->ev_refresh, &period) < 0) {
+        fprintf(stderr, "%s: error arming refresh timer, pinned addresses are not refreshed\n", __func__);
+    }
+}
+
+static int
+resolver_refresh_stop(void *arg)
+{
+    resolver_t *resolver = arg;
+
+    if (NULL != resolver->ev_refresh) {
+        event_free(resolver->ev_refresh);
+        resolver->ev_refresh = NULL;
+    }
+    return 0;
+}
+
+int
+resolver_resolve(resolver_t *resolver, resolver_cache_t *cache, const char *name, resolver_cb_t cb, void *arg)
+{
+    worker_t *worker = this_worker();
+    resolver_answer_t *answer = NULL;
+    resolver_waiter_t *waiter = NULL;
+
+    if (NULL == worker || strlen(name) >= RESOLVER_NAME_MAX) {
+        return -1;
+    }
+    waiter = resolver_waiter_new(resolver, worker, cache, cb, arg);
+    if (NULL == waiter) {
+        return -1;
+    }
+    snprintf(waiter->name, sizeof(waiter->name), "%s", name);
+
+    answer = resolver_pin_lookup(resolver, name);
+    if (NULL == answer && NULL != cache) {
+        answer = resolver_cache_lookup(cache, name);
+    }
+    if (NULL != answer) {
+        waiter->answer = resolver_answer_ref(answer);
+        waiter->cache = NULL;
+        if (worker_call(worker, resolver_deliver, waiter) < 0) {
+            resolver_answer_free(waiter->answer);
+            free(waiter);
+            return -1;
+        }
+        return 0;
+    }
+
+    if (resolver->shared) {
+        if (worker_call(resolver->worker, resolver_query, waiter) < 0) {
+            free(waiter);
+            return -1;
+        }
+        return 0;
+    }
+
+    if (NULL == this_dnsbase()) {
+        free(waiter);
+        return -1;
+    }
+    atomic_inc_relaxed(&resolver->queries);
+    waiter->resolving = true;
+    resolver_getaddrinfo(this_dnsbase(), name, resolver_local_done, waiter);
+    waiter->resolving = false;
+    if (waiter->answered) {
+        /* callback must not run from within resolver_resolve */
+        if (worker_call(worker, resolver_deliver, waiter) < 0) {
+            resolver_answer_free(waiter->answer);
+            free(waiter);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/* resolver thread: resolves for workers, or refreshes pins */
+static int
+resolver_worker_new(resolver_t *resolver)
+{
+    resolver->worker = worker_new(resolver, resolver->nameserver, WORKER_CPU_ANY);
+    if (NULL == resolver->worker) {
+        return -1;
+    }
+    worker_set_epilogue(resolver->worker, resolver_refresh_stop);
+    return 0;
+}
+
+resolver_t *
+resolver_new(const char *nameserver, bool shared, int nworkers)
+{
+    resolver_t *resolver = calloc(1, sizeof(resolver_t));
+    if (NULL != resolver) {
+        ilist_init(&resolver->pending);
+        islist_init(&resolver->pin_list);
+        resolver->shared = shared;
+        resolver->pins = hashtable_new(resolver_pin_cmp, resolver_name_hash, NULL, offsetof(resolver_pin_t, link), RESOLVER_PIN_BUCKETS, 1);
+        if (NULL == resolver->pins) {
+            goto error;
+        }
+        /* pins are only added before start: lookups never wait for refreshes */
+        hashtable_set_qsbr(resolver->pins, worker_qsbr());
+        resolver->nameserver = strdup(nameserver);
+        if (NULL == resolver->nameserver) {
+            goto error;
+        }
+        if (!shared) {
+            return resolver;
+        }
+        resolver->workers = calloc(nworkers, sizeof(worker_t *));
+        resolver->caches = calloc(nworkers, sizeof(resolver_cache_t *));
+        if (NULL == resolver->workers || NULL == resolver->caches) {
+            goto error;
+        }
+        resolver->maxworkers = nworkers;
+        if (resolver_worker_new(resolver) < 0) {
+            goto error;
+        }
+    }
+    return resolver;
+
+error:
+    resolver_free(resolver);
+    return NULL;
+}
+
+void
+resolver_free(resolver_t *resolver)
+{
+    if (NULL != resolver) {
+        resolver_stop(resolver);
+        /* fails queries in flight */
+        worker_free(resolver->worker);
+        resolver->worker = NULL;
+        free(resolver->workers);
+        resolver->workers = NULL;
+        free(resolver->caches);
+        resolver->caches = NULL;
+        /* pins are freed along with list, table does not own them */
+        hashtable_free(resolver->pins);
+        resolver->pins = NULL;
+        islink_t *link = NULL;
+        while (NULL != (link = islist_pop_front(&resolver->pin_list))) {
+            resolver_pin_t *pin = downcast(link, resolver_pin_t, next);
+            resolver_answer_free(pin->answer);
+            free(pin);
+        }
+        free(resolver->nameserver);
+        resolver->nameserver = NULL;
+        free(resolver);
+    }
+}
+
+void
+resolver_add_worker(resolver_t *resolver, worker_t *worker, resolver_cache_t *cache)
+{
+    if (resolver->shared && NULL != cache && resolver->nworkers < resolver->maxworkers) {
+        resolver->workers[resolver->nworkers] = worker;
+        resolver->caches[resolver->nworkers] = cache;
+        resolver->nworkers++;
+    }
+}
+
+int
+resolver_start(resolver_t *resolver)
+{
+    bool refresh = (0 != resolver->npins && 0 != resolver->refresh_ms);
+
+    if (resolver->started) {
+        return 0;
+    }
+    if (NULL == resolver->worker && refresh && resolver_worker_new(resolver) < 0) {
+        return -1;
+    }
+    if (NULL == resolver->worker) {
+        return 0;
+    }
+    if (worker_start(resolver->worker) < 0) {
+        return -1;
+    }
+    resolver->started = true;
+    if (refresh && worker_call(resolver->worker, resolver_refresh_start, resolver) < 0) {
+        fprintf(stderr, "%s: error starting refreshes, pinned addresses are not refreshed\n", __func__);
+    }
+    return 0;
+}
+
+void
+resolver_set_refresh(resolver_t *resolver, unsigned period_ms)
+{
+    resolver->refresh_ms = period_ms;
+}
+
+int
+resolver_pin(resolver_t *resolver, const char *name, const char *addr)
+{
+    struct sockaddr_storage ss;
+    struct sockaddr_in *sin = (struct sockaddr_in *)&ss;
+    struct sockaddr_in6 *sin6 = (struct sockaddr_in6 *)&ss;
+    resolver_pin_t *pin = NULL;
+
+    memset(&ss, 0, sizeof(ss));
+    if (1 == evutil_inet_pton(AF_INET, addr, &sin->sin_addr)) {
+        sin->sin_family = AF_INET;
+    }
+    else if (1 == evutil_inet_pton(AF_INET6, addr, &sin6->sin6_addr)) {
+        sin6->sin6_family = AF_INET6;
+    }
+    else {
+        fprintf(stderr, "%s: invalid address %s for %s\n", __func__, addr, name);
+        return -1;
+    }
+    if (strlen(name) >= RESOLVER_NAME_MAX) {
+        return -1;
+    }
+
+    pin = hashtable_find(resolver->pins, name);
+    if (NULL == pin) {
+        pin = calloc(1, sizeof(resolver_pin_t));
+        if (NULL == pin) {
+            return -1;
+        }
+        pin->answer = resolver_answer_new(name, 0, NULL);
+        if (NULL == pin->answer) {
+            free(pin);
+            return -1;
+        }
+        pin->answer->error = 0; /* addresses added below */
+        pin->resolver = resolver;
+        snprintf(pin->name, sizeof(pin->name), "%s", name);
+        if (HASHTABLE_E_SUCCESS != hashtable_add(resolver->pins, pin, pin->name)) {
+            resolver_answer_free(pin->answer);
+            free(pin);
+            return -1;
+        }
+        islist_push_front(&resolver->pin_list, &pin->next);
+        resolver->npins++;
+    }
+    /* not shared yet: answer can still be filled in */
+    if (pin->answer->naddrs < RESOLVER_MAX_ADDRS) {
+        pin->answer->addrs[pin->answer->naddrs++] = ss;
+    }
+    return 0;
+}
+
+int
+resolver_pin_hosts(resolver_t *resolver, const char *path)
+{
+    char line[1024];
+    int lineno = 0;
+    int ret = 0;
+    FILE *file = fopen(path, "r");
+
+    if (NULL == file) {
+        fprintf(stderr, "%s: error opening %s: %s\n", __func__, path, strerror(errno));
+        return -1;
+    }
+    /* address followed by names, '#' starts a comment */
+    while (0 == ret && NULL != fgets(line, sizeof(line), file)) {
+        char *save = NULL;
+        char *addr = NULL;
+        char *name = NULL;
+
+        lineno++;
+        line[strcspn(line, "#\n")] = '\0';
+        addr = strtok_r(line, " \t", &save);
+        if (NULL == addr) {
+            continue;
+        }
+        name = strtok_r(NULL, " \t", &save);
+        if (NULL == name) {
+            fprintf(stderr, "%s: %s:%d: no name for %s\n", __func__, path, lineno, addr);
+            ret = -1;
+        }
+        for (; 0 == ret && NULL != name; name = strtok_r(NULL, " \t", &save)) {
+            if (resolver_pin(resolver, name, addr) < 0) {
+                fprintf(stderr, "%s: %s:%d: error pinning %s\n", __func__, path, lineno, name);
+                ret = -1;
+            }
+        }
+    }
+    fclose(file);
+    return ret;
+}
+
+void
+resolver_stop(resolver_t *resolver)
+{
+    if (resolver->started) {
+        worker_stop(resolver->worker);
+        resolver->started = false;
+    }
+    resolver->stopped = true;
+}
+
+void
+resolver_get_stats(resolver_t *resolver, resolver_stats_t *stats)
+{
+    stats->queries = atomic_load_acquire(&resolver->queries);
+    stats->coalesced = atomic_load_acquire(&resolver->coalesced);
+    stats->published = atomic_load_acquire(&resolver->published);
+    stats->failures = atomic_load_acquire(&resolver->failures);
+    stats->refreshes = atomic_load_acquire(&resolver->refreshes);
+    stats->refresh_failures = atomic_load_acquire(&resolver->refresh_failures);
+}
+
+resolver_cache_t *
+resolver_cache_new(unsigned ttl_ms, unsigned negative_ttl_ms)
+{
+    resolver_cache_t *cache = calloc(1, sizeof(resolver_cache_t));
+    if (NULL != cache) {
+        cache->ttl_ms = ttl_ms;
+        cache->negative_ttl_ms = negative_ttl_ms;
+        cache->index = resolver_cache_index_new(RESOLVER_CACHE_SIZE);
+        if (NULL == cache->index) {
+            free(cache);
+            return NULL;
+        }
+    }
+    return cache;
+}
+
+/* answers held are charged to worker memory, shared ones included */
+static void
+resolver_entry_set(resolver_cache_t *cache, resolver_entry_t *entry, resolver_answer_t *answer)
+{
+    memacct_t *memacct = this_memacct();
+
+    if (NULL != entry->answer) {
+        const char *name = entry->answer->name;
+        resolver_cache_index_remove(cache->index, &name, NULL);
+        memacct_release(memacct, MEMACCT_DNS, sizeof(resolver_answer_t));
+        resolver_answer_free(entry->answer);
+        entry->answer = NULL;
+    }
+    if (NULL != answer) {
+        const char *name = answer->name;
+        /* fails out of memory only: answer is then just not cached */
+        if (HASHTABLE_E_SUCCESS != resolver_cache_index_add(cache->index, &name, entry - cache->entries)) {
+            return;
+        }
+        entry->answer = resolver_answer_ref(answer);
+        memacct_charge(memacct, MEMACCT_DNS, sizeof(resolver_answer_t));
+    }
+}
+
+void
+resolver_cache_free(resolver_cache_t *cache)
+{
+    if (NULL != cache) {
+        for (int i = 0; i < RESOLVER_CACHE_SIZE; ++i) {
+            resolver_entry_set(cache, &cache->entries[i], NULL);
+        }
+        resolver_cache_index_free(cache->index);
+        free(cache);
+    }
+}
+
+resolver_answer_t *
+resolver_cache_lookup(resolver_cache_t *cache, const char *name)
+{
+    uint32_t *idx = resolver_cache_index_find(cache->index, &name);
+
+    if (NULL != idx) {
+        resolver_entry_t *entry = &cache->entries[*idx];
+        if (resolver_now_ms() < entry->expires) {
+            cache->hits++;
+            if (0 != entry->answer->error) {
+                cache->negative_hits++;
+            }
+            return entry->answer;
+        }
+        resolver_entry_set(cache, entry, NULL);
+    }
+    cache->misses++;
+    return NULL;
+}
+
+/* replaces answer for same name, else a free slot, else the one expiring first */
+void
+resolver_cache_store(resolver_cache_t *cache, resolver_answer_t *answer)
+{
+    const char *name = answer->name;
+    resolver_entry_t *victim = NULL;
+    unsigned ttl_ms = cache->ttl_ms;
+    uint32_t *idx = NULL;
+
+    if (0 != answer->error) {
+        ttl_ms = resolver_answer_negative(answer) ? cache->negative_ttl_ms : 0;
+    }
+    if (0 == ttl_ms) {
+        return;
+    }
+    idx = resolver_cache_index_find(cache->index, &name);
+    if (NULL != idx) {
+        victim = &cache->entries[*idx];
+        if (victim->answer == answer) {
+            return; /* published, then delivered */
+        }
+    }
+    else {
+        /* stores only follow misses: slots are few, scanning them is fine */
+        for (int i = 0; i < RESOLVER_CACHE_SIZE; ++i) {
+            resolver_entry_t *entry = &cache->entries[i];
+            if (NULL == victim || (NULL != victim->answer &&
+                (NULL == entry->answer || entry->expires < victim->expires))) {
+                victim = entry;
+            }
+        }
+    }
+    resolver_entry_set(cache, victim, answer);
+    if (NULL == victim->answer) {
+        return;
+    }
+    victim->expires = resolver_now_ms() + ttl_ms;
+    if (0 != answer->error) {
+        cache->negative_stores++;
+    }
+}
+
+void
+resolver_cache_get_stats(resolver_cache_t *cache, resolver_cache_stats_t *stats)
+{
+    stats->size = resolver_cache_index_size(cache->index);
+    stats->hits = cache->hits;
+    stats->misses = cache->misses;
+    stats->negative_hits = cache->negative_hits;
+    stats->negative_stores = cache->negative_stores;
+}
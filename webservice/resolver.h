@@ -0,0 +1,197 @@
+#ifndef _TIGERA_RESOLVER__H__
+#define _TIGERA_RESOLVER__H__
+
+#include "includes.h"
+#include "reference.h"
+
+/* Resolution of upstream domain names (A and AAAA) on behalf
+ * of workers.
+ *
+ * By default each worker resolves on its own dns resolver. A
+ * shared resolver instead runs a thread of its own, owning the
+ * single dns resolver (one socket, one retry state) of all
+ * workers: requests and answers are handed over through worker
+ * mailboxes (@see worker_call), and identical queries in flight
+ * are coalesced into one.
+ *
+ * Answers are immutable and reference counted, so that workers
+ * share them. Each worker keeps answers it gets in a small cache
+ * of its own for a while; a shared resolver publishes every answer
+ * to the caches of all workers. Failures of dns (no such name, no
+ * addresses, server failure or timeout) are cached as well, for a
+ * shorter while, so that requests fail right away during outages
+ * rather than piling up on queries bound to fail.
+ *
+ * Names can also be pinned to addresses given upfront: they are
+ * answered without any query, and a resolver thread re-resolves
+ * them in background, replacing their addresses as a whole once
+ * resolved (pinned ones are kept while resolution fails).
+ */
+
+#define RESOLVER_NAME_MAX    256 /**< including terminating nul */
+#define RESOLVER_MAX_ADDRS   8   /**< # addresses kept per answer */
+#define RESOLVER_CACHE_SIZE  8   /**< # names cached per worker */
+#define RESOLVER_PIN_BUCKETS 16  /**< initial # buckets of pinned names, grown as needed */
+
+typedef struct resolver_answer resolver_answer_t;
+
+struct resolver_answer {
+    reference_t ref;
+    int error;     /**< evutil_getaddrinfo error, 0 if resolved */
+    size_t naddrs; /**< port of addresses is not set */
+    struct sockaddr_storage addrs[RESOLVER_MAX_ADDRS];
+    char name[RESOLVER_NAME_MAX];
+};
+
+/**
+ * @param answer borrowed (@see resolver_answer_ref to keep it),
+ *        NULL if it could not be allocated
+ */
+typedef void (*resolver_cb_t)(resolver_answer_t *answer, void *arg);
+
+typedef struct resolver resolver_t;
+
+typedef struct resolver_cache resolver_cache_t;
+
+typedef struct resolver_stats resolver_stats_t;
+
+struct resolver_stats {
+    size_t queries;   /**< # queries sent to dns server */
+    size_t coalesced; /**< # requests which joined a query in flight */
+    size_t published; /**< # answers published to worker caches */
+    size_t failures;  /**< # queries answered with an error */
+    size_t refreshes; /**< # pinned names re-resolved */
+    size_t refresh_failures;
+};
+
+typedef struct resolver_cache_stats resolver_cache_stats_t;
+
+struct resolver_cache_stats {
+    size_t size;
+    size_t hits;            /**< including negative ones */
+    size_t misses;
+    size_t negative_hits;   /**< # lookups answered with a cached error */
+    size_t negative_stores; /**< # errors cached */
+};
+
+struct worker;
+
+resolver_answer_t *
+resolver_answer_ref(resolver_answer_t *answer);
+
+/**
+ * Drops a reference to answer.
+ */
+void
+resolver_answer_free(resolver_answer_t *answer);
+
+/**
+ * @param nameserver dnsserver address and port (format "0.0.0.0:0")
+ *        resolver thread sends queries to
+ * @param shared whether workers resolve on resolver thread, rather
+ *        than on their own dns resolver
+ * @param nworkers # workers answers can be published to
+ */
+resolver_t *
+resolver_new(const char *nameserver, bool shared, int nworkers);
+
+/**
+ * Stops resolver thread, if not stopped yet. Requests
+ * still in flight get their callbacks run from calling thread.
+ */
+void
+resolver_free(resolver_t *resolver);
+
+/**
+ * Has shared resolver publish answers to cache, on worker
+ * thread. Does nothing for workers resolving on their own.
+ *
+ * Should be called before resolver_start.
+ */
+void
+resolver_add_worker(resolver_t *resolver, struct worker *worker, resolver_cache_t *cache);
+
+/**
+ * Pins name to address (IPv4 or IPv6): may be called again for
+ * further addresses of name.
+ *
+ * Should be called before resolver_start.
+ *
+ * @return 0, if successfull. -1, otherwise.
+ */
+int
+resolver_pin(resolver_t *resolver, const char *name, const char *addr);
+
+/**
+ * Pins names of hosts-style file: lines of an address followed
+ * by names, '#' starting comments.
+ *
+ * Should be called before resolver_start.
+ *
+ * @return 0, if successfull. -1, otherwise.
+ */
+int
+resolver_pin_hosts(resolver_t *resolver, const char *path);
+
+/**
+ * Sets how often pinned names are re-resolved, 0 (default)
+ * never does.
+ *
+ * Should be called before resolver_start.
+ */
+void
+resolver_set_refresh(resolver_t *resolver, unsigned period_ms);
+
+int
+resolver_start(resolver_t *resolver);
+
+/**
+ * Workers should be stopped first: answers are not
+ * delivered past this point.
+ */
+void
+resolver_stop(resolver_t *resolver);
+
+/**
+ * Resolves name for calling worker: cb(answer, arg) runs later on
+ * calling worker thread, never from within resolver_resolve. A
+ * pinned name, or a fresh answer in cache, is answered without
+ * any query, and answers got from a query are stored in cache.
+ *
+ * @param cache calling worker cache, or NULL
+ * @return 0, if cb is going to run. -1, otherwise.
+ */
+int
+resolver_resolve(resolver_t *resolver, resolver_cache_t *cache, const char *name, resolver_cb_t cb, void *arg);
+
+void
+resolver_get_stats(resolver_t *resolver, resolver_stats_t *stats);
+
+/**
+ * Per worker cache of answers, kept for ttl_ms after being
+ * stored. Answers carrying a dns error are kept for negative_ttl_ms
+ * instead, local errors (e.g. out of memory) are not cached.
+ * A ttl of 0 does not cache such answers.
+ *
+ * Not synchronized: meant for caches owned by a single worker.
+ */
+resolver_cache_t *
+resolver_cache_new(unsigned ttl_ms, unsigned negative_ttl_ms);
+
+void
+resolver_cache_free(resolver_cache_t *cache);
+
+/**
+ * @return fresh answer (borrowed), possibly carrying an
+ *         error, NULL if none
+ */
+resolver_answer_t *
+resolver_cache_lookup(resolver_cache_t *cache, const char *name);
+
+void
+resolver_cache_store(resolver_cache_t *cache, resolver_answer_t *answer);
+
+void
+resolver_cache_get_stats(resolver_cache_t *cache, resolver_cache_stats_t *stats);
+
+#endif /* _TIGERA_RESOLVER__H__ */
@@ -0,0 +1,512 @@
+#include "includes.h"
+#include "libs.h"
+#include "thread.h"
+#include "worker.h"
+#include "resolver.h"
+#include "atomic.h"
+#include <poll.h>
+#include <time.h>
+#include <assert.h>
+
+#define NR_WORKERS      4
+#define NR_REQUESTS     8    /**< per worker, all of them in flight at once */
+#define SERVER_DELAY_MS 100  /**< keeps query in flight while workers join it */
+#define NAME            "upstream.test"
+
+typedef struct dns_server dns_server_t;
+
+/**
+ * Answers A queries with 10.0.0.1, others with no records,
+ * each SERVER_DELAY_MS late. Names starting with "down" do
+ * not exist.
+ */
+struct dns_server {
+    int fd;
+    int port;
+    bool done;
+    atomic_t a_queries;
+};
+
+static void
+server_run(void *arg)
+{
+    dns_server_t *server = arg;
+    struct pollfd pfd = { server->fd, POLLIN, 0 };
+
+    while (!atomic_load_acquire(&server->done)) {
+        unsigned char packet[512];
+        struct sockaddr_storage from;
+        socklen_t fromlen = sizeof(from);
+        struct timespec delay = { 0, SERVER_DELAY_MS * 1000000 };
+        ssize_t n;
+        size_t qend = 12;
+
+        if (poll(&pfd, 1, 50) <= 0) {
+            continue;
+        }
+        n = recvfrom(server->fd, packet, sizeof(packet) - 16, 0, (struct sockaddr *)&from, &fromlen);
+        if (n < 12) {
+            continue;
+        }
+        /* question: labels, then type and class */
+        while (qend < (size_t)n && 0 != packet[qend]) {
+            qend += packet[qend] + 1;
+        }
+        qend += 5;
+        assert(qend <= (size_t)n);
+
+        bool a = (0 == packet[qend - 4] && 1 == packet[qend - 3]);
+        bool down = (0 == strncmp((const char *)&packet[13], "down", 4));
+        packet[2] = 0x81; /* response, recursion desired */
+        packet[3] = down ? 0x83 : 0x80; /* recursion available, no such name or no error */
+        memset(&packet[6], 0, 6);
+        n = qend;
+        if (a && !down) {
+            static const unsigned char record[] = {
+                0xc0, 0x0c, 0, 1, 0, 1, 0, 0, 0, 60, 0, 4, 10, 0, 0, 1
+            };
+            atomic_inc(&server->a_queries);
+            packet[7] = 1;
+            memcpy(&packet[n], record, sizeof(record));
+            n += sizeof(record);
+        }
+        nanosleep(&delay, NULL);
+        sendto(server->fd, packet, n, 0, (struct sockaddr *)&from, fromlen);
+    }
+}
+
+static void
+server_init(dns_server_t *server)
+{
+    struct sockaddr_in sin;
+    socklen_t len = sizeof(sin);
+
+    memset(server, 0, sizeof(*server));
+    memset(&sin, 0, sizeof(sin));
+    sin.sin_family = AF_INET;
+    sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    server->fd = socket(AF_INET, SOCK_DGRAM, 0);
+    assert(server->fd >= 0);
+    assert(0 == bind(server->fd, (struct sockaddr *)&sin, sizeof(sin)));
+    assert(0 == getsockname(server->fd, (struct sockaddr *)&sin, &len));
+    server->port = ntohs(sin.sin_port);
+}
+
+typedef struct worker_ctx worker_ctx_t;
+
+struct worker_ctx {
+    worker_t *worker;
+    resolver_t *resolver;
+    resolver_cache_t *cache;
+    const char *name;
+    bool requesting;
+    atomic_t answers; /**< only written by worker thread */
+};
+
+static void
+answered(resolver_answer_t *answer, void *arg)
+{
+    worker_ctx_t *ctx = arg;
+    struct sockaddr_in *sin = (struct sockaddr_in *)&answer->addrs[0];
+
+    assert(this_worker() == ctx->worker);
+    assert(!ctx->requesting);
+    assert(NULL != answer && 0 == answer->error && 1 == answer->naddrs);
+    assert(AF_INET == sin->sin_family);
+    if (0 == strcmp(NAME, ctx->name)) {
+        assert(htonl(0x0a000001) == sin->sin_addr.s_addr);
+        /* published before being delivered */
+        assert(answer == resolver_cache_lookup(ctx->cache, NAME));
+    }
+    else {
+        assert(htonl(INADDR_LOOPBACK) == sin->sin_addr.s_addr);
+    }
+    atomic_store_release(&ctx->answers, ctx->answers + 1);
+}
+
+static void
+request(void *arg)
+{
+    worker_ctx_t *ctx = arg;
+
+    ctx->requesting = true;
+    for (int i = 0; i < NR_REQUESTS; ++i) {
+        assert(0 == resolver_resolve(ctx->resolver, ctx->cache, ctx->name, answered, ctx));
+    }
+    ctx->requesting = false;
+}
+
+static void
+wait_answers(worker_ctx_t *ctxs, int n, long expected)
+{
+    struct timespec period = { 0, 10 * 1000000 };
+
+    for (int tries = 0; tries < 500; ++tries) {
+        long answers = 0;
+        for (int i = 0; i < n; ++i) {
+            answers += atomic_load_acquire(&ctxs[i].answers);
+        }
+        if (answers == expected) {
+            return;
+        }
+        nanosleep(&period, NULL);
+    }
+    assert(!"answers not delivered");
+}
+
+/* workers share one query, and every worker cache gets its answer */
+static void
+test_shared(dns_server_t *server, const char *nameserver)
+{
+    worker_ctx_t ctxs[NR_WORKERS];
+    resolver_stats_t stats;
+    resolver_t *resolver = resolver_new(nameserver, true, NR_WORKERS);
+    assert(NULL != resolver);
+
+    memset(ctxs, 0, sizeof(ctxs));
+    for (int i = 0; i < NR_WORKERS; ++i) {
+        ctxs[i].resolver = resolver;
+        ctxs[i].name = NAME;
+        ctxs[i].cache = resolver_cache_new(60000, 0);
+        ctxs[i].worker = worker_new(&ctxs[i], NULL, WORKER_CPU_ANY);
+        assert(NULL != ctxs[i].cache && NULL != ctxs[i].worker);
+        resolver_add_worker(resolver, ctxs[i].worker, ctxs[i].cache);
+    }
+    assert(0 == resolver_start(resolver));
+    for (int i = 0; i < NR_WORKERS; ++i) {
+        assert(0 == worker_start(ctxs[i].worker));
+        assert(0 == worker_call(ctxs[i].worker, request, &ctxs[i]));
+    }
+    wait_answers(ctxs, NR_WORKERS, NR_WORKERS * NR_REQUESTS);
+
+    resolver_get_stats(resolver, &stats);
+    assert(1 == atomic_load_acquire(&server->a_queries));
+    assert(1 == stats.queries);
+    assert(NR_WORKERS * NR_REQUESTS - 1 == stats.coalesced);
+    assert(1 == stats.published);
+
+    /* answered from worker caches from now on */
+    for (int i = 0; i < NR_WORKERS; ++i) {
+        assert(0 == worker_call(ctxs[i].worker, request, &ctxs[i]));
+    }
+    wait_answers(ctxs, NR_WORKERS, 2 * NR_WORKERS * NR_REQUESTS);
+    resolver_get_stats(resolver, &stats);
+    assert(1 == atomic_load_acquire(&server->a_queries));
+    assert(1 == stats.queries);
+
+    printf("shared resolver: %d requests, %zu query, %zu coalesced\n",
+           2 * NR_WORKERS * NR_REQUESTS, stats.queries, stats.coalesced);
+
+    for (int i = 0; i < NR_WORKERS; ++i) {
+        worker_stop(ctxs[i].worker);
+    }
+    resolver_stop(resolver);
+    for (int i = 0; i < NR_WORKERS; ++i) {
+        worker_free(ctxs[i].worker);
+    }
+    resolver_free(resolver);
+    for (int i = 0; i < NR_WORKERS; ++i) {
+        resolver_cache_free(ctxs[i].cache);
+    }
+}
+
+/* worker resolves on its own, answers never run from within resolver_resolve */
+static void
+test_local(const char *nameserver)
+{
+    worker_ctx_t ctx;
+    resolver_stats_t stats;
+    resolver_t *resolver = resolver_new(nameserver, false, 1);
+    assert(NULL != resolver);
+
+    memset(&ctx, 0, sizeof(ctx));
+    ctx.resolver = resolver;
+    ctx.name = "127.0.0.1"; /* answered right away */
+    ctx.worker = worker_new(&ctx, nameserver, WORKER_CPU_ANY);
+    assert(NULL != ctx.worker);
+    assert(0 == resolver_start(resolver));
+    assert(0 == worker_start(ctx.worker));
+
+    assert(0 == worker_call(ctx.worker, request, &ctx));
+    wait_answers(&ctx, 1, NR_REQUESTS);
+    resolver_get_stats(resolver, &stats);
+    assert(NR_REQUESTS == stats.queries);
+    assert(0 == stats.coalesced && 0 == stats.published);
+
+    worker_stop(ctx.worker);
+    resolver_stop(resolver);
+    worker_free(ctx.worker);
+    resolver_free(resolver);
+}
+
+typedef struct lookup_ctx lookup_ctx_t;
+
+struct lookup_ctx {
+    worker_t *worker;
+    resolver_t *resolver;
+    resolver_cache_t *cache;
+    const char *name;
+    atomic_t answers; /**< only written by worker thread */
+    int error; /**< of last answer */
+    struct sockaddr_storage addr; /**< first address of last answer */
+};
+
+static void
+lookup_answered(resolver_answer_t *answer, void *arg)
+{
+    lookup_ctx_t *ctx = arg;
+
+    assert(NULL != answer);
+    ctx->error = answer->error;
+    if (0 == answer->error) {
+        assert(0 != answer->naddrs);
+        ctx->addr = answer->addrs[0];
+    }
+    atomic_store_release(&ctx->answers, ctx->answers + 1);
+}
+
+static void
+lookup_request(void *arg)
+{
+    lookup_ctx_t *ctx = arg;
+    assert(0 == resolver_resolve(ctx->resolver, ctx->cache, ctx->name, lookup_answered, ctx));
+}
+
+/* @return first address name is answered with, if no error */
+static struct sockaddr_storage
+lookup_resolve(lookup_ctx_t *ctx, const char *name)
+{
+    struct timespec period = { 0, 1000000 };
+    long answers = atomic_load_acquire(&ctx->answers);
+
+    ctx->name = name;
+    assert(0 == worker_call(ctx->worker, lookup_request, ctx));
+    while (answers == atomic_load_acquire(&ctx->answers)) {
+        nanosleep(&period, NULL);
+    }
+    return ctx->addr;
+}
+
+/* pinned names never wait for a query, refreshes replace their addresses unless they fail */
+static void
+test_pinned(const char *nameserver)
+{
+    const char *path = "/tmp/resolver_test.hosts";
+    struct timespec period = { 0, 10 * 1000000 };
+    struct sockaddr_storage addr;
+    resolver_stats_t stats;
+    lookup_ctx_t ctx;
+    FILE *file = fopen(path, "w");
+    resolver_t *resolver = resolver_new(nameserver, false, 1);
+    assert(NULL != file && NULL != resolver);
+
+    fprintf(file, "# pinned\n192.0.2.1 " NAME " alias.test\n\n192.0.2.2 down.test # no longer resolves\n");
+    fclose(file);
+    assert(0 == resolver_pin_hosts(resolver, path));
+    assert(0 == resolver_pin(resolver, "other.test", "2001:db8::1"));
+    assert(0 == resolver_pin(resolver, "other.test", "192.0.2.3"));
+    assert(-1 == resolver_pin(resolver, "bad.test", "not an address"));
+    unlink(path);
+    /* more names than pin table starts with buckets for */
+    for (int i = 0; i < 4 * RESOLVER_PIN_BUCKETS; ++i) {
+        char name[32];
+        snprintf(name, sizeof(name), "pin%d.test", i);
+        assert(0 == resolver_pin(resolver, name, "192.0.2.4"));
+    }
+
+    memset(&ctx, 0, sizeof(ctx));
+    ctx.resolver = resolver;
+    ctx.worker = worker_new(&ctx, NULL, WORKER_CPU_ANY); /* no dns resolver of its own */
+    assert(NULL != ctx.worker);
+    assert(0 == resolver_start(resolver)); /* no refresh: no resolver thread */
+    assert(0 == worker_start(ctx.worker));
+
+    addr = lookup_resolve(&ctx, "ALIAS.test");
+    assert(AF_INET == addr.ss_family);
+    assert(htonl(0xc0000201) == ((struct sockaddr_in *)&addr)->sin_addr.s_addr);
+    addr = lookup_resolve(&ctx, "other.test");
+    assert(AF_INET6 == addr.ss_family);
+    addr = lookup_resolve(&ctx, "PIN42.test");
+    assert(htonl(0xc0000204) == ((struct sockaddr_in *)&addr)->sin_addr.s_addr);
+
+    worker_stop(ctx.worker);
+    resolver_stop(resolver);
+    worker_free(ctx.worker);
+    resolver_free(resolver);
+
+    /* again, refreshed */
+    resolver = resolver_new(nameserver, false, 1);
+    assert(NULL != resolver);
+    assert(0 == resolver_pin(resolver, NAME, "192.0.2.1"));
+    assert(0 == resolver_pin(resolver, "down.test", "192.0.2.2"));
+    resolver_set_refresh(resolver, 50);
+    ctx.resolver = resolver;
+    ctx.worker = worker_new(&ctx, NULL, WORKER_CPU_ANY);
+    assert(NULL != ctx.worker);
+    assert(0 == resolver_start(resolver));
+    assert(0 == worker_start(ctx.worker));
+
+    for (int tries = 0; tries < 500; ++tries) {
+        resolver_get_stats(resolver, &stats);
+        if (0 != stats.refreshes && 0 != stats.refresh_failures) {
+            break;
+        }
+        nanosleep(&period, NULL);
+    }
+    assert(0 != stats.refreshes && 0 != stats.refresh_failures);
+
+    addr = lookup_resolve(&ctx, NAME);
+    assert(htonl(0x0a000001) == ((struct sockaddr_in *)&addr)->sin_addr.s_addr);
+    addr = lookup_resolve(&ctx, "down.test");
+    assert(0 == ctx.error);
+    assert(htonl(0xc0000202) == ((struct sockaddr_in *)&addr)->sin_addr.s_addr);
+
+    printf("pinned: %zu refreshes, %zu failed\n", stats.refreshes, stats.refresh_failures);
+
+    worker_stop(ctx.worker);
+    resolver_stop(resolver);
+    worker_free(ctx.worker);
+    resolver_free(resolver);
+}
+
+/* failures are handed over to worker caches, and answered from them */
+static void
+test_negative(const char *nameserver)
+{
+    resolver_stats_t stats;
+    resolver_cache_stats_t cache_stats;
+    lookup_ctx_t ctx;
+    resolver_t *resolver = resolver_new(nameserver, true, 1);
+    assert(NULL != resolver);
+
+    memset(&ctx, 0, sizeof(ctx));
+    ctx.resolver = resolver;
+    ctx.cache = resolver_cache_new(0, 60000);
+    ctx.worker = worker_new(&ctx, NULL, WORKER_CPU_ANY);
+    assert(NULL != ctx.cache && NULL != ctx.worker);
+    resolver_add_worker(resolver, ctx.worker, ctx.cache);
+    assert(0 == resolver_start(resolver));
+    assert(0 == worker_start(ctx.worker));
+
+    for (int i = 0; i < 4; ++i) {
+        lookup_resolve(&ctx, "down.test");
+        assert(0 != ctx.error);
+    }
+    resolver_get_stats(resolver, &stats);
+    resolver_cache_get_stats(ctx.cache, &cache_stats);
+    assert(1 == stats.queries && 1 == stats.failures && 1 == stats.published);
+    assert(1 == cache_stats.negative_stores && 3 == cache_stats.negative_hits);
+
+    /* answers are not kept */
+    lookup_resolve(&ctx, NAME);
+    assert(0 == ctx.error);
+    resolver_get_stats(resolver, &stats);
+    assert(2 == stats.queries && 1 == stats.failures);
+
+    printf("negative: 4 failing requests, %zu query, %zu answered from cache\n",
+           stats.queries - 1, cache_stats.negative_hits);
+
+    worker_stop(ctx.worker);
+    resolver_stop(resolver);
+    worker_free(ctx.worker);
+    resolver_free(resolver);
+    resolver_cache_free(ctx.cache);
+}
+
+static void
+test_cache(void)
+{
+    resolver_cache_stats_t stats;
+    resolver_cache_t *cache = resolver_cache_new(60000, 0);
+    resolver_answer_t *answers[RESOLVER_CACHE_SIZE + 1];
+    assert(NULL != cache);
+
+    for (int i = 0; i < countof(answers); ++i) {
+        answers[i] = calloc(1, sizeof(resolver_answer_t));
+        assert(NULL != answers[i]);
+        reference_init(&answers[i]->ref, NULL, NULL);
+        snprintf(answers[i]->name, sizeof(answers[i]->name), "name%d", i);
+        answers[i]->naddrs = 1;
+    }
+
+    assert(NULL == resolver_cache_lookup(cache, "name0"));
+    resolver_cache_store(cache, answers[0]);
+    assert(answers[0] == resolver_cache_lookup(cache, "NAME0"));
+
+    /* errors are not cached without negative ttl */
+    answers[1]->error = EVUTIL_EAI_FAIL;
+    resolver_cache_store(cache, answers[1]);
+    assert(NULL == resolver_cache_lookup(cache, "name1"));
+    answers[1]->error = 0;
+
+    /* full: one is evicted */
+    for (int i = 1; i < countof(answers); ++i) {
+        resolver_cache_store(cache, answers[i]);
+    }
+    resolver_cache_get_stats(cache, &stats);
+    assert(RESOLVER_CACHE_SIZE == stats.size);
+    assert(answers[RESOLVER_CACHE_SIZE] == resolver_cache_lookup(cache, "name8"));
+    assert(NULL == resolver_cache_lookup(cache, "name0"));
+
+    /* same name, whatever its case: answer is replaced in place */
+    snprintf(answers[0]->name, sizeof(answers[0]->name), "NAME8");
+    resolver_cache_store(cache, answers[0]);
+    resolver_cache_get_stats(cache, &stats);
+    assert(RESOLVER_CACHE_SIZE == stats.size);
+    assert(answers[0] == resolver_cache_lookup(cache, "name8"));
+    assert(answers[1] == resolver_cache_lookup(cache, "name1"));
+
+    resolver_cache_free(cache);
+    snprintf(answers[0]->name, sizeof(answers[0]->name), "name0");
+
+    /* dns errors only, answers are not cached without ttl */
+    cache = resolver_cache_new(0, 60000);
+    assert(NULL != cache);
+    resolver_cache_store(cache, answers[0]);
+    assert(NULL == resolver_cache_lookup(cache, "name0"));
+    answers[1]->error = EVUTIL_EAI_MEMORY;
+    resolver_cache_store(cache, answers[1]);
+    assert(NULL == resolver_cache_lookup(cache, "name1"));
+    answers[1]->error = EVUTIL_EAI_NONAME;
+    resolver_cache_store(cache, answers[1]);
+    assert(answers[1] == resolver_cache_lookup(cache, "name1"));
+    resolver_cache_get_stats(cache, &stats);
+    assert(1 == stats.size && 1 == stats.hits && 1 == stats.negative_hits && 1 == stats.negative_stores);
+    resolver_cache_free(cache);
+
+    for (int i = 0; i < countof(answers); ++i) {
+        assert(1 == answers[i]->ref.refcnt);
+        free(answers[i]);
+    }
+}
+
+int
+main(int argc, char **argv)
+{
+    dns_server_t server;
+    thread_t *thread = NULL;
+    char nameserver[32];
+
+    worker_init();
+
+    test_cache();
+
+    server_init(&server);
+    snprintf(nameserver, sizeof(nameserver), "127.0.0.1:%d", server.port);
+    thread = thread_new(server_run);
+    assert(0 == thread_start(thread, &server));
+
+    test_shared(&server, nameserver);
+    test_local(nameserver);
+    test_pinned(nameserver);
+    test_negative(nameserver);
+
+    atomic_store_release(&server.done, true);
+    thread_join(thread);
+    thread_free(thread);
+    close(server.fd);
+
+    worker_fini();
+    return 0;
+}
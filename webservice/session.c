@@ -8,6 +8,16 @@
 #include "reference.h"
 #include "http_request.h"
 #include "http_parser.h"
+#include "compute.h"
+#include "atomic.h"
+#include "trace.h"
+#include "cache.h"
+#include "breaker.h"
+#include "hedge.h"
+#include "balancer.h"
+#include "resolver.h"
+#include "memacct.h"
+#include "pool.h"
 
 typedef enum session_state session_state_t;
 
@@ -24,6 +34,43 @@ enum session_state {
     ,ERROR_CLIENT_RESPONSE
 };
 
+typedef enum session_stage session_stage_t;
+
+/**
+ * Stage each upstream request of a session (NAME, JOKE) is in.
+ * Stages only change through events (@see session_fire), as
+ * session_transitions table says.
+ */
+enum session_stage {
+     STAGE_IDLE       /**< not requested */
+    ,STAGE_LOOKUP     /**< looked up in cache */
+    ,STAGE_RESOLVING  /**< upstream domain being resolved */
+    ,STAGE_CONNECTING /**< connection to upstream in progress */
+    ,STAGE_REQUESTING /**< request sent, waiting for reply */
+    ,STAGE_DECODING   /**< reply being decoded */
+    ,STAGE_REPLIED    /**< reply known: decoded, cached or default one */
+    ,STAGE_FAILED
+    ,STAGE_COUNT
+};
+
+typedef enum session_event session_event_t;
+
+enum session_event {
+     SESSION_EV_REQUEST   /**< client request needs upstream reply */
+    ,SESSION_EV_CACHED    /**< reply served from cache */
+    ,SESSION_EV_FALLBACK  /**< reply served from defaults, upstream breaker being open */
+    ,SESSION_EV_RESOLVE   /**< reply requested from upstream */
+    ,SESSION_EV_RESOLVED  /**< upstream addresses known */
+    ,SESSION_EV_CONNECTED /**< connected to upstream (or hedging connection did) */
+    ,SESSION_EV_RECEIVED  /**< upstream reply received */
+    ,SESSION_EV_DECODED   /**< upstream reply decoded */
+    ,SESSION_EV_FAILED    /**< upstream request failed: so does session */
+    ,SESSION_EV_COUNT
+};
+
+/* RFC 8305 connection attempt delay */
+#define SESSION_CONNECT_RACE_MS 250
+
 enum {
      CLIENT
     ,NAME
@@ -31,55 +78,313 @@ enum {
     ,COUNT
 };
 
+typedef struct upstream upstream_t;
+
+struct upstream {
+    const char *domain;
+    uint16_t port; /* upstream server listens on, host byte order */
+    const char *cache_key; /* parsed replies are cached under */
+    char *fallback[2]; /* reply served while upstream breaker is open and nothing is cached */
+};
+
+static const upstream_t upstreams[COUNT] = {
+    [NAME] = { "uinames.com", 80, "uinames.com/api/", { "John", "Doe" } },
+    [JOKE] = { "api.icndb.com", 80, "api.icndb.com/jokes/random", { "Eduardo Panisset can divide by zero.", NULL } }
+};
+
+typedef struct upstream_result upstream_result_t;
+
+/**
+ * Parsed upstream reply, as cached: name and surname, or
+ * joke. Single allocation charged to worker memory, freed
+ * with memacct_free().
+ */
+struct upstream_result {
+    char *strings[2];
+    char data[];
+};
+
 typedef struct dns_request dns_request_t;
 
 struct dns_request {
     int idx;
-    struct evdns_getaddrinfo_request *evdns_req;
-    reference_t *session; /* keeps weak reference to session object */
+    session_t *session; /* keeps weak reference to session object */
+};
+
+typedef struct session_task session_task_t;
+
+/**
+ * CPU-bound step offloaded to compute pool (decoding NAME or
+ * JOKE reply, rendering CLIENT response). It owns its input
+ * and output, so that session is never touched off its worker.
+ */
+struct session_task {
+    compute_task_t task;
+    session_t *session; /* keeps weak reference to session object */
+    struct evbuffer *body; /*< upstream reply to decode */
+    size_t body_charged; /*< bytes of body charged to worker memory, released once task is back on worker */
+    char *strings[3]; /*< decoded fields, or response input and then output */
+    bool failed;
+};
+
+typedef struct session_addr session_addr_t;
+
+/**
+ * Upstream address an http session connects to, as
+ * picked by upstream balancer.
+ */
+struct session_addr {
+    struct sockaddr_storage addr;
+    bool connected;
+};
+
+typedef struct session_hedge session_hedge_t;
+
+/**
+ * Second connection to upstream server: racing first one, when
+ * it takes too long to connect (happy eyeballs), or sending its
+ * request again, once its reply is late (hedging).
+ */
+struct session_hedge {
+    session_t *session;
+    http_session_t *http_session; /*< racing connection or hedged request, while in flight */
+    bool racing; /*< whether http session races connection rather than hedges request */
+    struct event *race_timer; /*< fires once connection takes too long */
+    struct event *timer; /*< fires once reply is late */
+    session_addr_t addr; /*< other upstream address than hedged request one, if any */
+    uint64_t start; /*< cycles first request was sent at */
 };
 
 struct session {
+    ilink_t link; /**< in sessions list of worker processing it */
     session_state_t state;
     http_session_t *http_sessions[COUNT]; /*< one client and two upstream http sessions */
-    reference_t *me; /* keeps strong referene to myself */
+    session_task_t tasks[COUNT]; /*< one per http session, at most */
+    session_hedge_t hedges[COUNT]; /*< one per upstream http session */
+    session_addr_t addrs[COUNT]; /*< of upstream http sessions */
+    reference_t ref; /* session is confined to its worker: local variant */
+    trace_t trace; /*< flight recorder, kept if session turns out slow */
+    bool timed; /*< whether trace clock runs: from first byte of client request (creation, for revalidations) until response is written */
+    bool traced; /*< whether trace was finished, and kept if slow */
     char *name;
     char *surname;
     char *joke;
-    bool name_replied; /*< whether webserver replied name request */
-    bool joke_replied; /*< whether webserver replied joke request */
-    int pending_resolutions; /*< counter for # in-progress dns resolutions */
-    int pending_connections; /*< counter for # in-progress connections to upstream servers */
-    int pending_replies; /*< counter for # pending replies from upstream servers */
+    session_stage_t stages[COUNT]; /*< of upstream requests */
+    int revalidation; /*< upstream refreshed in background (no client), CLIENT otherwise */
+    uint64_t upstream_start[COUNT]; /*< cycles request to upstream started at, 0 once its outcome is known */
+    unsigned upstream_generation[COUNT]; /*< of upstream breaker, request to upstream was let through under */
+    memacct_t *memacct; /*< of worker session was created on, or NULL */
 };
 
+/* session ids, as seen in traces */
+static atomic_t session_ids = 0;
+
 static void
 session_state_set(session_t *session, session_state_t state)
 {
     session->state = state;
+    trace_add(&session->trace, TRACE_STATE, state);
+}
+
+static int
+session_fire(session_t *session, int idx, session_event_t event);
+
+static int
+session_http_idx(session_t *session, http_session_t *http_session)
+{
+    int i = 0;
+    for (; i < COUNT && session->http_sessions[i] != http_session &&
+           session->hedges[i].http_session != http_session; ++i);
+    return i;
+}
+
+static void
+http_message_begin(http_session_t *http_session)
+{
+    session_t *session = http_session_master(http_session);
+    int idx = session_http_idx(session, http_session);
+
+    if (CLIENT == idx && !session->timed) {
+        /* time client spent connected before is not server latency */
+        trace_start(&session->trace);
+        session->timed = true;
+    }
+    trace_add(&session->trace, TRACE_FIRST_BYTE, idx);
+}
+
+/* only sessions which got a request are compared against slow threshold */
+static void
+session_trace_finish(session_t *session)
+{
+    if (session->timed && !session->traced) {
+        session->traced = true;
+        trace_finish(&session->trace);
+        http_service_session_traced(&session->trace);
+    }
 }
 
 static void
 dns_request_free(dns_request_t *request)
 {
     if (NULL != request) {
-        reference_weak_dec(request->session);
+        reference_local_weak_dec(&request->session->ref);
         request->session = NULL;
-       
-        if (NULL != request->evdns_req) { 
-            evdns_getaddrinfo_cancel(request->evdns_req);
-            request->evdns_req = NULL;
-        }
-        
         free(request);
     }
 }
 
+static session_addr_t *
+session_http_addr(session_t *session, int idx, http_session_t *http_session)
+{
+    return (http_session == session->hedges[idx].http_session) ?
+        &session->hedges[idx].addr : &session->addrs[idx];
+}
+
+/* upstream http session is done with, and so is its address */
+static void
+session_upstream_close(http_session_t *http_session, int idx, session_addr_t *addr)
+{
+    balancer_t *balancer = http_service_balancer(idx);
+
+    http_session_free(http_session);
+    http_service_upstream_request_remove();
+    if (NULL != balancer) {
+        balancer_release(balancer, &addr->addr);
+    }
+}
+
+/* hedged request takes over upstream request it hedged, or the other way round */
+static void
+session_hedge_swap(session_t *session, int idx)
+{
+    session_hedge_t *hedge = &session->hedges[idx];
+    http_session_t *http_session = hedge->http_session;
+    session_addr_t addr = hedge->addr;
+
+    hedge->http_session = session->http_sessions[idx];
+    hedge->addr = session->addrs[idx];
+    session->http_sessions[idx] = http_session;
+    session->addrs[idx] = addr;
+}
+
+static void
+session_hedge_cancel(session_t *session, int idx)
+{
+    session_hedge_t *hedge = &session->hedges[idx];
+
+    if (NULL != hedge->race_timer) {
+        event_free(hedge->race_timer);
+        hedge->race_timer = NULL;
+    }
+    if (NULL != hedge->timer) {
+        event_free(hedge->timer);
+        hedge->timer = NULL;
+    }
+    hedge->racing = false;
+    if (NULL != hedge->http_session) {
+        session_upstream_close(hedge->http_session, idx, &hedge->addr);
+        hedge->http_session = NULL;
+    }
+}
+
+static void
+session_upstream_free(session_t *session, int idx)
+{
+    session_hedge_cancel(session, idx);
+    if (NULL != session->http_sessions[idx]) {
+        session_upstream_close(session->http_sessions[idx], idx, &session->addrs[idx]);
+        session->http_sessions[idx] = NULL;
+    }
+}
+
+/**
+ * First reply to upstream request arrived: other request, if
+ * hedged, is cancelled and winner becomes upstream http session.
+ */
+static void
+session_upstream_settle(session_t *session, int idx, http_session_t *winner)
+{
+    session_hedge_t *hedge = &session->hedges[idx];
+    hedge_t *hedging = http_service_hedge(idx);
+
+    if (NULL != hedging) {
+        hedge_latency(hedging, worker_cycles_to_ns(worker_cycles() - hedge->start) / 1000);
+    }
+
+    if (winner == hedge->http_session) {
+        trace_add(&session->trace, TRACE_HEDGE_WON, idx);
+        if (NULL != hedging) {
+            hedging->won++;
+        }
+        session_hedge_swap(session, idx);
+    }
+    session_hedge_cancel(session, idx);
+}
+
+/**
+ * Request to upstream failed: as long as other request (hedged
+ * or hedging it) is in flight, only this one is dropped.
+ *
+ * @return whether other request is still in flight
+ */
+static bool
+session_upstream_attempt_failed(session_t *session, int idx, http_session_t *http_session)
+{
+    session_hedge_t *hedge = &session->hedges[idx];
+
+    if (NULL == hedge->http_session) {
+        return false;
+    }
+
+    trace_add(&session->trace, TRACE_FAILED, idx);
+    if (http_session == session->http_sessions[idx]) {
+        session_hedge_swap(session, idx);
+    }
+    session_upstream_close(hedge->http_session, idx, &hedge->addr);
+    hedge->http_session = NULL;
+    hedge->racing = false;
+    return true;
+}
+
+/* connection to upstream address succeeded, or not */
+static void
+session_upstream_connected(session_t *session, int idx, http_session_t *http_session, bool connected)
+{
+    balancer_t *balancer = http_service_balancer(idx);
+    session_addr_t *addr = session_http_addr(session, idx, http_session);
+
+    addr->connected = connected;
+    if (NULL != balancer) {
+        balancer_connected(balancer, &addr->addr, connected);
+    }
+
+    if (!connected) {
+        return;
+    }
+
+    session_hedge_t *hedge = &session->hedges[idx];
+    if (NULL != hedge->race_timer) {
+        evtimer_del(hedge->race_timer);
+    }
+    if (hedge->racing) {
+        /* first connection wins the race, the other one is cancelled */
+        if (http_session == hedge->http_session) {
+            trace_add(&session->trace, TRACE_RACE_WON, idx);
+            session_hedge_swap(session, idx);
+        }
+        session_upstream_close(hedge->http_session, idx, &hedge->addr);
+        hedge->http_session = NULL;
+        hedge->racing = false;
+    }
+}
+
 static void
 client_ready_to_close(http_session_t *http_session)
 {
     session_t *session = http_session_master(http_session);
     if (session->state == CLIENT_RESPONSE) {
+        /* response written: however long client keeps connection open */
+        session_trace_finish(session);
         fprintf(stderr, "client ready to close\n");
         http_service_session_remove(session);
     }
@@ -131,7 +436,7 @@ joke_create(char *sess_joke, int sess_joke_len, const char *token, int tlen, con
 
 
 static char *
-client_response_create(session_t *session)
+client_response_create(char *sess_name, char *sess_surname, char *sess_joke)
 {
     static const char name[]    = "Eduardo";
     static const char surname[] = "Panisset";
@@ -139,10 +444,6 @@ client_response_create(session_t *session)
     const int name_len = sizeof(name) - 1;
     const int surname_len = sizeof(surname) - 1;
 
-    char *sess_name = session->name;
-    char *sess_surname = session->surname;
-    char *sess_joke = session->joke;
-
     int sess_name_len = strlen(sess_name);
     int sess_surname_len = strlen(sess_surname);
     int sess_joke_len = strlen(sess_joke);
@@ -152,14 +453,14 @@ client_response_create(session_t *session)
     new_joke = joke_create(sess_joke, sess_joke_len, name, name_len, sess_name, sess_name_len);
 
     free(sess_name);
-    session->name = NULL;
 
     if (NULL == new_joke) {
+        free(sess_surname);
+        free(sess_joke);
         return NULL;
     }
 
     free(sess_joke);
-    session->joke = NULL;
 
     sess_joke = new_joke;
     sess_joke_len = strlen(sess_joke);
@@ -167,7 +468,6 @@ client_response_create(session_t *session)
     new_joke = joke_create(sess_joke, sess_joke_len, surname, surname_len, sess_surname, sess_surname_len);
 
     free(sess_surname);
-    session->surname = NULL;
 
     free(sess_joke);
 
@@ -175,27 +475,273 @@ client_response_create(session_t *session)
 }
 
 static void
-http_client_response(session_t *session)
+session_task_clear(session_task_t *task)
+{
+    if (NULL != task->body) {
+        evbuffer_free(task->body);
+        task->body = NULL;
+    }
+    for (int i = 0; i < countof(task->strings); ++i) {
+        free(task->strings[i]);
+        task->strings[i] = NULL;
+    }
+    task->failed = false;
+}
+
+static void
+session_task_submit(session_t *session, int idx, compute_fn_t work, compute_fn_t done)
+{
+    session_task_t *task = &session->tasks[idx];
+
+    task->session = session;
+    reference_local_weak_inc(&session->ref);
+    trace_add(&session->trace, TRACE_OFFLOAD, idx);
+    compute_task_init(&task->task, work, done);
+    http_service_offload(&task->task);
+}
+
+/**
+ * Back on worker: drops task reference to session.
+ *
+ * @return session, NULL if it is gone meanwhile (task
+ *         output is then discarded)
+ */
+static session_t *
+session_task_complete(session_task_t *task)
 {
-    if (!session->name_replied || !session->joke_replied) {
+    session_t *session = task->session;
+    bool alive = reference_local_alive(&session->ref);
+
+    /* body may have been freed on compute thread already: its
+     * charge is released here, memory account being worker's */
+    memacct_release(session->memacct, MEMACCT_JSON, task->body_charged);
+    task->body_charged = 0;
+
+    task->session = NULL;
+    if (!alive) {
+        session_task_clear(task);
+    }
+    else {
+        trace_add(&session->trace, TRACE_OFFLOADED, task - session->tasks);
+    }
+
+    /* might free session memory (and task with it), if it is gone */
+    reference_local_weak_dec(&session->ref);
+
+    return alive ? session : NULL;
+}
+
+static upstream_result_t *
+upstream_result_new(const char *first, const char *second)
+{
+    size_t first_len = strlen(first) + 1;
+    size_t second_len = (NULL != second) ? strlen(second) + 1 : 0;
+    upstream_result_t *result = memacct_malloc(this_memacct(), MEMACCT_CACHE,
+                                               sizeof(upstream_result_t) + first_len + second_len);
+
+    if (NULL != result) {
+        result->strings[0] = memcpy(result->data, first, first_len);
+        result->strings[1] = NULL;
+        if (NULL != second) {
+            result->strings[1] = memcpy(result->data + first_len, second, second_len);
+        }
+    }
+    return result;
+}
+
+/**
+ * Sets upstream reply, as if just received.
+ *
+ * @return 0, if successfull. -1, otherwise.
+ */
+static int
+session_result_set(session_t *session, int idx, char *const *strings)
+{
+    if (NAME == idx) {
+        session->name = strdup(strings[0]);
+        session->surname = strdup(strings[1]);
+        if (NULL == session->name || NULL == session->surname) {
+            free(session->name);
+            session->name = NULL;
+            free(session->surname);
+            session->surname = NULL;
+            return -1;
+        }
+    }
+    else {
+        session->joke = strdup(strings[0]);
+        if (NULL == session->joke) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static void
+session_cache_store(session_t *session, int idx)
+{
+    cache_t *cache = http_service_cache();
+    upstream_result_t *result = NULL;
+
+    /* worker over its memory budget: replies are no longer cached */
+    if (NULL == cache || memacct_exceeded(this_memacct())) {
         return;
     }
 
-    http_session_t *http_session = session->http_sessions[CLIENT];
+    if (NAME == idx) {
+        result = upstream_result_new(session->name, session->surname);
+    }
+    else {
+        result = upstream_result_new(session->joke, NULL);
+    }
 
-    char *response = client_response_create(session);
+    if (NULL == result || cache_put(cache, upstreams[idx].cache_key, result) < 0) {
+        fprintf(stderr, "%s: error caching upstream reply\n", __func__);
+    }
+}
 
-    if (NULL == response) {
-        session_state_set(session, ERROR_CLIENT_RESPONSE);
-        http_service_session_remove(session);
+static void
+session_revalidate(int idx);
+
+/**
+ * Whether request to upstream may be sent, as far as its
+ * breaker is concerned. Request outcome is then reported
+ * with session_upstream_outcome.
+ */
+static bool
+session_upstream_allowed(session_t *session, int idx)
+{
+    breaker_t *breaker = http_service_breaker(idx);
+    return NULL == breaker || breaker_allow(breaker, &session->upstream_generation[idx]);
+}
+
+/**
+ * Reports upstream request outcome to its breaker, once:
+ * sessions abandoned by their client report nothing.
+ */
+static void
+session_upstream_outcome(session_t *session, int idx, bool failed)
+{
+    breaker_t *breaker = http_service_breaker(idx);
+    uint64_t start = session->upstream_start[idx];
+
+    if (0 == start) {
+        return;
+    }
+    session->upstream_start[idx] = 0;
+
+    if (NULL == breaker) {
+        return;
+    }
+
+    if (failed) {
+        breaker_failure(breaker, session->upstream_generation[idx]);
+    }
+    else {
+        breaker_success(breaker, session->upstream_generation[idx], worker_cycles_to_ns(worker_cycles() - start) / 1000000);
+    }
+}
+
+/**
+ * Serves upstream reply from defaults, upstream breaker
+ * being open and nothing being cached.
+ *
+ * @return 0, if successfull. -1, otherwise.
+ */
+static int
+session_fallback(session_t *session, int idx)
+{
+    return session_result_set(session, idx, upstreams[idx].fallback);
+}
+
+/**
+ * Serves upstream reply from cache, even stale (revalidating
+ * it in background, once).
+ *
+ * @return 0, if served. -1, otherwise.
+ */
+static int
+session_cache_lookup(session_t *session, int idx)
+{
+    cache_t *cache = http_service_cache();
+    upstream_result_t *result = NULL;
+    cache_result_t cached;
+
+    if (NULL == cache) {
+        return -1;
+    }
+
+    cached = cache_get(cache, upstreams[idx].cache_key, (void **)&result);
+    if (CACHE_MISS == cached) {
+        return -1;
+    }
+
+    /* copied before revalidation might replace it */
+    if (session_result_set(session, idx, result->strings) < 0) {
+        if (CACHE_REVALIDATE == cached) {
+            cache_revalidate_failed(cache, upstreams[idx].cache_key);
+        }
+        return -1;
+    }
+
+    if (CACHE_REVALIDATE == cached) {
+        session_revalidate(idx);
+    }
+    return 0;
+}
+
+/**
+ * Session is given up on: upstream requests still in
+ * flight are cancelled along with it.
+ */
+static void
+session_cancel(session_t *session, session_state_t state)
+{
+    session_state_set(session, state);
+    http_service_session_remove(session);
+}
+
+/* on compute thread */
+static void
+client_response_render(compute_task_t *compute_task)
+{
+    session_task_t *task = downcast(compute_task, session_task_t, task);
+
+    /* strings are consumed */
+    char *response = client_response_create(task->strings[0], task->strings[1], task->strings[2]);
+
+    task->strings[0] = response;
+    task->strings[1] = NULL;
+    task->strings[2] = NULL;
+    task->failed = (NULL == response);
+}
+
+static void
+client_response_rendered(compute_task_t *compute_task)
+{
+    session_task_t *task = downcast(compute_task, session_task_t, task);
+    session_t *session = session_task_complete(task);
+    char *response = NULL;
+
+    if (NULL == session) {
         return;
     }
 
+    response = task->strings[0];
+    task->strings[0] = NULL;
+
+    if (task->failed) {
+        session_task_clear(task);
+        session_cancel(session, ERROR_CLIENT_RESPONSE);
+        return;
+    }
+
+    http_session_t *http_session = session->http_sessions[CLIENT];
+
     fprintf(stderr, "%s: writing response to client: %s\n", __func__, response);
 
     if (http_response_write(http_session, response) < 0) {
-        session_state_set(session, ERROR_CLIENT_RESPONSE);
-        http_service_session_remove(session);
+        session_cancel(session, ERROR_CLIENT_RESPONSE);
         return;
     }
 
@@ -203,16 +749,62 @@ http_client_response(session_t *session)
      * waiting for signal "ready-to-close" from
      * underlying channel. That will happen as
      * soon as all pending data is written to
-     * socket and EOF is received from client.
+     * socket (or EOF is received from client),
+     * whether client keeps connection open or not.
      */
     session_state_set(session, CLIENT_RESPONSE);
 }
 
+/* all upstream replies known: response is rendered */
 static void
-http_response_name(http_session_t *http_session)
+http_client_response(session_t *session)
 {
-    session_t *session = http_session_master(http_session);
-    struct evbuffer *body = http_session_body(http_session);
+    session_task_t *task = &session->tasks[CLIENT];
+
+    /* handed over to task */
+    task->strings[0] = session->name;
+    task->strings[1] = session->surname;
+    task->strings[2] = session->joke;
+    session->name = NULL;
+    session->surname = NULL;
+    session->joke = NULL;
+
+    session_task_submit(session, CLIENT, client_response_render, client_response_rendered);
+}
+
+/**
+ * Moves upstream reply body to task, so that upstream
+ * http session can be released right away.
+ */
+static int
+session_task_body_take(session_t *session, int idx)
+{
+    session_task_t *task = &session->tasks[idx];
+    struct evbuffer *body = http_session_body(session->http_sessions[idx]);
+
+    task->body = evbuffer_new();
+    if (NULL == task->body) {
+        return -1;
+    }
+
+    if (evbuffer_add_buffer(task->body, body) < 0) {
+        evbuffer_free(task->body);
+        task->body = NULL;
+        return -1;
+    }
+    /* no longer charged to upstream http session, freed below */
+    task->body_charged = evbuffer_get_length(task->body);
+    memacct_charge(session->memacct, MEMACCT_JSON, task->body_charged);
+
+    session_upstream_free(session, idx);
+    return 0;
+}
+
+/* on compute thread */
+static void
+name_decode(compute_task_t *compute_task)
+{
+    session_task_t *task = downcast(compute_task, session_task_t, task);
     json_t *jresponse = NULL;
     char *name = NULL;
     char *surname = NULL;
@@ -220,13 +812,9 @@ http_response_name(http_session_t *http_session)
     size_t body_len = 0;
     json_error_t jerror;
 
-    session->pending_replies--;
-
-    fprintf(stderr, "%s: name response received\n", __func__);
-
-    body_len = evbuffer_get_length(body);
+    body_len = evbuffer_get_length(task->body);
     
-    p = (char *)evbuffer_pullup(body, body_len);
+    p = (char *)evbuffer_pullup(task->body, body_len);
     if (NULL == p) {
         goto error;
     }
@@ -241,26 +829,19 @@ http_response_name(http_session_t *http_session)
         goto error;
     }
 
-    session->name = strdup(name);
-    if (NULL == session->name) {
+    task->strings[0] = strdup(name);
+    if (NULL == task->strings[0]) {
         goto error;
     }
 
-    session->surname = strdup(surname);
-    if (NULL == session->surname) {
+    task->strings[1] = strdup(surname);
+    if (NULL == task->strings[1]) {
         goto error;
     }
 
-    if (NULL != jresponse) {
-        json_decref(jresponse);
-    }
-
-    session->name_replied = true;
-
-    http_session_free(http_session);
-    session->http_sessions[NAME] = NULL;
-
-    http_client_response(session);
+    json_decref(jresponse);
+    evbuffer_free(task->body);
+    task->body = NULL;
 
     return;
 
@@ -269,29 +850,48 @@ error:
     if (NULL != jresponse) {
         json_decref(jresponse);
     }
+    task->failed = true;
+}
 
-    session_state_set(session, ERROR_CLIENT_RESPONSE);
-    http_service_session_remove(session);
+static void
+name_decoded(compute_task_t *compute_task)
+{
+    session_task_t *task = downcast(compute_task, session_task_t, task);
+    session_t *session = session_task_complete(task);
+
+    if (NULL == session) {
+        return;
+    }
+
+    if (task->failed) {
+        session_task_clear(task);
+        session_fire(session, NAME, SESSION_EV_FAILED);
+        return;
+    }
+
+    session->name = task->strings[0];
+    session->surname = task->strings[1];
+    task->strings[0] = NULL;
+    task->strings[1] = NULL;
+
+    session_fire(session, NAME, SESSION_EV_DECODED);
 }
 
+
+/* on compute thread */
 static void
-http_response_joke(http_session_t *http_session)
+joke_decode(compute_task_t *compute_task)
 {
-    session_t *session = http_session_master(http_session);
-    struct evbuffer *body = http_session_body(http_session);
+    session_task_t *task = downcast(compute_task, session_task_t, task);
     json_t *jresponse = NULL;
     char *joke = NULL;
     char *p = NULL;
     size_t body_len = 0;
     json_error_t jerror;
 
-    session->pending_replies--;
-
-    fprintf(stderr, "%s: joke response received\n", __func__);
-
-    body_len = evbuffer_get_length(body);
+    body_len = evbuffer_get_length(task->body);
     
-    p = (char *)evbuffer_pullup(body, body_len);
+    p = (char *)evbuffer_pullup(task->body, body_len);
     if (NULL == p) {
         goto error;
     }
@@ -307,21 +907,14 @@ http_response_joke(http_session_t *http_session)
         goto error;
     }
 
-    session->joke = strdup(joke);
-    if (NULL == session->joke) {
+    task->strings[0] = strdup(joke);
+    if (NULL == task->strings[0]) {
         goto error;
     }
 
-    if (NULL != jresponse) {
-        json_decref(jresponse);
-    }
-
-    session->joke_replied = true;
-    
-    http_session_free(http_session);
-    session->http_sessions[JOKE] = NULL;
-
-    http_client_response(session);
+    json_decref(jresponse);
+    evbuffer_free(task->body);
+    task->body = NULL;
 
     return;
 
@@ -330,11 +923,46 @@ error:
     if (NULL != jresponse) {
         json_decref(jresponse);
     }
+    task->failed = true;
+}
 
-    session_state_set(session, ERROR_CLIENT_RESPONSE);
-    http_service_session_remove(session);
+static void
+joke_decoded(compute_task_t *compute_task)
+{
+    session_task_t *task = downcast(compute_task, session_task_t, task);
+    session_t *session = session_task_complete(task);
+
+    if (NULL == session) {
+        return;
+    }
+
+    if (task->failed) {
+        session_task_clear(task);
+        session_fire(session, JOKE, SESSION_EV_FAILED);
+        return;
+    }
+
+    session->joke = task->strings[0];
+    task->strings[0] = NULL;
+
+    session_fire(session, JOKE, SESSION_EV_DECODED);
+}
+
+/* upstream reply received, hedged request (if any) is done with */
+static void
+http_upstream_reply(http_session_t *http_session)
+{
+    session_t *session = http_session_master(http_session);
+    int idx = session_http_idx(session, http_session);
+
+    session_upstream_settle(session, idx, http_session);
+    fprintf(stderr, "%s: %s reply received\n", __func__, upstreams[idx].domain);
+    session_fire(session, idx, SESSION_EV_RECEIVED);
 }
 
+static void
+session_hedge_arm(session_t *session, int idx);
+
 static void
 http_request_name(http_session_t *http_session)
 {
@@ -349,19 +977,26 @@ http_request_name(http_session_t *http_session)
     };
 
     session = http_session_master(http_session);
-    session->pending_connections--;
+    if (session_fire(session, NAME, SESSION_EV_CONNECTED) < 0) {
+        return;
+    }
+    session_upstream_connected(session, NAME, http_session, true);
 
     request.request_line = request_line;
     request.headers = headers;
     request.headers_count = countof(headers);
 
     if (http_request_write(http_session, &request) < 0) {
-        session_state_set(session, ERROR_REQUESTING_FROM_WS);
-        http_service_session_remove(session);
+        if (session_upstream_attempt_failed(session, NAME, http_session)) {
+            return;
+        }
+        session_fire(session, NAME, SESSION_EV_FAILED);
         return;
     }
-    session->pending_replies++;
     fprintf(stderr, "%s: name request sent\n", __func__);
+    if (http_session == session->http_sessions[NAME]) {
+        session_hedge_arm(session, NAME);
+    }
 }
 
 static void
@@ -378,35 +1013,184 @@ http_request_joke(http_session_t *http_session)
     };
 
     session = http_session_master(http_session);
-    session->pending_connections--;
+    if (session_fire(session, JOKE, SESSION_EV_CONNECTED) < 0) {
+        return;
+    }
+    session_upstream_connected(session, JOKE, http_session, true);
 
     request.request_line = request_line;
     request.headers = headers;
     request.headers_count = countof(headers);
 
     if (http_request_write(http_session, &request) < 0) {
-        session_state_set(session, ERROR_REQUESTING_FROM_WS);
-        http_service_session_remove(session);
+        if (session_upstream_attempt_failed(session, JOKE, http_session)) {
+            return;
+        }
+        session_fire(session, JOKE, SESSION_EV_FAILED);
         return;
     }
     fprintf(stderr, "%s: joke request sent\n", __func__);
-    session->pending_replies++;
+    if (http_session == session->http_sessions[JOKE]) {
+        session_hedge_arm(session, JOKE);
+    }
+}
+
+static void
+http_server_connect(session_t *session, int idx, bool hedged);
+
+/* connection to upstream takes too long: races it to another address */
+static void
+session_race_fire(evutil_socket_t fd, short events, void *arg)
+{
+    session_hedge_t *hedge = arg;
+    session_t *session = hedge->session;
+    int idx = hedge - session->hedges;
+
+    if (NULL != hedge->http_session) {
+        return;
+    }
+    trace_add(&session->trace, TRACE_RACE, idx);
+    hedge->racing = true;
+    http_server_connect(session, idx, true);
+}
+
+/* connecting to upstream: raced to another address, if it takes too long */
+static void
+session_race_arm(session_t *session, int idx)
+{
+    session_hedge_t *hedge = &session->hedges[idx];
+    balancer_t *balancer = http_service_balancer(idx);
+    struct timeval tv = { 0, SESSION_CONNECT_RACE_MS * 1000 };
+
+    if (NULL == balancer || balancer->naddrs < 2) {
+        return;
+    }
+
+    if (NULL == hedge->race_timer) {
+        hedge->race_timer = evtimer_new(this_event_base(), session_race_fire, hedge);
+        if (NULL == hedge->race_timer) {
+            /* not raced, then */
+            return;
+        }
+    }
+    evtimer_add(hedge->race_timer, &tv);
+}
+
+/**
+ * First connection to upstream failed before race started:
+ * other address is raced right away instead.
+ *
+ * @return whether racing connection took over
+ */
+static bool
+session_race_now(session_t *session, int idx, http_session_t *http_session)
+{
+    session_hedge_t *hedge = &session->hedges[idx];
+
+    if (http_session != session->http_sessions[idx] || NULL != hedge->http_session ||
+        NULL == hedge->race_timer || !evtimer_pending(hedge->race_timer, NULL)) {
+        return false;
+    }
+    evtimer_del(hedge->race_timer);
+    trace_add(&session->trace, TRACE_RACE, idx);
+    hedge->racing = true;
+    http_server_connect(session, idx, true);
+    return session_upstream_attempt_failed(session, idx, http_session);
+}
+
+/* upstream connection failed, timed out or sent malformed reply */
+static void
+http_upstream_error(http_session_t *http_session)
+{
+    session_t *session = http_session_master(http_session);
+    int idx = session_http_idx(session, http_session);
+
+    if (!session_http_addr(session, idx, http_session)->connected) {
+        session_upstream_connected(session, idx, http_session, false);
+        if (session_race_now(session, idx, http_session)) {
+            return;
+        }
+    }
+    if (session_upstream_attempt_failed(session, idx, http_session)) {
+        return;
+    }
+    session_fire(session, idx, SESSION_EV_FAILED);
+}
+
+/* upstream reply is late: same request goes to other address */
+static void
+session_hedge_fire(evutil_socket_t fd, short events, void *arg)
+{
+    session_hedge_t *hedge = arg;
+    session_t *session = hedge->session;
+    int idx = hedge - session->hedges;
+    hedge_t *hedging = http_service_hedge(idx);
+
+    if (NULL == hedging || NULL != hedge->http_session || !hedge_allow(hedging)) {
+        return;
+    }
+    trace_add(&session->trace, TRACE_HEDGE, idx);
+    http_server_connect(session, idx, true);
+}
+
+/**
+ * Request to upstream was sent (connection is up): hedged if
+ * reply is late. Time spent connecting does not count.
+ */
+static void
+session_hedge_arm(session_t *session, int idx)
+{
+    session_hedge_t *hedge = &session->hedges[idx];
+    hedge_t *hedging = http_service_hedge(idx);
+    unsigned delay_ms = 0;
+
+    hedge->start = worker_cycles();
+    if (NULL == hedging || 0 == (delay_ms = hedge_request(hedging))) {
+        return;
+    }
+
+    if (NULL == hedge->timer) {
+        hedge->timer = evtimer_new(this_event_base(), session_hedge_fire, hedge);
+        if (NULL == hedge->timer) {
+            /* not hedged, then */
+            return;
+        }
+    }
+    struct timeval tv = { delay_ms / 1000, (delay_ms % 1000) * 1000 };
+    evtimer_add(hedge->timer, &tv);
 }
 
+/**
+ * Connects to upstream address picked by its balancer.
+ *
+ * @param hedged whether request is sent again, its reply
+ *        being late: failing to send it is harmless then
+ */
 static void
-http_server_connect(session_t *session, struct sockaddr_storage *ss, int idx)
+http_server_connect(session_t *session, int idx, bool hedged)
 {
     http_callbacks_t callbacks;
     io_channel_error_t err;
     io_channel_t *channel = NULL;
     http_session_t *http_session = NULL;
+    balancer_t *balancer = http_service_balancer(idx);
+    session_addr_t *addr = hedged ? &session->hedges[idx].addr : &session->addrs[idx];
 
     memset(&callbacks, 0, sizeof(callbacks));
 
+    /* hedged request goes elsewhere, if possible */
+    if (NULL == balancer ||
+        balancer_pick(balancer, &addr->addr, hedged ? &session->addrs[idx].addr : NULL) < 0) {
+        balancer = NULL;
+        goto error;
+    }
+    addr->connected = false;
+
     channel = tcp_socket_new();
     if (NULL == channel) {
         goto error;
     }
+    channel_set_backpressure(channel, http_service_backpressure());
 
     http_session = http_session_new(session, channel, HTTP_RESPONSE);
     if (NULL == http_session) {
@@ -414,199 +1198,466 @@ http_server_connect(session_t *session, struct sockaddr_storage *ss, int idx)
         goto error;
     }
 
-    if (idx == NAME) {
-        callbacks.connected = http_request_name;
-        callbacks.message_complete = http_response_name;
-    }
-    else {
-        callbacks.connected = http_request_joke;
-        callbacks.message_complete = http_response_joke;
-    }
+    callbacks.message_begin = http_message_begin;
+    callbacks.error = http_upstream_error;
+    callbacks.message_complete = http_upstream_reply;
+    callbacks.connected = (NAME == idx) ? http_request_name : http_request_joke;
 
-    err = channel_connect(channel, ss);
+    trace_add(&session->trace, TRACE_CONNECT, idx);
+    err = channel_connect(channel, &addr->addr);
 
     if (err == IO_CHANNEL_E_ERROR) {
         http_session_free(http_session);
+        balancer_connected(balancer, &addr->addr, false);
         goto error;
     }
 
-    session->http_sessions[idx] = http_session;
-    session->pending_connections++;
+    if (hedged) {
+        session->hedges[idx].http_session = http_session;
+    }
+    else {
+        session->http_sessions[idx] = http_session;
+        session_race_arm(session, idx);
+    }
+    http_service_upstream_request_add();
     http_session_callbacks_set(http_session, &callbacks);
 
     return;
 
 error:
-    session_state_set(session, ERROR_CONNECTING_TO_WS);
-    http_service_session_remove(session);
+    if (NULL != balancer) {
+        balancer_release(balancer, &addr->addr);
+    }
+    if (hedged) {
+        fprintf(stderr, "%s: error %s\n", __func__, session->hedges[idx].racing ? "racing connection" : "hedging request");
+        session->hedges[idx].racing = false;
+        return;
+    }
+    session_fire(session, idx, SESSION_EV_FAILED);
 }
 
 
 static void
-dnsname_resolved_cb(int errcode, struct evutil_addrinfo *addr, void *ctx)
+dnsname_resolved(resolver_answer_t *answer, void *ctx)
 {
     dns_request_t *dns_request = ctx;
-    session_t *session = reference_get(dns_request->session);
+    session_t *session = dns_request->session;
+    bool alive = reference_local_alive(&session->ref);
     int idx = dns_request->idx;
-    
-    dns_request->evdns_req = NULL;
 
+    /* might free session memory, if it is gone */
     dns_request_free(dns_request);
 
-    if (NULL == session) {
+    if (!alive) {
         /* session is gone */
         return;
     }
-    
-    if (errcode) {
-        fprintf(stderr, "%s: dns resolution error: %s\n", __func__, evutil_gai_strerror(errcode));
+
+    if (NULL == answer) {
+        fprintf(stderr, "%s: dns resolution error\n", __func__);
+    }
+    else if (answer->error) {
+        fprintf(stderr, "%s: dns resolution error: %s\n", __func__, evutil_gai_strerror(answer->error));
     }
     else {
         char dst[INET6_ADDRSTRLEN];
-        struct sockaddr_storage ss;
-        struct evutil_addrinfo *ai;
-        bool found = false;
-
-        memset(&ss, 0, sizeof(ss));
-
-        for (ai = addr; ai; ai = ai->ai_next) {
-            //char buf[128];
-            //const char *s = NULL;
-
-            if (ai->ai_family == AF_INET) {
-                struct sockaddr_in *sin = (struct sockaddr_in *)ai->ai_addr;
-                memcpy(&ss, sin, sizeof(*sin));
-                //s = evutil_inet_ntop(AF_INET, &sin->sin_addr, buf, 128);
-                found = true;
-                break;
-            }
-            else if (ai->ai_family == AF_INET6) {
-                struct sockaddr_in6 *sin6 = (struct sockaddr_in6 *)ai->ai_addr;
-                memcpy(&ss, sin6, sizeof(*sin6));
-                //s = evutil_inet_ntop(AF_INET6, &sin6->sin6_addr, buf, 128);
-                found = true;
-                break;
-            }
+        struct sockaddr_storage addrs[BALANCER_MAX_ADDRS];
+        size_t naddrs = 0;
+        uint16_t port = http_service_upstream_port();
+
+        if (0 == port) {
+            port = upstreams[idx].port;
         }
-        evutil_freeaddrinfo(addr);
-        if (found) {
-            if (ss.ss_family == AF_INET) {
-                struct sockaddr_in *s4 = (struct sockaddr_in *)&ss;
-                s4->sin_port = htons(80);
-                fprintf(stderr, "%s: domain resolved %d: %s\n", __func__, idx, evutil_inet_ntop(ss.ss_family, &s4->sin_addr, dst, INET6_ADDRSTRLEN));
+
+        /* all of them: requests are spread over them, on upstream port */
+        for (size_t i = 0; i < answer->naddrs && naddrs < countof(addrs); ++i) {
+            struct sockaddr_storage *ss = &addrs[naddrs++];
+
+            *ss = answer->addrs[i];
+            if (ss->ss_family == AF_INET) {
+                struct sockaddr_in *s4 = (struct sockaddr_in *)ss;
+                s4->sin_port = htons(port);
+                fprintf(stderr, "%s: domain resolved %d: %s\n", __func__, idx, evutil_inet_ntop(ss->ss_family, &s4->sin_addr, dst, INET6_ADDRSTRLEN));
             }
             else {
-                struct sockaddr_in6 *s6 = (struct sockaddr_in6 *)&ss;
-                s6->sin6_port = htons(80);
-                fprintf(stderr, "%s: domain resolved %d: %s\n", __func__, idx, evutil_inet_ntop(ss.ss_family, &s6->sin6_addr, dst, INET6_ADDRSTRLEN));
+                struct sockaddr_in6 *s6 = (struct sockaddr_in6 *)ss;
+                s6->sin6_port = htons(port);
+                fprintf(stderr, "%s: domain resolved %d: %s\n", __func__, idx, evutil_inet_ntop(ss->ss_family, &s6->sin6_addr, dst, INET6_ADDRSTRLEN));
             }
-            session->pending_resolutions--;
-            http_server_connect(session, &ss, idx);
+        }
+        if (naddrs > 0 && NULL != http_service_balancer(idx)) {
+            balancer_update(http_service_balancer(idx), addrs, naddrs);
+            session_fire(session, idx, SESSION_EV_RESOLVED);
             return;
         }
         fprintf(stderr, "%s: no A nor AAAA records for domain name found\n", __func__);
     }
-    session_state_set(session, ERROR_RESOLVING_DOMAIN);
-    http_service_session_remove(session);
+    session_fire(session, idx, SESSION_EV_FAILED);
 }
 
 static void
-dnsname_resolve(dns_request_t *dns_request, const char *domain, int idx)
+dnsname_resolved_cb(resolver_answer_t *answer, void *ctx)
 {
-    struct evutil_addrinfo hints;
-    struct evdns_getaddrinfo_request *req = NULL;
-    struct evdns_base *dnsbase = this_dnsbase();
-    memset(&hints, 0, sizeof(hints));
-    hints.ai_family = AF_INET;
-    hints.ai_flags = EVUTIL_AI_CANONNAME;
-    hints.ai_socktype = SOCK_STREAM;
-    hints.ai_protocol = IPPROTO_TCP;
-
-    if (NULL == dnsbase) {
-        session_t *session = reference_get(dns_request->session);
-        dns_request_free(dns_request);
-        if (NULL != session) {
-            session_state_set(session, ERROR_RESOLVING_DOMAIN);
-            http_service_session_remove(session);
-        }
-        return;
-    }
-
-    req = evdns_getaddrinfo(dnsbase, domain, NULL,
-                          &hints, dnsname_resolved_cb, dns_request);
-    
-    dns_request->evdns_req = req;
-    dns_request->idx = idx;
-
-    fprintf(stderr, "resolving domain %s\n", domain);
+    uint64_t start = worker_cycles();
+    dnsname_resolved(answer, ctx);
+    worker_cb_timed(WORKER_CB_DNS, start);
 }
 
+/* answer comes later: cached, from worker dns resolver or from shared one */
 static dns_request_t *
 dns_request_new(session_t *session, const char *domain, int idx)
 {
     dns_request_t *dns_request = calloc(1, sizeof(dns_request_t));
     if (NULL != dns_request) {
-        dns_request->session = session->me;
-        reference_weak_inc(session->me);
-        dnsname_resolve(dns_request, domain, idx);
-        session->pending_resolutions++;
-
+        dns_request->session = session;
+        dns_request->idx = idx;
+        reference_local_weak_inc(&session->ref);
+
+        fprintf(stderr, "resolving domain %s\n", domain);
+        if (http_service_resolve(domain, dnsname_resolved_cb, dns_request) < 0) {
+            dns_request_free(dns_request);
+            return NULL;
+        }
     }
     return dns_request;
 }
     
+/* Upstream request pipeline: hooks run as their stage is entered,
+ * firing further events last (session may be gone past them).
+ */
+
+/* cache first, then upstream, unless its breaker is open: defaults then */
 static void
-client_msg_complete(http_session_t *http_session)
+session_lookup(session_t *session, int idx, session_stage_t from)
 {
-    session_t *session = http_session_master(http_session);
+    if (0 == session_cache_lookup(session, idx)) {
+        session_fire(session, idx, SESSION_EV_CACHED);
+    }
+    else if (session_upstream_allowed(session, idx)) {
+        session_fire(session, idx, SESSION_EV_RESOLVE);
+    }
+    /* upstream keeps failing: not worth waiting for */
+    else if (session_fallback(session, idx) < 0) {
+        session_fire(session, idx, SESSION_EV_FAILED);
+    }
+    else {
+        session_fire(session, idx, SESSION_EV_FALLBACK);
+    }
+}
 
-    /* self strong reference */
-    session->me = reference_new(session, NULL);
-    if (NULL == session->me) {
-        http_service_session_remove(session);
-        return;
+/* request to upstream is timed from now on, for its breaker */
+static void
+session_resolve(session_t *session, int idx, session_stage_t from)
+{
+    session->upstream_start[idx] = worker_cycles();
+
+    /* asynchronously resolve domain name of webserver */
+    if (NULL == dns_request_new(session, upstreams[idx].domain, idx)) {
+        session_fire(session, idx, SESSION_EV_FAILED);
     }
+}
 
-    /* asynchronously resolve domain names for name and joke webservers */
-    dns_request_t *request = dns_request_new(session, "uinames.com", NAME);
-    if (NULL == request) {
-        http_service_session_remove(session);
+static void
+session_connect(session_t *session, int idx, session_stage_t from)
+{
+    http_server_connect(session, idx, false);
+}
+
+typedef struct session_decoder session_decoder_t;
+
+struct session_decoder {
+    compute_fn_t decode;  /*< on compute thread */
+    compute_fn_t decoded; /*< back on worker */
+};
+
+static const session_decoder_t session_decoders[COUNT] = {
+    [NAME] = { name_decode, name_decoded },
+    [JOKE] = { joke_decode, joke_decoded }
+};
+
+static void
+session_decode(session_t *session, int idx, session_stage_t from)
+{
+    if (session_task_body_take(session, idx) < 0) {
+        session_fire(session, idx, SESSION_EV_FAILED);
         return;
     }
+    session_task_submit(session, idx, session_decoders[idx].decode, session_decoders[idx].decoded);
+}
 
-    request = dns_request_new(session, "api.icndb.com", JOKE);
-    if (NULL == request) {
+/**
+ * Upstream reply known: client is responded to once all of
+ * them are, while background revalidation is done.
+ */
+static void
+session_replied(session_t *session, int idx, session_stage_t from)
+{
+    if (CLIENT != session->revalidation) {
+        fprintf(stderr, "%s: %s revalidated\n", __func__, upstreams[idx].cache_key);
+        session->revalidation = CLIENT;
         http_service_session_remove(session);
         return;
     }
-    session_state_set(session, RESOLVING_WEBSERVER_DOMAINS);
+
+    for (int i = NAME; i < COUNT; ++i) {
+        if (STAGE_REPLIED != session->stages[i]) {
+            return;
+        }
+    }
+    http_client_response(session);
+}
+
+/* reply from upstream itself: its breaker learns about it, and it is cached */
+static void
+session_decoded(session_t *session, int idx, session_stage_t from)
+{
+    session_upstream_outcome(session, idx, false);
+    session_cache_store(session, idx);
+    session_replied(session, idx, from);
+}
+
+typedef struct session_stage_info session_stage_info_t;
+
+struct session_stage_info {
+    const char *name;
+    session_state_t state; /*< of session while an upstream request is in stage, START if none */
+    session_state_t error; /*< of session once an upstream request failed in stage */
+};
+
+static const session_stage_info_t session_stages[STAGE_COUNT] = {
+    [STAGE_IDLE]       = { "idle",       START,                       START },
+    [STAGE_LOOKUP]     = { "lookup",     START,                       ERROR_CLIENT_RESPONSE },
+    [STAGE_RESOLVING]  = { "resolving",  RESOLVING_WEBSERVER_DOMAINS, ERROR_RESOLVING_DOMAIN },
+    [STAGE_CONNECTING] = { "connecting", CONNECTING_TO_WEBSERVERS,    ERROR_CONNECTING_TO_WS },
+    [STAGE_REQUESTING] = { "requesting", REQUESTING_FROM_WEBSERVERS,  ERROR_REQUESTING_FROM_WS },
+    [STAGE_DECODING]   = { "decoding",   REQUESTING_FROM_WEBSERVERS,  ERROR_CLIENT_RESPONSE },
+    [STAGE_REPLIED]    = { "replied",    START,                       START },
+    [STAGE_FAILED]     = { "failed",     START,                       START }
+};
+
+/* upstream request failed: its breaker learns about it, and session is given up on */
+static void
+session_failed(session_t *session, int idx, session_stage_t from)
+{
+    session_upstream_outcome(session, idx, true);
+    session_cancel(session, session_stages[from].error);
+}
+
+typedef void (*session_hook_t)(session_t *session, int idx, session_stage_t from);
+
+typedef struct session_transition session_transition_t;
+
+struct session_transition {
+    session_stage_t to;  /*< STAGE_IDLE: event is unexpected in stage */
+    trace_type_t trace;  /*< recorded on transition, TRACE_COUNT if none */
+    session_hook_t hook; /*< run once stage is entered, may be NULL */
+};
+
+#define SESSION_FAIL { STAGE_FAILED, TRACE_FAILED, session_failed }
+
+/**
+ * Upstream request pipeline, by stage and event. A new stage
+ * (e.g. cache lookup) is a row, events leading to and from it,
+ * and a hook: other stages do not pay for it.
+ */
+static const session_transition_t session_transitions[STAGE_COUNT][SESSION_EV_COUNT] = {
+    [STAGE_IDLE] = {
+        [SESSION_EV_REQUEST]   = { STAGE_LOOKUP,     TRACE_COUNT,     session_lookup },
+        /* background revalidation */
+        [SESSION_EV_RESOLVE]   = { STAGE_RESOLVING,  TRACE_DNS_START, session_resolve }
+    },
+    [STAGE_LOOKUP] = {
+        [SESSION_EV_CACHED]    = { STAGE_REPLIED,    TRACE_CACHED,    session_replied },
+        [SESSION_EV_FALLBACK]  = { STAGE_REPLIED,    TRACE_FALLBACK,  session_replied },
+        [SESSION_EV_RESOLVE]   = { STAGE_RESOLVING,  TRACE_DNS_START, session_resolve },
+        [SESSION_EV_FAILED]    = SESSION_FAIL
+    },
+    [STAGE_RESOLVING] = {
+        [SESSION_EV_RESOLVED]  = { STAGE_CONNECTING, TRACE_DNS_END,   session_connect },
+        [SESSION_EV_FAILED]    = SESSION_FAIL
+    },
+    [STAGE_CONNECTING] = {
+        [SESSION_EV_CONNECTED] = { STAGE_REQUESTING, TRACE_CONNECTED, NULL },
+        [SESSION_EV_FAILED]    = SESSION_FAIL
+    },
+    [STAGE_REQUESTING] = {
+        /* hedging connection, or hedged one connecting last */
+        [SESSION_EV_CONNECTED] = { STAGE_REQUESTING, TRACE_CONNECTED, NULL },
+        [SESSION_EV_RECEIVED]  = { STAGE_DECODING,   TRACE_LAST_BYTE, session_decode },
+        [SESSION_EV_FAILED]    = SESSION_FAIL
+    },
+    [STAGE_DECODING] = {
+        [SESSION_EV_DECODED]   = { STAGE_REPLIED,    TRACE_COUNT,     session_decoded },
+        [SESSION_EV_FAILED]    = SESSION_FAIL
+    }
+};
+
+/* session state follows least advanced upstream request in flight */
+static void
+session_state_update(session_t *session)
+{
+    session_state_t state = START;
+
+    for (int i = NAME; i < COUNT; ++i) {
+        session_state_t stage_state = session_stages[session->stages[i]].state;
+        if (START != stage_state && (START == state || stage_state < state)) {
+            state = stage_state;
+        }
+    }
+    if (START != state && state != session->state) {
+        session_state_set(session, state);
+    }
+}
+
+/**
+ * Moves upstream request idx of session to stage event leads to:
+ * records event in session trace, updates session state, then
+ * runs hook of new stage, which may fire further events.
+ *
+ * @return 0, if session goes on. -1, if event was unexpected
+ *         or session is gone meanwhile (e.g. failed): callers
+ *         must then not touch session any longer. Hooks (and
+ *         callbacks) only ignore it when firing is what they
+ *         do last.
+ */
+static int
+session_fire(session_t *session, int idx, session_event_t event)
+{
+    session_stage_t from = session->stages[idx];
+    const session_transition_t *transition = &session_transitions[from][event];
+    bool alive = true;
+
+    if (STAGE_IDLE == transition->to) {
+        fprintf(stderr, "%s: upstream %d: unexpected event %d while %s\n",
+                __func__, idx, event, session_stages[from].name);
+        return -1;
+    }
+
+    session->stages[idx] = transition->to;
+    if (TRACE_COUNT != transition->trace) {
+        trace_add(&session->trace, transition->trace, idx);
+    }
+    session_state_update(session);
+
+    if (NULL != transition->hook) {
+        /* hook may remove session: memory is kept until it returns */
+        reference_local_weak_inc(&session->ref);
+        transition->hook(session, idx, from);
+        alive = reference_local_alive(&session->ref);
+        reference_local_weak_dec(&session->ref);
+    }
+    return alive ? 0 : -1;
+}
+
+static void
+client_msg_complete(http_session_t *http_session)
+{
+    session_t *session = http_session_master(http_session);
+
+    trace_add(&session->trace, TRACE_LAST_BYTE, CLIENT);
+
+    /* responded to as soon as both replies are known */
+    for (int idx = NAME; idx < COUNT; ++idx) {
+        if (session_fire(session, idx, SESSION_EV_REQUEST) < 0) {
+            return;
+        }
+    }
+}
+
+/* last strong reference dropped: dns requests may still point to session */
+static void
+session_release(reference_t *ref)
+{
+    session_t *session = downcast(ref, session_t, ref);
+    int i = 0;
+
+    /* unless responded to: failed, or client went away */
+    session_trace_finish(session);
+
+    if (CLIENT != session->revalidation && NULL != http_service_cache()) {
+        /* stale value gets revalidated again on next lookup */
+        cache_revalidate_failed(http_service_cache(), upstreams[session->revalidation].cache_key);
+    }
+
+    http_session_free(session->http_sessions[CLIENT]);
+    session->http_sessions[CLIENT] = NULL;
+    for (i = NAME; i < countof(session->http_sessions); ++i) {
+        session_upstream_free(session, i);
+    }
+    free(session->name);
+    session->name = NULL;
+    free(session->surname);
+    session->surname = NULL;
+    free(session->joke);
+    session->joke = NULL;
+}
+
+static void
+session_dealloc(reference_t *ref)
+{
+    session_t *session = downcast(ref, session_t, ref);
+    pool_t *pool = http_service_session_pool();
+    memacct_release(session->memacct, MEMACCT_SESSION, sizeof(session_t));
+    if (NULL == pool || !pool_put(pool, session)) {
+        free(session);
+    }
 }
 
 void
 session_free(session_t *session)
 {
     if (NULL != session) {
-        int i = 0;
-        for (i = 0; i < countof(session->http_sessions); ++i) {
-            http_session_free(session->http_sessions[i]);
-            session->http_sessions[i] = NULL;
+        reference_local_dec(&session->ref);
+    }
+}
+
+static session_t *
+session_alloc(void)
+{
+    pool_t *pool = http_service_session_pool();
+    session_t *session = (NULL != pool) ? pool_get(pool) : calloc(1, sizeof(session_t));
+    if (NULL != session) {
+        memset(session, 0, sizeof(*session));
+        reference_init(&session->ref, session_release, session_dealloc);
+        session->memacct = this_memacct();
+        memacct_charge(session->memacct, MEMACCT_SESSION, sizeof(session_t));
+        for (int i = 0; i < COUNT; ++i) {
+            session->hedges[i].session = session;
         }
-        reference_dec(session->me);
-        session->me = NULL;
-        free(session->name);
-        session->name = NULL;
-        free(session->surname);
-        session->surname = NULL;
-        free(session->joke);
-        session->joke = NULL;
-        free(session);
+        trace_init(&session->trace, atomic_inc(&session_ids));
+        session->revalidation = CLIENT;
+    }
+    return session;
+}
+
+/**
+ * Refreshes stale cached upstream reply with a session of
+ * its own, which no client waits for.
+ */
+static void
+session_revalidate(int idx)
+{
+    session_t *session = session_alloc();
+
+    if (NULL == session) {
+        cache_revalidate_failed(http_service_cache(), upstreams[idx].cache_key);
+        return;
+    }
+    session->revalidation = idx;
+    session->timed = true;
+    if (!session_upstream_allowed(session, idx)) {
+        /* stale value is served until upstream recovers */
+        session_free(session);
+        return;
     }
+    http_service_session_add(session);
+    session_fire(session, idx, SESSION_EV_RESOLVE);
 }
 
 session_t *
 session_new(io_channel_t *channel)
 {
-    session_t *session = calloc(1, sizeof(session_t));
+    session_t *session = session_alloc();
     if (NULL != session) {
         http_session_t *http_session = http_session_new(session, channel, HTTP_REQUEST);
         if (NULL != http_session) {
@@ -614,9 +1665,8 @@ session_new(io_channel_t *channel)
             memset(&callbacks, 0, sizeof(callbacks));
             session->http_sessions[CLIENT] = http_session;
             session->state = START;
-            session->name_replied = false;
-            session->joke_replied = false;
             session_state_set(session, PARSING_CLIENT_REQUEST);
+            callbacks.message_begin = http_message_begin;
             callbacks.message_complete = client_msg_complete;
             callbacks.ready_to_close = client_ready_to_close;
             http_session_callbacks_set(http_session, &callbacks);
@@ -627,3 +1677,35 @@ session_new(io_channel_t *channel)
     }
     return session;
 }
+
+bool
+session_is_idle(session_t *session)
+{
+    return (PARSING_CLIENT_REQUEST == session->state) &&
+           http_session_is_idle(session->http_sessions[CLIENT]);
+}
+
+bool
+session_is_done(session_t *session)
+{
+    return (CLIENT_RESPONSE == session->state) &&
+           http_session_is_flushed(session->http_sessions[CLIENT]);
+}
+
+ilink_t *
+session_link(session_t *session)
+{
+    return &session->link;
+}
+
+session_t *
+session_from_link(ilink_t *link)
+{
+    return downcast(link, session_t, link);
+}
+
+void
+session_pool_init(pool_t *pool, size_t max)
+{
+    pool_init(pool, sizeof(session_t), max, NULL);
+}
@@ -11,4 +11,37 @@ struct io_channel;
 session_t *
 session_new(struct io_channel *channel);
 
+/**
+ * Whether client connection is open but client
+ * has not started sending any request yet.
+ */
+bool
+session_is_idle(session_t *session);
+
+/**
+ * Whether client was responded to and response was fully
+ * written: nothing is left but closing its connection,
+ * whether client closes it or not.
+ */
+bool
+session_is_done(session_t *session);
+
+/**
+ * Link embedded in session, so that it can be kept
+ * in a list without any node allocation.
+ */
+ilink_t *
+session_link(session_t *session);
+
+session_t *
+session_from_link(ilink_t *link);
+
+/**
+ * Sets up pool sessions freed by a worker are kept in
+ * for reuse (@see http_service_session_pool).
+ */
+struct pool;
+void
+session_pool_init(struct pool *pool, size_t max);
+
 #endif /* _TIGERA_SESSION__H__ */
@@ -0,0 +1,370 @@
+#ifndef _TIGERA_SWISSTABLE__H__
+#define _TIGERA_SWISSTABLE__H__
+
+#include "includes.h"
+#include "hashtable.h"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+/* Open addressing Hash Table implementation ("Swiss table").
+ *
+ * Keys and values are stored inline in a slot array. A parallel
+ * array keeps one control byte per slot: empty, deleted, or 7 bits
+ * of key hash for full slots. Lookups compare control bytes of 16
+ * slots at once (SSE2) and only compare keys of slots whose 7 bits
+ * match, so that neither allocation per insert nor pointer chase
+ * per probe takes place.
+ *
+ * Not synchronized: meant for tables owned by a single worker.
+ *
+ * Tables are generated per key/value type, so that hash and compare
+ * get inlined for fixed-size keys:
+ *
+ *   SWISSTABLE_DEFINE(name, key_type, value_type)
+ *       hashes and compares keys bytewise (keys must not have
+ *       uninitialized padding)
+ *
+ *   SWISSTABLE_DEFINE_HASH_EQ(name, key_type, value_type, hash, eq)
+ *       uint64_t hash(const key_type *), bool eq(const key_type *, const key_type *)
+ *
+ * both of which define name_t and:
+ *
+ *   name_t *name_new(size_t capacity);
+ *   void name_free(name_t *table);
+ *   value_type *name_find(name_t *table, const key_type *key);
+ *   hashtable_error_t name_add(name_t *table, const key_type *key, value_type value);
+ *   bool name_remove(name_t *table, const key_type *key, value_type *value);
+ *   size_t name_size(name_t *table);
+ */
+
+#define SWISSTABLE_GROUP_WIDTH  16
+#define SWISSTABLE_MIN_CAPACITY SWISSTABLE_GROUP_WIDTH
+
+#define SWISSTABLE_CTRL_EMPTY   ((int8_t)-128) /**< 0x80 */
+#define SWISSTABLE_CTRL_DELETED ((int8_t)-2)   /**< 0xfe */
+
+/* bitmask of slots within group matching */
+typedef uint32_t swisstable_mask_t;
+
+static inline swisstable_mask_t
+swisstable_group_match(const int8_t *group, int8_t h2)
+{
+#if defined(__SSE2__)
+    __m128i ctrl = _mm_load_si128((const __m128i *)group);
+    return _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_set1_epi8(h2), ctrl));
+#else
+    swisstable_mask_t mask = 0;
+    for (int i = 0; i < SWISSTABLE_GROUP_WIDTH; ++i) {
+        mask |= (swisstable_mask_t)(group[i] == h2) << i;
+    }
+    return mask;
+#endif
+}
+
+static inline swisstable_mask_t
+swisstable_group_match_empty(const int8_t *group)
+{
+    return swisstable_group_match(group, SWISSTABLE_CTRL_EMPTY);
+}
+
+/* empty and deleted control bytes are the only negative ones */
+static inline swisstable_mask_t
+swisstable_group_match_empty_or_deleted(const int8_t *group)
+{
+#if defined(__SSE2__)
+    __m128i ctrl = _mm_load_si128((const __m128i *)group);
+    return _mm_movemask_epi8(ctrl);
+#else
+    swisstable_mask_t mask = 0;
+    for (int i = 0; i < SWISSTABLE_GROUP_WIDTH; ++i) {
+        mask |= (swisstable_mask_t)(group[i] < 0) << i;
+    }
+    return mask;
+#endif
+}
+
+/* h1 selects first group to probe, h2 is kept in control byte */
+static inline size_t
+swisstable_h1(uint64_t hash)
+{
+    return hash >> 7;
+}
+
+static inline int8_t
+swisstable_h2(uint64_t hash)
+{
+    return hash & 0x7f;
+}
+
+static inline uint64_t
+swisstable_mix(uint64_t h)
+{
+    /* murmur3 fmix64 */
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+    return h;
+}
+
+/* unrolled by compiler whenever len is a constant */
+static inline uint64_t
+swisstable_hash_bytes(const void *data, size_t len)
+{
+    const unsigned char *p = data;
+    uint64_t h = len * 0x9e3779b97f4a7c15ULL;
+    while (len >= 8) {
+        uint64_t word;
+        memcpy(&word, p, 8);
+        h = (h ^ word) * 0x9e3779b97f4a7c15ULL;
+        h = (h << 31) | (h >> 33);
+        p += 8;
+        len -= 8;
+    }
+    if (len > 0) {
+        uint64_t word = 0;
+        memcpy(&word, p, len);
+        h = (h ^ word) * 0x9e3779b97f4a7c15ULL;
+    }
+    return swisstable_mix(h);
+}
+
+/* growth is allowed up to 7/8 of capacity */
+static inline size_t
+swisstable_max_load(size_t capacity)
+{
+    return capacity - capacity / 8;
+}
+
+/**
+ * Control bytes are allocated aligned to group width,
+ * so that every group can be loaded with one instruction.
+ */
+static inline int8_t *
+swisstable_ctrl_new(size_t capacity)
+{
+    void *ctrl = NULL;
+    if (0 != posix_memalign(&ctrl, SWISSTABLE_GROUP_WIDTH, capacity)) {
+        return NULL;
+    }
+    memset(ctrl, SWISSTABLE_CTRL_EMPTY, capacity);
+    return ctrl;
+}
+
+#define swisstable_foreach(table, i) \
+    for ((i) = 0; (i) < (table)->capacity; ++(i)) \
+        if ((table)->ctrl[(i)] >= 0)
+
+#define SWISSTABLE_DEFINE(name, key_type, value_type) \
+    static inline uint64_t \
+    name##_hash_key(const key_type *key) \
+    { \
+        return swisstable_hash_bytes(key, sizeof(key_type)); \
+    } \
+    static inline bool \
+    name##_eq_key(const key_type *a, const key_type *b) \
+    { \
+        return 0 == memcmp(a, b, sizeof(key_type)); \
+    } \
+    SWISSTABLE_DEFINE_HASH_EQ(name, key_type, value_type, name##_hash_key, name##_eq_key)
+
+#define SWISSTABLE_DEFINE_HASH_EQ(name, key_type, value_type, hash, eq) \
+    typedef struct name##_slot name##_slot_t; \
+    \
+    struct name##_slot { \
+        key_type key; \
+        value_type value; \
+    }; \
+    \
+    typedef struct name name##_t; \
+    \
+    struct name { \
+        int8_t *ctrl; \
+        name##_slot_t *slots; \
+        size_t capacity; /**< power of 2, multiple of group width */ \
+        size_t size; \
+        size_t growth_left; /**< # empty slots that may still be filled */ \
+    }; \
+    \
+    static inline void \
+    name##_free(name##_t *table) \
+    { \
+        if (NULL != table) { \
+            free(table->ctrl); \
+            free(table->slots); \
+            free(table); \
+        } \
+    } \
+    \
+    static inline int \
+    name##_alloc(name##_t *table, size_t capacity) \
+    { \
+        size_t cap = SWISSTABLE_MIN_CAPACITY; \
+        while (cap < capacity) { \
+            cap <<= 1; \
+        } \
+        int8_t *ctrl = swisstable_ctrl_new(cap); \
+        name##_slot_t *slots = malloc(cap * sizeof(name##_slot_t)); \
+        if (NULL == ctrl || NULL == slots) { \
+            free(ctrl); \
+            free(slots); \
+            return -1; \
+        } \
+        table->ctrl = ctrl; \
+        table->slots = slots; \
+        table->capacity = cap; \
+        table->size = 0; \
+        table->growth_left = swisstable_max_load(cap); \
+        return 0; \
+    } \
+    \
+    static inline name##_t * \
+    name##_new(size_t capacity) \
+    { \
+        name##_t *table = calloc(1, sizeof(name##_t)); \
+        if (NULL != table) { \
+            if (name##_alloc(table, capacity) < 0) { \
+                free(table); \
+                return NULL; \
+            } \
+        } \
+        return table; \
+    } \
+    \
+    static inline size_t \
+    name##_size(name##_t *table) \
+    { \
+        return table->size; \
+    } \
+    \
+    /* probes groups with triangular steps: visits every group */ \
+    static inline size_t \
+    name##_find_slot(name##_t *table, const key_type *key, uint64_t h) \
+    { \
+        size_t mask = table->capacity / SWISSTABLE_GROUP_WIDTH - 1; \
+        size_t group = swisstable_h1(h) & mask; \
+        int8_t h2 = swisstable_h2(h); \
+        for (size_t step = 1; step <= mask + 1; ++step) { \
+            const int8_t *ctrl = &table->ctrl[group * SWISSTABLE_GROUP_WIDTH]; \
+            swisstable_mask_t match = swisstable_group_match(ctrl, h2); \
+            while (0 != match) { \
+                size_t i = group * SWISSTABLE_GROUP_WIDTH + __builtin_ctz(match); \
+                if (eq(&table->slots[i].key, key)) { \
+                    return i; \
+                } \
+                match &= match - 1; \
+            } \
+            if (0 != swisstable_group_match_empty(ctrl)) { \
+                break; \
+            } \
+            group = (group + step) & mask; \
+        } \
+        return table->capacity; \
+    } \
+    \
+    static inline size_t \
+    name##_find_free(name##_t *table, uint64_t h) \
+    { \
+        size_t mask = table->capacity / SWISSTABLE_GROUP_WIDTH - 1; \
+        size_t group = swisstable_h1(h) & mask; \
+        for (size_t step = 1; ; ++step) { \
+            const int8_t *ctrl = &table->ctrl[group * SWISSTABLE_GROUP_WIDTH]; \
+            swisstable_mask_t match = swisstable_group_match_empty_or_deleted(ctrl); \
+            if (0 != match) { \
+                return group * SWISSTABLE_GROUP_WIDTH + __builtin_ctz(match); \
+            } \
+            group = (group + step) & mask; \
+        } \
+    } \
+    \
+    static inline value_type * \
+    name##_find(name##_t *table, const key_type *key) \
+    { \
+        size_t i = name##_find_slot(table, key, hash(key)); \
+        if (i == table->capacity) { \
+            return NULL; \
+        } \
+        return &table->slots[i].value; \
+    } \
+    \
+    /* grows table, or just drops tombstones if mostly deleted */ \
+    static inline int \
+    name##_rehash(name##_t *table) \
+    { \
+        name##_t old = *table; \
+        size_t capacity = old.capacity; \
+        if (old.size >= swisstable_max_load(old.capacity) / 2) { \
+            capacity *= 2; \
+        } \
+        if (name##_alloc(table, capacity) < 0) { \
+            *table = old; \
+            return -1; \
+        } \
+        for (size_t i = 0; i < old.capacity; ++i) { \
+            if (old.ctrl[i] >= 0) { \
+                uint64_t h = hash(&old.slots[i].key); \
+                size_t j = name##_find_free(table, h); \
+                table->ctrl[j] = swisstable_h2(h); \
+                table->slots[j] = old.slots[i]; \
+                table->size++; \
+                table->growth_left--; \
+            } \
+        } \
+        free(old.ctrl); \
+        free(old.slots); \
+        return 0; \
+    } \
+    \
+    static inline hashtable_error_t \
+    name##_add(name##_t *table, const key_type *key, value_type value) \
+    { \
+        uint64_t h = hash(key); \
+        if (name##_find_slot(table, key, h) != table->capacity) { \
+            return HASHTABLE_E_FOUND; \
+        } \
+        size_t i = name##_find_free(table, h); \
+        if (0 == table->growth_left && SWISSTABLE_CTRL_EMPTY == table->ctrl[i]) { \
+            if (name##_rehash(table) < 0) { \
+                return HASHTABLE_E_ERROR; \
+            } \
+            i = name##_find_free(table, h); \
+        } \
+        if (SWISSTABLE_CTRL_EMPTY == table->ctrl[i]) { \
+            table->growth_left--; \
+        } \
+        table->ctrl[i] = swisstable_h2(h); \
+        table->slots[i].key = *key; \
+        table->slots[i].value = value; \
+        table->size++; \
+        return HASHTABLE_E_SUCCESS; \
+    } \
+    \
+    static inline bool \
+    name##_remove(name##_t *table, const key_type *key, value_type *value) \
+    { \
+        size_t i = name##_find_slot(table, key, hash(key)); \
+        if (i == table->capacity) { \
+            return false; \
+        } \
+        if (NULL != value) { \
+            *value = table->slots[i].value; \
+        } \
+        /* groups are probed whole: if slot group has an empty slot, \
+         * no probe ever went past it and slot may become empty again \
+         */ \
+        const int8_t *group = &table->ctrl[i & ~(size_t)(SWISSTABLE_GROUP_WIDTH - 1)]; \
+        if (0 != swisstable_group_match_empty(group)) { \
+            table->ctrl[i] = SWISSTABLE_CTRL_EMPTY; \
+            table->growth_left++; \
+        } \
+        else { \
+            table->ctrl[i] = SWISSTABLE_CTRL_DELETED; \
+        } \
+        table->size--; \
+        return true; \
+    }
+
+#endif /* _TIGERA_SWISSTABLE__H__ */
@@ -0,0 +1,193 @@
+#include "includes.h"
+#include "swisstable.h"
+#include <time.h>
+#include <assert.h>
+
+#define NR_KEYS     (256*1024)
+#define NR_LOOKUPS  (4*1024*1024)
+
+SWISSTABLE_DEFINE(u32_table, uint32_t, uint32_t)
+
+typedef struct item item_t;
+
+struct item {
+    uint32_t key;
+    hashtable_link_t link;
+};
+
+static item_t items[NR_KEYS];
+
+static int
+item_cmp(const void *value, const void *key)
+{
+    const item_t *item = value;
+    return item->key != *(const uint32_t *)key;
+}
+
+static hash_t
+item_hash(const void *key)
+{
+    return swisstable_hash_bytes(key, sizeof(uint32_t));
+}
+
+static double
+now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void
+test_u32(void)
+{
+    u32_table_t *table = u32_table_new(0);
+    uint32_t value;
+    assert(NULL != table);
+
+    for (uint32_t key = 0; key < NR_KEYS; ++key) {
+        assert(HASHTABLE_E_SUCCESS == u32_table_add(table, &key, key * 3));
+        assert(HASHTABLE_E_FOUND == u32_table_add(table, &key, 0));
+    }
+    assert(NR_KEYS == u32_table_size(table));
+
+    for (uint32_t key = 0; key < NR_KEYS; ++key) {
+        uint32_t *v = u32_table_find(table, &key);
+        assert(NULL != v && *v == key * 3);
+    }
+
+    for (uint32_t key = 0; key < NR_KEYS; key += 2) {
+        assert(u32_table_remove(table, &key, &value));
+        assert(value == key * 3);
+        assert(!u32_table_remove(table, &key, NULL));
+    }
+    assert(NR_KEYS / 2 == u32_table_size(table));
+
+    /* churn through tombstones without growing */
+    size_t capacity = table->capacity;
+    for (int round = 0; round < 8; ++round) {
+        for (uint32_t key = 0; key < NR_KEYS; key += 2) {
+            uint32_t k = key + (round + 1) * NR_KEYS;
+            assert(HASHTABLE_E_SUCCESS == u32_table_add(table, &k, k));
+        }
+        for (uint32_t key = 0; key < NR_KEYS; key += 2) {
+            uint32_t k = key + (round + 1) * NR_KEYS;
+            assert(u32_table_remove(table, &k, NULL));
+        }
+    }
+    assert(capacity == table->capacity);
+
+    size_t i, n = 0;
+    swisstable_foreach(table, i) {
+        assert(table->slots[i].key % 2);
+        n++;
+    }
+    assert(n == u32_table_size(table));
+
+    u32_table_free(table);
+}
+
+typedef struct tuple tuple_t;
+
+/* fixed size key without implicit padding, e.g. a 5-tuple */
+struct tuple {
+    uint8_t src[16];
+    uint8_t dst[16];
+    uint16_t src_port;
+    uint16_t dst_port;
+    uint8_t proto;
+    uint8_t reserved[3];
+};
+
+static inline uint64_t
+tuple_hash(const tuple_t *key)
+{
+    return swisstable_hash_bytes(key, sizeof(*key));
+}
+
+static inline bool
+tuple_eq(const tuple_t *a, const tuple_t *b)
+{
+    return a->src_port == b->src_port && a->dst_port == b->dst_port &&
+           a->proto == b->proto && 0 == memcmp(a->src, b->src, sizeof(a->src)) &&
+           0 == memcmp(a->dst, b->dst, sizeof(a->dst));
+}
+
+SWISSTABLE_DEFINE_HASH_EQ(tuple_table, tuple_t, void *, tuple_hash, tuple_eq)
+
+/* hash and compare specialized for key type */
+static void
+test_tuple(void)
+{
+    tuple_t key;
+    tuple_table_t *table = tuple_table_new(16);
+    assert(NULL != table);
+
+    memset(&key, 0, sizeof(key));
+    key.proto = IPPROTO_TCP;
+    inet_pton(AF_INET, "10.0.0.1", key.dst);
+    inet_pton(AF_INET, "10.0.0.2", key.src);
+    key.src_port = htons(5000);
+
+    for (int port = 1024; port < 1024 + 4096; ++port) {
+        key.dst_port = htons(port);
+        assert(HASHTABLE_E_SUCCESS == tuple_table_add(table, &key, &items[port]));
+    }
+    for (int port = 1024; port < 1024 + 4096; ++port) {
+        key.dst_port = htons(port);
+        void **value = tuple_table_find(table, &key);
+        assert(NULL != value && *value == &items[port]);
+    }
+    key.proto = IPPROTO_UDP;
+    assert(NULL == tuple_table_find(table, &key));
+
+    tuple_table_free(table);
+}
+
+/* lookups of chained hashtable against inline open addressing */
+static void
+bench(void)
+{
+    uint32_t sum = 0;
+    u32_table_t *table = u32_table_new(NR_KEYS);
+    hashtable_t *hashtable = hashtable_new(item_cmp, item_hash, NULL, offsetof(item_t, link), NR_KEYS, 1);
+    assert(NULL != table && NULL != hashtable);
+
+    for (uint32_t key = 0; key < NR_KEYS; ++key) {
+        items[key].key = key;
+        u32_table_add(table, &key, key);
+        hashtable_add(hashtable, &items[key], &key);
+    }
+
+    double start = now();
+    for (uint32_t i = 0; i < NR_LOOKUPS; ++i) {
+        uint32_t key = (i * 2654435761u) % (2 * NR_KEYS);
+        item_t *item = hashtable_find(hashtable, &key);
+        sum += (NULL != item);
+    }
+    double chained = now() - start;
+
+    start = now();
+    for (uint32_t i = 0; i < NR_LOOKUPS; ++i) {
+        uint32_t key = (i * 2654435761u) % (2 * NR_KEYS);
+        uint32_t *value = u32_table_find(table, &key);
+        sum += (NULL != value);
+    }
+    double swiss = now() - start;
+
+    assert(sum == NR_LOOKUPS);
+    printf("chained: %6.2f Mlookups/s, swiss: %6.2f Mlookups/s (50%% hits)\n",
+           NR_LOOKUPS / chained / 1e6, NR_LOOKUPS / swiss / 1e6);
+
+    hashtable_free(hashtable);
+    u32_table_free(table);
+}
+
+int
+main(int argc, char **argv)
+{
+    test_u32();
+    test_tuple();
+    bench();
+    return 0;
+}
@@ -3,10 +3,24 @@
 #include "io_service.h"
 #include "worker.h"
 #include "atomic.h"
+#include "backpressure.h"
+#include "memacct.h"
 
 #define tcp_socket_cast(p)  downcast(p, tcp_socket_t, parent)
-#define TCP_SOCKET_READ_HIGH_WM (16*1024*1024) /**< memory limit for input buffer in bytes */
 #define TCP_SOCKET_BACKLOG  100
+#define TCP_SOCKET_PARKED_TIMEOUT 60 /**< seconds parked connection waits for peer to send something */
+
+typedef struct tcp_socket_accept_ctx tcp_socket_accept_ctx_t;
+
+/**
+ * Connection being accepted: fd is owned by whoever
+ * (accept or reject) sets it to -1.
+ */
+struct tcp_socket_accept_ctx {
+    evutil_socket_t fd;
+    struct event_base *ebase;
+    backpressure_t *backpressure; /**< of listener */
+};
 
 typedef struct tcp_socket tcp_socket_t;
 
@@ -17,6 +31,16 @@ struct tcp_socket {
         struct evconnlistener *listener;
     };
     bool listen;
+    bool accepted;                /**< whether peer connected to us */
+    backpressure_t *backpressure; /**< budget buffers count against, or NULL */
+    memacct_t *memacct;           /**< of worker socket was created on, or NULL */
+    struct evbuffer_cb_entry *input_cb;
+    struct evbuffer_cb_entry *output_cb;
+    ilink_t waiting;              /**< in backpressure waiting connections, if linked */
+    size_t buffered;              /**< bytes held by input and output buffers */
+    size_t wm;                    /**< watermark set on bufferevent */
+    bool paused;                  /**< whether backpressure stopped reading */
+    struct event *parked;         /**< waits for accepted peer to send something, while parked */
 };
 
 static int
@@ -25,6 +49,65 @@ tcp_socket_config(tcp_socket_t *tcp_socket);
 io_channel_t *
 tcp_socket_new(void);
 
+static struct bufferevent *
+tcp_socket_bev_new(struct event_base *ebase, evutil_socket_t fd)
+{
+    return bufferevent_socket_new(ebase,
+                                  fd,
+                                  BEV_OPT_CLOSE_ON_FREE |
+                                  BEV_OPT_THREADSAFE |
+                                  BEV_OPT_UNLOCK_CALLBACKS |
+                                  BEV_OPT_DEFER_CALLBACKS);
+}
+
+/* parked connection: owns fd through its event */
+static void
+tcp_socket_unpark(tcp_socket_t *tcp_socket)
+{
+    event_free(tcp_socket->parked);
+    tcp_socket->parked = NULL;
+    memacct_release(tcp_socket->memacct, MEMACCT_TCP_SOCKET, event_get_struct_event_size());
+}
+
+/* drops bufferevent, along with bytes it held */
+static void
+tcp_socket_release(tcp_socket_t *tcp_socket)
+{
+    backpressure_t *backpressure = tcp_socket->backpressure;
+
+    if (NULL != tcp_socket->parked) {
+        evutil_socket_t fd = event_get_fd(tcp_socket->parked);
+        tcp_socket_unpark(tcp_socket);
+        evutil_closesocket(fd);
+        return;
+    }
+    if (NULL == tcp_socket->bev) {
+        return;
+    }
+    if (NULL != tcp_socket->input_cb) {
+        evbuffer_remove_cb_entry(bufferevent_get_input(tcp_socket->bev), tcp_socket->input_cb);
+        tcp_socket->input_cb = NULL;
+    }
+    if (NULL != tcp_socket->output_cb) {
+        evbuffer_remove_cb_entry(bufferevent_get_output(tcp_socket->bev), tcp_socket->output_cb);
+        tcp_socket->output_cb = NULL;
+    }
+    /* accounted as soon as configured */
+    if (NULL != backpressure) {
+        if (ilink_linked(&tcp_socket->waiting)) {
+            ilist_remove(&backpressure->waiting, &tcp_socket->waiting);
+        }
+        if (tcp_socket->paused) {
+            backpressure->paused--;
+        }
+        backpressure_detach(backpressure, tcp_socket->buffered);
+        memacct_release(tcp_socket->memacct, MEMACCT_TCP_SOCKET, tcp_socket->buffered);
+        tcp_socket->buffered = 0;
+    }
+    bufferevent_free(tcp_socket->bev);
+    tcp_socket->bev = NULL;
+}
+
 static void
 tcp_socket_free(io_channel_t *channel)
 {
@@ -37,26 +120,94 @@ tcp_socket_free(io_channel_t *channel)
             }
         }
         else {
-            if (NULL != tcp_socket->bev) {
-                bufferevent_free(tcp_socket->bev);
-                tcp_socket->bev = NULL;
-            }
+            tcp_socket_release(tcp_socket);
         }
+        memacct_release(tcp_socket->memacct, MEMACCT_TCP_SOCKET, sizeof(tcp_socket_t));
         free(tcp_socket);
     }
 }
 
+/**
+ * Peer sent something (or closed): parked connection gets
+ * its buffers back, and lets io service know. Peer idle for
+ * too long: connection is closed, and io service told so.
+ */
+static void
+tcp_socket_parked_cb(evutil_socket_t fd, short events, void *arg)
+{
+    io_channel_t *channel = arg;
+    tcp_socket_t *tcp_socket = tcp_socket_cast(channel);
+    struct event_base *ebase = event_get_base(tcp_socket->parked);
+    uint64_t start = worker_cycles();
+
+    tcp_socket_unpark(tcp_socket);
+    if (events & EV_TIMEOUT) {
+        evutil_closesocket(fd);
+        channel->service->event_cb(channel, IO_CHANNEL_EVENT_READ | IO_CHANNEL_EVENT_TIMEOUT);
+        worker_cb_timed(WORKER_CB_EVENT, start);
+        return;
+    }
+    tcp_socket->bev = tcp_socket_bev_new(ebase, fd);
+    if (NULL == tcp_socket->bev) {
+        evutil_closesocket(fd);
+    }
+    if (NULL == tcp_socket->bev || tcp_socket_config(tcp_socket) < 0) {
+        channel->service->event_cb(channel, IO_CHANNEL_EVENT_ERROR);
+    }
+    else {
+        channel->service->read_cb(channel);
+    }
+    worker_cb_timed(WORKER_CB_READ, start);
+}
+
+/**
+ * Accepted connection peer sent nothing to yet (e.g. just opened
+ * by a client pool) is parked: no bufferevent (nor buffers) until
+ * peer sends something, only an event waiting for it (for up to
+ * TCP_SOCKET_PARKED_TIMEOUT).
+ */
+static int
+tcp_socket_park(tcp_socket_t *tcp_socket, tcp_socket_accept_ctx_t *ctx)
+{
+    char byte = 0;
+    struct timeval timeout = { TCP_SOCKET_PARKED_TIMEOUT, 0 };
+
+    if (recv(ctx->fd, &byte, 1, MSG_PEEK | MSG_DONTWAIT) >= 0 ||
+        (EAGAIN != errno && EWOULDBLOCK != errno)) {
+        return -1;
+    }
+    tcp_socket->parked = event_new(ctx->ebase, ctx->fd, EV_READ, tcp_socket_parked_cb, &tcp_socket->parent);
+    if (NULL == tcp_socket->parked) {
+        return -1;
+    }
+    if (event_add(tcp_socket->parked, &timeout) < 0) {
+        event_free(tcp_socket->parked);
+        tcp_socket->parked = NULL;
+        return -1;
+    }
+    memacct_charge(tcp_socket->memacct, MEMACCT_TCP_SOCKET, event_get_struct_event_size());
+    ctx->fd = -1; /*< parked event owns fd from now on */
+    return 0;
+}
+
 static io_channel_t *
 tcp_socket_accept(io_channel_accept_param_t *param)
 {
-    struct event_base *ebase = this_event_base();
-    if (NULL == ebase) {
-        return NULL;
-    }
+    tcp_socket_accept_ctx_t *ctx = param->io_ctx;
     io_channel_t *channel = tcp_socket_new();
     if (NULL != channel) {
         tcp_socket_t *tcp_socket = tcp_socket_cast(channel);
-        tcp_socket->bev = param->io_ctx;
+        tcp_socket->accepted = true;
+        tcp_socket->backpressure = ctx->backpressure;
+        if (tcp_socket_park(tcp_socket, ctx) == 0) {
+            return channel;
+        }
+        tcp_socket->bev = tcp_socket_bev_new(ctx->ebase, ctx->fd);
+        if (NULL == tcp_socket->bev) {
+            tcp_socket_free(channel);
+            return NULL;
+        }
+        ctx->fd = -1; /*< bufferevent owns fd from now on */
         if (tcp_socket_config(tcp_socket) == 0) {
             return channel; 
         }
@@ -66,6 +217,32 @@ tcp_socket_accept(io_channel_accept_param_t *param)
     return channel;
 }
 
+static io_channel_error_t
+tcp_socket_reject(io_channel_accept_param_t *param, const unsigned char *buffer, size_t len)
+{
+    char discard[512];
+    tcp_socket_accept_ctx_t *ctx = param->io_ctx;
+    io_channel_error_t error = IO_CHANNEL_E_SUCCESS;
+
+    /* freshly accepted socket has an empty send buffer:
+     * a short reply fits in it without ever blocking
+     */
+    if (send(ctx->fd, buffer, len, MSG_DONTWAIT | MSG_NOSIGNAL) != (ssize_t)len) {
+        error = IO_CHANNEL_E_ERROR;
+    }
+    shutdown(ctx->fd, SHUT_WR);
+
+    /* closing with unread data in receive buffer would reset
+     * connection (and drop reply), so consume what already arrived
+     */
+    while (recv(ctx->fd, discard, sizeof(discard), MSG_DONTWAIT) > 0) {
+    }
+
+    evutil_closesocket(ctx->fd);
+    ctx->fd = -1;
+    return error;
+}
+
 static struct evbuffer *
 tcp_socket_get_input(io_channel_t *channel)
 {
@@ -129,14 +306,7 @@ tcp_socket_connect(io_channel_t *channel, struct sockaddr_storage *sockaddr)
         goto error;
     }
 
-    bev =
-        bufferevent_socket_new(ebase,
-                                fd,
-                                BEV_OPT_CLOSE_ON_FREE |
-                                BEV_OPT_THREADSAFE |
-                                BEV_OPT_UNLOCK_CALLBACKS |
-                                BEV_OPT_DEFER_CALLBACKS);
-
+    bev = tcp_socket_bev_new(ebase, fd);
     if (bev == NULL) {
         goto error;
     }
@@ -164,9 +334,7 @@ error:
     if (fd != -1) {
         evutil_closesocket(fd);
     }
-    if (tcp_socket->bev != NULL) {
-        bufferevent_free(tcp_socket->bev);
-    }
+    tcp_socket_release(tcp_socket);
     return IO_CHANNEL_E_ERROR;
 }
 
@@ -222,31 +390,142 @@ tcp_socket_drain_input(io_channel_t *channel, size_t len)
     return 0;
 }
 
+static void
+tcp_socket_pause(tcp_socket_t *tcp_socket)
+{
+    if (!tcp_socket->paused) {
+        bufferevent_disable(tcp_socket->bev, EV_READ);
+        tcp_socket->paused = true;
+        tcp_socket->backpressure->paused++;
+        tcp_socket->backpressure->pauses++;
+    }
+}
+
+static void
+tcp_socket_resume(tcp_socket_t *tcp_socket)
+{
+    if (tcp_socket->paused) {
+        bufferevent_enable(tcp_socket->bev, EV_READ);
+        tcp_socket->paused = false;
+        tcp_socket->backpressure->paused--;
+    }
+}
+
+/* worker thread: worker buffers dropped, output backlogs still hold back their own connections */
+static void
+tcp_socket_resume_waiting(void *arg)
+{
+    backpressure_t *backpressure = arg;
+    ilink_t *link = NULL;
+
+    backpressure->resuming = false;
+    while (!backpressure_exceeded(backpressure) &&
+           NULL != (link = ilist_pop_front(&backpressure->waiting))) {
+        tcp_socket_t *tcp_socket = downcast(link, tcp_socket_t, waiting);
+        if (evbuffer_get_length(bufferevent_get_output(tcp_socket->bev)) <= tcp_socket->wm) {
+            tcp_socket_resume(tcp_socket);
+        }
+    }
+}
+
+/**
+ * Accounts bytes coming in and out of connection buffers, and
+ * stops reading once connection (its output backlog) or, for
+ * accepted connections, worker (all buffers) is over budget.
+ * Connections to upstream servers keep reading: they are what
+ * drains client connections.
+ */
+static void
+tcp_socket_buffer_cb(struct evbuffer *buffer, const struct evbuffer_cb_info *info, void *arg)
+{
+    tcp_socket_t *tcp_socket = arg;
+    backpressure_t *backpressure = tcp_socket->backpressure;
+    struct evbuffer *output = bufferevent_get_output(tcp_socket->bev);
+    size_t wm = backpressure_wm(backpressure);
+
+    tcp_socket->buffered += info->n_added;
+    tcp_socket->buffered -= info->n_deleted;
+    backpressure_account(backpressure, info->n_added, info->n_deleted, tcp_socket->buffered);
+    memacct_charge(tcp_socket->memacct, MEMACCT_TCP_SOCKET, info->n_added);
+    memacct_release(tcp_socket->memacct, MEMACCT_TCP_SOCKET, info->n_deleted);
+
+    /* share shrinks and grows along with # connections */
+    if (wm != tcp_socket->wm) {
+        tcp_socket->wm = wm;
+        bufferevent_setwatermark(tcp_socket->bev, EV_READ, 0, wm);
+        bufferevent_setwatermark(tcp_socket->bev, EV_WRITE, wm / 2, 0);
+    }
+
+    if (buffer == output && evbuffer_get_length(output) > wm) {
+        tcp_socket_pause(tcp_socket);
+    }
+    else if (0 != info->n_added && tcp_socket->accepted && backpressure_exceeded(backpressure)) {
+        tcp_socket_pause(tcp_socket);
+        if (!ilink_linked(&tcp_socket->waiting)) {
+            ilist_push_back(&backpressure->waiting, &tcp_socket->waiting);
+        }
+    }
+
+    if (0 != info->n_deleted && !backpressure->resuming &&
+        !ilist_empty(&backpressure->waiting) && backpressure_relieved(backpressure)) {
+        backpressure->resuming = true;
+        if (NULL == this_worker() ||
+            worker_call(this_worker(), tcp_socket_resume_waiting, backpressure) < 0) {
+            backpressure->resuming = false;
+        }
+    }
+}
+
+/* output backlog drained to half of watermark: reads again, unless waiting for worker */
+static void
+tcp_socket_output_drained(tcp_socket_t *tcp_socket)
+{
+    if (!tcp_socket->paused || ilink_linked(&tcp_socket->waiting) ||
+        evbuffer_get_length(bufferevent_get_output(tcp_socket->bev)) > tcp_socket->wm / 2) {
+        return;
+    }
+    if (tcp_socket->accepted && backpressure_exceeded(tcp_socket->backpressure)) {
+        ilist_push_back(&tcp_socket->backpressure->waiting, &tcp_socket->waiting);
+        return;
+    }
+    tcp_socket_resume(tcp_socket);
+}
+
 /* calls back registered io service */
 static void
 tcp_socket_write_cb(struct bufferevent *bev, void *arg)
 {
     io_channel_t *channel = arg;
+    uint64_t start = worker_cycles();
+
+    if (NULL != tcp_socket_cast(channel)->backpressure) {
+        tcp_socket_output_drained(tcp_socket_cast(channel));
+    }
 
     if (NULL != channel->service && NULL != channel->service->write_cb) {
         channel->service->write_cb(arg);
     }
+    /* channel might be gone by now */
+    worker_cb_timed(WORKER_CB_WRITE, start);
 }
 
 static void
 tcp_socket_read_cb(struct bufferevent *bev, void *arg)
 {
     io_channel_t *channel = arg;
+    uint64_t start = worker_cycles();
 
     if (NULL != channel->service && NULL != channel->service->read_cb) {
         channel->service->read_cb(arg);
     }
+    worker_cb_timed(WORKER_CB_READ, start);
 }
 
 static void
 tcp_socket_event_cb(struct bufferevent *bev, short events, void *arg)
 {
     io_channel_t *channel = arg;
+    uint64_t start = worker_cycles();
 
     if (NULL == channel->service && NULL == channel->service->event_cb) {
         return;
@@ -278,6 +557,7 @@ tcp_socket_event_cb(struct bufferevent *bev, short events, void *arg)
         io_event |= IO_CHANNEL_EVENT_WRITE;
     }
     channel->service->event_cb(channel, io_event);
+    worker_cb_timed(WORKER_CB_EVENT, start);
 }
 
 static int 
@@ -294,7 +574,22 @@ tcp_socket_config(tcp_socket_t *tcp_socket)
         tcp_socket->bev = NULL;
         return -1;
     }
-    bufferevent_setwatermark(tcp_socket->bev, EV_READ, 0, TCP_SOCKET_READ_HIGH_WM);
+    if (NULL == tcp_socket->backpressure) {
+        tcp_socket->wm = BACKPRESSURE_MAX_WM;
+        bufferevent_setwatermark(tcp_socket->bev, EV_READ, 0, tcp_socket->wm);
+        return 0;
+    }
+
+    backpressure_attach(tcp_socket->backpressure);
+    tcp_socket->wm = backpressure_wm(tcp_socket->backpressure);
+    bufferevent_setwatermark(tcp_socket->bev, EV_READ, 0, tcp_socket->wm);
+    bufferevent_setwatermark(tcp_socket->bev, EV_WRITE, tcp_socket->wm / 2, 0);
+    tcp_socket->input_cb = evbuffer_add_cb(bufferevent_get_input(tcp_socket->bev), tcp_socket_buffer_cb, tcp_socket);
+    tcp_socket->output_cb = evbuffer_add_cb(bufferevent_get_output(tcp_socket->bev), tcp_socket_buffer_cb, tcp_socket);
+    if (NULL == tcp_socket->input_cb || NULL == tcp_socket->output_cb) {
+        tcp_socket_release(tcp_socket);
+        return -1;
+    }
     return 0;
 }
 
@@ -314,8 +609,10 @@ tcp_socket_accept_cb(struct evconnlistener *listener,
 {
     struct event_base *ebase = NULL;
     io_channel_accept_param_t param;
+    tcp_socket_accept_ctx_t ctx;
     io_channel_t *channel = arg;
     socklen_t addrlen = socklen;
+    uint64_t start = 0;
 
     if (sockaddr->sa_family != AF_INET && sockaddr->sa_family != AF_INET6) {
         goto error;
@@ -335,35 +632,85 @@ tcp_socket_accept_cb(struct evconnlistener *listener,
         goto error;
     }
 
-    struct bufferevent *bev =
-        bufferevent_socket_new(ebase,
-                                fd,
-                                BEV_OPT_CLOSE_ON_FREE |
-                                BEV_OPT_THREADSAFE |
-                                BEV_OPT_UNLOCK_CALLBACKS |
-                                BEV_OPT_DEFER_CALLBACKS);
-    
-    if (NULL == bev) {
-        goto error;
-    }
-    param.io_ctx = bev;
+    ctx.fd = fd;
+    ctx.ebase = ebase;
+    ctx.backpressure = tcp_socket_cast(channel)->backpressure;
+    param.io_ctx = &ctx;
+    start = worker_cycles();
     channel->service->accept_cb(channel, &param);
+    worker_cb_timed(WORKER_CB_ACCEPT, start);
 
-    return;
+    if (-1 == ctx.fd) {
+        /* connection either accepted or rejected by io service */
+        return;
+    }
+    fd = ctx.fd;
 
 error:
     evutil_closesocket(fd); 
 }
 
+/**
+ * Starts accepting on bound socket fd, either
+ * just created or handed over by another process.
+ */
 static io_channel_error_t
-tcp_socket_listen(io_channel_t *channel, struct sockaddr_storage *sockaddr)
+tcp_socket_listen_fd(io_channel_t *channel, int fd)
 {
-    evutil_socket_t fd = -1;
     struct event_base *ebase = NULL;
-    int addrlen = sizeof(struct sockaddr_storage);
     struct evconnlistener *listener = NULL;
     tcp_socket_t *tcp_socket = tcp_socket_cast(channel);
 
+    /* returns event loop object associated to this thread */
+    ebase = this_event_base();
+        
+    listener = evconnlistener_new(ebase,
+                                  tcp_socket_accept_cb,
+                                  channel,
+                                  LEV_OPT_CLOSE_ON_FREE |
+                                  //LEV_OPT_THREADSAFE |
+                                  LEV_OPT_CLOSE_ON_EXEC |
+                                  LEV_OPT_REUSEABLE,
+                                  TCP_SOCKET_BACKLOG,
+                                  fd);
+
+    if (NULL == listener) {
+        evutil_closesocket(fd);
+        return IO_CHANNEL_E_ERROR;
+    }
+
+    tcp_socket->listener = listener;
+    tcp_socket->listen = true;
+    evconnlistener_set_error_cb(listener, tcp_socket_accept_error_cb);
+
+    return IO_CHANNEL_E_SUCCESS;
+}
+
+static int
+tcp_socket_get_fd(io_channel_t *channel)
+{
+    tcp_socket_t *tcp_socket = tcp_socket_cast(channel);
+    if (tcp_socket->listen) {
+        if (NULL == tcp_socket->listener) {
+            return -1;
+        }
+        return evconnlistener_get_fd(tcp_socket->listener);
+    }
+    if (NULL != tcp_socket->parked) {
+        return event_get_fd(tcp_socket->parked);
+    }
+    if (NULL == tcp_socket->bev) {
+        return -1;
+    }
+    return bufferevent_getfd(tcp_socket->bev);
+}
+
+static io_channel_error_t
+tcp_socket_listen(io_channel_t *channel, struct sockaddr_storage *sockaddr)
+{
+    evutil_socket_t fd = -1;
+    int addrlen = sizeof(struct sockaddr_storage);
+
     if (AF_INET  != sockaddr->ss_family &&
         AF_INET6 != sockaddr->ss_family) {
         return IO_CHANNEL_E_ERROR;
@@ -384,49 +731,47 @@ tcp_socket_listen(io_channel_t *channel, struct sockaddr_storage *sockaddr)
         goto error;
     }
 
-    if (bind(fd, (struct sockaddr *)sockaddr, addrlen) != 0) {
-        int err = evutil_socket_geterror(fd);
-        fprintf(stderr, "%s: %s\n", __func__, evutil_socket_error_to_string(err));
+    /* "::" accepts IPv4 connections as well, whatever net.ipv6.bindv6only says */
+    optval = 0;
+    if (AF_INET6 == sockaddr->ss_family &&
+        0 != setsockopt(fd, IPPROTO_IPV6, IPV6_V6ONLY, &optval, sizeof(optval))) {
         evutil_closesocket(fd);
         goto error;
     }
 
-    /* returns event loop object associated to this thread */
-    ebase = this_event_base();
-        
-    listener = evconnlistener_new(ebase,
-                                  tcp_socket_accept_cb,
-                                  channel,
-                                  LEV_OPT_CLOSE_ON_FREE |
-                                  //LEV_OPT_THREADSAFE |
-                                  LEV_OPT_CLOSE_ON_EXEC |
-                                  LEV_OPT_REUSEABLE,
-                                  TCP_SOCKET_BACKLOG,
-                                  fd);
-
-    if (NULL == listener) {
+    if (bind(fd, (struct sockaddr *)sockaddr, addrlen) != 0) {
+        int err = evutil_socket_geterror(fd);
+        fprintf(stderr, "%s: %s\n", __func__, evutil_socket_error_to_string(err));
         evutil_closesocket(fd);
         goto error;
     }
 
-    tcp_socket->listener = listener;
-    tcp_socket->listen = true;
-    evconnlistener_set_error_cb(listener, tcp_socket_accept_error_cb);
-
-    return IO_CHANNEL_E_SUCCESS;
+    return tcp_socket_listen_fd(channel, fd);
 
 error:
-    if (NULL != listener) {
-        evconnlistener_free(listener);
-    }
     return IO_CHANNEL_E_ERROR;
 }
 
+static void
+tcp_socket_set_backpressure(io_channel_t *channel, backpressure_t *backpressure)
+{
+    tcp_socket_cast(channel)->backpressure = backpressure;
+}
+
+static bool
+tcp_socket_is_parked(io_channel_t *channel)
+{
+    return NULL != tcp_socket_cast(channel)->parked;
+}
+
 io_channel_ops_t
 tcp_socket_ops = {
     .name = "tcp_socket",
     .accept = tcp_socket_accept,
+    .reject = tcp_socket_reject,
     .listen = tcp_socket_listen,
+    .listen_fd = tcp_socket_listen_fd,
+    .get_fd = tcp_socket_get_fd,
     .connect = tcp_socket_connect,
     .read = tcp_socket_read,
     .write = tcp_socket_write,
@@ -437,7 +782,9 @@ tcp_socket_ops = {
     .get_input_length = tcp_socket_get_input_length,
     .get_output_length = tcp_socket_get_output_length,
     .get_write_low_wm = tcp_socket_get_write_low_wm,
-    .drain_input = tcp_socket_drain_input
+    .drain_input = tcp_socket_drain_input,
+    .set_backpressure = tcp_socket_set_backpressure,
+    .is_parked = tcp_socket_is_parked
 };
 
 io_channel_t *
@@ -446,7 +793,15 @@ tcp_socket_new(void)
     tcp_socket_t *tcp_socket = calloc(1, sizeof(tcp_socket_t));
     if (NULL != tcp_socket) {
         tcp_socket->parent.ops = &tcp_socket_ops;
+        tcp_socket->memacct = this_memacct();
+        memacct_charge(tcp_socket->memacct, MEMACCT_TCP_SOCKET, sizeof(tcp_socket_t));
         return &tcp_socket->parent;
     }
     return NULL;
 }
+
+size_t
+tcp_socket_parked_size(void)
+{
+    return sizeof(tcp_socket_t) + event_get_struct_event_size();
+}
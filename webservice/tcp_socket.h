@@ -8,4 +8,10 @@
 io_channel_t *
 tcp_socket_new(void);
 
+/**
+ * @return bytes held by a parked connection (@see channel_is_parked)
+ */
+size_t
+tcp_socket_parked_size(void);
+
 #endif
@@ -15,12 +15,53 @@ typedef struct thread_key thread_key_t;
 
 typedef void (*thread_fn_t)(void *);
 
+#define THREAD_CPU_ANY  (-1) /**< thread is not pinned to any cpu */
+#define THREAD_NODE_ANY (-1) /**< thread memory is not bound to any numa node */
+#define THREAD_MAX_CPUS 1024 /**< same as glibc CPU_SETSIZE */
+#define THREAD_MAX_NODES 1024 /**< highest numa nodes count kernels are built with */
+
+typedef struct thread_numa_policy thread_numa_policy_t;
+
+/**
+ * Memory policy of a thread, as saved to be restored later
+ * (e.g. one inherited through numactl).
+ */
+struct thread_numa_policy {
+    int mode;
+    unsigned long nodemask[THREAD_MAX_NODES / (8 * sizeof(unsigned long))];
+};
+
 thread_t *
 thread_new(thread_fn_t fn);
 
 void
 thread_free(thread_t *thread);
 
+/**
+ * Pins thread to cpu.
+ *
+ * Should be called before thread_start.
+ *
+ * @param thread
+ * @param cpu cpu index or THREAD_CPU_ANY
+ * @return 0, if successfull. -1, otherwise.
+ */
+int
+thread_set_affinity(thread_t *thread, int cpu);
+
+/**
+ * Makes thread prefer memory from numa node for
+ * every allocation it does once started.
+ *
+ * Should be called before thread_start.
+ *
+ * @param thread
+ * @param node numa node index or THREAD_NODE_ANY
+ * @return 0, if successfull. -1, otherwise.
+ */
+int
+thread_set_numa_node(thread_t *thread, int node);
+
 int
 thread_start(thread_t *thread, void *arg);
 
@@ -36,6 +77,49 @@ thread_signal(thread_id_t *thread_id, thread_signal_t sig);
 void
 thread_id_free(thread_id_t *thread_id);
 
+/**
+ * Fills cpus with indexes of cpus this process is allowed
+ * to run on (honours cgroup cpuset and taskset restrictions).
+ *
+ * @return # cpus written to cpus, or -1 on error.
+ */
+int
+thread_cpus_available(int *cpus, int max);
+
+/**
+ * @return numa node cpu belongs to, or THREAD_NODE_ANY if unknown.
+ */
+int
+thread_cpu_numa_node(int cpu);
+
+/**
+ * Makes calling thread prefer memory from numa node for
+ * its next allocations. THREAD_NODE_ANY restores default
+ * (local) allocation policy.
+ *
+ * @return 0, if successfull. -1, otherwise.
+ */
+int
+thread_numa_node_prefer(int node);
+
+/**
+ * Saves memory policy of calling thread, for
+ * thread_numa_policy_restore.
+ *
+ * @return 0, if successfull. -1, otherwise.
+ */
+int
+thread_numa_policy_save(thread_numa_policy_t *policy);
+
+/**
+ * Restores memory policy of calling thread saved
+ * with thread_numa_policy_save.
+ *
+ * @return 0, if successfull. -1, otherwise.
+ */
+int
+thread_numa_policy_restore(const thread_numa_policy_t *policy);
+
 thread_key_t *
 thread_key_new(void);
 
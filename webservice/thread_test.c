@@ -1,6 +1,7 @@
 #include "includes.h"
 #include "thread.h"
 #include "rwlock.h"
+#include "reference.h"
 #include <assert.h>
 
 static thread_key_t *thread_key = NULL;
@@ -48,6 +49,76 @@ thread_run(void *arg)
     user_arg_free(user_arg);
 }
 
+#define SHARED_THREADS  8
+#define SHARED_ROUNDS   100000
+
+typedef struct shared shared_t;
+
+/* object handed between threads through atomic references */
+struct shared {
+    reference_t ref;
+    atomic_t uses;
+    int released;
+    int freed;
+};
+
+static void
+shared_release(reference_t *ref)
+{
+    shared_t *shared = downcast(ref, shared_t, ref);
+    shared->released++;
+}
+
+static void
+shared_free(reference_t *ref)
+{
+    shared_t *shared = downcast(ref, shared_t, ref);
+    shared->freed++;
+}
+
+static void
+shared_run(void *arg)
+{
+    shared_t *shared = arg;
+    for (int i = 0; i < SHARED_ROUNDS; ++i) {
+        reference_inc(&shared->ref);
+        atomic_inc(&shared->uses);
+        reference_dec(&shared->ref);
+    }
+    /* drops reference taken on its behalf */
+    reference_dec(&shared->ref);
+}
+
+static void
+reference_test(void)
+{
+    thread_t *threads[SHARED_THREADS];
+    shared_t shared;
+
+    memset(&shared, 0, sizeof(shared));
+    reference_init(&shared.ref, shared_release, shared_free);
+    reference_weak_inc(&shared.ref);
+
+    for (int i = 0; i < countof(threads); ++i) {
+        reference_inc(&shared.ref);
+        threads[i] = thread_new(shared_run);
+        thread_start(threads[i], &shared);
+    }
+    reference_dec(&shared.ref);
+
+    for (int i = 0; i < countof(threads); ++i) {
+        thread_join(threads[i]);
+        thread_free(threads[i]);
+    }
+
+    /* only weak reference is left */
+    assert(SHARED_THREADS * SHARED_ROUNDS == shared.uses);
+    assert(1 == shared.released && 0 == shared.freed);
+    assert(!reference_upgrade(&shared.ref));
+    reference_weak_dec(&shared.ref);
+    assert(1 == shared.freed);
+}
+
 int
 main(int argc, char **argv)
 {
@@ -78,5 +149,7 @@ main(int argc, char **argv)
 
     thread_key_free(thread_key);
 
+    reference_test();
+
     return 0;
 }
@@ -32,16 +32,39 @@ daemonize(void)
 }
 
 static struct sockaddr_in addr4;
+static struct sockaddr_in6 addr6;
+static int family = AF_INET; /* of listening address */
 static struct sockaddr_storage ss;
 static int nworkers = 4;
 static int background = 0;
 static char* resolver = NULL;
+static bool cpu_affinity = true;
+static size_t max_sessions = 0;
+static size_t max_upstream_requests = 0;
+static unsigned drain_timeout = 30;
+static int compute_threads = 0;
+static unsigned trace_threshold = 1000;
+static unsigned cache_ttl = 0;
+static unsigned cache_stale = 0;
+static unsigned breaker_open = 5000;
+static unsigned breaker_slow = 3000;
+static unsigned hedge_delay = 0;
+static unsigned hedge_budget = 0;
+static bool shared_resolver = false;
+static unsigned dns_ttl = 0;
+static unsigned dns_negative_ttl = 2000;
+static unsigned buffer_budget = 64 * 1024; /**< KB */
+static unsigned memory_budget = 0; /**< MB */
+static char *pin_hosts = NULL;
+static char *pins[16];
+static int npins = 0;
+static unsigned pin_refresh = 60000;
 
 void
 usage(char **argv)
 {
 
-    fprintf(stderr, "Usage: %s [-a <ipv4>] [-p <port>] [-n <# workers>] [-d <makes process a daemon if present>] [-r <dnsserver ip:port>]\n",
+    fprintf(stderr, "Usage: %s [-a <ipv4 or ipv6, :: for dual-stack>] [-p <port>] [-n <# workers>] [-d <makes process a daemon if present>] [-r <dnsserver ip:port>] [-c <do not pin workers to cpus if present>] [-s <max sessions per worker>] [-u <max upstream requests per worker>] [-t <drain timeout in seconds>] [-j <# compute threads>] [-l <slow session threshold in ms>] [-k <cache ttl in ms>] [-w <cache stale window in ms>] [-b <upstream breaker open period in ms>] [-e <hedge delay in ms, 0 for adaptive>] [-g <hedged requests budget in %%>] [-q <resolve on a single thread shared by workers if present>] [-y <dns answer ttl in ms>] [-x <dns failure ttl in ms>] [-f <pinned upstream addresses hosts file>] [-i <pinned upstream name=address>] [-z <pinned addresses refresh period in ms>] [-o <connection buffers budget per worker in KB>] [-m <memory budget per worker in MB>]\n",
             argv[0]);
 };
 
@@ -52,16 +75,22 @@ process_args(int argc, char **argv)
 
     int opt;
 
-    while ((opt = getopt(argc, argv, "a:p:n:d:r:h:?")) != -1) {
+    while ((opt = getopt(argc, argv, "a:p:n:d:r:cs:u:t:j:l:k:w:b:e:g:qy:x:f:i:z:o:m:h:?")) != -1) {
         switch (opt) {
 
         case 'a':
-            if (1 != inet_pton(AF_INET, optarg, &addr4.sin_addr)) {
-                fprintf(stderr, "Invalid ipv4 argument");
+            if (1 == inet_pton(AF_INET, optarg, &addr4.sin_addr)) {
+                family = AF_INET;
+            }
+            else if (1 == inet_pton(AF_INET6, optarg, &addr6.sin6_addr)) {
+                family = AF_INET6;
+            }
+            else {
+                fprintf(stderr, "Invalid ip address argument");
                 usage(argv);
                 return -1;
             }
-            fprintf(stderr, "%s: ipv4 listening address set %s\n", __func__, optarg);
+            fprintf(stderr, "%s: %s listening address set %s\n", __func__, (AF_INET == family) ? "ipv4" : "ipv6", optarg);
             break;
 
         case 'p':
@@ -71,6 +100,7 @@ process_args(int argc, char **argv)
                 return -1;
             }
             addr4.sin_port = htons(port);
+            addr6.sin6_port = htons(port);
             break;
 
         case 'n':
@@ -93,6 +123,154 @@ process_args(int argc, char **argv)
             resolver = strdup(optarg);
             break;
 
+        case 'c':
+            cpu_affinity = false;
+            break;
+
+        case 's':
+            if (1 != sscanf(optarg, "%zu", &max_sessions)) {
+                fprintf(stderr, "Invalid max sessions argument");
+                usage(argv);
+                return -1;
+            }
+            break;
+
+        case 'u':
+            if (1 != sscanf(optarg, "%zu", &max_upstream_requests)) {
+                fprintf(stderr, "Invalid max upstream requests argument");
+                usage(argv);
+                return -1;
+            }
+            break;
+
+        case 't':
+            if (1 != sscanf(optarg, "%u", &drain_timeout)) {
+                fprintf(stderr, "Invalid drain timeout argument");
+                usage(argv);
+                return -1;
+            }
+            break;
+
+        case 'j':
+            if (1 != sscanf(optarg, "%d", &compute_threads) || compute_threads < 0) {
+                fprintf(stderr, "Invalid compute threads argument");
+                usage(argv);
+                return -1;
+            }
+            break;
+
+        case 'l':
+            if (1 != sscanf(optarg, "%u", &trace_threshold)) {
+                fprintf(stderr, "Invalid slow session threshold argument");
+                usage(argv);
+                return -1;
+            }
+            break;
+
+        case 'k':
+            if (1 != sscanf(optarg, "%u", &cache_ttl)) {
+                fprintf(stderr, "Invalid cache ttl argument");
+                usage(argv);
+                return -1;
+            }
+            break;
+
+        case 'w':
+            if (1 != sscanf(optarg, "%u", &cache_stale)) {
+                fprintf(stderr, "Invalid cache stale window argument");
+                usage(argv);
+                return -1;
+            }
+            break;
+
+        case 'b':
+            if (1 != sscanf(optarg, "%u", &breaker_open)) {
+                fprintf(stderr, "Invalid breaker open period argument");
+                usage(argv);
+                return -1;
+            }
+            break;
+
+        case 'e':
+            if (1 != sscanf(optarg, "%u", &hedge_delay)) {
+                fprintf(stderr, "Invalid hedge delay argument");
+                usage(argv);
+                return -1;
+            }
+            break;
+
+        case 'g':
+            if (1 != sscanf(optarg, "%u", &hedge_budget) || hedge_budget > 100) {
+                fprintf(stderr, "Invalid hedge budget argument");
+                usage(argv);
+                return -1;
+            }
+            break;
+
+        case 'q':
+            shared_resolver = true;
+            break;
+
+        case 'y':
+            if (1 != sscanf(optarg, "%u", &dns_ttl)) {
+                fprintf(stderr, "Invalid dns answer ttl argument");
+                usage(argv);
+                return -1;
+            }
+            break;
+
+        case 'x':
+            if (1 != sscanf(optarg, "%u", &dns_negative_ttl)) {
+                fprintf(stderr, "Invalid dns failure ttl argument");
+                usage(argv);
+                return -1;
+            }
+            break;
+
+        case 'f':
+            /* daemon changes working directory */
+            free(pin_hosts);
+            pin_hosts = realpath(optarg, NULL);
+            if (NULL == pin_hosts) {
+                fprintf(stderr, "Invalid pinned addresses hosts file argument");
+                usage(argv);
+                return -1;
+            }
+            break;
+
+        case 'i':
+            if (NULL == strchr(optarg, '=') || npins == countof(pins)) {
+                fprintf(stderr, "Invalid pinned address argument");
+                usage(argv);
+                return -1;
+            }
+            pins[npins++] = optarg;
+            break;
+
+        case 'z':
+            if (1 != sscanf(optarg, "%u", &pin_refresh)) {
+                fprintf(stderr, "Invalid pinned addresses refresh period argument");
+                usage(argv);
+                return -1;
+            }
+            break;
+
+        case 'o':
+            if (1 != sscanf(optarg, "%u", &buffer_budget)) {
+                fprintf(stderr, "Invalid connection buffers budget argument");
+                usage(argv);
+                return -1;
+            }
+            break;
+
+        case 'm':
+            if (1 != sscanf(optarg, "%u", &memory_budget)) {
+                fprintf(stderr, "Invalid memory budget argument");
+                usage(argv);
+                return -1;
+            }
+            break;
+
         case 'h':
         case '?':
         /* fallthrough */
@@ -111,6 +289,8 @@ main(int argc, char **argv)
     addr4.sin_family = AF_INET;
     addr4.sin_port = htons(5000);
     inet_pton(AF_INET, "127.0.0.1", &addr4.sin_addr);
+    addr6.sin6_family = AF_INET6;
+    addr6.sin6_port = htons(5000);
     resolver = strdup("8.8.8.8:53");
 
     if (process_args(argc, argv) < 0) {
@@ -122,17 +302,38 @@ main(int argc, char **argv)
         exit(EXIT_FAILURE);
     }
 
-    memcpy(&ss, &addr4, sizeof(struct sockaddr_in));
+    if (AF_INET == family) {
+        memcpy(&ss, &addr4, sizeof(struct sockaddr_in));
+    }
+    else {
+        memcpy(&ss, &addr6, sizeof(struct sockaddr_in6));
+    }
+
+    http_service_set_argv(argv);
 
     if (background) {
         daemonize();
     }
 
+    http_service_set_cpu_affinity(cpu_affinity);
+    http_service_set_session_limit(max_sessions);
+    http_service_set_upstream_limit(max_upstream_requests);
+    http_service_set_drain_timeout(drain_timeout);
+    http_service_set_compute_threads(compute_threads);
+    http_service_set_trace_threshold(trace_threshold);
+    http_service_set_cache(cache_ttl, cache_stale);
+    http_service_set_breaker(breaker_open, breaker_slow);
+    http_service_set_hedge(hedge_delay, hedge_budget);
+    http_service_set_resolver(shared_resolver, dns_ttl, dns_negative_ttl);
+    http_service_set_buffer_budget((size_t)buffer_budget * 1024);
+    http_service_set_memory_budget((size_t)memory_budget * 1024 * 1024);
+    http_service_set_pins(pin_hosts, pins, npins, pin_refresh);
     http_service_init(nworkers, &ss, resolver);
     http_service_start();
     http_service_fini();
 
     free(resolver);
+    free(pin_hosts);
 
     return 0;
 }
@@ -0,0 +1,178 @@
+#include "includes.h"
+#include "atomic.h"
+#include "worker.h"
+#include "trace.h"
+#include <time.h>
+
+/* traces are copied word by word, atomically, so that
+ * readers racing with writer get torn copies at worst
+ */
+_Static_assert(0 == sizeof(trace_t) % sizeof(uint64_t), "trace_t should be made of whole words");
+
+typedef struct trace_slot trace_slot_t;
+
+struct trace_slot {
+    atomic_t seq; /**< odd while being written, 2 * # writes otherwise */
+    trace_t trace;
+} __attribute__((aligned(64)));
+
+struct trace_ring {
+    atomic_t head; /**< # traces ever put */
+    size_t mask;
+    trace_slot_t *slots;
+};
+
+static const char *trace_names[TRACE_COUNT] = {
+    "state", "dns_start", "dns_end", "connect", "connected",
+    "first_byte", "last_byte", "offload", "offloaded", "cached",
+    "fallback", "failed", "hedge", "hedge_won",
+    "race", "race_won"
+};
+
+void
+trace_init(trace_t *trace, uint64_t id)
+{
+    trace->id = id;
+    trace->start = worker_cycles();
+    trace->nevents = 0;
+    trace->dropped = 0;
+    trace->duration_us = 0;
+}
+
+void
+trace_start(trace_t *trace)
+{
+    trace->start = worker_cycles();
+    trace->nevents = 0;
+    trace->dropped = 0;
+}
+
+static uint32_t
+trace_elapsed_us(trace_t *trace)
+{
+    return worker_cycles_to_ns(worker_cycles() - trace->start) / 1000;
+}
+
+void
+trace_add(trace_t *trace, trace_type_t type, uint16_t arg)
+{
+    if (TRACE_MAX_EVENTS == trace->nevents) {
+        trace->dropped++;
+        return;
+    }
+    trace_event_t *event = &trace->events[trace->nevents++];
+    event->at_us = trace_elapsed_us(trace);
+    event->type = type;
+    event->arg = arg;
+}
+
+uint32_t
+trace_finish(trace_t *trace)
+{
+    trace->duration_us = trace_elapsed_us(trace);
+    return trace->duration_us;
+}
+
+void
+trace_print(const trace_t *trace)
+{
+    struct tm tm;
+    char when[32];
+
+    localtime_r(&trace->when.tv_sec, &tm);
+    strftime(when, sizeof(when), "%H:%M:%S", &tm);
+    fprintf(stderr, "  session %" PRIu64 " at %s.%06ld took %" PRIu32 "us:",
+            trace->id, when, (long)trace->when.tv_usec, trace->duration_us);
+    for (int i = 0; i < trace->nevents; ++i) {
+        const trace_event_t *event = &trace->events[i];
+        fprintf(stderr, " +%" PRIu32 "us %s(%u)", event->at_us,
+                event->type < TRACE_COUNT ? trace_names[event->type] : "?", event->arg);
+    }
+    if (0 != trace->dropped) {
+        fprintf(stderr, " ...%u more", trace->dropped);
+    }
+    fprintf(stderr, "\n");
+}
+
+trace_ring_t *
+trace_ring_new(size_t size)
+{
+    trace_ring_t *ring = calloc(1, sizeof(trace_ring_t));
+    size_t n = 1;
+
+    if (NULL == ring) {
+        return NULL;
+    }
+    while (n < size) {
+        n <<= 1;
+    }
+    if (0 != posix_memalign((void **)&ring->slots, 64, n * sizeof(trace_slot_t))) {
+        free(ring);
+        return NULL;
+    }
+    memset(ring->slots, 0, n * sizeof(trace_slot_t));
+    ring->mask = n - 1;
+    return ring;
+}
+
+void
+trace_ring_free(trace_ring_t *ring)
+{
+    if (NULL != ring) {
+        free(ring->slots);
+        free(ring);
+    }
+}
+
+void
+trace_ring_put(trace_ring_t *ring, const trace_t *trace)
+{
+    atomic_t head = __atomic_load_n(&ring->head, __ATOMIC_RELAXED);
+    trace_slot_t *slot = &ring->slots[head & ring->mask];
+    atomic_t seq = __atomic_load_n(&slot->seq, __ATOMIC_RELAXED);
+    const uint64_t *src = (const uint64_t *)trace;
+    uint64_t *dst = (uint64_t *)&slot->trace;
+
+    __atomic_store_n(&slot->seq, seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    for (size_t i = 0; i < sizeof(trace_t) / sizeof(uint64_t); ++i) {
+        __atomic_store_n(&dst[i], src[i], __ATOMIC_RELAXED);
+    }
+    atomic_store_release(&slot->seq, seq + 2);
+    atomic_store_release(&ring->head, head + 1);
+}
+
+size_t
+trace_ring_snapshot(trace_ring_t *ring, trace_t *traces, size_t max)
+{
+    atomic_t head = atomic_load_acquire(&ring->head);
+    atomic_t first = head - (atomic_t)(ring->mask + 1);
+    size_t n = 0;
+
+    if (first < 0) {
+        first = 0;
+    }
+    if (head - first > (atomic_t)max) {
+        first = head - max;
+    }
+
+    for (atomic_t i = first; i < head; ++i) {
+        trace_slot_t *slot = &ring->slots[i & ring->mask];
+        /* slot seq once trace i is written into it */
+        atomic_t expected = 2 * (i / (atomic_t)(ring->mask + 1) + 1);
+        uint64_t *dst = (uint64_t *)&traces[n];
+
+        if (atomic_load_acquire(&slot->seq) != expected) {
+            /* being overwritten by a newer trace */
+            continue;
+        }
+        for (size_t j = 0; j < sizeof(trace_t) / sizeof(uint64_t); ++j) {
+            dst[j] = __atomic_load_n(&((uint64_t *)&slot->trace)[j], __ATOMIC_RELAXED);
+        }
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (expected == __atomic_load_n(&slot->seq, __ATOMIC_RELAXED)) {
+            n++;
+        }
+    }
+    return n;
+}
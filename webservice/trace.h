@@ -0,0 +1,109 @@
+#ifndef _TIGERA_TRACE__H__
+#define _TIGERA_TRACE__H__
+
+#include "includes.h"
+
+/* Flight recorder: each session carries a compact fixed-size
+ * trace of what happened to it and when. Recording an event is
+ * a few stores; only traces of slow sessions are kept, copied
+ * into a ring owned by their worker, which any thread may read
+ * without locking (each slot is a seqlock).
+ */
+
+#define TRACE_MAX_EVENTS 30 /**< events past it are only counted */
+
+typedef enum trace_type trace_type_t;
+
+enum trace_type {
+     TRACE_STATE       /**< arg: new session state */
+    ,TRACE_DNS_START   /**< arg: upstream */
+    ,TRACE_DNS_END     /**< arg: upstream */
+    ,TRACE_CONNECT     /**< arg: upstream */
+    ,TRACE_CONNECTED   /**< arg: upstream */
+    ,TRACE_FIRST_BYTE  /**< arg: http session (client or upstream) */
+    ,TRACE_LAST_BYTE   /**< arg: http session (client or upstream) */
+    ,TRACE_OFFLOAD     /**< arg: http session step was offloaded for */
+    ,TRACE_OFFLOADED   /**< arg: http session step was offloaded for */
+    ,TRACE_CACHED      /**< arg: upstream served from cache */
+    ,TRACE_FALLBACK    /**< arg: upstream served from defaults, its breaker being open */
+    ,TRACE_FAILED      /**< arg: upstream request failed */
+    ,TRACE_HEDGE       /**< arg: upstream reply late, request sent again */
+    ,TRACE_HEDGE_WON   /**< arg: upstream replied to hedged request first */
+    ,TRACE_RACE        /**< arg: upstream connection slow, raced to another address */
+    ,TRACE_RACE_WON    /**< arg: racing upstream connection connected first */
+    ,TRACE_COUNT
+};
+
+typedef struct trace_event trace_event_t;
+
+struct trace_event {
+    uint32_t at_us; /**< since trace started */
+    uint16_t type;
+    uint16_t arg;
+};
+
+typedef struct trace trace_t;
+
+struct trace {
+    uint64_t id;
+    uint64_t start;       /**< worker_cycles when trace started */
+    struct timeval when;  /**< wall clock trace started, set once kept */
+    uint32_t duration_us; /**< set by trace_finish */
+    uint16_t nevents;
+    uint16_t dropped;     /**< # events past TRACE_MAX_EVENTS */
+    trace_event_t events[TRACE_MAX_EVENTS];
+};
+
+typedef struct trace_ring trace_ring_t;
+
+void
+trace_init(trace_t *trace, uint64_t id);
+
+/**
+ * Restarts trace clock: duration, and time of events recorded
+ * from now on, are measured from now. Earlier events are dropped.
+ */
+void
+trace_start(trace_t *trace);
+
+void
+trace_add(trace_t *trace, trace_type_t type, uint16_t arg);
+
+/**
+ * @return trace duration (us)
+ */
+uint32_t
+trace_finish(trace_t *trace);
+
+/**
+ * Prints trace to stderr.
+ */
+void
+trace_print(const trace_t *trace);
+
+/**
+ * @param size # traces kept (rounded up to power of 2)
+ */
+trace_ring_t *
+trace_ring_new(size_t size);
+
+void
+trace_ring_free(trace_ring_t *ring);
+
+/**
+ * Copies trace into ring, overwriting oldest one.
+ * Only ever called by thread owning ring.
+ */
+void
+trace_ring_put(trace_ring_t *ring, const trace_t *trace);
+
+/**
+ * Copies traces in ring, oldest first, skipping those being
+ * overwritten meanwhile. May be called from any thread.
+ *
+ * @return # traces copied
+ */
+size_t
+trace_ring_snapshot(trace_ring_t *ring, trace_t *traces, size_t max);
+
+#endif /* _TIGERA_TRACE__H__ */
@@ -0,0 +1,175 @@
+#include "includes.h"
+#include "thread.h"
+#include "worker.h"
+#include "trace.h"
+#include "atomic.h"
+#include <assert.h>
+
+#define RING_SIZE   16
+#define NR_TRACES   (256*1024)
+#define NR_READERS  2
+
+typedef struct ring_test ring_test_t;
+
+struct ring_test {
+    trace_ring_t *ring;
+    bool done;
+    size_t snapshots;
+    size_t copied;
+};
+
+/* every field derives from trace id: torn copies would show */
+static void
+trace_fill(trace_t *trace, uint64_t id)
+{
+    trace_init(trace, id);
+    for (int i = 0; i < (int)(id % (TRACE_MAX_EVENTS + 4)); ++i) {
+        trace_add(trace, TRACE_STATE, (uint16_t)id);
+    }
+    trace_finish(trace);
+    trace->duration_us = (uint32_t)id;
+}
+
+static void
+trace_check(const trace_t *trace)
+{
+    int nevents = trace->id % (TRACE_MAX_EVENTS + 4);
+
+    assert((uint32_t)trace->id == trace->duration_us);
+    assert((nevents > TRACE_MAX_EVENTS ? TRACE_MAX_EVENTS : nevents) == trace->nevents);
+    assert((nevents > TRACE_MAX_EVENTS ? nevents - TRACE_MAX_EVENTS : 0) == trace->dropped);
+    for (int i = 0; i < trace->nevents; ++i) {
+        assert((uint16_t)trace->id == trace->events[i].arg);
+    }
+}
+
+static void
+writer_run(void *arg)
+{
+    ring_test_t *test = arg;
+    trace_t trace;
+
+    for (uint64_t id = 1; id <= NR_TRACES; ++id) {
+        trace_fill(&trace, id);
+        trace_ring_put(test->ring, &trace);
+    }
+    atomic_store_release(&test->done, true);
+}
+
+static void
+reader_run(void *arg)
+{
+    ring_test_t *test = arg;
+    trace_t traces[RING_SIZE];
+
+    while (!atomic_load_acquire(&test->done)) {
+        size_t n = trace_ring_snapshot(test->ring, traces, RING_SIZE);
+        for (size_t i = 0; i < n; ++i) {
+            trace_check(&traces[i]);
+            /* oldest first */
+            assert(0 == i || traces[i - 1].id < traces[i].id);
+        }
+        __atomic_fetch_add(&test->snapshots, 1, __ATOMIC_RELAXED);
+        __atomic_fetch_add(&test->copied, n, __ATOMIC_RELAXED);
+    }
+}
+
+/* readers never see torn traces, however hard writer goes */
+static void
+test_concurrent(void)
+{
+    thread_t *writer = NULL;
+    thread_t *readers[NR_READERS];
+    ring_test_t test;
+    trace_t traces[RING_SIZE];
+
+    memset(&test, 0, sizeof(test));
+    test.ring = trace_ring_new(RING_SIZE);
+    assert(NULL != test.ring);
+
+    for (int i = 0; i < NR_READERS; ++i) {
+        readers[i] = thread_new(reader_run);
+        assert(0 == thread_start(readers[i], &test));
+    }
+    writer = thread_new(writer_run);
+    assert(0 == thread_start(writer, &test));
+
+    thread_join(writer);
+    thread_free(writer);
+    for (int i = 0; i < NR_READERS; ++i) {
+        thread_join(readers[i]);
+        thread_free(readers[i]);
+    }
+
+    /* quiet ring: last traces, all of them */
+    assert(RING_SIZE == trace_ring_snapshot(test.ring, traces, RING_SIZE));
+    for (int i = 0; i < RING_SIZE; ++i) {
+        assert(NR_TRACES - RING_SIZE + 1 + i == traces[i].id);
+        trace_check(&traces[i]);
+    }
+    printf("trace ring: %d traces put, %zu snapshots, %zu traces copied\n", NR_TRACES, test.snapshots, test.copied);
+
+    trace_ring_free(test.ring);
+}
+
+static void
+test(void)
+{
+    trace_t trace, traces[4];
+    trace_ring_t *ring = trace_ring_new(3); /* rounded up to 4 */
+    assert(NULL != ring);
+
+    assert(0 == trace_ring_snapshot(ring, traces, countof(traces)));
+
+    for (uint64_t id = 1; id <= 2; ++id) {
+        trace_fill(&trace, id);
+        trace_ring_put(ring, &trace);
+    }
+    assert(2 == trace_ring_snapshot(ring, traces, countof(traces)));
+    assert(1 == traces[0].id && 2 == traces[1].id);
+
+    /* most recent ones only */
+    assert(1 == trace_ring_snapshot(ring, traces, 1));
+    assert(2 == traces[0].id);
+
+    for (uint64_t id = 3; id <= 9; ++id) {
+        trace_fill(&trace, id);
+        trace_ring_put(ring, &trace);
+    }
+    assert(4 == trace_ring_snapshot(ring, traces, countof(traces)));
+    for (int i = 0; i < 4; ++i) {
+        assert(6 + i == traces[i].id);
+        trace_check(&traces[i]);
+    }
+
+    trace_ring_free(ring);
+}
+
+/* restarted trace only times what happens from then on */
+static void
+test_start(void)
+{
+    trace_t trace;
+
+    trace_init(&trace, 1);
+    trace_add(&trace, TRACE_STATE, 1);
+    usleep(20000);
+    trace_start(&trace);
+    trace_add(&trace, TRACE_FIRST_BYTE, 0);
+    assert(trace_finish(&trace) < 20000);
+    assert(1 == trace.nevents && TRACE_FIRST_BYTE == trace.events[0].type);
+    assert(trace.events[0].at_us <= trace.duration_us);
+}
+
+int
+main(int argc, char **argv)
+{
+    worker_init();
+
+    test();
+    test_start();
+    test_concurrent();
+
+    worker_fini();
+    return 0;
+}
@@ -1,7 +1,22 @@
 #include "includes.h"
 #include "libs.h"
 #include "thread.h"
+#include "atomic.h"
+#include "qsbr.h"
+#include "mpsc.h"
+#include "mutex.h"
 #include "worker.h"
+#include "memacct.h"
+#include <sys/eventfd.h>
+#include <time.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#define WORKER_QUIESCENT_PERIOD_MS 100 /**< bounds grace periods while workers are idle */
+#define WORKER_MAILBOX_SIZE  1024 /**< # calls queued to a worker before falling back to its overflow list */
+#define WORKER_MAILBOX_BATCH 256  /**< # calls run per event loop iteration */
+#define WORKER_LAG_PERIOD_MS 50   /**< how often loop lag is sampled */
 
 /* stores one worker per thread context */
 static thread_key_t *thread_worker_key = NULL;
@@ -9,25 +24,295 @@ static thread_key_t *thread_worker_key = NULL;
 /* stores main thread id */
 static thread_id_t *main_thread_id = NULL;
 
+/* reclamation domain of data shared by workers */
+static qsbr_t *workers_qsbr = NULL;
+
+/* worker_cycles to nanoseconds, calibrated by worker_init */
+static double ns_per_cycle = 1.0;
+
 struct worker {
     struct event_base *ebase;
     struct evdns_base *dnsbase;
     thread_t *thread;
+    int cpu; /**< cpu worker thread is pinned to */
+    int node; /**< numa node worker memory is allocated from */
     worker_prologue_t prologue;
     worker_epilogue_t epilogue;
     void *ctx;
+    mpsc_queue_t *mailbox;     /**< calls from other threads */
+    int mailbox_fd;            /**< eventfd waking worker up for mailbox */
+    struct event *ev_mailbox;
+    atomic_t mailbox_signaled; /**< whether a wakeup is pending */
+    mutex_t *overflow_lock;
+    ilist_t overflow;          /**< calls past a full mailbox, run after it */
+    atomic_t overflowing;      /**< whether overflow holds calls: later calls queue behind them */
+    struct event *ev_lag;
+    uint64_t lag_deadline_ns;  /**< when lag timer should fire */
+    uint64_t slow_threshold_ns;
+    worker_profile_t profile;  /**< only touched by worker thread */
+    memacct_t memacct;         /**< only touched by worker thread, once started */
+};
+
+typedef struct worker_call_arg worker_call_arg_t;
+
+struct worker_call_arg {
+    ilink_t link; /**< in worker overflow */
+    worker_call_t fn;
+    void *arg;
 };
 
+static uint64_t
+worker_monotonic_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+uint64_t
+worker_cycles(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    return worker_monotonic_ns();
+#endif
+}
+
+/* briefly sleeps: tsc ticks at constant rate on any cpu of hosts we run on */
+static void
+worker_cycles_calibrate(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    struct timespec period = { 0, 5 * 1000000 };
+    uint64_t ns = worker_monotonic_ns();
+    uint64_t cycles = worker_cycles();
+
+    nanosleep(&period, NULL);
+
+    ns = worker_monotonic_ns() - ns;
+    cycles = worker_cycles() - cycles;
+    if (0 != cycles) {
+        ns_per_cycle = (double)ns / cycles;
+    }
+#endif
+}
+
+uint64_t
+worker_cycles_to_ns(uint64_t cycles)
+{
+    return (uint64_t)(cycles * ns_per_cycle);
+}
+
+static void
+worker_histogram_add(worker_histogram_t *histogram, uint64_t us)
+{
+    int bucket = (0 == us) ? 0 : 64 - __builtin_clzll(us);
+
+    if (bucket >= WORKER_HISTOGRAM_BUCKETS) {
+        bucket = WORKER_HISTOGRAM_BUCKETS - 1;
+    }
+    histogram->buckets[bucket]++;
+    histogram->count++;
+    if (us > histogram->max_us) {
+        histogram->max_us = us;
+    }
+}
+
+static void
+worker_cb_record(worker_t *worker, worker_cb_t type, uint64_t ns)
+{
+    worker_profile_t *profile = &worker->profile;
+
+    worker_histogram_add(&profile->callbacks[type], ns / 1000);
+
+    if (ns >= worker->slow_threshold_ns) {
+        worker_slow_cb_t *slow = &profile->slow[profile->nslow++ % WORKER_SLOW_RING_SIZE];
+        slow->type = type;
+        slow->duration_us = ns / 1000;
+        gettimeofday(&slow->when, NULL);
+    }
+}
+
+void
+worker_cb_timed(worker_cb_t type, uint64_t start)
+{
+    uint64_t cycles = worker_cycles() - start;
+    worker_t *worker = this_worker();
+
+    if (NULL != worker) {
+        worker_cb_record(worker, type, worker_cycles_to_ns(cycles));
+    }
+}
+
+static int
+worker_lag_arm(worker_t *worker)
+{
+    struct timeval period = { 0, WORKER_LAG_PERIOD_MS * 1000 };
+
+    worker->lag_deadline_ns = worker_monotonic_ns() + WORKER_LAG_PERIOD_MS * 1000000ULL;
+    return event_add(worker->ev_lag, &period);
+}
+
+/**
+ * Loop lag: how late timer fires, i.e. how long ready
+ * events wait behind callbacks being run.
+ */
+static void
+worker_lag_cb(evutil_socket_t fd, short events, void *arg)
+{
+    worker_t *worker = arg;
+    uint64_t now = worker_monotonic_ns();
+    uint64_t lag = (now > worker->lag_deadline_ns) ? now - worker->lag_deadline_ns : 0;
+
+    worker_histogram_add(&worker->profile.lag, lag / 1000);
+
+    if (worker_lag_arm(worker) < 0) {
+        fprintf(stderr, "%s: error re-arming lag timer\n", __func__);
+    }
+}
+
+static void
+worker_mailbox_signal(worker_t *worker)
+{
+    uint64_t one = 1;
+
+    /* one wakeup for as many calls as queued until worker runs them */
+    if (0 == __atomic_exchange_n(&worker->mailbox_signaled, 1, __ATOMIC_SEQ_CST)) {
+        if (write(worker->mailbox_fd, &one, sizeof(one)) < 0) {
+            fprintf(stderr, "%s: error waking worker up\n", __func__);
+        }
+    }
+}
+
+/**
+ * Takes oldest overflowed call. Once overflow is emptied, calls
+ * go to mailbox again: the one taken runs before any of them.
+ */
+static worker_call_arg_t *
+worker_overflow_pop(worker_t *worker)
+{
+    ilink_t *link = NULL;
+
+    if (0 == atomic_load_acquire(&worker->overflowing)) {
+        return NULL;
+    }
+    mutex_lock(worker->overflow_lock);
+    link = ilist_pop_front(&worker->overflow);
+    if (ilist_empty(&worker->overflow)) {
+        atomic_store_release(&worker->overflowing, 0);
+    }
+    mutex_unlock(worker->overflow_lock);
+    return NULL != link ? downcast(link, worker_call_arg_t, link) : NULL;
+}
+
+/**
+ * Mailbox first: calls overflowed were all queued after
+ * those in mailbox by then.
+ *
+ * @return # calls run
+ */
+static size_t
+worker_mailbox_drain(worker_t *worker, size_t budget)
+{
+    size_t n = 0;
+    mpsc_fn_t fn = NULL;
+    void *arg = NULL;
+    worker_call_arg_t *call = NULL;
+
+    for (; n < budget && 0 == mpsc_queue_pop(worker->mailbox, &fn, &arg); ++n) {
+        uint64_t start = worker_cycles();
+        fn(arg);
+        worker_cb_record(worker, WORKER_CB_CALL, worker_cycles_to_ns(worker_cycles() - start));
+    }
+    for (; n < budget && NULL != (call = worker_overflow_pop(worker)); ++n) {
+        uint64_t start = worker_cycles();
+        call->fn(call->arg);
+        free(call);
+        worker_cb_record(worker, WORKER_CB_CALL, worker_cycles_to_ns(worker_cycles() - start));
+    }
+    return n;
+}
+
+static void
+worker_mailbox_cb(evutil_socket_t fd, short events, void *arg)
+{
+    worker_t *worker = arg;
+    uint64_t value;
+
+    if (read(fd, &value, sizeof(value)) < 0) {
+        /* spurious wakeup */
+    }
+
+    /* calls queued from now on signal again */
+    __atomic_store_n(&worker->mailbox_signaled, 0, __ATOMIC_SEQ_CST);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+    if (WORKER_MAILBOX_BATCH == worker_mailbox_drain(worker, WORKER_MAILBOX_BATCH)) {
+        /* let other events run before next batch */
+        worker_mailbox_signal(worker);
+    }
+}
+
 static void
 worker_failure(void)
 {
     thread_signal(main_thread_id, THREAD_SIGTERM);
 }
 
+static void
+worker_quiescent_cb(evutil_socket_t fd, short events, void *arg)
+{
+    /* nothing to do: just makes idle loop iterate */
+}
+
+/**
+ * Runs event loop one iteration at a time: in between, callbacks
+ * hold no reference to shared data, which makes it a quiescent
+ * state. A periodic timer keeps idle workers from delaying
+ * reclamation for long.
+ */
+static void
+worker_dispatch(worker_t *worker)
+{
+    struct timeval period = { 0, WORKER_QUIESCENT_PERIOD_MS * 1000 };
+    struct event *ev_quiescent = NULL;
+
+    ev_quiescent = event_new(worker->ebase, -1, EV_PERSIST, worker_quiescent_cb, NULL);
+    if (NULL == ev_quiescent || event_add(ev_quiescent, &period) < 0 ||
+        qsbr_register(workers_qsbr) < 0) {
+        fprintf(stderr, "%s: error registering worker to qsbr\n", __func__);
+        worker_failure();
+        goto exit;
+    }
+
+    if (worker_lag_arm(worker) < 0) {
+        fprintf(stderr, "%s: error arming lag timer\n", __func__);
+    }
+
+    while (!event_base_got_exit(worker->ebase) && !event_base_got_break(worker->ebase)) {
+        qsbr_quiescent(workers_qsbr);
+        if (event_base_loop(worker->ebase, EVLOOP_ONCE) < 0) {
+            break;
+        }
+    }
+
+    event_del(worker->ev_lag);
+
+    /* calls queued before worker was stopped */
+    worker_mailbox_drain(worker, SIZE_MAX);
+
+    qsbr_unregister(workers_qsbr);
+
+exit:
+    if (NULL != ev_quiescent) {
+        event_free(ev_quiescent);
+    }
+}
+
 static void
 worker_loop(void *arg)
 {
-    //int ret;
     worker_t *worker = arg;
 
     thread_key_set(thread_worker_key, worker);
@@ -40,7 +325,7 @@ worker_loop(void *arg)
         }
     }
 
-    /*ret = */event_base_dispatch(worker->ebase);
+    worker_dispatch(worker);
 
     if (NULL != worker->epilogue) {
         worker->epilogue(worker->ctx);
@@ -63,59 +348,146 @@ worker_init(void)
     if (NULL == thread_worker_key) {
         return -1;
     }
+
+    workers_qsbr = qsbr_new();
+    if (NULL == workers_qsbr) {
+        return -1;
+    }
+
+    worker_cycles_calibrate();
     return 0;
 }
 
 void
 worker_fini(void)
 {
+    qsbr_free(workers_qsbr);
+    workers_qsbr = NULL;
     thread_key_free(thread_worker_key);
     thread_worker_key = NULL;
     thread_id_free(main_thread_id);
     main_thread_id = NULL;
 }
 
+static int
+worker_bases_new(worker_t *worker, const char *resolver)
+{
+    struct event_base *ebase = event_base_new();
+    struct evdns_base *dnsbase = NULL;
+    if (NULL == ebase) {
+        return -1;
+    }
+    worker->ebase = ebase;
+    if (evthread_make_base_notifiable(ebase) != 0) {
+        return -1;
+    }
+
+    if (NULL == resolver) {
+        /* names are resolved elsewhere */
+        return 0;
+    }
+
+    dnsbase = evdns_base_new(ebase, 0);
+    if (NULL == dnsbase) {
+        fprintf(stderr, "%s: error starting dns resolver\n", __func__);
+        return -1;
+    }
+    worker->dnsbase = dnsbase;
+
+    if (evdns_base_nameserver_ip_add(dnsbase, resolver) < 0) {
+        fprintf(stderr, "%s: error setting dnsserver to %s\n", __func__, resolver);
+        return -1;
+    }
+
+    if (evdns_base_set_option(dnsbase, "timeout", "1.0") < 0) {
+        fprintf(stderr, "%s: error setting dnsbase option timeout\n", __func__);
+        return -1;
+    }
+    if (evdns_base_set_option(dnsbase, "attempts", "3") < 0) {
+        fprintf(stderr, "%s: error setting dnsbase option attempts\n", __func__);
+        return -1;
+    }
+    if (evdns_base_set_option(dnsbase, "max-timeouts", "3") < 0) {
+        fprintf(stderr, "%s: error setting dnsbase option max-timeouts\n", __func__);
+        return -1;
+    }
+    /* A and AAAA answers: RFC 8305 resolution delay for the later one */
+    if (evdns_base_set_option(dnsbase, "getaddrinfo-allow-skew", "0.05") < 0) {
+        fprintf(stderr, "%s: error setting dnsbase option getaddrinfo-allow-skew\n", __func__);
+        return -1;
+    }
+    if (evdns_base_set_option(dnsbase, "randomize-case", "0") < 0) {
+        fprintf(stderr, "%s: error setting dnsbase option randomize-case\n", __func__);
+        return -1;
+    }
+    return 0;
+}
+
+static int
+worker_mailbox_new(worker_t *worker)
+{
+    worker->mailbox = mpsc_queue_new(WORKER_MAILBOX_SIZE);
+    if (NULL == worker->mailbox) {
+        return -1;
+    }
+
+    ilist_init(&worker->overflow);
+    worker->overflow_lock = mutex_new();
+    if (NULL == worker->overflow_lock) {
+        return -1;
+    }
+
+    worker->mailbox_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (worker->mailbox_fd < 0) {
+        fprintf(stderr, "%s: error creating eventfd\n", __func__);
+        return -1;
+    }
+
+    worker->ev_mailbox = event_new(worker->ebase, worker->mailbox_fd, EV_READ | EV_PERSIST, worker_mailbox_cb, worker);
+    if (NULL == worker->ev_mailbox || event_add(worker->ev_mailbox, NULL) < 0) {
+        return -1;
+    }
+
+    worker->ev_lag = evtimer_new(worker->ebase, worker_lag_cb, worker);
+    if (NULL == worker->ev_lag) {
+        return -1;
+    }
+    return 0;
+}
+
 worker_t *
-worker_new(void *ctx, const char *resolver)
+worker_new(void *ctx, const char *resolver, int cpu)
 {
     worker_t *worker = calloc(1, sizeof(worker_t));
     if (NULL != worker) {
-        struct event_base *ebase = event_base_new();
-        struct evdns_base *dnsbase = NULL;
-        if (NULL == ebase) {
-            goto error;
-        }
-        if (evthread_make_base_notifiable(ebase) != 0) {
-            goto error;
-        }
-        worker->ebase = ebase;
+        thread_numa_policy_t policy;
+        bool preferred = false;
+        int ret;
 
-        dnsbase = evdns_base_new(ebase, 0);
-        if (NULL == dnsbase) {
-            fprintf(stderr, "%s: error starting dns resolver\n", __func__);
-            goto error;
+        worker->cpu = cpu;
+        worker->node = THREAD_NODE_ANY;
+        worker->mailbox_fd = -1;
+        worker->slow_threshold_ns = WORKER_SLOW_CB_US * 1000ULL;
+        if (WORKER_CPU_ANY != cpu) {
+            worker->node = thread_cpu_numa_node(cpu);
         }
-        worker->dnsbase = dnsbase;
 
-        if (evdns_base_nameserver_ip_add(dnsbase, resolver) < 0) {
-            fprintf(stderr, "%s: error setting dnsserver to %s\n", __func__, resolver);
-            goto error;
-        }
-        
-        if (evdns_base_set_option(dnsbase, "timeout", "1.0") < 0) {
-            fprintf(stderr, "%s: error setting dnsbase option timeout\n", __func__);
-            goto error;
-        }
-        if (evdns_base_set_option(dnsbase, "attempts", "3") < 0) {
-            fprintf(stderr, "%s: error setting dnsbase option attempts\n", __func__);
-            goto error;
+        /* event loop and resolver are created here but only ever
+         * touched by worker thread: take them from its numa node,
+         * then give calling thread its own policy back (e.g. set
+         * by numactl).
+         */
+        preferred = THREAD_NODE_ANY != worker->node &&
+                    0 == thread_numa_policy_save(&policy) &&
+                    0 == thread_numa_node_prefer(worker->node);
+        ret = worker_bases_new(worker, resolver);
+        if (0 == ret) {
+            ret = worker_mailbox_new(worker);
         }
-        if (evdns_base_set_option(dnsbase, "max-timeouts", "3") < 0) {
-            fprintf(stderr, "%s: error setting dnsbase option max-timeouts\n", __func__);
-            goto error;
+        if (preferred && thread_numa_policy_restore(&policy) < 0) {
+            fprintf(stderr, "%s: error restoring memory policy\n", __func__);
         }
-        if (evdns_base_set_option(dnsbase, "randomize-case", "0") < 0) {
-            fprintf(stderr, "%s: error setting dnsbase option randomize-case\n", __func__);
+        if (ret < 0) {
             goto error;
         }
 
@@ -124,6 +496,12 @@ worker_new(void *ctx, const char *resolver)
 	        goto error;
         }
         worker->thread = thread;
+
+        if (thread_set_affinity(thread, cpu) < 0 ||
+            thread_set_numa_node(thread, worker->node) < 0) {
+            fprintf(stderr, "%s: error pinning worker to cpu %d\n", __func__, cpu);
+            goto error;
+        }
         worker->ctx = ctx;
     }
     return worker;
@@ -137,6 +515,29 @@ void
 worker_free(worker_t *worker)
 {
     if (NULL != worker) {
+        if (NULL != worker->ev_lag) {
+            event_free(worker->ev_lag);
+            worker->ev_lag = NULL;
+        }
+        if (NULL != worker->ev_mailbox) {
+            event_free(worker->ev_mailbox);
+            worker->ev_mailbox = NULL;
+        }
+        if (-1 != worker->mailbox_fd) {
+            close(worker->mailbox_fd);
+            worker->mailbox_fd = -1;
+        }
+        mpsc_queue_free(worker->mailbox);
+        worker->mailbox = NULL;
+        if (NULL != worker->overflow_lock) {
+            /* calls never run (worker was not started) */
+            worker_call_arg_t *call = NULL;
+            while (NULL != (call = worker_overflow_pop(worker))) {
+                free(call);
+            }
+            mutex_free(worker->overflow_lock);
+            worker->overflow_lock = NULL;
+        }
         if (NULL != worker->dnsbase) {
             evdns_base_free(worker->dnsbase, 1);
             worker->dnsbase = NULL;
@@ -177,6 +578,110 @@ worker_join(worker_t *worker)
     return thread_join(worker->thread);
 }
 
+int
+worker_call(worker_t *worker, worker_call_t fn, void *arg)
+{
+    if (0 == atomic_load_acquire(&worker->overflowing) &&
+        0 == mpsc_queue_push(worker->mailbox, fn, arg)) {
+        worker_mailbox_signal(worker);
+        return 0;
+    }
+
+    /* mailbox full, or calls already overflowed: queued behind them */
+    worker_call_arg_t *call = calloc(1, sizeof(worker_call_arg_t));
+    if (NULL == call) {
+        return -1;
+    }
+    call->fn = fn;
+    call->arg = arg;
+    mutex_lock(worker->overflow_lock);
+    ilist_push_back(&worker->overflow, &call->link);
+    atomic_store_release(&worker->overflowing, 1);
+    mutex_unlock(worker->overflow_lock);
+    worker_mailbox_signal(worker);
+    return 0;
+}
+
+void
+worker_set_slow_threshold(worker_t *worker, unsigned usec)
+{
+    worker->slow_threshold_ns = usec * 1000ULL;
+}
+
+void
+worker_get_profile(worker_t *worker, worker_profile_t *profile)
+{
+    *profile = worker->profile;
+}
+
+static const char *
+worker_cb_name(worker_cb_t type)
+{
+    static const char *names[WORKER_CB_COUNT] = {
+        "accept", "read", "write", "event", "dns", "call"
+    };
+    return names[type];
+}
+
+/* @return upper bound (us) of bucket pct % of samples fall in */
+static uint64_t
+worker_histogram_percentile(const worker_histogram_t *histogram, unsigned pct)
+{
+    uint64_t rank = (histogram->count * pct + 99) / 100;
+    uint64_t seen = 0;
+
+    for (int i = 0; i < WORKER_HISTOGRAM_BUCKETS - 1; ++i) {
+        seen += histogram->buckets[i];
+        if (seen >= rank) {
+            return 1ULL << i;
+        }
+    }
+    return histogram->max_us;
+}
+
+static void
+worker_histogram_print(const char *name, const worker_histogram_t *histogram)
+{
+    fprintf(stderr, "  %-6s %10" PRIu64 " samples, p50 < %" PRIu64 "us, p99 < %" PRIu64 "us, max %" PRIu64 "us\n",
+            name, histogram->count,
+            worker_histogram_percentile(histogram, 50),
+            worker_histogram_percentile(histogram, 99),
+            histogram->max_us);
+}
+
+static void
+worker_profile_dump_cb(void *arg)
+{
+    worker_t *worker = arg;
+    worker_profile_t *profile = &worker->profile;
+    uint64_t first = (profile->nslow > WORKER_SLOW_RING_SIZE) ? profile->nslow - WORKER_SLOW_RING_SIZE : 0;
+
+    fprintf(stderr, "%s: worker on cpu %d\n", __func__, worker->cpu);
+    worker_histogram_print("lag", &profile->lag);
+    for (int i = 0; i < WORKER_CB_COUNT; ++i) {
+        if (0 != profile->callbacks[i].count) {
+            worker_histogram_print(worker_cb_name(i), &profile->callbacks[i]);
+        }
+    }
+
+    fprintf(stderr, "  %" PRIu64 " callbacks over %" PRIu64 "us\n", profile->nslow, worker->slow_threshold_ns / 1000);
+    for (uint64_t i = first; i < profile->nslow; ++i) {
+        worker_slow_cb_t *slow = &profile->slow[i % WORKER_SLOW_RING_SIZE];
+        struct tm tm;
+        char when[32];
+        localtime_r(&slow->when.tv_sec, &tm);
+        strftime(when, sizeof(when), "%H:%M:%S", &tm);
+        fprintf(stderr, "    %s.%06ld %-6s %" PRIu64 "us\n", when, (long)slow->when.tv_usec,
+                worker_cb_name(slow->type), slow->duration_us);
+    }
+}
+
+int
+worker_profile_dump(worker_t *worker)
+{
+    return worker_call(worker, worker_profile_dump_cb, worker);
+}
+
 void
 worker_set_prologue(worker_t *worker, worker_prologue_t prologue)
 {
@@ -189,6 +694,36 @@ worker_set_epilogue(worker_t *worker, worker_epilogue_t epilogue)
     worker->epilogue = epilogue;
 }
 
+void *
+worker_get_ctx(worker_t *worker)
+{
+    return worker->ctx;
+}
+
+int
+worker_get_cpu(worker_t *worker)
+{
+    return worker->cpu;
+}
+
+int
+worker_get_numa_node(worker_t *worker)
+{
+    return worker->node;
+}
+
+memacct_t *
+worker_memacct(worker_t *worker)
+{
+    return &worker->memacct;
+}
+
+struct qsbr *
+worker_qsbr(void)
+{
+    return workers_qsbr;
+}
+
 worker_t *
 this_worker(void)
 {
@@ -205,6 +740,26 @@ this_event_base(void)
     return NULL;
 }
 
+void *
+this_worker_ctx(void)
+{
+    worker_t *worker = this_worker();
+    if (NULL != worker) {
+        return worker->ctx;
+    }
+    return NULL;
+}
+
+memacct_t *
+this_memacct(void)
+{
+    worker_t *worker = this_worker();
+    if (NULL != worker) {
+        return &worker->memacct;
+    }
+    return NULL;
+}
+
 struct evdns_base *
 this_dnsbase(void)
 {
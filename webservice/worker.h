@@ -5,6 +5,62 @@ typedef struct worker worker_t;
 
 typedef int (*worker_prologue_t)(void *);
 typedef int (*worker_epilogue_t)(void *);
+typedef void (*worker_call_t)(void *);
+
+#define WORKER_CPU_ANY  (-1) /**< worker thread is not pinned */
+
+#define WORKER_HISTOGRAM_BUCKETS 20 /**< [0,1us), [1,2us), [2,4us)... up to 2^18us and over */
+#define WORKER_SLOW_RING_SIZE    64 /**< # slowest callbacks kept, most recent ones */
+#define WORKER_SLOW_CB_US      1000 /**< default slow callback threshold */
+
+/**
+ * Kinds of callbacks timed on worker threads.
+ */
+typedef enum worker_cb worker_cb_t;
+
+enum worker_cb {
+     WORKER_CB_ACCEPT /**< incoming connection */
+    ,WORKER_CB_READ   /**< socket data read */
+    ,WORKER_CB_WRITE  /**< socket data written */
+    ,WORKER_CB_EVENT  /**< connected, eof, error, timeout */
+    ,WORKER_CB_DNS    /**< name resolved */
+    ,WORKER_CB_CALL   /**< worker_call */
+    ,WORKER_CB_COUNT
+};
+
+typedef struct worker_slow_cb worker_slow_cb_t;
+
+struct worker_slow_cb {
+    worker_cb_t type;
+    uint64_t duration_us;
+    struct timeval when; /**< wall clock callback completed at */
+};
+
+typedef struct worker_histogram worker_histogram_t;
+
+/**
+ * Log2 histogram: bucket 0 counts samples under 1us, bucket i
+ * samples in [2^(i-1), 2^i) us, last bucket everything above.
+ */
+struct worker_histogram {
+    uint64_t buckets[WORKER_HISTOGRAM_BUCKETS];
+    uint64_t count;
+    uint64_t max_us;
+};
+
+typedef struct worker_profile worker_profile_t;
+
+/**
+ * Worker event loop health: how late its timers run (a loop busy
+ * in a callback delays every connection of that worker), and how
+ * long callbacks take.
+ */
+struct worker_profile {
+    worker_histogram_t lag;                      /**< loop lag samples */
+    worker_histogram_t callbacks[WORKER_CB_COUNT]; /**< durations per callback kind */
+    worker_slow_cb_t slow[WORKER_SLOW_RING_SIZE]; /**< ring of callbacks over threshold */
+    uint64_t nslow;                              /**< # slow callbacks ever recorded */
+};
 
 int
 worker_init(void);
@@ -12,8 +68,16 @@ worker_init(void);
 void
 worker_fini(void);
 
+/**
+ * Creates worker with its own event loop and dns resolver
+ * (none if resolver is NULL).
+ *
+ * If cpu is not WORKER_CPU_ANY, worker thread is pinned to it
+ * and worker memory (event loop, buffers, sessions) is allocated
+ * from cpu's numa node.
+ */
 worker_t *
-worker_new(void *ctx, const char *resolver);
+worker_new(void *ctx, const char *resolver, int cpu);
 
 void
 worker_free(worker_t *worker);
@@ -27,15 +91,116 @@ worker_stop(worker_t *worker);
 int
 worker_join(worker_t *worker);
 
+/**
+ * Asynchronously runs fn(arg) on worker's thread,
+ * from its event loop. May be called from any thread.
+ *
+ * Calls go through a lock-free mailbox and run in batches,
+ * woken up once. Calls from a thread always run in order:
+ * past a full mailbox, calls are allocated and queued on a
+ * locked overflow list, run once mailbox is drained (and
+ * later calls queue there too, until it is emptied).
+ * Calls queued before worker_stop still run.
+ *
+ * @return 0, if successfull. -1, otherwise.
+ */
+int
+worker_call(worker_t *worker, worker_call_t fn, void *arg);
+
+/**
+ * Cheap monotonic cycle counter (TSC on x86) for timing
+ * callbacks with worker_cb_timed.
+ */
+uint64_t
+worker_cycles(void);
+
+uint64_t
+worker_cycles_to_ns(uint64_t cycles);
+
+/**
+ * Accounts callback which started at cycle count start
+ * (@see worker_cycles) to calling worker profile. Does
+ * nothing off worker threads.
+ *
+ * Callbacks wrap their work with:
+ *     uint64_t start = worker_cycles();
+ *     ...
+ *     worker_cb_timed(WORKER_CB_READ, start);
+ */
+void
+worker_cb_timed(worker_cb_t type, uint64_t start);
+
+/**
+ * Sets how long callbacks may run before being recorded in
+ * worker slow callback ring (default WORKER_SLOW_CB_US).
+ *
+ * Should be called before worker_start.
+ */
+void
+worker_set_slow_threshold(worker_t *worker, unsigned usec);
+
+/**
+ * Copies worker profile. Profile is only ever touched by its
+ * worker: should be called from worker thread (@see worker_call)
+ * or once worker is stopped.
+ */
+void
+worker_get_profile(worker_t *worker, worker_profile_t *profile);
+
+/**
+ * Asynchronously prints worker profile to stderr
+ * from worker thread. May be called from any thread.
+ *
+ * @return 0, if successfull. -1, otherwise.
+ */
+int
+worker_profile_dump(worker_t *worker);
+
 void
 worker_set_prologue(worker_t *worker, worker_prologue_t prologue);
 
 void
 worker_set_epilogue(worker_t *worker, worker_epilogue_t epilogue);
 
+void *
+worker_get_ctx(worker_t *worker);
+
+int
+worker_get_cpu(worker_t *worker);
+
+int
+worker_get_numa_node(worker_t *worker);
+
+/**
+ * Return account of memory held by worker (@see memacct.h):
+ * its budget should be set before worker_start.
+ */
+struct memacct;
+
+struct memacct *
+worker_memacct(worker_t *worker);
+
+/**
+ * Return reclamation domain every worker is registered to:
+ * workers go through a quiescent state in between event
+ * loop iterations, so tables shared by them can be read
+ * without locks (@see hashtable_set_qsbr).
+ */
+struct qsbr;
+
+struct qsbr *
+worker_qsbr(void);
+
 worker_t *
 this_worker(void);
 
+/**
+ * Return context given to worker_new for
+ * worker running on this thread.
+ */
+void *
+this_worker_ctx(void);
+
 /**
  * Return event loop object per thread
  * for processing events on each thread.
@@ -45,9 +210,17 @@ struct event_base;
 struct event_base *
 this_event_base(void);
 
+/**
+ * Return memory account of worker running on
+ * this thread, NULL off worker threads.
+ */
+struct memacct *
+this_memacct(void);
+
 /**
  * Return dnsbase per thread for
- * asynchronous dns resolution.
+ * asynchronous dns resolution, NULL
+ * if worker has no dns resolver.
  */
 struct evdns_base;
 
@@ -1,9 +1,15 @@
+#define _GNU_SOURCE /**< sched_getcpu */
 #include "includes.h"
 #include "libs.h"
+#include "thread.h"
 #include "worker.h"
+#include "atomic.h"
+#include <sched.h>
 #include <assert.h>
 
 #define NR_WORKERS  100
+#define NR_PRODUCERS 4
+#define NR_CALLS    (64*1024) /**< per producer, overflows mailbox */
 
 static int counter[NR_WORKERS];
 
@@ -12,6 +18,7 @@ prologue(void *ctx)
 {
     int *i = ctx;
     ++(*i);
+    assert(sched_getcpu() == worker_get_cpu(this_worker()));
     return 0;
 }
 
@@ -24,16 +31,182 @@ epilogue(void *ctx)
     return 0;
 }
 
+typedef struct mailbox_test mailbox_test_t;
+
+struct mailbox_test {
+    worker_t *worker;
+    atomic_t calls;      /**< only written by worker thread */
+    size_t last[NR_PRODUCERS];
+    bool ordered;
+};
+
+typedef struct call_arg call_arg_t;
+
+struct call_arg {
+    mailbox_test_t *test;
+    int producer;
+    size_t seq;
+};
+
+typedef struct producer_arg producer_arg_t;
+
+struct producer_arg {
+    mailbox_test_t *test;
+    int id;
+    call_arg_t *calls; /**< run once worker is stopped: freed by main thread */
+};
+
+static void
+mailbox_call(void *arg)
+{
+    call_arg_t *call = arg;
+    mailbox_test_t *test = call->test;
+    assert(this_worker() == test->worker);
+    atomic_store_release(&test->calls, test->calls + 1);
+    if (call->seq <= test->last[call->producer]) {
+        test->ordered = false;
+    }
+    test->last[call->producer] = call->seq;
+}
+
+static void
+producer_run(void *arg)
+{
+    producer_arg_t *producer = arg;
+    call_arg_t *calls = producer->calls;
+
+    for (size_t i = 0; i < NR_CALLS; ++i) {
+        calls[i].test = producer->test;
+        calls[i].producer = producer->id;
+        calls[i].seq = i + 1;
+        assert(0 == worker_call(producer->test->worker, mailbox_call, &calls[i]));
+    }
+}
+
+/* several threads hammering one worker mailbox */
+static void
+mailbox_test(int cpu)
+{
+    thread_t *threads[NR_PRODUCERS];
+    producer_arg_t producers[NR_PRODUCERS];
+    mailbox_test_t test;
+
+    memset(&test, 0, sizeof(test));
+    test.ordered = true;
+    test.worker = worker_new(&test, "8.8.8.8:53", cpu);
+    assert(NULL != test.worker);
+    assert(0 == worker_start(test.worker));
+
+    for (int i = 0; i < NR_PRODUCERS; ++i) {
+        producers[i].test = &test;
+        producers[i].id = i;
+        producers[i].calls = calloc(NR_CALLS, sizeof(call_arg_t));
+        assert(NULL != producers[i].calls);
+        threads[i] = thread_new(producer_run);
+        thread_start(threads[i], &producers[i]);
+    }
+    for (int i = 0; i < NR_PRODUCERS; ++i) {
+        thread_join(threads[i]);
+        thread_free(threads[i]);
+    }
+
+    /* calls past mailbox overflow still run before worker stops */
+    worker_stop(test.worker);
+    assert(NR_PRODUCERS * NR_CALLS == test.calls);
+    assert(test.ordered);
+    printf("mailbox: %ld calls, in order\n", test.calls);
+    worker_free(test.worker);
+
+    for (int i = 0; i < NR_PRODUCERS; ++i) {
+        free(producers[i].calls);
+    }
+}
+
+#define NR_FAST_CALLS 1000
+#define SLOW_CALL_US  20000
+
+typedef struct profile_test profile_test_t;
+
+struct profile_test {
+    worker_t *worker;
+    atomic_t calls; /**< only written by worker thread */
+};
+
+static void
+fast_call(void *arg)
+{
+    profile_test_t *test = arg;
+    atomic_store_release(&test->calls, test->calls + 1);
+}
+
+static void
+slow_call(void *arg)
+{
+    profile_test_t *test = arg;
+    /* loop is blocked: delays lag timer as well */
+    usleep(SLOW_CALL_US);
+    atomic_store_release(&test->calls, test->calls + 1);
+}
+
+/* slow callback shows up in profile, fast ones do not */
+static void
+profile_test(int cpu)
+{
+    profile_test_t test;
+    worker_profile_t profile;
+    uint64_t lag_samples = 0;
+
+    memset(&test, 0, sizeof(test));
+    test.worker = worker_new(&test, "8.8.8.8:53", cpu);
+    assert(NULL != test.worker);
+    worker_set_slow_threshold(test.worker, SLOW_CALL_US / 2);
+    assert(0 == worker_start(test.worker));
+
+    for (int i = 0; i < NR_FAST_CALLS; ++i) {
+        assert(0 == worker_call(test.worker, fast_call, &test));
+        if (NR_FAST_CALLS / 2 == i) {
+            assert(0 == worker_call(test.worker, slow_call, &test));
+        }
+    }
+    while (atomic_load_acquire(&test.calls) < NR_FAST_CALLS + 1) {
+        usleep(1000);
+    }
+    /* a few lag samples */
+    usleep(200 * 1000);
+    assert(0 == worker_profile_dump(test.worker));
+    worker_stop(test.worker);
+
+    worker_get_profile(test.worker, &profile);
+    assert(NR_FAST_CALLS + 2 == profile.callbacks[WORKER_CB_CALL].count); /* and dump */
+    assert(profile.callbacks[WORKER_CB_CALL].max_us >= SLOW_CALL_US);
+    assert(1 == profile.nslow);
+    assert(WORKER_CB_CALL == profile.slow[0].type);
+    assert(profile.slow[0].duration_us >= SLOW_CALL_US);
+    assert(0 == profile.callbacks[WORKER_CB_READ].count);
+    for (int i = 0; i < WORKER_HISTOGRAM_BUCKETS; ++i) {
+        lag_samples += profile.lag.buckets[i];
+    }
+    assert(lag_samples == profile.lag.count && lag_samples > 0);
+    printf("profile: %" PRIu64 " lag samples, max lag %" PRIu64 "us, slowest call %" PRIu64 "us\n",
+           profile.lag.count, profile.lag.max_us, profile.callbacks[WORKER_CB_CALL].max_us);
+
+    worker_free(test.worker);
+}
 
 int
 main(int argc, char **argv)
 {
 	worker_t *workers[NR_WORKERS];
+    int cpus[THREAD_MAX_CPUS];
+    int ncpus;
 
     worker_init();
 
+    ncpus = thread_cpus_available(cpus, countof(cpus));
+    assert(ncpus > 0);
+
 	for (int i = 0; i < countof(workers); ++i) {
-		workers[i] = worker_new(&counter[i], "8.8.8.8:53");
+		workers[i] = worker_new(&counter[i], "8.8.8.8:53", cpus[i % ncpus]);
         worker_set_prologue(workers[i], prologue);
         worker_set_epilogue(workers[i], epilogue);
 		worker_start(workers[i]);
@@ -45,6 +218,9 @@ main(int argc, char **argv)
 		worker_free(workers[i]);
 	}
 
+    mailbox_test(cpus[0]);
+    profile_test(cpus[0]);
+
     worker_fini();
     return 0;
 }